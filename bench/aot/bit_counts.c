@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+// bench/bit_counts.cj
+static int64_t counts(int64_t n, int64_t seed)
+{
+    uint64_t x = seed;
+    int64_t total = 0;
+    for (int64_t i = 0; i < n; i++)
+    {
+        x = x * 6364136223846793005u + 1442695040888963407u;
+        total = total + __builtin_popcountll(x) + __builtin_clzll((uint64_t)((int64_t)x / 128) | 1) + __builtin_ctzll(x | 4096);
+    }
+    return total;
+}
+
+int64_t cjit_main(void)
+{
+    uint64_t total = 0;
+    for (int64_t r = 0; r < 100; r++)
+        total = total * 7 + counts(100003 + r, r);
+    return total;
+}
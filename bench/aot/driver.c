@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// Runs the entry of an object file written by cjit --aot, or of the C
+// version of the same kernel, and prints the result and the run time the
+// way cjit --time does. It defines what the object file takes from its
+// program: the stack limit of the thread and the trap handler.
+
+__thread uintptr_t cjit_stack_limit;
+
+int64_t cjit_main(void);
+
+void cjit_trap(int64_t trap)
+{
+    printf("runtime error: %s\n", trap == 1 ? "division by zero" : "stack overflow");
+    exit(1);
+}
+
+static double now_seconds(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        cjit_stack_limit = (uintptr_t)&limit - limit.rlim_cur + 64 * 1024;
+    double start = now_seconds();
+    int64_t result = cjit_main();
+    double finished = now_seconds();
+    printf("Result: %lld\n", (long long)result);
+    printf("Time: run %.3f ms\n", (finished - start) * 1e3);
+    return 0;
+}
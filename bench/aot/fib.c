@@ -0,0 +1,14 @@
+#include <stdint.h>
+
+// bench/fib.cj
+static int64_t fib(int64_t n)
+{
+    if (n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int64_t cjit_main(void)
+{
+    return fib(32);
+}
@@ -0,0 +1,16 @@
+#include <stdint.h>
+
+// bench/nested_loops.cj
+int64_t cjit_main(void)
+{
+    int64_t count = 0;
+    for (int64_t i = 0; i < 8000; i++)
+    {
+        for (int64_t j = 0; j < i; j++)
+        {
+            if (j > 10 && i - j > 10)
+                count++;
+        }
+    }
+    return count;
+}
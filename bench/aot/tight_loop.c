@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+// bench/tight_loop.cj
+static int64_t sums(int64_t n, int64_t k)
+{
+    int64_t s = 0;
+    int64_t t = 0;
+    for (int64_t i = 0; i < n; i++)
+    {
+        s = s + i / 8;
+        t = t + (i & k);
+    }
+    return s + t;
+}
+
+int64_t cjit_main(void)
+{
+    int64_t total = 0;
+    for (int64_t r = 0; r < 100; r++)
+        total = total * 7 + sums(1000003 + r, r);
+    return total;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "../../libcjit/libcjit.h"
+
+// Cost of a call from the host into compiled code: a C function through a
+// pointer the compiler cannot see through, the native entry through a typed
+// pointer, cjit_call, then cjit_call from several threads at once. Every
+// loop checks its sum, so a broken call fails the benchmark.
+
+#define CALLS 100000000
+#define CHECKED_CALLS 10000000
+#define THREADS 4
+
+static const char *source = "int add(int a, int b) { return a + b; }\n"
+                            "float scale(float x, int k) { return x * k; }\n"
+                            "return add(40, 2);\n";
+
+typedef int64_t (*AddFunction)(int64_t, int64_t);
+
+static int64_t add_in_c(int64_t a, int64_t b)
+{
+    return a + b;
+}
+
+static double now_seconds(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, int64_t calls, double seconds, int64_t sum, int64_t expected)
+{
+    printf("%-28s %8.2f ns per call\n", name, seconds * 1e9 / calls);
+    if (sum != expected)
+    {
+        printf("%s: sum %lld, expected %lld\n", name, (long long)sum, (long long)expected);
+        exit(1);
+    }
+}
+
+static int64_t call_pointer(AddFunction function, int64_t calls)
+{
+    int64_t sum = 0;
+    for (int64_t i = 0; i < calls; i++)
+        sum = function(sum, i);
+    return sum;
+}
+
+static int64_t call_checked(const CJITFunction *function, int64_t calls)
+{
+    int64_t sum = 0;
+    for (int64_t i = 0; i < calls; i++)
+    {
+        CJITValue arguments[2] = {{.i = sum}, {.i = i}};
+        CJITValue result;
+        const char *error;
+        if (!cjit_call(function, arguments, &result, &error))
+        {
+            printf("runtime error: %s\n", error);
+            exit(1);
+        }
+        sum = result.i;
+    }
+    return sum;
+}
+
+static void *call_thread(void *function)
+{
+    int64_t *sum = malloc(sizeof(int64_t));
+    *sum = call_checked(function, CHECKED_CALLS);
+    return sum;
+}
+
+int main(void)
+{
+    CJITContext *context = cjit_create_context();
+    double start = now_seconds();
+    CJITProgram *program = cjit_compile(context, "call_overhead.cj", source);
+    if (program == NULL)
+        return 1;
+    printf("%-28s %8.3f ms\n", "compile", (now_seconds() - start) * 1e3);
+
+    CJITValue result;
+    const char *error;
+    if (!cjit_call(cjit_entry(program), NULL, &result, &error) || result.i != 42)
+        return 1;
+    CJITValue arguments[2] = {{.f = 1.5}, {.i = 3}};
+    if (!cjit_call(cjit_lookup(program, "scale"), arguments, &result, &error) || result.f != 4.5)
+        return 1;
+    if (cjit_function_pointer(cjit_lookup(program, "add"), "f(ii)") != NULL || cjit_lookup(program, "missing") != NULL)
+        return 1;
+
+    const CJITFunction *add = cjit_lookup(program, "add");
+    AddFunction native = (AddFunction)cjit_function_pointer(add, cjit_signature(add));
+    int64_t expected = (int64_t)CALLS * (CALLS - 1) / 2;
+    int64_t checked_expected = (int64_t)CHECKED_CALLS * (CHECKED_CALLS - 1) / 2;
+
+    // volatile keeps gcc from inlining add_in_c into the loop
+    AddFunction volatile c_function = add_in_c;
+    start = now_seconds();
+    int64_t sum = call_pointer(c_function, CALLS);
+    report("C function pointer", CALLS, now_seconds() - start, sum, expected);
+
+    start = now_seconds();
+    sum = call_pointer(native, CALLS);
+    report("native function pointer", CALLS, now_seconds() - start, sum, expected);
+
+    start = now_seconds();
+    sum = call_checked(add, CHECKED_CALLS);
+    report("cjit_call", CHECKED_CALLS, now_seconds() - start, sum, checked_expected);
+
+    pthread_t threads[THREADS];
+    start = now_seconds();
+    for (int t = 0; t < THREADS; t++)
+        pthread_create(&threads[t], NULL, call_thread, (void *)add);
+    for (int t = 0; t < THREADS; t++)
+    {
+        int64_t *thread_sum;
+        pthread_join(threads[t], (void **)&thread_sum);
+        sum = *thread_sum;
+        free(thread_sum);
+        if (sum != checked_expected)
+            report("cjit_call, threads", CHECKED_CALLS, 1, sum, checked_expected);
+    }
+    report("cjit_call, 4 threads", (int64_t)CHECKED_CALLS * THREADS, now_seconds() - start, checked_expected, checked_expected);
+
+    cjit_unload(program);
+    cjit_destroy_context(context);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "../../libcjit/libcjit.h"
+
+// Cost of a call from compiled code into C: a loop calling a trivial host
+// function registered with cjit_register_symbol and a loop calling sqrt of
+// libm, each next to the same loop in C calling through a function pointer
+// the compiler cannot see through, as compiled code calls through its
+// helper table. Every loop checks its result, so a broken call fails the
+// benchmark.
+
+#define CALLS 100000000
+
+static const char *source = "extern long step(long sum, long i);\n"
+                            "extern float sqrt(float x);\n"
+                            "int steps(int n) { int sum = 0; for (int i = 0; i < n; i++) { sum = step(sum, i); } return sum; }\n"
+                            "float roots(int n) { float sum = 0.0; for (int i = 0; i < n; i++) { sum = sum + sqrt(i); } return sum; }\n"
+                            "return steps(10);\n";
+
+typedef int64_t (*StepFunction)(int64_t, int64_t);
+typedef double (*RootFunction)(double);
+typedef int64_t (*StepsFunction)(int64_t);
+typedef double (*RootsFunction)(int64_t);
+
+static int64_t step(int64_t sum, int64_t i)
+{
+    return sum + i;
+}
+
+static double now_seconds(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double seconds, double value, double expected)
+{
+    printf("%-28s %8.2f ns per call\n", name, seconds * 1e9 / CALLS);
+    if (value != expected)
+    {
+        printf("%s: got %.17g, expected %.17g\n", name, value, expected);
+        exit(1);
+    }
+}
+
+static int64_t steps_in_c(StepFunction function, int64_t n)
+{
+    int64_t sum = 0;
+    for (int64_t i = 0; i < n; i++)
+        sum = function(sum, i);
+    return sum;
+}
+
+static double roots_in_c(RootFunction function, int64_t n)
+{
+    double sum = 0.0;
+    for (int64_t i = 0; i < n; i++)
+        sum = sum + function((double)i);
+    return sum;
+}
+
+int main(void)
+{
+    CJITContext *context = cjit_create_context();
+    cjit_register_symbol(context, "step", (void *)step);
+    CJITProgram *program = cjit_compile(context, "extern_calls.cj", source);
+    if (program == NULL)
+        return 1;
+    CJITValue result;
+    const char *error;
+    if (!cjit_call(cjit_entry(program), NULL, &result, &error) || result.i != 45)
+        return 1;
+    StepsFunction steps = (StepsFunction)cjit_function_pointer(cjit_lookup(program, "steps"), "i(i)");
+    RootsFunction roots = (RootsFunction)cjit_function_pointer(cjit_lookup(program, "roots"), "f(i)");
+
+    // volatile keeps gcc from inlining step and sqrt into the loops
+    StepFunction volatile c_step = step;
+    RootFunction volatile c_sqrt = sqrt;
+    int64_t expected = (int64_t)CALLS * (CALLS - 1) / 2;
+
+    double start = now_seconds();
+    int64_t sum = steps_in_c(c_step, CALLS);
+    report("C calling step", now_seconds() - start, sum, expected);
+
+    start = now_seconds();
+    sum = steps(CALLS);
+    report("compiled code calling step", now_seconds() - start, sum, expected);
+
+    start = now_seconds();
+    double root_sum = roots_in_c(c_sqrt, CALLS);
+    double root_expected = root_sum;
+    report("C calling sqrt", now_seconds() - start, root_sum, root_expected);
+
+    start = now_seconds();
+    root_sum = roots(CALLS);
+    report("compiled code calling sqrt", now_seconds() - start, root_sum, root_expected);
+
+    cjit_unload(program);
+    cjit_destroy_context(context);
+    return 0;
+}
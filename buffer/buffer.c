@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <wchar.h>
+#include "buffer.h"
+
+OutputBuffer *init_buffer(size_t capacity)
+{
+    OutputBuffer *buffer = malloc(sizeof(OutputBuffer));
+    buffer->data = malloc(capacity);
+    if (!buffer->data)
+    {
+        wprintf(L"Memory allocation failed while initializing output buffer.\n");
+        exit(1);
+    }
+    buffer->size = 0;
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+void free_buffer(OutputBuffer *buffer)
+{
+    free(buffer->data);
+    free(buffer);
+}
+
+void reserve_buffer(OutputBuffer *buffer, size_t extra)
+{
+    if (buffer->size + extra <= buffer->capacity)
+        return;
+
+    size_t new_capacity = buffer->capacity * 2;
+    while (new_capacity < buffer->size + extra)
+        new_capacity *= 2;
+
+    buffer->data = realloc(buffer->data, new_capacity);
+    if (!buffer->data)
+    {
+        wprintf(L"Memory allocation failed while resizing output buffer.\n");
+        exit(1);
+    }
+    buffer->capacity = new_capacity;
+}
+
+void buffer_append(OutputBuffer *buffer, const char *data, size_t length)
+{
+    reserve_buffer(buffer, length);
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+}
+
+void buffer_append_str(OutputBuffer *buffer, const char *str)
+{
+    buffer_append(buffer, str, strlen(str));
+}
+
+void buffer_append_char(OutputBuffer *buffer, char c)
+{
+    reserve_buffer(buffer, 1);
+    buffer->data[buffer->size++] = c;
+}
+
+void buffer_append_repeat(OutputBuffer *buffer, char c, int count)
+{
+    if (count <= 0)
+        return;
+    reserve_buffer(buffer, count);
+    memset(buffer->data + buffer->size, c, count);
+    buffer->size += count;
+}
+
+void buffer_append_int(OutputBuffer *buffer, int64_t value)
+{
+    char digits[24];
+    int length = 0;
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+    do
+    {
+        digits[length++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    reserve_buffer(buffer, length + 1);
+    if (value < 0)
+        buffer->data[buffer->size++] = '-';
+    while (length > 0)
+        buffer->data[buffer->size++] = digits[--length];
+}
+
+void buffer_append_double(OutputBuffer *buffer, double value)
+{
+    buffer_printf(buffer, "%g", value);
+}
+
+void buffer_printf(OutputBuffer *buffer, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer->data + buffer->size, buffer->capacity - buffer->size, format, args);
+    va_end(args);
+
+    if (length < 0)
+        return;
+
+    if (buffer->size + length >= buffer->capacity)
+    {
+        reserve_buffer(buffer, length + 1);
+        va_start(args, format);
+        vsnprintf(buffer->data + buffer->size, buffer->capacity - buffer->size, format, args);
+        va_end(args);
+    }
+    buffer->size += length;
+}
+
+int flush_buffer(OutputBuffer *buffer, int fd)
+{
+    size_t written = 0;
+    while (written < buffer->size)
+    {
+        ssize_t result = write(fd, buffer->data + written, buffer->size - written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        written += result;
+    }
+    buffer->size = 0;
+    return 0;
+}
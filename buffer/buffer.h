@@ -0,0 +1,29 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+// Growable byte buffer used by the dumpers. Everything is appended in memory
+// and written out with a single write() call in flush_buffer, so large dumps
+// do not pay for stdio locking or wide character conversion per line.
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+} OutputBuffer;
+
+OutputBuffer *init_buffer(size_t capacity);
+void free_buffer(OutputBuffer *buffer);
+void reserve_buffer(OutputBuffer *buffer, size_t extra);
+void buffer_append(OutputBuffer *buffer, const char *data, size_t length);
+void buffer_append_str(OutputBuffer *buffer, const char *str);
+void buffer_append_char(OutputBuffer *buffer, char c);
+void buffer_append_repeat(OutputBuffer *buffer, char c, int count);
+void buffer_append_int(OutputBuffer *buffer, int64_t value);
+void buffer_append_double(OutputBuffer *buffer, double value);
+void buffer_printf(OutputBuffer *buffer, const char *format, ...);
+int flush_buffer(OutputBuffer *buffer, int fd);
+
+#endif
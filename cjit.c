@@ -7,23 +7,28 @@
 #include "src_lexer/lexer.h"
 #include "hashmap/hashmap.h"
 #include "parser/parser.h"
+#include "semantic/semantic.h"
+#include "ir/ir.h"
+#include "ffi/ffi.h"
+#include "vm/bytecode.h"
+#include "opt/opt.h"
+#include "jit/jit.h"
+#include "jit/code_cache.h"
+#include "jit/object_file.h"
+#include "tier/tier.h"
+#include "buffer/buffer.h"
 #include "misc/file.h"
 #include <wchar.h>
 #include <sys/resource.h>
 #include <stdint.h>
 #include <locale.h>
-
-// TODO: add support for several statements, they should be separated by ";"
-// TODO: add blocks and function declaration support
-// TODO: check error when expression parser put parenthesis to get_token_precedence, so actually just add parenthesis support to parser
+#include <unistd.h>
+#include <time.h>
 
 // TODO: everytime when there is error in token like expected one but get another, it should enter panic mode and go to next statement after ";" or ")", "}"
 // TODO: check for amount of brackets in expression, right now this work fine "(1 + 2) * (3.43 / 54"
-// TODO: after function declaration add support for function call
-// TODO: after functions and variables start making Syntax checker, that will just check types and if it declared
 // TODO: add more complex types like long, unsigned
 // TODO: continue adding cyrylic support for lexer(remaka advance, error, checking for character in is alpha)
-// TODO: remove error when it fault if last character is space
 // TODO: refactor parser into different files
 // TODO: add globals to parser
 // TODO: add proper error handling
@@ -60,127 +65,488 @@ void *convert_string_to_number(const char *str, const TokenType type)
     return result;
 }
 
-parser_literal parse_var_type()
+static double now_seconds()
 {
-    // TODO: add more complex types like long, unsigned
-    Token token = get_parser_token(current_parser);
-    parser_literal type = {NULL, LITERAL_INT, LITERAL_SIGNED};
-
-    switch (token.type)
-    {
-    case T_INT:
-        type.literal_type = LITERAL_INT;
-        break;
-    case T_FLOAT:
-        type.literal_type = LITERAL_FLOAT;
-        break;
-    default:
-        current_parser->error_found = true;
-        // TODO: add proper error handling
-        wprintf(L"Unknown token type in parse_var_type: %s\n", token_to_string(token.type));
-    }
-
-    advance_parser(current_parser);
-    return type;
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
 }
 
-int parse_assignment_expression()
+static void write_buffer(OutputBuffer *buffer)
 {
-    if (peek_parser_token_type(current_parser, T_IDENTIFIER, 0) && peek_parser_token_type(current_parser, T_ASSIGN, 1))
-    {
-        char *name = get_parser_token(current_parser).value;
-        advance_parser(current_parser);
+    fflush(stdout);
+    flush_buffer(buffer, STDOUT_FILENO);
+    free_buffer(buffer);
+}
 
-        consume_parser_token(current_parser, T_ASSIGN);
+typedef enum
+{
+    ENGINE_VM,
+    ENGINE_JIT,
+    ENGINE_TIERED // interpreter first, hot functions move to the JIT
+} Engine;
 
-        int expression = parse_assignment_expression();
-        return add_ast_node(current_parser, cast_assignment_node(name, expression));
-    }
+typedef struct
+{
+    bool dump_bytecode;
+    bool show_time;
+    bool profile;
+    bool superinstructions;
+    Engine engine;
+    bool code_heap_stats;
+    bool jit_stats;
+    JITOptions jit_options;
+    bool tier_stats;
+    TierOptions tier_options;
+    OptOptions opt_options;
+    bool opt_stats;
+    const char *profile_out; // file the branch and call profile is saved to, NULL for none
+    IRProfile *profile_in; // loaded from an earlier run, NULL for none
+    const char *code_cache; // directory of compiled programs, NULL for none
+    uint64_t cache_key; // of the source and everything its code depends on
+    const char *aot; // object file the native code is written to instead of running it, NULL for none
+} RunOptions;
 
-    return parse_expression(current_parser, 0);
+static void print_result(JITValue result, IRType type)
+{
+    if (type == IR_FLOAT)
+        wprintf(L"Result: %g\n", result.f);
+    else
+        wprintf(L"Result: %lld\n", (long long)result.i);
 }
 
-ASTNode cast_declaration_node(char *name, parser_literal var_type, int expression)
+// Lowers and optimizes the program with the loaded profile, NULL if lowering
+// fails or the result does not verify
+static IRModule *lower_and_optimize(Parser *parser, RunOptions *options)
 {
-    ASTNode node;
-    node.type = N_VARIABLE_DECLARATION;
-    node.data.variable_declaration.name = name;
-    node.data.variable_declaration.literal = var_type;
-    node.data.variable_declaration.expression = expression;
-    return node;
+    IRModule *module = lower_program(parser);
+    if (module == NULL)
+        return NULL;
+    module->profile = options->profile_in;
+    OptStats stats;
+    memset(&stats, 0, sizeof(OptStats));
+    optimize_module(module, &options->opt_options, &stats);
+    if (verify_ir_module(module) > 0)
+    {
+        free_ir_module(module);
+        return NULL;
+    }
+    if (options->opt_stats)
+    {
+        OutputBuffer *buffer = init_buffer(OUTPUT_BUFFER_SIZE);
+        dump_opt_stats(&stats, buffer);
+        write_buffer(buffer);
+    }
+    return module;
 }
 
-void add_variable_declaration(parser_literal var_type)
+// Hash of the options the native code of a program depends on, with the
+// counts of the loaded profile
+static uint64_t options_hash(const RunOptions *options)
 {
-    parser_declaration *declaration = malloc(sizeof(parser_declaration));
-    declaration->type = VARIABLE_DECLARATION;
-    declaration->literal = var_type;
-
-    hashmap_insert(current_parser->declarations, var_type.value, declaration);
+    const JITOptions *jit = &options->jit_options;
+    bool flags[] = {jit->allocate_registers, jit->select_patterns, jit->peephole};
+    uint64_t hash = code_cache_hash(0, flags, sizeof(flags));
+    hash = code_cache_hash(hash, &jit->extensions, sizeof(jit->extensions));
+    hash = code_cache_hash(hash, options->opt_options.enabled, sizeof(options->opt_options.enabled));
+    hash = code_cache_hash(hash, &options->opt_options.vector_lanes, sizeof(options->opt_options.vector_lanes));
+    const IRProfile *profile = options->profile_in;
+    for (int s = 0; profile && s < profile->site_count; s++)
+    {
+        hash = code_cache_hash(hash, &profile->sites[s].node, sizeof(profile->sites[s].node));
+        hash = code_cache_hash(hash, profile->sites[s].counts, sizeof(profile->sites[s].counts));
+    }
+    return hash;
 }
 
-int parse_declaration(Parser *parser)
+static int run_native(Parser *parser, RunOptions *options)
 {
-    parser_literal var_type = parse_var_type();
-    int decl_node;
+    double start = now_seconds();
+    CodeHeap *heap = init_code_heap();
+    IRModule *module = NULL;
+    JITModule *native = NULL;
+    if (options->code_cache)
+    {
+        int *extern_of_symbol = malloc((parser->symbol_count + 1) * sizeof(int));
+        IRExtern *externs;
+        int extern_count = collect_extern_functions(parser, &externs, extern_of_symbol);
+        native = code_cache_load(heap, options->code_cache, options->cache_key, externs, extern_count);
+        free_extern_functions(externs, extern_count);
+        free(extern_of_symbol);
+    }
+    bool cached = native != NULL;
+    if (!cached)
+    {
+        module = lower_and_optimize(parser, options);
+        if (module == NULL)
+        {
+            free_code_heap(heap);
+            return 1;
+        }
+        native = jit_compile_module(heap, module, &options->jit_options);
+        if (options->code_cache)
+            code_cache_store(options->code_cache, options->cache_key, native);
+    }
+    double compiled = now_seconds();
+
+    JITValue result;
+    const char *error = NULL;
+    int status = 0;
+    if (jit_call(native, native->entry, NULL, &result, &error) != JIT_OK)
+    {
+        wprintf(L"%s: runtime error: %s\n", parser->file_name, error);
+        status = 1;
+    }
+    else
+        print_result(result, native->functions[native->entry].return_type);
+    double finished = now_seconds();
+
+    if (options->show_time)
+        wprintf(L"Time: compile %.3f ms, run %.3f ms\n", (compiled - start) * 1e3, (finished - compiled) * 1e3);
 
-    while (true)
+    if (options->jit_stats && cached)
+        wprintf(L"jit: loaded from the code cache, %zu bytes of code\n", native->size);
+    else if (options->jit_stats)
+    {
+        JITStats *stats = &native->stats;
+        wprintf(L"jit: %d values, %d intervals, %d splits, %d spilled, %d spill slots, %d moves, %d fused compares, %d folded, %d instructions\n", stats->values, stats->intervals, stats->splits, stats->spilled, stats->spill_slots, stats->moves, stats->fused, stats->folded, stats->instructions);
+        PeepholeStats *peephole = &stats->peephole;
+        wprintf(L"peephole: %d moves, %d jumps, %d branches, %d tests, %d zeroes, %d bytes saved, %zu bytes of code\n", peephole->moves, peephole->jumps, peephole->branches, peephole->tests, peephole->zeroes, peephole->bytes, native->size);
+        wprintf(L"layout: %d functions profiled, %d cold blocks\n", stats->layout.profiled, stats->layout.cold);
+    }
+    if (options->code_heap_stats)
     {
-        Token token = consume_parser_token(current_parser, T_IDENTIFIER);
-        var_type.value = token.value;
+        OutputBuffer *buffer = init_buffer(OUTPUT_BUFFER_SIZE);
+        dump_code_heap_stats(heap, buffer);
+        write_buffer(buffer);
+    }
+    free_jit_module(native);
+    free_code_heap(heap);
+    if (module)
+        free_ir_module(module);
+    return status;
+}
 
-        add_variable_declaration(var_type);
-        consume_parser_token(current_parser, T_ASSIGN);
+// Compiles the program like run_native and writes it to an object file
+static int run_aot(Parser *parser, RunOptions *options)
+{
+    double start = now_seconds();
+    IRModule *module = lower_and_optimize(parser, options);
+    if (module == NULL)
+        return 1;
+    CodeHeap *heap = init_code_heap();
+    JITModule *native = jit_compile_module(heap, module, &options->jit_options);
+    int status = write_object_file(options->aot, native, module) ? 0 : 1;
+    if (options->show_time)
+        wprintf(L"Time: compile %.3f ms\n", (now_seconds() - start) * 1e3);
+    if (options->jit_stats)
+        wprintf(L"aot: %zu bytes of code, %d relocations\n", native->helpers, native->relocation_count + JIT_HELPER_COUNT);
+    free_jit_module(native);
+    free_code_heap(heap);
+    free_ir_module(module);
+    return status;
+}
 
-        int value = parse_assignment_expression();
+static int run_program(Parser *parser, RunOptions *options)
+{
+    double start = now_seconds();
+    VMProgram *program = compile_program(parser);
+    if (program == NULL)
+        return 1;
+    if (options->superinstructions)
+        fuse_superinstructions(program);
+    // counting goes on from the loaded profile, so saving it again adds this run
+    if (options->profile_in)
+        ir_profile_merge(program->profile, options->profile_in);
 
-        decl_node = add_ast_node(current_parser, cast_declaration_node(token.value, var_type, value));
+    // the tiered engine lowers the IR up front and compiles from it when a function gets hot
+    IRModule *module = NULL;
+    CodeHeap *heap = NULL;
+    Tier *tier = NULL;
+    if (options->engine == ENGINE_TIERED && !options->dump_bytecode)
+    {
+        module = lower_and_optimize(parser, options);
+        if (module == NULL)
+        {
+            free_vm_program(program);
+            return 1;
+        }
+        heap = init_code_heap();
+    }
+    double compiled = now_seconds();
 
-        // TODO: remake declarations parcing so it could handle chain of declarations "int x = 5, y = 10, z = 15;"
-        break;
-        // if(!peek_parser_token_type(current_parser, T_COMMA, 0)){
-        //     break;
-        // }
-        // advance_parser(current_parser);
+    if (options->dump_bytecode)
+    {
+        OutputBuffer *buffer = init_buffer(OUTPUT_BUFFER_SIZE);
+        dump_bytecode(program, buffer);
+        write_buffer(buffer);
+        free_vm_program(program);
+        return 0;
     }
 
-    consume_parser_token(current_parser, T_SEMICOLON);
-    return decl_node;
+    VM *vm = init_vm(program);
+    // the profiling interpreter also counts the branch and call sites
+    VMProfile *profile = options->profile || options->profile_out ? calloc(1, sizeof(VMProfile)) : NULL;
+    VMValue result;
+    VMStatus vm_status;
+    if (module)
+    {
+        options->tier_options.jit = options->jit_options;
+        options->tier_options.opt = options->opt_options;
+        // hot functions are compiled with what the interpreter counted so far
+        module->profile = program->profile;
+        tier = init_tier(parser, program, module, heap, &options->tier_options);
+        vm->tier = &tier->hooks;
+        vm_status = vm_call_tiered(vm, program->entry, NULL, &result);
+    }
+    else
+        vm_status = profile ? vm_call_profiled(vm, program->entry, NULL, &result, profile) : vm_call(vm, program->entry, NULL, &result);
+    int status = 0;
+    if (vm_status != VM_OK)
+    {
+        wprintf(L"%s: runtime error: %s\n", parser->file_name, vm->error);
+        status = 1;
+    }
+    else
+        print_result((JITValue){.i = result.i}, program->functions[program->entry]->return_type);
+    double finished = now_seconds();
+
+    if (options->show_time)
+        wprintf(L"Time: compile %.3f ms, run %.3f ms\n", (compiled - start) * 1e3, (finished - compiled) * 1e3);
+    if (profile && options->profile)
+    {
+        OutputBuffer *buffer = init_buffer(OUTPUT_BUFFER_SIZE);
+        dump_vm_profile(profile, 12, buffer);
+        write_buffer(buffer);
+    }
+    free(profile);
+    if (tier && options->tier_stats)
+    {
+        OutputBuffer *buffer = init_buffer(OUTPUT_BUFFER_SIZE);
+        dump_tier_stats(tier, buffer);
+        write_buffer(buffer);
+    }
+    if (tier && options->code_heap_stats)
+    {
+        OutputBuffer *buffer = init_buffer(OUTPUT_BUFFER_SIZE);
+        dump_code_heap_stats(heap, buffer);
+        write_buffer(buffer);
+    }
+
+    if (options->profile_out && !save_ir_profile(program->profile, options->profile_out))
+        status = 1;
+
+    if (tier)
+    {
+        free_tier(tier);
+        free_code_heap(heap);
+        free_ir_module(module);
+    }
+    free_vm(vm);
+    free_vm_program(program);
+    return status;
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    char *file_name = NULL;
+    ASTDumpFormat ast_format = AST_DUMP_TREE;
+    bool dump_ast = false;
+    bool dump_ir = false;
+    const char *profile_in = NULL;
+    RunOptions run_options = {
+        .superinstructions = true,
+        .engine = ENGINE_VM,
+        .jit_options = {.allocate_registers = true, .select_patterns = true, .peephole = true},
+        .tier_options = {
+            .threshold = TIER_THRESHOLD,
+            .threads = TIER_COMPILER_THREADS,
+            .jit = {.allocate_registers = true, .select_patterns = true, .peephole = true},
+        },
+    };
+    init_opt_options(&run_options.opt_options);
+    run_options.opt_options.vector_lanes = jit_supports_avx2() ? 4 : 2;
+    run_options.jit_options.extensions = jit_cpu_extensions();
+
+    for (int i = 1; i < argc; i++)
     {
-        wprintf(L"Usage: %s <file>\n", argv[0]);
+        if (strcmp(argv[i], "--dump-ir") == 0)
+            dump_ir = true;
+        else if (strcmp(argv[i], "--dump-ast") == 0)
+            dump_ast = true;
+        else if (strcmp(argv[i], "--dump-bytecode") == 0)
+            run_options.dump_bytecode = true;
+        else if (strcmp(argv[i], "--time") == 0)
+            run_options.show_time = true;
+        else if (strcmp(argv[i], "--vm-profile") == 0)
+            run_options.profile = true;
+        else if (strcmp(argv[i], "--no-superinstructions") == 0)
+            run_options.superinstructions = false;
+        else if (strcmp(argv[i], "--engine=vm") == 0)
+            run_options.engine = ENGINE_VM;
+        else if (strcmp(argv[i], "--engine=jit") == 0)
+            run_options.engine = ENGINE_JIT;
+        else if (strcmp(argv[i], "--engine=tiered") == 0)
+            run_options.engine = ENGINE_TIERED;
+        else if (strncmp(argv[i], "--tier-threshold=", 17) == 0 && atoi(argv[i] + 17) > 0)
+            run_options.tier_options.threshold = (uint32_t)atoi(argv[i] + 17);
+        else if (strncmp(argv[i], "--jit-threads=", 14) == 0 && isdigit((unsigned char)argv[i][14]))
+            run_options.tier_options.threads = atoi(argv[i] + 14);
+        else if (strcmp(argv[i], "--tier-stats") == 0)
+            run_options.tier_stats = true;
+        else if (strcmp(argv[i], "--code-heap-stats") == 0)
+            run_options.code_heap_stats = true;
+        else if (strcmp(argv[i], "--jit-stats") == 0)
+            run_options.jit_stats = true;
+        else if (strncmp(argv[i], "--passes=", 9) == 0)
+        {
+            if (!parse_opt_passes(argv[i] + 9, &run_options.opt_options))
+            {
+                wprintf(L"Unknown pass list: %s, expected none or a comma separated list of inline, sccp, strength, cfg, select, gvn, licm, indvars, vectorize, unroll, dce\n", argv[i] + 9);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--simd=auto") == 0)
+            run_options.opt_options.vector_lanes = jit_supports_avx2() ? 4 : 2;
+        else if (strcmp(argv[i], "--simd=sse2") == 0)
+            run_options.opt_options.vector_lanes = 2;
+        else if (strcmp(argv[i], "--simd=avx2") == 0)
+        {
+            if (!jit_supports_avx2())
+            {
+                wprintf(L"This processor does not support AVX2\n");
+                return 1;
+            }
+            run_options.opt_options.vector_lanes = 4;
+        }
+        else if (strcmp(argv[i], "--opt-stats") == 0)
+            run_options.opt_stats = true;
+        else if (strcmp(argv[i], "--regalloc=linear") == 0)
+            run_options.jit_options.allocate_registers = true;
+        else if (strcmp(argv[i], "--regalloc=stack") == 0)
+            run_options.jit_options.allocate_registers = false;
+        else if (strcmp(argv[i], "--isel=patterns") == 0)
+            run_options.jit_options.select_patterns = true;
+        else if (strcmp(argv[i], "--isel=simple") == 0)
+            run_options.jit_options.select_patterns = false;
+        else if (strncmp(argv[i], "--profile-out=", 14) == 0 && argv[i][14] != '\0')
+            run_options.profile_out = argv[i] + 14;
+        else if (strncmp(argv[i], "--profile-in=", 13) == 0 && argv[i][13] != '\0')
+            profile_in = argv[i] + 13;
+        else if (strncmp(argv[i], "--code-cache=", 13) == 0 && argv[i][13] != '\0')
+            run_options.code_cache = argv[i] + 13;
+        else if (strncmp(argv[i], "--aot=", 6) == 0 && argv[i][6] != '\0')
+            run_options.aot = argv[i] + 6;
+        else if (strcmp(argv[i], "--cpu=native") == 0)
+            run_options.jit_options.extensions = jit_cpu_extensions();
+        else if (strcmp(argv[i], "--cpu=baseline") == 0)
+            run_options.jit_options.extensions = 0;
+        else if (strcmp(argv[i], "--no-peephole") == 0)
+            run_options.jit_options.peephole = false;
+        else if (strcmp(argv[i], "--ast-format=tree") == 0)
+            ast_format = AST_DUMP_TREE;
+        else if (strcmp(argv[i], "--ast-format=compact") == 0)
+            ast_format = AST_DUMP_COMPACT;
+        else if (argv[i][0] == '-')
+        {
+            wprintf(L"Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+        else
+            file_name = argv[i];
+    }
+
+    if (file_name == NULL)
+    {
+        wprintf(L"Usage: %s [--dump-ast] [--ast-format=tree|compact] [--dump-ir] [--dump-bytecode] [--time] [--vm-profile] [--no-superinstructions] [--engine=vm|jit|tiered] [--tier-threshold=<n>] [--jit-threads=<n>] [--tier-stats] [--code-heap-stats] [--jit-stats] [--regalloc=linear|stack] [--isel=patterns|simple] [--cpu=native|baseline] [--no-peephole] [--profile-out=<file>] [--profile-in=<file>] [--code-cache=<dir>] [--aot=<file.o>] [--passes=<list>|none] [--simd=auto|sse2|avx2] [--opt-stats] <file>\n", argv[0]);
+        return 1;
+    }
+    if (run_options.profile_out && run_options.engine == ENGINE_JIT)
+    {
+        wprintf(L"--profile-out needs the vm or tiered engine\n");
+        return 1;
+    }
+    if (run_options.aot && (run_options.code_cache || run_options.profile_out || run_options.dump_bytecode))
+    {
+        wprintf(L"--aot writes the program instead of running it\n");
+        return 1;
+    }
+    if (run_options.code_cache && run_options.engine != ENGINE_JIT)
+    {
+        wprintf(L"--code-cache needs the jit engine\n");
         return 1;
     }
     setlocale(LC_CTYPE, "en_US.UTF-8");
 
     int file_size;
-    char *source = read_file(argv[1], &file_size);
+    char *source = read_file(file_name, &file_size);
+    if (source == NULL)
+        return 1;
 
+    double start = now_seconds();
     HashMap *lexers_hashmap = init_hashmap();
-    Lexer *lexer = lex_source(source, strdup(argv[1]));
-    hashmap_insert(lexers_hashmap, strdup(argv[1]), lexer);
-    current_lexer = hashmap_get(lexers_hashmap, argv[1]);
+    Lexer *lexer = lex_source(source, strdup(file_name));
+    hashmap_insert(lexers_hashmap, strdup(file_name), lexer);
 
-    // print_tokens(current_lexer);
+    // print_tokens(lexer);
 
-    Parser *parser = init_parser(current_lexer);
-    current_parser = parser;
+    Parser *parser = init_parser(lexer);
 
-    // int head = parse_expression(parser, 0);
-    int head = parse_declaration(parser);
-    print_ast_node(parser, head, 0);
+    int program = parse_program(parser);
+    // an object file leaves the extern functions to the linker
+    if (analyze_program(parser) > 0 || (!run_options.aot && resolve_extern_functions(parser, NULL, 0) > 0))
+    {
+        free_parser(parser, true);
+        free_hashmap(lexers_hashmap, free_lexer_wrapper);
+        return 1;
+    }
+    // node numbers only match a profile of the same source
+    if (profile_in && (run_options.profile_in = load_ir_profile(profile_in, parser->ast_count)) == NULL)
+    {
+        free_parser(parser, true);
+        free_hashmap(lexers_hashmap, free_lexer_wrapper);
+        return 1;
+    }
+    if (run_options.code_cache)
+        run_options.cache_key = code_cache_key(source, file_size, options_hash(&run_options));
+    if (run_options.show_time)
+        wprintf(L"Time: parse and check %.3f ms\n", (now_seconds() - start) * 1e3);
 
-    // for (int i = 0; i < parser->ast_count; i++)
-    // {
-    //     wprintf(L"AST node %d type: %d\n", i, parser->ast_nodes[i].type);
-    // }
+    int status = 0;
+    if (dump_ast)
+    {
+        ASTNode *root = &parser->ast_nodes[program];
+        for (int i = 0; i < root->data.block.statement_count; i++)
+        {
+            print_ast(parser, parser->ast_lists[root->data.block.first_statement + i], ast_format);
+        }
+    }
+    if (dump_ir)
+    {
+        IRModule *module = lower_and_optimize(parser, &run_options);
+        if (module == NULL)
+            status = 1;
+        else
+        {
+            OutputBuffer *buffer = init_buffer(OUTPUT_BUFFER_SIZE);
+            dump_ir_module(module, buffer);
+            write_buffer(buffer);
+        }
+        if (module)
+            free_ir_module(module);
+    }
+    if (status == 0 && (run_options.dump_bytecode || (!dump_ast && !dump_ir)))
+    {
+        if (run_options.aot)
+            status = run_aot(parser, &run_options);
+        else
+            status = run_options.engine == ENGINE_JIT && !run_options.dump_bytecode ? run_native(parser, &run_options) : run_program(parser, &run_options);
+    }
 
+    if (run_options.profile_in)
+        free_ir_profile(run_options.profile_in);
     free_parser(parser, true);
     free_hashmap(lexers_hashmap, free_lexer_wrapper);
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -1,6 +0,0 @@
-#include "../src_lexer/lexer.h"
-#include "../parser/parser.h"
-#include <stddef.h>
-
-Lexer *current_lexer = NULL;
-Parser *current_parser = NULL;
\ No newline at end of file
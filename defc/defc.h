@@ -1,19 +1,115 @@
 #ifndef DEFC_H
 #define DEFC_H
 
-#include "../src_lexer/lexer.h"
-#include "../parser/parser.h"
 #include <stddef.h>
 
-extern Lexer *current_lexer;
-extern Parser *current_parser;
-
 #define MAX_ERRORS 255
 
 #define TOKEN_INCREMENT 1024
 
 #define PARSER_INCREMENT 1024
 
+// first error message of a program kept for hosts of libcjit
+#define PARSER_ERROR_SIZE 256
+
 #define HASHMAP_SIZE 1024
 
+#define AST_VISIT_STACK_INCREMENT 64
+
+// must stay a power of two, the type hash index masks with it
+#define TYPE_TABLE_INCREMENT 64
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+#define IR_INSTRUCTION_INCREMENT 256
+
+#define IR_BLOCK_INCREMENT 32
+
+#define IR_FUNCTION_INCREMENT 16
+
+#define IR_VECTOR_LOOP_INCREMENT 4
+
+#define IR_SITE_INCREMENT 64
+
+// executions of a branch before its profile decides the block layout, a side
+// it never took is cold
+#define PROFILE_MIN_SAMPLES 32
+
+// calls of a site that make it hot, hot sites get the inlining budget of
+// calls in loops
+#define PROFILE_HOT_CALLS 1000
+
+// inlining: callee instructions a call site may take, more inside loops and
+// for every constant argument, up to a limit for the caller as a whole
+#define INLINE_BUDGET 24
+#define INLINE_LOOP_FACTOR 4
+#define INLINE_CONSTANT_BONUS 8
+#define INLINE_GROWTH_LIMIT 2000
+
+// how many inlined bodies deep a call can be inlined again, bounds recursion
+#define INLINE_DEPTH_LIMIT 2
+
+// multiplies an integer power by a constant exponent may expand to
+#define STRENGTH_POWER_MULTIPLIES 12
+
+// instructions besides constants a side of a branch turned into selects may
+// compute, and phis its join may select
+#define SELECT_ARM_BUDGET 4
+
+// instructions a fully unrolled loop may grow to
+#define UNROLL_FULL_BUDGET 64
+
+// iterations a partially unrolled body runs, fewer to stay under the budget
+#define UNROLL_FACTOR 4
+#define UNROLL_PARTIAL_BUDGET 48
+
+// vector registers a vectorized loop computes in, one per node, the JIT keeps
+// one more for the induction step and two scratch registers
+#define VECTOR_MAX_NODES 12
+
+#define VM_CODE_INCREMENT 256
+
+#define VM_CONSTANT_INCREMENT 64
+
+#define VM_LOOP_INCREMENT 8
+
+// profiled sites of a program, the operand c of an instruction names them
+#define VM_SITE_LIMIT 32000
+
+// value slots shared by all interpreter frames
+#define VM_STACK_SIZE (1 << 20)
+
+#define VM_FRAME_LIMIT (1 << 16)
+
+#define JIT_CODE_INCREMENT 4096
+#define JIT_STACK_RESERVE (1 << 22)
+// kept free at the end of a thread's stack for the C functions native code
+// calls and for its trap handler
+#define JIT_STACK_MARGIN (1 << 16)
+
+#define CODE_HEAP_REGION_SIZE (1 << 20)
+
+// chunk sizes are CODE_HEAP_MIN_CHUNK << class, larger code gets its own region
+#define CODE_HEAP_MIN_CHUNK 64
+#define CODE_HEAP_CLASS_COUNT 13
+
+#define CODE_HEAP_REGION_INCREMENT 8
+
+// layout of code cache files and the code the compiler produces, bumped
+// with every change to the lowering, the passes or the code generator. A
+// different one makes every file a miss.
+#define CODE_CACHE_VERSION 5
+
+// calls plus loop back edges before the tiered interpreter compiles a function
+#define TIER_THRESHOLD 1000
+
+#define TIER_COMPILER_THREADS 2
+
+// jobs per priority level, a power of two
+#define TIER_QUEUE_DEPTH 64
+#define TIER_PRIORITY_LEVELS 4
+
+// back edges between two looks for the on-stack replacement code of a loop
+#define TIER_OSR_POLL 256
+
 #endif
\ No newline at end of file
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <dlfcn.h>
+#include "ffi.h"
+#include "../semantic/types.h"
+
+// Calls from programs to C functions. A program declares them with
+//
+//     extern float sqrt(float x);
+//
+// and after the semantic pass every extern function is resolved to an
+// address, from the symbols the host registered or else with dlsym over the
+// process and the libraries it loaded. Native code calls that address like
+// a C compiler would, nothing is converted or boxed: parameters of type int
+// and long are int64_t, float is double, the low half of an int64_t is the
+// C int a parameter of that type reads. A long result is int64_t, an int
+// result the C int in the low half of RAX, which the caller sign extends.
+// The interpreter goes through ffi_call.
+
+static bool fits_registers(Parser *parser, parser_declaration *function)
+{
+    int counts[2] = {0, 0};
+    Type *type = get_type(parser->types, function->type_id);
+    for (int k = 0; k < type->param_count; k++)
+    {
+        counts[type_param(parser->types, function->type_id, k) == TYPE_FLOAT]++;
+    }
+    return counts[0] <= FFI_INT_ARGUMENTS && counts[1] <= FFI_FLOAT_ARGUMENTS;
+}
+
+// Sets the address of every extern function of parser, returns the number
+// of those that were not found or take too many arguments
+int resolve_extern_functions(Parser *parser, const FFISymbol *symbols, int symbol_count)
+{
+    int error_count = 0;
+    for (int i = 0; i < parser->symbol_count; i++)
+    {
+        parser_declaration *function = parser->symbols[i];
+        if (function->type != FUNCTION_DECLARATION || !function->is_extern)
+            continue;
+        const char *name = function->literal.value;
+        function->address = NULL;
+        // the last registration of a name wins
+        for (int s = symbol_count - 1; s >= 0 && function->address == NULL; s--)
+        {
+            if (strcmp(symbols[s].name, name) == 0)
+                function->address = symbols[s].address;
+        }
+        if (function->address == NULL)
+            function->address = dlsym(RTLD_DEFAULT, name);
+
+        if (function->address == NULL)
+        {
+            report_error(parser, L"%s: unresolved extern function '%s'", parser->file_name, name);
+            error_count++;
+        }
+        else if (!fits_registers(parser, function))
+        {
+            report_error(parser, L"%s: extern function '%s' takes more than %d int or %d float arguments", parser->file_name, name, FFI_INT_ARGUMENTS, FFI_FLOAT_ARGUMENTS);
+            error_count++;
+        }
+    }
+    return error_count;
+}
+
+// The extern functions of parser in symbol order, extern_of_symbol gets
+// the index of each and -1 for the other symbols. Returns their number.
+int collect_extern_functions(Parser *parser, IRExtern **externs, int *extern_of_symbol)
+{
+    int count = 0;
+    *externs = NULL;
+    for (int i = 0; i < parser->symbol_count; i++)
+    {
+        parser_declaration *function = parser->symbols[i];
+        extern_of_symbol[i] = -1;
+        if (function->type != FUNCTION_DECLARATION || !function->is_extern)
+            continue;
+
+        Type *type = get_type(parser->types, function->type_id);
+        *externs = realloc(*externs, (count + 1) * sizeof(IRExtern));
+        IRExtern *target = &(*externs)[count];
+        target->name = function->literal.value;
+        target->address = function->address;
+        target->return_type = ir_type_of(type->base);
+        target->int32_result = function->literal.literal_type == LITERAL_INT;
+        target->param_count = type->param_count;
+        target->param_types = malloc(type->param_count + 1);
+        for (int k = 0; k < type->param_count; k++)
+        {
+            target->param_types[k] = ir_type_of(type_param(parser->types, function->type_id, k));
+        }
+        extern_of_symbol[i] = count++;
+    }
+    return count;
+}
+
+void free_extern_functions(IRExtern *externs, int count)
+{
+    for (int e = 0; e < count; e++)
+    {
+        free(externs[e].param_types);
+    }
+    free(externs);
+}
+
+typedef int32_t (*Int32Function)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, double, double, double, double, double, double, double, double);
+typedef int64_t (*IntFunction)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, double, double, double, double, double, double, double, double);
+typedef double (*FloatFunction)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, double, double, double, double, double, double, double, double);
+
+// Calls function with one argument per parameter. Every argument register
+// is passed, the ones function does not take are ignored by it.
+FFIValue ffi_call(const IRExtern *function, const FFIValue *arguments)
+{
+    int64_t ints[FFI_INT_ARGUMENTS] = {0};
+    double floats[FFI_FLOAT_ARGUMENTS] = {0};
+    int int_count = 0;
+    int float_count = 0;
+    for (int k = 0; k < function->param_count; k++)
+    {
+        if (function->param_types[k] == IR_FLOAT)
+            floats[float_count++] = arguments[k].f;
+        else
+            ints[int_count++] = arguments[k].i;
+    }
+
+    FFIValue result;
+    if (function->return_type == IR_FLOAT)
+        result.f = ((FloatFunction)function->address)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], floats[0], floats[1], floats[2], floats[3], floats[4], floats[5], floats[6], floats[7]);
+    else if (function->int32_result)
+        result.i = ((Int32Function)function->address)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], floats[0], floats[1], floats[2], floats[3], floats[4], floats[5], floats[6], floats[7]);
+    else
+        result.i = ((IntFunction)function->address)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], floats[0], floats[1], floats[2], floats[3], floats[4], floats[5], floats[6], floats[7]);
+    return result;
+}
@@ -0,0 +1,31 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "../parser/parser.h"
+#include "../ir/ir.h"
+
+#ifndef FFI_H
+#define FFI_H
+
+// arguments an extern function takes in registers, the only ones it can take
+#define FFI_INT_ARGUMENTS 6
+#define FFI_FLOAT_ARGUMENTS 8
+
+// a C function the host registers under name, found before dlsym looks
+typedef struct
+{
+    const char *name;
+    void *address;
+} FFISymbol;
+
+typedef union
+{
+    int64_t i;
+    double f;
+} FFIValue;
+
+int resolve_extern_functions(Parser *parser, const FFISymbol *symbols, int symbol_count);
+int collect_extern_functions(Parser *parser, IRExtern **externs, int *extern_of_symbol);
+void free_extern_functions(IRExtern *externs, int count);
+FFIValue ffi_call(const IRExtern *function, const FFIValue *arguments);
+
+#endif
@@ -61,6 +61,29 @@ void *hashmap_get(HashMap *map, const char *key)
     return NULL;
 }
 
+// Removes the most recently inserted entry for key, an older entry with the
+// same key becomes visible again. Returns the removed value.
+void *hashmap_remove(HashMap *map, const char *key)
+{
+    unsigned long index = get_hash_index(key);
+    HashMapEntry **link = &map->buckets[index];
+
+    while (*link != NULL)
+    {
+        HashMapEntry *entry = *link;
+        if (strcmp(entry->key, key) == 0)
+        {
+            void *value = entry->value;
+            *link = entry->next;
+            free(entry->key);
+            free(entry);
+            return value;
+        }
+        link = &entry->next;
+    }
+    return NULL;
+}
+
 void free_hashmap(HashMap *map, void (*free_entry)(void *))
 {
     for (int i = 0; i < HASHMAP_SIZE; i++)
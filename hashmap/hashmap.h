@@ -18,6 +18,7 @@ unsigned long hash_string(const char *key);
 unsigned long get_hash_index(const char *key);
 void hashmap_insert(HashMap *hashmap, char *key, void *value);
 void *hashmap_get(HashMap *map, const char *key);
+void *hashmap_remove(HashMap *map, const char *key);
 void free_hashmap(HashMap *map, void (*free_entry)(void *));
 
 #endif
\ No newline at end of file
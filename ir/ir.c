@@ -0,0 +1,740 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "ir.h"
+#include "../ffi/ffi.h"
+#include "../defc/defc.h"
+
+const IROpcodeInfo ir_opcode_info[IR_OPCODE_COUNT] = {
+    [IR_NOP] = {"nop", 0, false, false},
+    [IR_CONST] = {"const", 0, false, false},
+    [IR_PARAM] = {"param", 0, false, false},
+    [IR_PHI] = {"phi", 0, true, false},
+    [IR_ADD] = {"add", 2, false, false},
+    [IR_SUB] = {"sub", 2, false, false},
+    [IR_MUL] = {"mul", 2, false, false},
+    [IR_DIV] = {"div", 2, false, false},
+    [IR_POW] = {"pow", 2, false, false},
+    [IR_NEG] = {"neg", 1, false, false},
+    [IR_MULHI] = {"mulhi", 2, false, false},
+    [IR_AND] = {"and", 2, false, false},
+    [IR_OR] = {"or", 2, false, false},
+    [IR_NOT] = {"not", 1, false, false},
+    [IR_SHL] = {"shl", 1, false, false},
+    [IR_SHR] = {"shr", 1, false, false},
+    [IR_SAR] = {"sar", 1, false, false},
+    [IR_EQ] = {"eq", 2, false, false},
+    [IR_NE] = {"ne", 2, false, false},
+    [IR_LT] = {"lt", 2, false, false},
+    [IR_LE] = {"le", 2, false, false},
+    [IR_GT] = {"gt", 2, false, false},
+    [IR_GE] = {"ge", 2, false, false},
+    [IR_SELECT] = {"select", 3, false, false},
+    [IR_ITOF] = {"itof", 1, false, false},
+    [IR_FTOI] = {"ftoi", 1, false, false},
+    [IR_SQRT] = {"sqrt", 1, false, false},
+    [IR_FMA] = {"fma", 3, false, false},
+    [IR_MIN] = {"min", 2, false, false},
+    [IR_MAX] = {"max", 2, false, false},
+    [IR_ABS] = {"abs", 1, false, false},
+    [IR_POPCNT] = {"popcnt", 1, false, false},
+    [IR_CLZ] = {"clz", 1, false, false},
+    [IR_CTZ] = {"ctz", 1, false, false},
+    [IR_CALL] = {"call", 0, true, false},
+    [IR_CALL_EXTERN] = {"call_extern", 0, true, false},
+    [IR_VREDUCE] = {"vreduce", 0, true, false},
+    [IR_LOAD] = {"load", 1, false, false},
+    [IR_JUMP] = {"jump", 0, false, true},
+    [IR_BRANCH] = {"branch", 1, false, true},
+    [IR_RETURN] = {"ret", 1, false, true},
+};
+
+static void *grow_array(void *array, int *size, int needed, size_t element_size, int increment)
+{
+    if (needed <= *size)
+        return array;
+    while (*size < needed)
+        *size += increment;
+    array = realloc(array, *size * element_size);
+    if (!array)
+    {
+        wprintf(L"Memory allocation failed while resizing IR.\n");
+        exit(1);
+    }
+    return array;
+}
+
+IRModule *init_ir_module(int symbol_count)
+{
+    IRModule *module = malloc(sizeof(IRModule));
+    module->function_size = IR_FUNCTION_INCREMENT;
+    module->function_count = 0;
+    module->functions = malloc(module->function_size * sizeof(IRFunction *));
+    module->symbol_count = symbol_count;
+    module->function_of_symbol = malloc((symbol_count > 0 ? symbol_count : 1) * sizeof(int));
+    for (int i = 0; i < symbol_count; i++)
+    {
+        module->function_of_symbol[i] = -1;
+    }
+    module->entry = -1;
+    module->externs = NULL;
+    module->extern_count = 0;
+    module->extern_of_symbol = NULL;
+    module->profile = NULL;
+    return module;
+}
+
+void free_ir_module(IRModule *module)
+{
+    for (int i = 0; i < module->function_count; i++)
+    {
+        free_ir_function(module->functions[i]);
+    }
+    free(module->functions);
+    free(module->function_of_symbol);
+    free_extern_functions(module->externs, module->extern_count);
+    free(module->extern_of_symbol);
+    free(module);
+}
+
+IRFunction *init_ir_function(char *name, int symbol, IRType return_type)
+{
+    IRFunction *function = calloc(1, sizeof(IRFunction));
+    function->name = name;
+    function->symbol = symbol;
+    function->return_type = return_type;
+
+    function->instruction_size = IR_INSTRUCTION_INCREMENT;
+    function->instructions = malloc(function->instruction_size * sizeof(IRInstruction));
+    function->block_size = IR_BLOCK_INCREMENT;
+    function->blocks = malloc(function->block_size * sizeof(IRBlock));
+    function->operand_size = IR_INSTRUCTION_INCREMENT;
+    function->operands = malloc(function->operand_size * sizeof(int32_t));
+
+    if (!function->instructions || !function->blocks || !function->operands)
+    {
+        wprintf(L"Memory allocation failed while initializing IR function.\n");
+        exit(1);
+    }
+    return function;
+}
+
+void ir_invalidate_analyses(IRFunction *function)
+{
+    free(function->use_offsets);
+    free(function->uses);
+    free(function->pred_offsets);
+    free(function->preds);
+    free(function->succ_offsets);
+    free(function->succs);
+    free(function->idom);
+    free(function->rpo);
+    function->use_offsets = function->uses = NULL;
+    function->pred_offsets = function->preds = NULL;
+    function->succ_offsets = function->succs = NULL;
+    function->idom = function->rpo = NULL;
+}
+
+void free_ir_function(IRFunction *function)
+{
+    ir_invalidate_analyses(function);
+    free(function->replacements);
+    free(function->param_types);
+    free(function->instructions);
+    free(function->blocks);
+    free(function->operands);
+    for (int i = 0; i < function->vector_loop_count; i++)
+    {
+        free(function->vector_loops[i].nodes);
+    }
+    free(function->vector_loops);
+    free(function);
+}
+
+int add_ir_function(IRModule *module, IRFunction *function)
+{
+    module->functions = grow_array(module->functions, &module->function_size, module->function_count + 1, sizeof(IRFunction *), IR_FUNCTION_INCREMENT);
+    module->functions[module->function_count] = function;
+    if (function->symbol >= 0 && function->symbol < module->symbol_count)
+        module->function_of_symbol[function->symbol] = module->function_count;
+    return module->function_count++;
+}
+
+int ir_add_block(IRFunction *function)
+{
+    function->blocks = grow_array(function->blocks, &function->block_size, function->block_count + 1, sizeof(IRBlock), IR_BLOCK_INCREMENT);
+    IRBlock *block = &function->blocks[function->block_count];
+    block->first = -1;
+    block->count = 0;
+    block->source = -1;
+    return function->block_count++;
+}
+
+int ir_emit(IRFunction *function, int block, IROpcode op, IRType type, int a, int b)
+{
+    int old_size = function->instruction_size;
+    function->instructions = grow_array(function->instructions, &function->instruction_size, function->instruction_count + 1, sizeof(IRInstruction), IR_INSTRUCTION_INCREMENT);
+    if (function->replacements && function->instruction_size != old_size)
+    {
+        function->replacements = realloc(function->replacements, function->instruction_size * sizeof(int32_t));
+        for (int i = old_size; i < function->instruction_size; i++)
+        {
+            function->replacements[i] = i;
+        }
+    }
+    IRInstruction *instruction = &function->instructions[function->instruction_count];
+    instruction->op = op;
+    instruction->type = type;
+    instruction->flags = 0;
+    instruction->block = block;
+    instruction->args[0] = a;
+    instruction->args[1] = b;
+    instruction->args[2] = -1;
+    instruction->source = -1;
+    instruction->imm.i = 0;
+    return function->instruction_count++;
+}
+
+int ir_emit_const_int(IRFunction *function, int block, int64_t value)
+{
+    int index = ir_emit(function, block, IR_CONST, IR_INT, -1, -1);
+    function->instructions[index].imm.i = value;
+    return index;
+}
+
+int ir_emit_const_float(IRFunction *function, int block, double value)
+{
+    int index = ir_emit(function, block, IR_CONST, IR_FLOAT, -1, -1);
+    function->instructions[index].imm.f = value;
+    return index;
+}
+
+int ir_add_operands(IRFunction *function, const int32_t *operands, int count)
+{
+    function->operands = grow_array(function->operands, &function->operand_size, function->operand_count + count + 1, sizeof(int32_t), IR_INSTRUCTION_INCREMENT);
+    int first = function->operand_count;
+    if (count > 0)
+        memcpy(&function->operands[first], operands, count * sizeof(int32_t));
+    function->operand_count += count;
+    return first;
+}
+
+// Copies nodes, returns the index of the loop
+int ir_add_vector_loop(IRFunction *function, const IRVectorNode *nodes, int node_count, int result, int lanes)
+{
+    function->vector_loops = grow_array(function->vector_loops, &function->vector_loop_size, function->vector_loop_count + 1, sizeof(IRVectorLoop), IR_VECTOR_LOOP_INCREMENT);
+    IRVectorLoop *loop = &function->vector_loops[function->vector_loop_count];
+    loop->nodes = malloc((node_count + 1) * sizeof(IRVectorNode));
+    if (!loop->nodes)
+    {
+        wprintf(L"Memory allocation failed while adding a vector loop.\n");
+        exit(1);
+    }
+    memcpy(loop->nodes, nodes, node_count * sizeof(IRVectorNode));
+    loop->node_count = node_count;
+    loop->result = result;
+    loop->lanes = lanes;
+    return function->vector_loop_count++;
+}
+
+// Only valid after ir_compact, returns -1 for an empty block
+int ir_terminator(IRFunction *function, int block)
+{
+    IRBlock *range = &function->blocks[block];
+    if (range->count == 0)
+        return -1;
+    int last = range->first + range->count - 1;
+    return ir_opcode_info[function->instructions[last].op].is_terminator ? last : -1;
+}
+
+static int terminator_successors(IRInstruction *instruction, int32_t *successors)
+{
+    switch (instruction->op)
+    {
+    case IR_JUMP:
+        successors[0] = instruction->imm.jump.target;
+        return 1;
+    case IR_BRANCH:
+        successors[0] = instruction->imm.jump.target;
+        successors[1] = instruction->imm.jump.other;
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+int ir_successors(IRFunction *function, int block, int32_t *successors)
+{
+    int terminator = ir_terminator(function, block);
+    if (terminator < 0)
+        return 0;
+    return terminator_successors(&function->instructions[terminator], successors);
+}
+
+void ir_replace_value(IRFunction *function, int from, int to)
+{
+    if (function->replacements == NULL)
+    {
+        function->replacements = malloc(function->instruction_size * sizeof(int32_t));
+        for (int i = 0; i < function->instruction_size; i++)
+        {
+            function->replacements[i] = i;
+        }
+    }
+    function->replacements[from] = to;
+}
+
+int ir_resolve_value(IRFunction *function, int value)
+{
+    if (function->replacements == NULL || value < 0)
+        return value;
+    while (function->replacements[value] != value)
+    {
+        int next = function->replacements[value];
+        function->replacements[value] = function->replacements[next];
+        value = next;
+    }
+    return value;
+}
+
+// Phis whose operands are all the same value (or the phi itself) are
+// replaced by that value, repeated until nothing changes
+static void remove_trivial_phis(IRFunction *function, const bool *reachable)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < function->instruction_count; i++)
+        {
+            IRInstruction *instruction = &function->instructions[i];
+            if (instruction->op != IR_PHI || !reachable[instruction->block])
+                continue;
+
+            int same = -1;
+            bool trivial = true;
+            for (int k = 0; k < instruction->imm.list.count; k++)
+            {
+                int predecessor = function->operands[instruction->imm.list.first + 2 * k];
+                int value = ir_resolve_value(function, function->operands[instruction->imm.list.first + 2 * k + 1]);
+                if (!reachable[predecessor] || value == i || value == same)
+                    continue;
+                if (same >= 0)
+                {
+                    trivial = false;
+                    break;
+                }
+                same = value;
+            }
+
+            if (trivial && same >= 0)
+            {
+                ir_replace_value(function, i, same);
+                instruction->op = IR_NOP;
+                changed = true;
+            }
+        }
+    }
+}
+
+static int rank_in_block(IRInstruction *instruction)
+{
+    if (instruction->op == IR_PHI)
+        return 0;
+    if (ir_opcode_info[instruction->op].is_terminator)
+        return 2;
+    return 1;
+}
+
+// Rebuilds the function so every block is a contiguous range with phis first
+// and its terminator last. Drops unreachable blocks, nops and trivial phis and
+// applies pending replacements. Value and block indices change.
+void ir_compact(IRFunction *function)
+{
+    int instruction_count = function->instruction_count;
+    int block_count = function->block_count;
+
+    int *terminators = malloc(block_count * sizeof(int));
+    bool *reachable = calloc(block_count, sizeof(bool));
+    int *worklist = malloc((block_count + 1) * sizeof(int));
+    int *block_map = malloc(block_count * sizeof(int));
+    int *bucket_offsets = calloc(block_count + 1, sizeof(int));
+    int *bucket = malloc((instruction_count + 1) * sizeof(int));
+    int *value_map = malloc((instruction_count + 1) * sizeof(int));
+
+    for (int b = 0; b < block_count; b++)
+    {
+        terminators[b] = -1;
+    }
+    for (int i = 0; i < instruction_count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        if (instruction->op != IR_NOP && ir_opcode_info[instruction->op].is_terminator)
+            terminators[instruction->block] = i;
+    }
+
+    int worklist_count = 0;
+    if (block_count > 0)
+    {
+        reachable[0] = true;
+        worklist[worklist_count++] = 0;
+    }
+    while (worklist_count > 0)
+    {
+        int block = worklist[--worklist_count];
+        int32_t successors[2];
+        int successor_count = terminators[block] >= 0 ? terminator_successors(&function->instructions[terminators[block]], successors) : 0;
+        for (int k = 0; k < successor_count; k++)
+        {
+            if (!reachable[successors[k]])
+            {
+                reachable[successors[k]] = true;
+                worklist[worklist_count++] = successors[k];
+            }
+        }
+    }
+
+    remove_trivial_phis(function, reachable);
+
+    int new_block_count = 0;
+    for (int b = 0; b < block_count; b++)
+    {
+        block_map[b] = reachable[b] ? new_block_count++ : -1;
+    }
+
+    // counting sort of live instructions by block, stable in index order
+    for (int i = 0; i < instruction_count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        if (instruction->op != IR_NOP && reachable[instruction->block])
+            bucket_offsets[instruction->block + 1]++;
+    }
+    for (int b = 0; b < block_count; b++)
+    {
+        bucket_offsets[b + 1] += bucket_offsets[b];
+    }
+    int *fill = malloc((block_count + 1) * sizeof(int));
+    memcpy(fill, bucket_offsets, (block_count + 1) * sizeof(int));
+    for (int i = 0; i < instruction_count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        value_map[i] = -1;
+        if (instruction->op != IR_NOP && reachable[instruction->block])
+            bucket[fill[instruction->block]++] = i;
+    }
+    free(fill);
+
+    IRInstruction *instructions = malloc((instruction_count > 0 ? instruction_count : 1) * sizeof(IRInstruction));
+    IRBlock *blocks = malloc((new_block_count > 0 ? new_block_count : 1) * sizeof(IRBlock));
+    int new_count = 0;
+    for (int b = 0; b < block_count; b++)
+    {
+        if (!reachable[b])
+            continue;
+
+        IRBlock *block = &blocks[block_map[b]];
+        block->first = new_count;
+        block->source = function->blocks[b].source;
+        for (int rank = 0; rank < 3; rank++)
+        {
+            for (int k = bucket_offsets[b]; k < bucket_offsets[b + 1]; k++)
+            {
+                IRInstruction *instruction = &function->instructions[bucket[k]];
+                if (rank_in_block(instruction) != rank)
+                    continue;
+                value_map[bucket[k]] = new_count;
+                instructions[new_count++] = *instruction;
+            }
+        }
+        block->count = new_count - block->first;
+    }
+
+    int32_t *operands = malloc((function->operand_count + 1) * sizeof(int32_t));
+    int operand_count = 0;
+    for (int i = 0; i < new_count; i++)
+    {
+        IRInstruction *instruction = &instructions[i];
+        const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+
+        instruction->block = block_map[instruction->block];
+        for (int k = 0; k < info->value_args; k++)
+        {
+            if (instruction->args[k] >= 0)
+                instruction->args[k] = value_map[ir_resolve_value(function, instruction->args[k])];
+        }
+
+        if (instruction->op == IR_JUMP || instruction->op == IR_BRANCH)
+        {
+            instruction->imm.jump.target = block_map[instruction->imm.jump.target];
+            if (instruction->op == IR_BRANCH)
+                instruction->imm.jump.other = block_map[instruction->imm.jump.other];
+        }
+        else if (instruction->op == IR_PHI)
+        {
+            int first = operand_count;
+            for (int k = 0; k < instruction->imm.list.count; k++)
+            {
+                int predecessor = function->operands[instruction->imm.list.first + 2 * k];
+                int value = function->operands[instruction->imm.list.first + 2 * k + 1];
+                if (!reachable[predecessor])
+                    continue;
+                operands[operand_count++] = block_map[predecessor];
+                operands[operand_count++] = value_map[ir_resolve_value(function, value)];
+            }
+            instruction->imm.list.first = first;
+            instruction->imm.list.count = (operand_count - first) / 2;
+        }
+        else if (info->has_list)
+        {
+            int first = operand_count;
+            for (int k = 0; k < instruction->imm.list.count; k++)
+            {
+                operands[operand_count++] = value_map[ir_resolve_value(function, function->operands[instruction->imm.list.first + k])];
+            }
+            instruction->imm.list.first = first;
+        }
+    }
+
+    free(function->instructions);
+    free(function->blocks);
+    free(function->operands);
+    free(function->replacements);
+    function->replacements = NULL;
+
+    function->instructions = instructions;
+    function->instruction_count = new_count;
+    function->instruction_size = instruction_count > 0 ? instruction_count : 1;
+    function->blocks = blocks;
+    function->block_count = new_block_count;
+    function->block_size = new_block_count > 0 ? new_block_count : 1;
+    function->operands = operands;
+    function->operand_count = operand_count;
+    function->operand_size = function->operand_count + 1;
+    ir_invalidate_analyses(function);
+
+    free(terminators);
+    free(reachable);
+    free(worklist);
+    free(block_map);
+    free(bucket_offsets);
+    free(bucket);
+    free(value_map);
+}
+
+void ir_build_uses(IRFunction *function)
+{
+    if (function->use_offsets)
+        return;
+
+    int count = function->instruction_count;
+    int32_t *offsets = calloc(count + 2, sizeof(int32_t));
+
+    // two passes over the instruction array: count, then fill
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            IRInstruction *instruction = &function->instructions[i];
+            const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+            int values[3];
+            int value_count = 0;
+
+            for (int k = 0; k < info->value_args; k++)
+            {
+                if (instruction->args[k] >= 0)
+                    values[value_count++] = instruction->args[k];
+            }
+            for (int k = 0; k < value_count; k++)
+            {
+                if (pass == 0)
+                    offsets[values[k] + 2]++;
+                else
+                    function->uses[offsets[values[k] + 1]++] = i;
+            }
+
+            if (info->has_list)
+            {
+                int stride = instruction->op == IR_PHI ? 2 : 1;
+                for (int k = 0; k < instruction->imm.list.count; k++)
+                {
+                    int value = function->operands[instruction->imm.list.first + k * stride + stride - 1];
+                    if (pass == 0)
+                        offsets[value + 2]++;
+                    else
+                        function->uses[offsets[value + 1]++] = i;
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                offsets[i + 2] += offsets[i + 1];
+            }
+            function->uses = malloc((offsets[count + 1] + 1) * sizeof(int32_t));
+        }
+    }
+
+    function->use_offsets = offsets;
+}
+
+void ir_build_cfg(IRFunction *function)
+{
+    if (function->succ_offsets)
+        return;
+
+    int count = function->block_count;
+    function->succ_offsets = malloc((count + 1) * sizeof(int32_t));
+    function->succs = malloc((2 * count + 1) * sizeof(int32_t));
+    function->pred_offsets = calloc(count + 2, sizeof(int32_t));
+
+    int succ_count = 0;
+    for (int b = 0; b < count; b++)
+    {
+        function->succ_offsets[b] = succ_count;
+        succ_count += ir_successors(function, b, &function->succs[succ_count]);
+    }
+    function->succ_offsets[count] = succ_count;
+
+    for (int k = 0; k < succ_count; k++)
+    {
+        function->pred_offsets[function->succs[k] + 2]++;
+    }
+    for (int b = 0; b < count; b++)
+    {
+        function->pred_offsets[b + 2] += function->pred_offsets[b + 1];
+    }
+    function->preds = malloc((succ_count + 1) * sizeof(int32_t));
+    for (int b = 0; b < count; b++)
+    {
+        for (int k = function->succ_offsets[b]; k < function->succ_offsets[b + 1]; k++)
+        {
+            function->preds[function->pred_offsets[function->succs[k] + 1]++] = b;
+        }
+    }
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+void ir_build_dominators(IRFunction *function)
+{
+    if (function->idom)
+        return;
+    ir_build_cfg(function);
+
+    int count = function->block_count;
+    int *order = malloc((count + 1) * sizeof(int));
+    int *stack = malloc((count + 1) * sizeof(int));
+    int *next_successor = calloc(count + 1, sizeof(int));
+    bool *visited = calloc(count + 1, sizeof(bool));
+
+    // iterative depth first search, post order reversed afterwards
+    int order_count = 0;
+    int stack_count = 0;
+    if (count > 0)
+    {
+        stack[stack_count++] = 0;
+        visited[0] = true;
+    }
+    while (stack_count > 0)
+    {
+        int block = stack[stack_count - 1];
+        int k = function->succ_offsets[block] + next_successor[block];
+        if (k < function->succ_offsets[block + 1])
+        {
+            next_successor[block]++;
+            int successor = function->succs[k];
+            if (!visited[successor])
+            {
+                visited[successor] = true;
+                stack[stack_count++] = successor;
+            }
+            continue;
+        }
+        order[order_count++] = block;
+        stack_count--;
+    }
+
+    function->rpo = malloc((count + 1) * sizeof(int32_t));
+    int *position = malloc((count + 1) * sizeof(int));
+    for (int b = 0; b < count; b++)
+    {
+        position[b] = -1;
+    }
+    for (int i = 0; i < order_count; i++)
+    {
+        function->rpo[i] = order[order_count - 1 - i];
+        position[function->rpo[i]] = i;
+    }
+    for (int i = order_count; i < count; i++)
+    {
+        function->rpo[i] = -1;
+    }
+
+    function->idom = malloc((count + 1) * sizeof(int32_t));
+    for (int b = 0; b < count; b++)
+    {
+        function->idom[b] = -1;
+    }
+    if (count > 0)
+        function->idom[0] = 0;
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 1; i < order_count; i++)
+        {
+            int block = function->rpo[i];
+            int new_idom = -1;
+            for (int k = function->pred_offsets[block]; k < function->pred_offsets[block + 1]; k++)
+            {
+                int predecessor = function->preds[k];
+                if (function->idom[predecessor] < 0)
+                    continue;
+                if (new_idom < 0)
+                {
+                    new_idom = predecessor;
+                    continue;
+                }
+                int a = predecessor;
+                int b = new_idom;
+                while (a != b)
+                {
+                    while (position[a] > position[b])
+                        a = function->idom[a];
+                    while (position[b] > position[a])
+                        b = function->idom[b];
+                }
+                new_idom = a;
+            }
+            if (new_idom >= 0 && function->idom[block] != new_idom)
+            {
+                function->idom[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    free(order);
+    free(stack);
+    free(next_successor);
+    free(visited);
+    free(position);
+}
+
+// Block a dominates block b
+bool ir_dominates(IRFunction *function, int a, int b)
+{
+    ir_build_dominators(function);
+    if (function->idom[b] < 0)
+        return false;
+    while (b != a)
+    {
+        if (b == 0)
+            return false;
+        b = function->idom[b];
+    }
+    return true;
+}
@@ -0,0 +1,300 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "../parser/parser.h"
+#include "../buffer/buffer.h"
+
+#ifndef IR_H
+#define IR_H
+
+typedef enum
+{
+    IR_NOP,
+
+    IR_CONST,
+    IR_PARAM,
+    IR_PHI,
+
+    // arithmetic, typed by the instruction type
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_POW,
+    IR_NEG,
+    // high 64 bits of the signed 128 bit integer product
+    IR_MULHI,
+
+    // integer bitwise
+    IR_AND,
+    IR_OR,
+    IR_NOT,
+    // integer shifts by imm.i, logical and arithmetic right
+    IR_SHL,
+    IR_SHR,
+    IR_SAR,
+
+    // comparisons produce int 0/1, typed by their operands
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+
+    // integer args[1] when args[0] is not zero, args[2] otherwise
+    IR_SELECT,
+
+    IR_ITOF,
+    IR_FTOI,
+
+    // intrinsics, typed by the instruction type. min and max are x < y ? x : y
+    // and x > y ? x : y, fma is args[0] * args[1] + args[2] rounded once,
+    // clz and ctz of zero are 64
+    IR_SQRT,
+    IR_FMA,
+    IR_MIN,
+    IR_MAX,
+    IR_ABS,
+    IR_POPCNT,
+    IR_CLZ,
+    IR_CTZ,
+
+    IR_CALL,
+    // call of the extern function args[0] of the module, see IRExtern
+    IR_CALL_EXTERN,
+
+    // sum of a vectorized loop, see IRVectorLoop
+    IR_VREDUCE,
+
+    // 64 bit value of the instruction type at args[0] + imm.i bytes
+    IR_LOAD,
+
+    // terminators
+    IR_JUMP,
+    IR_BRANCH,
+    IR_RETURN,
+
+    IR_OPCODE_COUNT
+} IROpcode;
+
+typedef enum
+{
+    IR_VOID,
+    IR_INT,
+    IR_FLOAT
+} IRType;
+
+// Every instruction defines the value with its own index, operands are value
+// indices. Phi and call operand lists live in IRFunction.operands, so an
+// instruction never owns memory and the array can be copied and compacted.
+typedef struct
+{
+    uint8_t op;
+    uint8_t type;
+    uint16_t flags; // calls: how many inlined bodies the call was copied out of
+    int32_t block;
+    // calls: function index, vreduce: index in IRFunction.vector_loops,
+    // otherwise values
+    int32_t args[3];
+    int32_t source; // AST node the instruction was lowered from, -1 if none
+    union
+    {
+        int64_t i;
+        double f;
+        // phi: pairs of (predecessor block, value); call: argument values
+        struct
+        {
+            int32_t first;
+            int32_t count;
+        } list;
+        struct
+        {
+            int32_t target;
+            int32_t other;
+        } jump;
+    } imm;
+} IRInstruction;
+
+// After ir_compact the instructions of a block are the range [first, first + count),
+// phis first and the terminator last
+typedef struct
+{
+    int first;
+    int count;
+    int source;
+} IRBlock;
+
+// One operation of a vectorized loop body, applied to every lane. Phi 0 is
+// the induction variable, lane k starting at start + k, phi 1 the
+// accumulator, param k the loop invariant list operand 3 + k. Operands are
+// earlier nodes.
+typedef struct
+{
+    uint8_t op;
+    int32_t args[2];
+    int64_t imm; // constant, shift count, phi or param number
+} IRVectorNode;
+
+// Counted loop whose iterations are summed lanes at a time. vreduce takes
+// the list (start, trip, init, invariants...), runs trip iterations of the
+// body with the induction variable from start on, trip being a multiple of
+// lanes, and returns init plus the sum of every iteration's contribution.
+typedef struct
+{
+    IRVectorNode *nodes;
+    int node_count;
+    int result; // node the accumulator takes at the end of an iteration
+    int lanes;
+} IRVectorLoop;
+
+typedef struct
+{
+    const char *name;
+    int value_args; // args[] entries that are values
+    bool has_list;
+    bool is_terminator;
+} IROpcodeInfo;
+
+typedef struct
+{
+    char *name;
+    int symbol;
+    IRType return_type;
+    int param_count;
+    uint8_t *param_types;
+
+    IRInstruction *instructions;
+    int instruction_size;
+    int instruction_count;
+
+    IRBlock *blocks;
+    int block_size;
+    int block_count;
+
+    int32_t *operands;
+    int operand_size;
+    int operand_count;
+
+    IRVectorLoop *vector_loops;
+    int vector_loop_size;
+    int vector_loop_count;
+
+    // pending value replacements applied by ir_compact, NULL when there are none
+    int32_t *replacements;
+
+    // built on demand, compressed rows indexed by value / block
+    int32_t *use_offsets;
+    int32_t *uses;
+    int32_t *pred_offsets;
+    int32_t *preds;
+    int32_t *succ_offsets;
+    int32_t *succs;
+    int32_t *idom;
+    int32_t *rpo;
+} IRFunction;
+
+typedef enum
+{
+    IR_SITE_BRANCH,
+    IR_SITE_CALL
+} IRSiteKind;
+
+// Execution counts of a branch or a call, taken by the interpreter. A site
+// is the AST node its IR instruction was lowered from, see
+// IRInstruction.source: an if, while or for statement for the branch on its
+// condition, && and || for the branch around their right operand, a call.
+typedef struct
+{
+    int32_t node;
+    uint8_t kind;
+    uint64_t counts[2]; // branches: condition false and true, calls: counts[1]
+} IRSite;
+
+// The side table of the sites of a program, site_of_node is -1 for the
+// nodes that are none. The interpreter may count into it while compiler
+// threads read it, both go through relaxed atomics.
+typedef struct
+{
+    IRSite *sites;
+    int site_size;
+    int site_count;
+    int32_t *site_of_node;
+    int node_count;
+} IRProfile;
+
+// C function declared extern, called with the System V convention at the
+// address resolve_extern_functions found
+typedef struct
+{
+    char *name;
+    void *address;
+    IRType return_type;
+    bool int32_result; // declared int: a C int, only the low half of RAX is set
+    int param_count;
+    uint8_t *param_types;
+} IRExtern;
+
+typedef struct
+{
+    IRFunction **functions;
+    int function_size;
+    int function_count;
+
+    // parser symbol index to function index, -1 for non functions
+    int *function_of_symbol;
+    int symbol_count;
+    int entry;
+
+    // numbered in symbol order, extern_of_symbol is -1 for other symbols
+    IRExtern *externs;
+    int extern_count;
+    int *extern_of_symbol;
+
+    const IRProfile *profile; // not owned, NULL without one
+} IRModule;
+
+extern const IROpcodeInfo ir_opcode_info[IR_OPCODE_COUNT];
+
+IRModule *init_ir_module(int symbol_count);
+void free_ir_module(IRModule *module);
+IRFunction *init_ir_function(char *name, int symbol, IRType return_type);
+void free_ir_function(IRFunction *function);
+int add_ir_function(IRModule *module, IRFunction *function);
+
+int ir_add_block(IRFunction *function);
+int ir_emit(IRFunction *function, int block, IROpcode op, IRType type, int a, int b);
+int ir_emit_const_int(IRFunction *function, int block, int64_t value);
+int ir_emit_const_float(IRFunction *function, int block, double value);
+int ir_add_operands(IRFunction *function, const int32_t *operands, int count);
+int ir_add_vector_loop(IRFunction *function, const IRVectorNode *nodes, int node_count, int result, int lanes);
+int ir_terminator(IRFunction *function, int block);
+int ir_successors(IRFunction *function, int block, int32_t *successors);
+
+void ir_replace_value(IRFunction *function, int from, int to);
+int ir_resolve_value(IRFunction *function, int value);
+void ir_compact(IRFunction *function);
+void ir_invalidate_analyses(IRFunction *function);
+
+void ir_build_uses(IRFunction *function);
+void ir_build_cfg(IRFunction *function);
+void ir_build_dominators(IRFunction *function);
+bool ir_dominates(IRFunction *function, int a, int b);
+
+IRType ir_type_of(int type_id);
+IRModule *lower_program(Parser *parser);
+IRFunction *lower_osr_function(Parser *parser, IRModule *module, int function, int loop);
+
+IRProfile *init_ir_profile(int node_count);
+void free_ir_profile(IRProfile *profile);
+int ir_profile_add_site(IRProfile *profile, int node, IRSiteKind kind);
+bool ir_profile_counts(const IRProfile *profile, int node, uint64_t counts[2]);
+void ir_profile_merge(IRProfile *profile, const IRProfile *other);
+bool save_ir_profile(const IRProfile *profile, const char *path);
+IRProfile *load_ir_profile(const char *path, int node_count);
+
+void dump_ir_function(IRFunction *function, IRModule *module, OutputBuffer *buffer);
+void dump_ir_module(IRModule *module, OutputBuffer *buffer);
+int verify_ir_function(IRFunction *function, IRModule *module);
+int verify_ir_module(IRModule *module);
+
+#endif
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ir.h"
+#include "../buffer/buffer.h"
+
+static const char *ir_type_name(IRType type)
+{
+    switch (type)
+    {
+    case IR_INT:
+        return "int";
+    case IR_FLOAT:
+        return "float";
+    default:
+        return "void";
+    }
+}
+
+static void append_value(OutputBuffer *buffer, int value)
+{
+    if (value < 0)
+    {
+        buffer_append_str(buffer, "undef");
+        return;
+    }
+    buffer_append_char(buffer, '%');
+    buffer_append_int(buffer, value);
+}
+
+static void append_block(OutputBuffer *buffer, int block)
+{
+    buffer_append_str(buffer, "bb");
+    buffer_append_int(buffer, block);
+}
+
+// n0 = phi 0; n1 = param 0; n2 = add n0, n1; ... -> n2
+static void append_vector_loop(OutputBuffer *buffer, IRVectorLoop *loop)
+{
+    buffer_append_str(buffer, " x");
+    buffer_append_int(buffer, loop->lanes);
+    buffer_append_str(buffer, " {");
+    for (int n = 0; n < loop->node_count; n++)
+    {
+        IRVectorNode *node = &loop->nodes[n];
+        buffer_append_str(buffer, n == 0 ? "n" : "; n");
+        buffer_append_int(buffer, n);
+        buffer_append_str(buffer, " = ");
+        buffer_append_str(buffer, ir_opcode_info[node->op].name);
+        for (int k = 0; k < ir_opcode_info[node->op].value_args; k++)
+        {
+            buffer_append_str(buffer, k == 0 ? " n" : ", n");
+            buffer_append_int(buffer, node->args[k]);
+        }
+        if (ir_opcode_info[node->op].value_args == 0 || node->op == IR_SHL || node->op == IR_SHR)
+        {
+            buffer_append_str(buffer, ir_opcode_info[node->op].value_args == 0 ? " " : ", ");
+            buffer_append_int(buffer, node->imm);
+        }
+    }
+    buffer_append_str(buffer, "} -> n");
+    buffer_append_int(buffer, loop->result);
+}
+
+static void dump_instruction(IRFunction *function, IRModule *module, int index, OutputBuffer *buffer)
+{
+    IRInstruction *instruction = &function->instructions[index];
+    const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+
+    buffer_append_str(buffer, "  ");
+    if (instruction->type != IR_VOID)
+    {
+        append_value(buffer, index);
+        buffer_append_char(buffer, ':');
+        buffer_append_str(buffer, ir_type_name(instruction->type));
+        buffer_append_str(buffer, " = ");
+    }
+    buffer_append_str(buffer, info->name);
+
+    switch (instruction->op)
+    {
+    case IR_CONST:
+        buffer_append_char(buffer, ' ');
+        if (instruction->type == IR_FLOAT)
+            buffer_append_double(buffer, instruction->imm.f);
+        else
+            buffer_append_int(buffer, instruction->imm.i);
+        break;
+    case IR_PARAM:
+        buffer_append_char(buffer, ' ');
+        buffer_append_int(buffer, instruction->imm.i);
+        break;
+    case IR_PHI:
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            buffer_append_str(buffer, k == 0 ? " [" : ", [");
+            append_block(buffer, function->operands[instruction->imm.list.first + 2 * k]);
+            buffer_append_char(buffer, ' ');
+            append_value(buffer, function->operands[instruction->imm.list.first + 2 * k + 1]);
+            buffer_append_char(buffer, ']');
+        }
+        break;
+    case IR_CALL:
+        buffer_append_str(buffer, " @");
+        if (module && instruction->args[0] >= 0 && instruction->args[0] < module->function_count)
+            buffer_append_str(buffer, module->functions[instruction->args[0]]->name);
+        else
+            buffer_append_int(buffer, instruction->args[0]);
+        buffer_append_char(buffer, '(');
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            if (k > 0)
+                buffer_append_str(buffer, ", ");
+            append_value(buffer, function->operands[instruction->imm.list.first + k]);
+        }
+        buffer_append_char(buffer, ')');
+        break;
+    case IR_CALL_EXTERN:
+        buffer_append_str(buffer, " @");
+        if (module && instruction->args[0] >= 0 && instruction->args[0] < module->extern_count)
+            buffer_append_str(buffer, module->externs[instruction->args[0]].name);
+        else
+            buffer_append_int(buffer, instruction->args[0]);
+        buffer_append_char(buffer, '(');
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            if (k > 0)
+                buffer_append_str(buffer, ", ");
+            append_value(buffer, function->operands[instruction->imm.list.first + k]);
+        }
+        buffer_append_char(buffer, ')');
+        break;
+    case IR_VREDUCE:
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            buffer_append_str(buffer, k == 0 ? " " : ", ");
+            append_value(buffer, function->operands[instruction->imm.list.first + k]);
+        }
+        if (instruction->args[0] >= 0 && instruction->args[0] < function->vector_loop_count)
+            append_vector_loop(buffer, &function->vector_loops[instruction->args[0]]);
+        break;
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR:
+    case IR_LOAD:
+        buffer_append_char(buffer, ' ');
+        append_value(buffer, instruction->args[0]);
+        buffer_append_str(buffer, ", ");
+        buffer_append_int(buffer, instruction->imm.i);
+        break;
+    case IR_JUMP:
+        buffer_append_char(buffer, ' ');
+        append_block(buffer, instruction->imm.jump.target);
+        break;
+    case IR_BRANCH:
+        buffer_append_char(buffer, ' ');
+        append_value(buffer, instruction->args[0]);
+        buffer_append_str(buffer, ", ");
+        append_block(buffer, instruction->imm.jump.target);
+        buffer_append_str(buffer, ", ");
+        append_block(buffer, instruction->imm.jump.other);
+        break;
+    default:
+        for (int k = 0; k < info->value_args; k++)
+        {
+            if (instruction->args[k] < 0 && instruction->op == IR_RETURN)
+                break;
+            buffer_append_str(buffer, k == 0 ? " " : ", ");
+            append_value(buffer, instruction->args[k]);
+        }
+    }
+    buffer_append_char(buffer, '\n');
+}
+
+void dump_ir_function(IRFunction *function, IRModule *module, OutputBuffer *buffer)
+{
+    ir_build_cfg(function);
+
+    buffer_append_str(buffer, "function ");
+    buffer_append_str(buffer, function->name);
+    buffer_append_char(buffer, '(');
+    for (int i = 0; i < function->param_count; i++)
+    {
+        if (i > 0)
+            buffer_append_str(buffer, ", ");
+        buffer_append_str(buffer, ir_type_name(function->param_types[i]));
+    }
+    buffer_append_str(buffer, ") -> ");
+    buffer_append_str(buffer, ir_type_name(function->return_type));
+    buffer_append_char(buffer, '\n');
+
+    for (int b = 0; b < function->block_count; b++)
+    {
+        append_block(buffer, b);
+        buffer_append_char(buffer, ':');
+        if (function->pred_offsets[b] < function->pred_offsets[b + 1])
+        {
+            buffer_append_str(buffer, " ; preds");
+            for (int k = function->pred_offsets[b]; k < function->pred_offsets[b + 1]; k++)
+            {
+                buffer_append_char(buffer, ' ');
+                append_block(buffer, function->preds[k]);
+            }
+        }
+        buffer_append_char(buffer, '\n');
+
+        IRBlock *block = &function->blocks[b];
+        for (int i = block->first; i < block->first + block->count; i++)
+        {
+            dump_instruction(function, module, i, buffer);
+        }
+    }
+}
+
+void dump_ir_module(IRModule *module, OutputBuffer *buffer)
+{
+    for (int i = 0; i < module->function_count; i++)
+    {
+        if (i > 0)
+            buffer_append_char(buffer, '\n');
+        dump_ir_function(module->functions[i], module, buffer);
+    }
+}
@@ -0,0 +1,801 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "ir.h"
+#include "../parser/parser.h"
+#include "../parser/visitor.h"
+#include "../semantic/semantic.h"
+#include "../semantic/types.h"
+#include "../ffi/ffi.h"
+#include "../defc/defc.h"
+
+// Lowering walks the AST with visit_ast. Every node pushes exactly one entry
+// on the value stack in its post callback (-1 for statements), control flow
+// nodes switch blocks from the pre callback of their children.
+//
+// SSA form is built directly with the algorithm of Braun et al., "Simple and
+// Efficient Construction of Static Single Assignment Form": variables are
+// looked up per block, phis are created on demand and completed when a block
+// is sealed. Phis may be appended after the rest of their block, ir_compact
+// moves them to the front and removes the trivial ones.
+//
+// lower_osr_function lowers a function again for on-stack replacement: its
+// only parameter is the address of an interpreter frame, and the entry block
+// jumps straight into the body of one loop. Bytecode registers and IR
+// variables share their slots and only variables are live across a back
+// edge, so a variable read from the entry block is a load from its slot. The
+// code in front of the loop is still lowered but nothing reaches it,
+// ir_compact drops it along with the phis it fed.
+
+typedef struct
+{
+    int node;
+    int blocks[3];
+    int value;
+} LowerControl;
+
+typedef struct
+{
+    Parser *parser;
+    IRModule *module;
+    IRFunction *function;
+    parser_declaration *symbol;
+    int current;
+
+    int variable_count;
+    uint8_t *variable_types;
+    int32_t *definitions; // block * variable_count + variable
+    bool *sealed;
+    NodeList *predecessors;
+    NodeList *incomplete; // pairs of (variable, phi)
+    int block_capacity;
+
+    int *values;
+    int value_size;
+    int value_count;
+
+    LowerControl *controls;
+    int control_size;
+    int control_count;
+
+    int osr_loop; // loop node the entry block jumps into, -1 for the plain function
+    int osr_frame; // value of the frame address parameter
+
+    int error_count;
+} LowerContext;
+
+IRType ir_type_of(int type_id)
+{
+    switch (type_id)
+    {
+    case TYPE_INT:
+        return IR_INT;
+    case TYPE_FLOAT:
+        return IR_FLOAT;
+    default:
+        return IR_VOID;
+    }
+}
+
+static int new_block(LowerContext *context, bool sealed)
+{
+    int block = ir_add_block(context->function);
+
+    if (block >= context->block_capacity)
+    {
+        int old_capacity = context->block_capacity;
+        context->block_capacity = context->block_capacity ? context->block_capacity * 2 : IR_BLOCK_INCREMENT;
+        context->definitions = realloc(context->definitions, (size_t)context->block_capacity * (context->variable_count + 1) * sizeof(int32_t));
+        context->sealed = realloc(context->sealed, context->block_capacity * sizeof(bool));
+        context->predecessors = realloc(context->predecessors, context->block_capacity * sizeof(NodeList));
+        context->incomplete = realloc(context->incomplete, context->block_capacity * sizeof(NodeList));
+        for (int b = old_capacity; b < context->block_capacity; b++)
+        {
+            context->predecessors[b] = (NodeList){NULL, 0, 0};
+            context->incomplete[b] = (NodeList){NULL, 0, 0};
+        }
+    }
+
+    for (int v = 0; v < context->variable_count; v++)
+    {
+        context->definitions[block * context->variable_count + v] = -1;
+    }
+    context->sealed[block] = sealed;
+    return block;
+}
+
+static void add_predecessor(LowerContext *context, int block, int predecessor)
+{
+    node_list_push(&context->predecessors[block], predecessor);
+}
+
+static int emit(LowerContext *context, IROpcode op, IRType type, int a, int b)
+{
+    return ir_emit(context->function, context->current, op, type, a, b);
+}
+
+static int zero_value(LowerContext *context, int block, IRType type)
+{
+    if (type == IR_FLOAT)
+        return ir_emit_const_float(context->function, block, 0.0);
+    return ir_emit_const_int(context->function, block, 0);
+}
+
+static void write_variable(LowerContext *context, int variable, int block, int value)
+{
+    context->definitions[block * context->variable_count + variable] = value;
+}
+
+static int read_variable(LowerContext *context, int variable, int block);
+
+static void add_phi_operands(LowerContext *context, int variable, int phi)
+{
+    IRFunction *function = context->function;
+    int block = function->instructions[phi].block;
+    NodeList *predecessors = &context->predecessors[block];
+    int32_t *pairs = malloc((2 * predecessors->count + 1) * sizeof(int32_t));
+
+    for (int k = 0; k < predecessors->count; k++)
+    {
+        pairs[2 * k] = predecessors->items[k];
+        pairs[2 * k + 1] = read_variable(context, variable, predecessors->items[k]);
+    }
+
+    int first = ir_add_operands(function, pairs, 2 * predecessors->count);
+    function->instructions[phi].imm.list.first = first;
+    function->instructions[phi].imm.list.count = predecessors->count;
+    free(pairs);
+}
+
+static int read_variable(LowerContext *context, int variable, int block)
+{
+    int value = context->definitions[block * context->variable_count + variable];
+    if (value >= 0)
+        return value;
+
+    IRType type = context->variable_types[variable];
+    NodeList *predecessors = &context->predecessors[block];
+
+    if (!context->sealed[block])
+    {
+        value = ir_emit(context->function, block, IR_PHI, type, -1, -1);
+        node_list_push(&context->incomplete[block], variable);
+        node_list_push(&context->incomplete[block], value);
+    }
+    else if (predecessors->count == 0 && block == 0 && context->osr_loop >= 0)
+    {
+        value = ir_emit(context->function, block, IR_LOAD, type, context->osr_frame, -1);
+        context->function->instructions[value].imm.i = variable * (int64_t)sizeof(int64_t);
+    }
+    else if (predecessors->count == 0)
+    {
+        // entry block or unreachable code, variables start out as zero
+        value = zero_value(context, block, type);
+    }
+    else if (predecessors->count == 1)
+    {
+        value = read_variable(context, variable, predecessors->items[0]);
+    }
+    else
+    {
+        value = ir_emit(context->function, block, IR_PHI, type, -1, -1);
+        context->function->instructions[value].imm.list.count = 0;
+        write_variable(context, variable, block, value);
+        add_phi_operands(context, variable, value);
+    }
+
+    write_variable(context, variable, block, value);
+    return value;
+}
+
+static void seal_block(LowerContext *context, int block)
+{
+    NodeList *incomplete = &context->incomplete[block];
+    for (int k = 0; k < incomplete->count; k += 2)
+    {
+        add_phi_operands(context, incomplete->items[k], incomplete->items[k + 1]);
+    }
+    incomplete->count = 0;
+    context->sealed[block] = true;
+}
+
+static void push_value(LowerContext *context, int value)
+{
+    if (context->value_count >= context->value_size)
+    {
+        context->value_size = context->value_size ? context->value_size * 2 : 64;
+        context->values = realloc(context->values, context->value_size * sizeof(int));
+    }
+    context->values[context->value_count++] = value;
+}
+
+static int pop_value(LowerContext *context)
+{
+    return context->values[--context->value_count];
+}
+
+static LowerControl *push_control(LowerContext *context, int node)
+{
+    if (context->control_count >= context->control_size)
+    {
+        context->control_size = context->control_size ? context->control_size * 2 : 16;
+        context->controls = realloc(context->controls, context->control_size * sizeof(LowerControl));
+    }
+    LowerControl *control = &context->controls[context->control_count++];
+    control->node = node;
+    control->blocks[0] = control->blocks[1] = control->blocks[2] = -1;
+    control->value = -1;
+    return control;
+}
+
+static LowerControl *top_control(LowerContext *context, int node)
+{
+    if (context->control_count > 0 && context->controls[context->control_count - 1].node == node)
+        return &context->controls[context->control_count - 1];
+    return NULL;
+}
+
+static void jump_to(LowerContext *context, int target)
+{
+    int jump = emit(context, IR_JUMP, IR_VOID, -1, -1);
+    context->function->instructions[jump].imm.jump.target = target;
+    add_predecessor(context, target, context->current);
+}
+
+// target is where the condition holds, node is the if, loop, && or || whose
+// profile site the branch shares with the interpreter
+static void branch_to(LowerContext *context, int node, int condition, int target, int other)
+{
+    int branch = emit(context, IR_BRANCH, IR_VOID, condition, -1);
+    context->function->instructions[branch].source = node;
+    context->function->instructions[branch].imm.jump.target = target;
+    context->function->instructions[branch].imm.jump.other = other;
+    add_predecessor(context, target, context->current);
+    add_predecessor(context, other, context->current);
+}
+
+// the body of the loop an OSR function enters is left unsealed until the
+// entry block jumps to it
+static int new_loop_body(LowerContext *context, int loop)
+{
+    return new_block(context, loop != context->osr_loop);
+}
+
+static void enter_loop_body(LowerContext *context, int loop, int body)
+{
+    if (loop != context->osr_loop)
+        return;
+    int jump = ir_emit(context->function, 0, IR_JUMP, IR_VOID, -1, -1);
+    context->function->instructions[jump].imm.jump.target = body;
+    add_predecessor(context, body, 0);
+    seal_block(context, body);
+}
+
+// 0/1 value of a number, as && || and ! need it
+static int truth_value(LowerContext *context, int value)
+{
+    IROpcode op = context->function->instructions[value].op;
+    if (op >= IR_EQ && op <= IR_GE)
+        return value;
+
+    IRType type = context->function->instructions[value].type;
+    return emit(context, IR_NE, IR_INT, value, zero_value(context, context->current, type));
+}
+
+// branches only test for non zero, ints can be used as they are
+static int condition_value(LowerContext *context, int value)
+{
+    if (context->function->instructions[value].type == IR_INT)
+        return value;
+    return truth_value(context, value);
+}
+
+static IROpcode binary_opcode(TokenType type)
+{
+    switch (type)
+    {
+    case T_PLUS:
+        return IR_ADD;
+    case T_MINUS:
+        return IR_SUB;
+    case T_MULTIPLY:
+        return IR_MUL;
+    case T_DIVIDE:
+        return IR_DIV;
+    case T_POWER:
+        return IR_POW;
+    case T_BAND:
+        return IR_AND;
+    case T_BOR:
+        return IR_OR;
+    case T_EQUAL:
+        return IR_EQ;
+    case T_NOT_EQUAL:
+        return IR_NE;
+    case T_LESS:
+        return IR_LT;
+    case T_LESS_EQUAL:
+        return IR_LE;
+    case T_GREATER:
+        return IR_GT;
+    case T_GREATER_EQUAL:
+        return IR_GE;
+    default:
+        return IR_NOP;
+    }
+}
+
+static bool is_short_circuit(ASTNode *node)
+{
+    return node->type == N_BINARY_EXPRESSION && (node->data.binary.operator== T_AND || node->data.binary.operator== T_OR);
+}
+
+static int variable_slot(LowerContext *context, int symbol)
+{
+    parser_declaration *declaration = context->parser->symbols[symbol];
+    context->variable_types[declaration->slot] = ir_type_of(declaration->type_id);
+    return declaration->slot;
+}
+
+static void lower_error(LowerContext *context, const wchar_t *message, const char *name)
+{
+    report_error(context->parser, L"%s: lowering error: %ls '%s'", context->parser->file_name, message, name);
+    context->error_count++;
+}
+
+// Moves to the block the child of a control flow node belongs in
+static void enter_child(LowerContext *context, Parser *parser, const ASTVisit *visit)
+{
+    ASTNode *parent = &parser->ast_nodes[visit->parent];
+    LowerControl *control = top_control(context, visit->parent);
+    if (control == NULL)
+        return;
+
+    switch (parent->type)
+    {
+    case N_IF:
+        if (visit->child_position == 1)
+        {
+            int condition = condition_value(context, pop_value(context));
+            int then_block = new_block(context, true);
+            int join = new_block(context, false);
+            int else_block = parent->data.if_statement.else_branch >= 0 ? new_block(context, true) : join;
+            branch_to(context, visit->parent, condition, then_block, else_block);
+            control->blocks[0] = else_block;
+            control->blocks[1] = join;
+            context->current = then_block;
+        }
+        else if (visit->child_position == 2)
+        {
+            jump_to(context, control->blocks[1]);
+            context->current = control->blocks[0];
+        }
+        break;
+    case N_WHILE:
+        if (visit->child_position == 1)
+        {
+            int condition = condition_value(context, pop_value(context));
+            int body = new_loop_body(context, visit->parent);
+            int exit = new_block(context, true);
+            branch_to(context, visit->parent, condition, body, exit);
+            enter_loop_body(context, visit->parent, body);
+            control->blocks[1] = exit;
+            context->current = body;
+        }
+        break;
+    case N_FOR:
+    {
+        int header = control->blocks[0];
+        if (visit->node == parent->data.for_statement.init)
+            break;
+        if (header < 0 && (visit->node == parent->data.for_statement.condition || visit->node == parent->data.for_statement.body))
+        {
+            header = new_block(context, false);
+            jump_to(context, header);
+            context->current = header;
+            control->blocks[0] = header;
+        }
+        if (visit->node == parent->data.for_statement.body)
+        {
+            int body = new_loop_body(context, visit->parent);
+            int exit = new_block(context, true);
+            if (parent->data.for_statement.condition >= 0)
+                branch_to(context, visit->parent, condition_value(context, pop_value(context)), body, exit);
+            else
+                jump_to(context, body);
+            enter_loop_body(context, visit->parent, body);
+            control->blocks[1] = exit;
+            context->current = body;
+        }
+        break;
+    }
+    case N_BINARY_EXPRESSION:
+        if (visit->child_position == 1)
+        {
+            // && skips the right operand when the left one is false, || when it is true
+            bool is_and = parent->data.binary.operator== T_AND;
+            int left = truth_value(context, pop_value(context));
+            int right_block = new_block(context, true);
+            int join = new_block(context, false);
+            control->value = ir_emit_const_int(context->function, context->current, is_and ? 0 : 1);
+            control->blocks[0] = context->current;
+            control->blocks[1] = join;
+            if (is_and)
+                branch_to(context, visit->parent, left, right_block, join);
+            else
+                branch_to(context, visit->parent, left, join, right_block);
+            context->current = right_block;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static VisitAction lower_pre(Parser *parser, const ASTVisit *visit, void *data)
+{
+    LowerContext *context = data;
+    ASTNode *node = &parser->ast_nodes[visit->node];
+
+    // nested function definitions are lowered as functions of their own
+    if (node->type == N_FUNCTION_DECLARATION || node->type == N_FUNCTION_PROTOTYPE)
+        return VISIT_SKIP;
+
+    if (visit->parent >= 0)
+        enter_child(context, parser, visit);
+
+    if (node->type == N_IF || node->type == N_WHILE || node->type == N_FOR || is_short_circuit(node))
+        push_control(context, visit->node);
+
+    if (node->type == N_WHILE)
+    {
+        int header = new_block(context, false);
+        jump_to(context, header);
+        context->current = header;
+        top_control(context, visit->node)->blocks[0] = header;
+    }
+
+    return VISIT_CONTINUE;
+}
+
+static void lower_return(LowerContext *context, int value)
+{
+    IRType return_type = context->function->return_type;
+    if (value < 0)
+        value = zero_value(context, context->current, return_type);
+    emit(context, IR_RETURN, IR_VOID, value, -1);
+
+    // anything after return is unreachable, ir_compact drops it
+    context->current = new_block(context, true);
+}
+
+static VisitAction lower_post(Parser *parser, const ASTVisit *visit, void *data)
+{
+    LowerContext *context = data;
+    IRFunction *function = context->function;
+    ASTNode *node = &parser->ast_nodes[visit->node];
+    int value = -1;
+
+    switch (node->type)
+    {
+    case N_LITERAL:
+        if (node->data.literal.literal_type == LITERAL_FLOAT)
+            value = ir_emit_const_float(function, context->current, strtod(node->data.literal.value, NULL));
+        else
+            value = ir_emit_const_int(function, context->current, strtoll(node->data.literal.value, NULL, 10));
+        break;
+    case N_IDENTIFIER:
+        value = read_variable(context, variable_slot(context, node->data.identifier.declaration), context->current);
+        break;
+    case N_ASSIGNMENT:
+        value = pop_value(context);
+        write_variable(context, variable_slot(context, node->data.assignment.declaration), context->current, value);
+        break;
+    case N_VARIABLE_DECLARATION:
+    {
+        int slot = variable_slot(context, node->data.variable_declaration.declaration);
+        int initial = node->data.variable_declaration.expression >= 0 ? pop_value(context) : zero_value(context, context->current, context->variable_types[slot]);
+        write_variable(context, slot, context->current, initial);
+        break;
+    }
+    case N_UPDATE:
+    {
+        int slot = variable_slot(context, node->data.update.declaration);
+        IRType type = context->variable_types[slot];
+        int old_value = read_variable(context, slot, context->current);
+        int one = type == IR_FLOAT ? ir_emit_const_float(function, context->current, 1.0) : ir_emit_const_int(function, context->current, 1);
+        int new_value = emit(context, node->data.update.operator== T_INCREMENT ? IR_ADD : IR_SUB, type, old_value, one);
+        write_variable(context, slot, context->current, new_value);
+        value = node->data.update.prefix ? new_value : old_value;
+        break;
+    }
+    case N_CAST:
+    {
+        int operand = pop_value(context);
+        IRType type = ir_type_of(node->type_id);
+        if (function->instructions[operand].type == type)
+            value = operand;
+        else
+            value = emit(context, type == IR_FLOAT ? IR_ITOF : IR_FTOI, type, operand, -1);
+        break;
+    }
+    case N_UNARY_EXPRESSION:
+    {
+        int operand = pop_value(context);
+        IRType type = function->instructions[operand].type;
+        switch (node->data.unary.operator)
+        {
+        case T_MINUS:
+            value = emit(context, IR_NEG, type, operand, -1);
+            break;
+        case T_NOT:
+            value = emit(context, IR_EQ, IR_INT, operand, zero_value(context, context->current, type));
+            break;
+        case T_BNOT:
+            value = emit(context, IR_NOT, IR_INT, operand, -1);
+            break;
+        default:
+            value = operand;
+        }
+        break;
+    }
+    case N_BINARY_EXPRESSION:
+    {
+        int right = pop_value(context);
+        if (is_short_circuit(node))
+        {
+            LowerControl *control = top_control(context, visit->node);
+            int right_value = truth_value(context, right);
+            int join = control->blocks[1];
+            int pairs[4] = {control->blocks[0], control->value, context->current, right_value};
+            jump_to(context, join);
+            seal_block(context, join);
+            context->current = join;
+            value = ir_emit(function, join, IR_PHI, IR_INT, -1, -1);
+            function->instructions[value].imm.list.first = ir_add_operands(function, pairs, 4);
+            function->instructions[value].imm.list.count = 2;
+            context->control_count--;
+            break;
+        }
+
+        int left = pop_value(context);
+        IRType type = function->instructions[left].type;
+        IROpcode op = binary_opcode(node->data.binary.operator);
+        bool comparison = op >= IR_EQ && op <= IR_GE;
+        value = emit(context, op, comparison ? IR_INT : type, left, right);
+        break;
+    }
+    case N_CALL:
+    {
+        int count = node->data.call.argument_count;
+        int32_t *arguments = malloc((count + 1) * sizeof(int32_t));
+        for (int k = count - 1; k >= 0; k--)
+        {
+            arguments[k] = pop_value(context);
+        }
+
+        if (node->data.call.intrinsic >= 0)
+        {
+            static const IROpcode intrinsic_ops[INTRINSIC_COUNT] = {
+                [INTRINSIC_SQRT] = IR_SQRT,
+                [INTRINSIC_FMA] = IR_FMA,
+                [INTRINSIC_MIN] = IR_MIN,
+                [INTRINSIC_MAX] = IR_MAX,
+                [INTRINSIC_ABS] = IR_ABS,
+                [INTRINSIC_POPCOUNT] = IR_POPCNT,
+                [INTRINSIC_CLZ] = IR_CLZ,
+                [INTRINSIC_CTZ] = IR_CTZ,
+            };
+            value = emit(context, intrinsic_ops[node->data.call.intrinsic], ir_type_of(node->type_id), arguments[0], count > 1 ? arguments[1] : -1);
+            if (count > 2)
+                function->instructions[value].args[2] = arguments[2];
+            function->instructions[value].source = visit->node;
+            free(arguments);
+            break;
+        }
+
+        parser_declaration *callee = parser->symbols[node->data.call.declaration];
+        IROpcode op = callee->is_extern ? IR_CALL_EXTERN : IR_CALL;
+        int callee_index = callee->is_extern ? context->module->extern_of_symbol[callee->index] : context->module->function_of_symbol[callee->index];
+        if (callee_index < 0)
+            lower_error(context, L"call to function without definition", callee->literal.value);
+
+        value = emit(context, op, ir_type_of(node->type_id), callee_index, -1);
+        function->instructions[value].source = visit->node;
+        function->instructions[value].imm.list.first = ir_add_operands(function, arguments, count);
+        function->instructions[value].imm.list.count = count;
+        free(arguments);
+        break;
+    }
+    case N_RETURN:
+        lower_return(context, node->data.return_statement.expression >= 0 ? pop_value(context) : -1);
+        break;
+    case N_BLOCK:
+    case N_PROGRAM:
+        context->value_count -= node->data.block.statement_count;
+        break;
+    case N_IF:
+    {
+        LowerControl *control = top_control(context, visit->node);
+        int join = control->blocks[1];
+        context->value_count -= node->data.if_statement.else_branch >= 0 ? 2 : 1;
+        jump_to(context, join);
+        seal_block(context, join);
+        context->current = join;
+        context->control_count--;
+        break;
+    }
+    case N_WHILE:
+    {
+        LowerControl *control = top_control(context, visit->node);
+        context->value_count -= 1;
+        jump_to(context, control->blocks[0]);
+        seal_block(context, control->blocks[0]);
+        context->current = control->blocks[1];
+        context->control_count--;
+        break;
+    }
+    case N_FOR:
+    {
+        LowerControl *control = top_control(context, visit->node);
+        // body, update and init entries, the condition was consumed by the branch
+        context->value_count -= 1 + (node->data.for_statement.update >= 0) + (node->data.for_statement.init >= 0);
+        jump_to(context, control->blocks[0]);
+        seal_block(context, control->blocks[0]);
+        context->current = control->blocks[1];
+        context->control_count--;
+        break;
+    }
+    case N_FUNCTION_DECLARATION:
+    case N_FUNCTION_PROTOTYPE:
+    case N_PARAMETER:
+        break;
+    default:
+        lower_error(context, L"cannot lower node", node_type_to_string(node->type));
+    }
+
+    push_value(context, value);
+    return VISIT_CONTINUE;
+}
+
+static int lower_function(LowerContext *context, IRFunction *function, parser_declaration *symbol)
+{
+    Parser *parser = context->parser;
+    context->function = function;
+    context->symbol = symbol;
+    context->variable_count = symbol->local_count;
+    context->variable_types = calloc(context->variable_count + 1, sizeof(uint8_t));
+    context->value_count = 0;
+    context->control_count = 0;
+    context->block_capacity = 0;
+    context->definitions = NULL;
+    context->sealed = NULL;
+    context->predecessors = NULL;
+    context->incomplete = NULL;
+
+    context->current = new_block(context, true);
+    if (context->osr_loop >= 0)
+    {
+        context->osr_frame = emit(context, IR_PARAM, IR_INT, -1, -1);
+        function->instructions[context->osr_frame].imm.i = 0;
+        context->current = new_block(context, true);
+    }
+
+    int root = symbol->definition;
+    if (parser->ast_nodes[root].type == N_FUNCTION_DECLARATION)
+    {
+        ASTNode *prototype = &parser->ast_nodes[symbol->node];
+        const uint8_t *param_types = context->module->functions[context->module->function_of_symbol[function->symbol]]->param_types;
+        for (int i = 0; i < prototype->data.function_prototype.parameter_count; i++)
+        {
+            // parameters occupy the first slots of the frame in declaration order
+            context->variable_types[i] = param_types[i];
+            if (context->osr_loop >= 0)
+                continue;
+            int value = emit(context, IR_PARAM, param_types[i], -1, -1);
+            function->instructions[value].imm.i = i;
+            write_variable(context, i, context->current, value);
+        }
+        root = parser->ast_nodes[root].data.function_declaration.body;
+    }
+
+    ASTVisitor visitor = {lower_pre, lower_post, context};
+    visit_ast(parser, root, &visitor);
+
+    lower_return(context, -1);
+
+    for (int b = 0; b < context->block_capacity; b++)
+    {
+        free(context->predecessors[b].items);
+        free(context->incomplete[b].items);
+    }
+    free(context->predecessors);
+    free(context->incomplete);
+    free(context->definitions);
+    free(context->sealed);
+    free(context->variable_types);
+
+    ir_compact(function);
+    return context->error_count;
+}
+
+IRModule *lower_program(Parser *parser)
+{
+    IRModule *module = init_ir_module(parser->symbol_count);
+    LowerContext context;
+    memset(&context, 0, sizeof(LowerContext));
+    context.parser = parser;
+    context.module = module;
+    context.osr_loop = -1;
+
+    module->extern_of_symbol = malloc((parser->symbol_count + 1) * sizeof(int));
+    module->extern_count = collect_extern_functions(parser, &module->externs, module->extern_of_symbol);
+
+    // create every function first so calls can refer to functions defined later
+    for (int i = 0; i < parser->symbol_count; i++)
+    {
+        parser_declaration *symbol = parser->symbols[i];
+        if (symbol->type != FUNCTION_DECLARATION || symbol->definition < 0)
+            continue;
+
+        Type *type = get_type(parser->types, symbol->type_id);
+        IRFunction *function = init_ir_function(symbol->literal.value, i, ir_type_of(type->base));
+        function->param_count = type->param_count;
+        function->param_types = malloc(type->param_count + 1);
+        for (int k = 0; k < type->param_count; k++)
+        {
+            function->param_types[k] = ir_type_of(type_param(parser->types, symbol->type_id, k));
+        }
+
+        int index = add_ir_function(module, function);
+        if (i == parser->entry_function)
+            module->entry = index;
+    }
+
+    for (int i = 0; i < module->function_count; i++)
+    {
+        IRFunction *function = module->functions[i];
+        lower_function(&context, function, parser->symbols[function->symbol]);
+    }
+
+    free(context.values);
+    free(context.controls);
+
+    if (context.error_count > 0)
+    {
+        free_ir_module(module);
+        return NULL;
+    }
+    return module;
+}
+
+// Variant of a function of module for on-stack replacement at loop, the AST
+// node of one of its while or for statements. It takes the address of an
+// interpreter frame of the function, enters the loop at the start of its
+// body and returns what the function returns. NULL if lowering fails.
+IRFunction *lower_osr_function(Parser *parser, IRModule *module, int function, int loop)
+{
+    IRFunction *plain = module->functions[function];
+    IRFunction *osr = init_ir_function(plain->name, plain->symbol, plain->return_type);
+    osr->param_count = 1;
+    osr->param_types = malloc(1);
+    osr->param_types[0] = IR_INT;
+
+    LowerContext context;
+    memset(&context, 0, sizeof(LowerContext));
+    context.parser = parser;
+    context.module = module;
+    context.osr_loop = loop;
+    lower_function(&context, osr, parser->symbols[plain->symbol]);
+
+    free(context.values);
+    free(context.controls);
+
+    if (context.error_count > 0)
+    {
+        free_ir_function(osr);
+        return NULL;
+    }
+    return osr;
+}
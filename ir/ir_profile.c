@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "ir.h"
+#include "../defc/defc.h"
+
+// Profiles of branch and call sites. The bytecode compiler adds a site for
+// every conditional jump and call it emits, the interpreter counts into it,
+// and the passes and the JIT look sites up by the source node of their IR
+// instruction. AST nodes are numbered program wide, so the copies of a site
+// made by inlining and unrolling share its counts.
+//
+// A profile is saved as text: a header with the number of AST nodes of the
+// program it was taken from, then one line per site with its node, kind and
+// counts. Loading checks the header, node numbers only mean anything for
+// the same source.
+
+#define PROFILE_MAGIC "cjit-profile"
+#define PROFILE_VERSION 1
+
+IRProfile *init_ir_profile(int node_count)
+{
+    IRProfile *profile = calloc(1, sizeof(IRProfile));
+    profile->node_count = node_count;
+    profile->site_of_node = malloc((node_count + 1) * sizeof(int32_t));
+    if (!profile->site_of_node)
+    {
+        wprintf(L"Memory allocation failed for the profile.\n");
+        exit(1);
+    }
+    for (int n = 0; n < node_count; n++)
+    {
+        profile->site_of_node[n] = -1;
+    }
+    return profile;
+}
+
+void free_ir_profile(IRProfile *profile)
+{
+    free(profile->sites);
+    free(profile->site_of_node);
+    free(profile);
+}
+
+// Returns the site of node, added when it has none yet
+int ir_profile_add_site(IRProfile *profile, int node, IRSiteKind kind)
+{
+    if (profile->site_of_node[node] >= 0)
+        return profile->site_of_node[node];
+    if (profile->site_count >= profile->site_size)
+    {
+        profile->site_size += IR_SITE_INCREMENT;
+        profile->sites = realloc(profile->sites, profile->site_size * sizeof(IRSite));
+        if (!profile->sites)
+        {
+            wprintf(L"Memory allocation failed for the profile.\n");
+            exit(1);
+        }
+    }
+    profile->sites[profile->site_count] = (IRSite){node, kind, {0, 0}};
+    profile->site_of_node[node] = profile->site_count;
+    return profile->site_count++;
+}
+
+// Counts of the site of node, false when it has none
+bool ir_profile_counts(const IRProfile *profile, int node, uint64_t counts[2])
+{
+    if (profile == NULL || node < 0 || node >= profile->node_count || profile->site_of_node[node] < 0)
+        return false;
+    const IRSite *site = &profile->sites[profile->site_of_node[node]];
+    counts[0] = __atomic_load_n(&site->counts[0], __ATOMIC_RELAXED);
+    counts[1] = __atomic_load_n(&site->counts[1], __ATOMIC_RELAXED);
+    return true;
+}
+
+// Adds the counts of other to the sites of the same node and kind
+void ir_profile_merge(IRProfile *profile, const IRProfile *other)
+{
+    for (int s = 0; s < other->site_count; s++)
+    {
+        const IRSite *site = &other->sites[s];
+        if (site->node >= profile->node_count || profile->site_of_node[site->node] < 0)
+            continue;
+        IRSite *target = &profile->sites[profile->site_of_node[site->node]];
+        if (target->kind != site->kind)
+            continue;
+        target->counts[0] += site->counts[0];
+        target->counts[1] += site->counts[1];
+    }
+}
+
+bool save_ir_profile(const IRProfile *profile, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        wprintf(L"Error opening file: %s\n", path);
+        return false;
+    }
+    fprintf(file, "%s %d %d\n", PROFILE_MAGIC, PROFILE_VERSION, profile->node_count);
+    for (int s = 0; s < profile->site_count; s++)
+    {
+        const IRSite *site = &profile->sites[s];
+        fprintf(file, "%d %s %llu %llu\n", site->node, site->kind == IR_SITE_CALL ? "call" : "branch", (unsigned long long)site->counts[0], (unsigned long long)site->counts[1]);
+    }
+    return fclose(file) == 0;
+}
+
+// NULL when the file cannot be read or was saved for another program
+IRProfile *load_ir_profile(const char *path, int node_count)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        wprintf(L"Error opening file: %s\n", path);
+        return NULL;
+    }
+    char magic[16];
+    int version;
+    int nodes;
+    if (fscanf(file, "%15s %d %d", magic, &version, &nodes) != 3 || strcmp(magic, PROFILE_MAGIC) != 0 || version != PROFILE_VERSION)
+    {
+        wprintf(L"%s is not a profile\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if (nodes != node_count)
+    {
+        wprintf(L"%s was saved for another program\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    IRProfile *profile = init_ir_profile(node_count);
+    int node;
+    char kind[8];
+    unsigned long long counts[2];
+    while (fscanf(file, "%d %7s %llu %llu", &node, kind, &counts[0], &counts[1]) == 4)
+    {
+        if (node < 0 || node >= node_count)
+            continue;
+        int site = ir_profile_add_site(profile, node, strcmp(kind, "call") == 0 ? IR_SITE_CALL : IR_SITE_BRANCH);
+        profile->sites[site].counts[0] += counts[0];
+        profile->sites[site].counts[1] += counts[1];
+    }
+    fclose(file);
+    return profile;
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <wchar.h>
+#include "ir.h"
+
+typedef struct
+{
+    IRFunction *function;
+    int error_count;
+} IRVerifier;
+
+static void verify_error(IRVerifier *verifier, int instruction, const wchar_t *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    wprintf(L"IR error in %s", verifier->function->name);
+    if (instruction >= 0)
+        wprintf(L" at %%%d", instruction);
+    wprintf(L": ");
+    vwprintf(format, args);
+    wprintf(L"\n");
+    va_end(args);
+    verifier->error_count++;
+}
+
+static bool valid_value(IRFunction *function, int value)
+{
+    return value >= 0 && value < function->instruction_count && function->instructions[value].type != IR_VOID;
+}
+
+// The definition of value must be available at the end of block for phis,
+// or before instruction user otherwise
+static void check_dominance(IRVerifier *verifier, int value, int user, int use_block)
+{
+    IRFunction *function = verifier->function;
+    int definition_block = function->instructions[value].block;
+
+    if (use_block < 0)
+    {
+        if (definition_block == function->instructions[user].block && value >= user)
+            verify_error(verifier, user, L"%%%d is used before it is defined", value);
+        else if (!ir_dominates(function, definition_block, function->instructions[user].block))
+            verify_error(verifier, user, L"definition of %%%d does not dominate its use", value);
+        return;
+    }
+
+    if (!ir_dominates(function, definition_block, use_block))
+        verify_error(verifier, user, L"phi operand %%%d does not dominate bb%d", value, use_block);
+}
+
+static void check_operand(IRVerifier *verifier, int user, int value, IRType expected)
+{
+    IRFunction *function = verifier->function;
+    if (!valid_value(function, value))
+    {
+        verify_error(verifier, user, L"invalid operand %d", value);
+        return;
+    }
+    if (expected != IR_VOID && function->instructions[value].type != expected)
+        verify_error(verifier, user, L"operand %%%d has the wrong type", value);
+    check_dominance(verifier, value, user, -1);
+}
+
+static void verify_instruction(IRVerifier *verifier, IRModule *module, int index)
+{
+    IRFunction *function = verifier->function;
+    IRInstruction *instruction = &function->instructions[index];
+    IRType type = instruction->type;
+
+    switch (instruction->op)
+    {
+    case IR_NOP:
+        verify_error(verifier, index, L"nop left in compacted function");
+        break;
+    case IR_CONST:
+        if (type == IR_VOID)
+            verify_error(verifier, index, L"constant without type");
+        break;
+    case IR_PARAM:
+        if (instruction->block != 0 || instruction->imm.i < 0 || instruction->imm.i >= function->param_count)
+            verify_error(verifier, index, L"invalid parameter");
+        else if (function->param_types[instruction->imm.i] != type)
+            verify_error(verifier, index, L"parameter has the wrong type");
+        break;
+    case IR_PHI:
+    {
+        int block = instruction->block;
+        int predecessor_count = function->pred_offsets[block + 1] - function->pred_offsets[block];
+        if (instruction->imm.list.count != predecessor_count)
+            verify_error(verifier, index, L"phi has %d operands but its block has %d predecessors", instruction->imm.list.count, predecessor_count);
+
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            int predecessor = function->operands[instruction->imm.list.first + 2 * k];
+            int value = function->operands[instruction->imm.list.first + 2 * k + 1];
+            bool found = false;
+            for (int p = function->pred_offsets[block]; p < function->pred_offsets[block + 1]; p++)
+            {
+                found |= function->preds[p] == predecessor;
+            }
+            if (!found)
+                verify_error(verifier, index, L"phi operand from bb%d which is not a predecessor", predecessor);
+            if (!valid_value(function, value))
+                verify_error(verifier, index, L"invalid phi operand %d", value);
+            else
+            {
+                if (function->instructions[value].type != type)
+                    verify_error(verifier, index, L"phi operand %%%d has the wrong type", value);
+                if (found)
+                    check_dominance(verifier, value, index, predecessor);
+            }
+        }
+        break;
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_POW:
+        if (type == IR_VOID)
+            verify_error(verifier, index, L"arithmetic without type");
+        check_operand(verifier, index, instruction->args[0], type);
+        check_operand(verifier, index, instruction->args[1], type);
+        break;
+    case IR_NEG:
+        check_operand(verifier, index, instruction->args[0], type);
+        break;
+    case IR_AND:
+    case IR_OR:
+        if (type != IR_INT)
+            verify_error(verifier, index, L"bitwise operation on non integer");
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        check_operand(verifier, index, instruction->args[1], IR_INT);
+        break;
+    case IR_NOT:
+        if (type != IR_INT)
+            verify_error(verifier, index, L"bitwise operation on non integer");
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        break;
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR:
+        if (type != IR_INT)
+            verify_error(verifier, index, L"shift of non integer");
+        if (instruction->imm.i < 0 || instruction->imm.i > 63)
+            verify_error(verifier, index, L"shift count %d out of range", (int)instruction->imm.i);
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        break;
+    case IR_MULHI:
+        if (type != IR_INT)
+            verify_error(verifier, index, L"mulhi of non integer");
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        check_operand(verifier, index, instruction->args[1], IR_INT);
+        break;
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+        if (type != IR_INT)
+            verify_error(verifier, index, L"comparison must produce int");
+        check_operand(verifier, index, instruction->args[0], IR_VOID);
+        if (valid_value(function, instruction->args[0]))
+            check_operand(verifier, index, instruction->args[1], function->instructions[instruction->args[0]].type);
+        break;
+    case IR_SELECT:
+        if (type != IR_INT)
+            verify_error(verifier, index, L"select of non integer");
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        check_operand(verifier, index, instruction->args[1], IR_INT);
+        check_operand(verifier, index, instruction->args[2], IR_INT);
+        break;
+    case IR_ITOF:
+        if (type != IR_FLOAT)
+            verify_error(verifier, index, L"itof must produce float");
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        break;
+    case IR_FTOI:
+        if (type != IR_INT)
+            verify_error(verifier, index, L"ftoi must produce int");
+        check_operand(verifier, index, instruction->args[0], IR_FLOAT);
+        break;
+    case IR_SQRT:
+    case IR_FMA:
+        if (type != IR_FLOAT)
+            verify_error(verifier, index, L"%s of non float", ir_opcode_info[instruction->op].name);
+        for (int k = 0; k < ir_opcode_info[instruction->op].value_args; k++)
+        {
+            check_operand(verifier, index, instruction->args[k], IR_FLOAT);
+        }
+        break;
+    case IR_MIN:
+    case IR_MAX:
+    case IR_ABS:
+        if (type == IR_VOID)
+            verify_error(verifier, index, L"arithmetic without type");
+        for (int k = 0; k < ir_opcode_info[instruction->op].value_args; k++)
+        {
+            check_operand(verifier, index, instruction->args[k], type);
+        }
+        break;
+    case IR_POPCNT:
+    case IR_CLZ:
+    case IR_CTZ:
+        if (type != IR_INT)
+            verify_error(verifier, index, L"bit count of non integer");
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        break;
+    case IR_CALL:
+    {
+        int callee = instruction->args[0];
+        if (module == NULL)
+            break;
+        if (callee < 0 || callee >= module->function_count)
+        {
+            verify_error(verifier, index, L"call to unknown function %d", callee);
+            break;
+        }
+        IRFunction *target = module->functions[callee];
+        if (target->param_count != instruction->imm.list.count)
+            verify_error(verifier, index, L"call passes %d arguments to %s which takes %d", instruction->imm.list.count, target->name, target->param_count);
+        else
+        {
+            for (int k = 0; k < instruction->imm.list.count; k++)
+            {
+                check_operand(verifier, index, function->operands[instruction->imm.list.first + k], target->param_types[k]);
+            }
+        }
+        if (target->return_type != type)
+            verify_error(verifier, index, L"call result has the wrong type");
+        break;
+    }
+    case IR_CALL_EXTERN:
+    {
+        int callee = instruction->args[0];
+        if (module == NULL)
+            break;
+        if (callee < 0 || callee >= module->extern_count)
+        {
+            verify_error(verifier, index, L"call to unknown extern function %d", callee);
+            break;
+        }
+        IRExtern *target = &module->externs[callee];
+        if (target->param_count != instruction->imm.list.count)
+            verify_error(verifier, index, L"call passes %d arguments to %s which takes %d", instruction->imm.list.count, target->name, target->param_count);
+        else
+        {
+            for (int k = 0; k < instruction->imm.list.count; k++)
+            {
+                check_operand(verifier, index, function->operands[instruction->imm.list.first + k], target->param_types[k]);
+            }
+        }
+        if (target->return_type != type)
+            verify_error(verifier, index, L"call result has the wrong type");
+        break;
+    }
+    case IR_VREDUCE:
+    {
+        int loop = instruction->args[0];
+        if (type != IR_INT)
+            verify_error(verifier, index, L"vreduce of non integer");
+        if (loop < 0 || loop >= function->vector_loop_count)
+        {
+            verify_error(verifier, index, L"vreduce of unknown loop %d", loop);
+            break;
+        }
+        IRVectorLoop *vector = &function->vector_loops[loop];
+        if (instruction->imm.list.count < 3)
+            verify_error(verifier, index, L"vreduce without start, trip and init");
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            check_operand(verifier, index, function->operands[instruction->imm.list.first + k], IR_INT);
+        }
+        for (int n = 0; n < vector->node_count; n++)
+        {
+            IRVectorNode *node = &vector->nodes[n];
+            if (node->op == IR_PARAM && (node->imm < 0 || node->imm + 3 >= instruction->imm.list.count))
+                verify_error(verifier, index, L"vector node %d reads missing operand %d", n, (int)node->imm);
+            for (int k = 0; k < ir_opcode_info[node->op].value_args; k++)
+            {
+                if (node->args[k] < 0 || node->args[k] >= n)
+                    verify_error(verifier, index, L"vector node %d uses node %d", n, node->args[k]);
+            }
+        }
+        if (vector->result < 0 || vector->result >= vector->node_count)
+            verify_error(verifier, index, L"vector loop result %d out of range", vector->result);
+        break;
+    }
+    case IR_LOAD:
+        if (type == IR_VOID)
+            verify_error(verifier, index, L"load without type");
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        break;
+    case IR_JUMP:
+        if (instruction->imm.jump.target < 0 || instruction->imm.jump.target >= function->block_count)
+            verify_error(verifier, index, L"jump to invalid block");
+        break;
+    case IR_BRANCH:
+        check_operand(verifier, index, instruction->args[0], IR_INT);
+        if (instruction->imm.jump.target < 0 || instruction->imm.jump.target >= function->block_count || instruction->imm.jump.other < 0 || instruction->imm.jump.other >= function->block_count)
+            verify_error(verifier, index, L"branch to invalid block");
+        break;
+    case IR_RETURN:
+        if (instruction->args[0] >= 0)
+            check_operand(verifier, index, instruction->args[0], function->return_type);
+        else if (function->return_type != IR_VOID)
+            verify_error(verifier, index, L"missing return value");
+        break;
+    default:
+        verify_error(verifier, index, L"unknown opcode %d", instruction->op);
+    }
+}
+
+// Checks structure, types and SSA dominance, returns the number of errors
+int verify_ir_function(IRFunction *function, IRModule *module)
+{
+    IRVerifier verifier = {function, 0};
+
+    if (function->block_count == 0)
+    {
+        verify_error(&verifier, -1, L"function has no blocks");
+        return verifier.error_count;
+    }
+
+    ir_build_cfg(function);
+    ir_build_dominators(function);
+
+    int expected_first = 0;
+    for (int b = 0; b < function->block_count; b++)
+    {
+        IRBlock *block = &function->blocks[b];
+        if (block->first != expected_first || block->count <= 0)
+        {
+            verify_error(&verifier, -1, L"bb%d is not a contiguous non empty range", b);
+            return verifier.error_count;
+        }
+        expected_first += block->count;
+
+        bool phis_done = false;
+        for (int i = block->first; i < block->first + block->count; i++)
+        {
+            IRInstruction *instruction = &function->instructions[i];
+            bool last = i == block->first + block->count - 1;
+
+            if (instruction->block != b)
+                verify_error(&verifier, i, L"instruction is recorded in bb%d but placed in bb%d", instruction->block, b);
+            if (ir_opcode_info[instruction->op].is_terminator != last)
+                verify_error(&verifier, i, last ? L"bb%d does not end with a terminator" : L"terminator in the middle of bb%d", b);
+            if (instruction->op == IR_PHI && phis_done)
+                verify_error(&verifier, i, L"phi after other instructions in bb%d", b);
+            phis_done |= instruction->op != IR_PHI;
+
+            if (instruction->op < IR_OPCODE_COUNT)
+                verify_instruction(&verifier, module, i);
+            else
+                verify_error(&verifier, i, L"unknown opcode %d", instruction->op);
+        }
+    }
+
+    if (expected_first != function->instruction_count)
+        verify_error(&verifier, -1, L"instructions outside of any block");
+
+    return verifier.error_count;
+}
+
+int verify_ir_module(IRModule *module)
+{
+    int error_count = 0;
+    for (int i = 0; i < module->function_count; i++)
+    {
+        error_count += verify_ir_function(module->functions[i], module);
+    }
+    return error_count;
+}
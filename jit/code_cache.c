@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cpuid.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "code_cache.h"
+#include "../defc/defc.h"
+
+// Native code of whole programs kept on disk between runs. A file holds the
+// code of a module as jit_compile_module left it, the entry of every
+// function and one relocation per slot of the helper table, the only bytes
+// that depend on where this process has its C functions. Loading maps the
+// file, copies the code into the code heap and writes the helper addresses
+// of this process into the slots, and those of the extern functions the
+// caller resolved, nothing is compiled.
+//
+// Files are named after a key that covers everything the code depends on:
+// the source, the options it was compiled with, CODE_CACHE_VERSION for the
+// compiler that produced it, the CPU features the compiler may have used
+// and the thread pointer offset of the stack limit, which prologues read
+// directly. A file written for another key is never read, stale files are
+// simply not found.
+
+#define CODE_CACHE_MAGIC 0x65646f63746a6963ull // "cjitcode"
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+typedef struct
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t function_count;
+    uint64_t key;
+    uint64_t code_offset; // page aligned, from the start of the file
+    uint64_t code_size;
+    uint64_t helpers;
+    uint32_t relocation_count;
+    int32_t entry;
+} CodeCacheHeader;
+
+// followed by the parameter types of all functions, in function order
+typedef struct
+{
+    int64_t entry; // offset in the code, -1 when the function was not compiled
+    int32_t param_count;
+    uint8_t return_type;
+} CodeCacheFunction;
+
+// an absolute address at position in the code, of a helper or of
+// extern function slot - JIT_HELPER_COUNT
+typedef struct
+{
+    uint64_t position;
+    uint32_t slot;
+} CodeCacheRelocation;
+
+// FNV-1a, hash starts from 0 for the first piece
+uint64_t code_cache_hash(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    if (hash == 0)
+        hash = FNV_OFFSET;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t code_cache_key(const char *source, size_t size, uint64_t options)
+{
+    // the feature bits of leaves 1 and 7, not the model or the APIC id
+    unsigned int eax, ebx, ecx, edx;
+    uint32_t features[4] = {0};
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        features[0] = ecx;
+        features[1] = edx;
+    }
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        features[2] = ebx;
+        features[3] = ecx;
+    }
+    int32_t version = CODE_CACHE_VERSION;
+    int32_t stack_limit = jit_stack_limit_offset();
+
+    uint64_t hash = code_cache_hash(0, &version, sizeof(version));
+    hash = code_cache_hash(hash, features, sizeof(features));
+    hash = code_cache_hash(hash, &stack_limit, sizeof(stack_limit));
+    hash = code_cache_hash(hash, &options, sizeof(options));
+    return code_cache_hash(hash, source, size);
+}
+
+static char *cache_path(const char *directory, uint64_t key, const char *suffix)
+{
+    size_t size = strlen(directory) + strlen(suffix) + 32;
+    char *path = malloc(size);
+    snprintf(path, size, "%s/%016llx.code%s", directory, (unsigned long long)key, suffix);
+    return path;
+}
+
+static size_t page_align(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+// NULL when there is no file for key or it does not hold what its header says
+JITModule *code_cache_load(CodeHeap *heap, const char *directory, uint64_t key, const IRExtern *externs, int extern_count)
+{
+    char *path = cache_path(directory, key, "");
+    int file = open(path, O_RDONLY);
+    free(path);
+    if (file < 0)
+        return NULL;
+    struct stat status;
+    if (fstat(file, &status) != 0 || (size_t)status.st_size < sizeof(CodeCacheHeader))
+    {
+        close(file);
+        return NULL;
+    }
+    size_t size = (size_t)status.st_size;
+    uint8_t *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED)
+        return NULL;
+
+    const CodeCacheHeader *header = (const CodeCacheHeader *)mapping;
+    size_t tables = sizeof(CodeCacheHeader) + header->function_count * sizeof(CodeCacheFunction);
+    const CodeCacheFunction *functions = (const CodeCacheFunction *)(mapping + sizeof(CodeCacheHeader));
+    bool valid = header->magic == CODE_CACHE_MAGIC && header->version == CODE_CACHE_VERSION && header->key == key && tables <= size && header->code_offset <= size && header->code_size <= size - header->code_offset && header->helpers + (JIT_HELPER_COUNT + extern_count) * sizeof(uint64_t) <= header->code_size && header->entry >= 0 && (uint32_t)header->entry < header->function_count;
+    size_t param_total = 0;
+    for (uint32_t f = 0; valid && f < header->function_count; f++)
+    {
+        valid = functions[f].param_count >= 0 && functions[f].entry >= -1 && functions[f].entry < (int64_t)header->code_size;
+        param_total += valid ? functions[f].param_count : 0;
+    }
+    const uint8_t *param_types = mapping + tables;
+    const CodeCacheRelocation *relocations = (const CodeCacheRelocation *)(param_types + param_total);
+    valid = valid && tables + param_total + header->relocation_count * sizeof(CodeCacheRelocation) <= header->code_offset;
+    for (uint32_t r = 0; valid && r < header->relocation_count; r++)
+    {
+        valid = relocations[r].slot < (uint32_t)(JIT_HELPER_COUNT + extern_count) && relocations[r].position + sizeof(uint64_t) <= header->code_size;
+    }
+    if (!valid)
+    {
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    uint8_t *memory = code_heap_allocate(heap, header->code_size);
+    code_heap_write(heap, memory, 0, mapping + header->code_offset, header->code_size);
+    for (uint32_t r = 0; r < header->relocation_count; r++)
+    {
+        uint32_t slot = relocations[r].slot;
+        void *target = slot < JIT_HELPER_COUNT ? jit_helper_address(slot) : externs[slot - JIT_HELPER_COUNT].address;
+        uint64_t address = (uint64_t)(uintptr_t)target;
+        code_heap_write(heap, memory, relocations[r].position, &address, sizeof(address));
+    }
+
+    JITModule *module = calloc(1, sizeof(JITModule));
+    module->heap = heap;
+    module->memory = memory;
+    module->size = header->code_size;
+    module->helpers = header->helpers;
+    module->extern_count = extern_count;
+    module->function_count = header->function_count;
+    module->entry = header->entry;
+    module->functions = calloc(header->function_count + 1, sizeof(JITFunction));
+    for (uint32_t f = 0; f < header->function_count; f++)
+    {
+        JITFunction *function = &module->functions[f];
+        function->entry = functions[f].entry >= 0 ? memory + functions[f].entry : NULL;
+        function->param_count = functions[f].param_count;
+        function->return_type = functions[f].return_type;
+        function->param_types = malloc(function->param_count + 1);
+        memcpy(function->param_types, param_types, function->param_count);
+        param_types += function->param_count;
+    }
+    munmap(mapping, size);
+    return module;
+}
+
+static bool write_all(int file, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = write(file, bytes, size);
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// Writes a temporary file and renames it, so a process loading the same key
+// meanwhile sees a whole file or none
+bool code_cache_store(const char *directory, uint64_t key, const JITModule *module)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d", (int)getpid());
+    char *temporary = cache_path(directory, key, suffix);
+    int file = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+    {
+        wprintf(L"Error opening file: %s\n", temporary);
+        free(temporary);
+        return false;
+    }
+
+    size_t param_total = 0;
+    for (int f = 0; f < module->function_count; f++)
+    {
+        param_total += module->functions[f].param_count;
+    }
+    int slot_count = JIT_HELPER_COUNT + module->extern_count;
+    size_t tables = sizeof(CodeCacheHeader) + module->function_count * sizeof(CodeCacheFunction) + param_total + slot_count * sizeof(CodeCacheRelocation);
+    CodeCacheHeader header = {CODE_CACHE_MAGIC, CODE_CACHE_VERSION, (uint32_t)module->function_count, key, page_align(tables), module->size, module->helpers, (uint32_t)slot_count, module->entry};
+    bool written = write_all(file, &header, sizeof(header));
+    for (int f = 0; f < module->function_count; f++)
+    {
+        const JITFunction *function = &module->functions[f];
+        CodeCacheFunction record = {function->entry ? (uint8_t *)function->entry - module->memory : -1, function->param_count, function->return_type};
+        written = written && write_all(file, &record, sizeof(record));
+    }
+    for (int f = 0; f < module->function_count; f++)
+    {
+        written = written && write_all(file, module->functions[f].param_types, module->functions[f].param_count);
+    }
+    for (int s = 0; s < slot_count; s++)
+    {
+        CodeCacheRelocation relocation = {module->helpers + s * sizeof(uint64_t), (uint32_t)s};
+        written = written && write_all(file, &relocation, sizeof(relocation));
+    }
+    uint8_t *padding = calloc(header.code_offset - tables + 1, 1);
+    written = written && write_all(file, padding, header.code_offset - tables);
+    written = written && write_all(file, module->memory, module->size);
+    free(padding);
+    written = close(file) == 0 && written;
+
+    char *path = cache_path(directory, key, "");
+    if (written)
+        written = rename(temporary, path) == 0;
+    if (!written)
+    {
+        wprintf(L"Error writing file: %s\n", path);
+        unlink(temporary);
+    }
+    free(temporary);
+    free(path);
+    return written;
+}
@@ -0,0 +1,15 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "jit.h"
+#include "code_heap.h"
+
+#ifndef JIT_CODE_CACHE_H
+#define JIT_CODE_CACHE_H
+
+uint64_t code_cache_hash(uint64_t hash, const void *data, size_t size);
+uint64_t code_cache_key(const char *source, size_t size, uint64_t options);
+JITModule *code_cache_load(CodeHeap *heap, const char *directory, uint64_t key, const IRExtern *externs, int extern_count);
+bool code_cache_store(const char *directory, uint64_t key, const JITModule *module);
+
+#endif
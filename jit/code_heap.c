@@ -0,0 +1,354 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "code_heap.h"
+
+// Executable memory for the JIT. Regions of CODE_HEAP_REGION_SIZE are mapped
+// once and carved into power of two chunks, each starting with a CodeChunk
+// header followed by the code. Released chunks go to a free list per size
+// class and are handed out again before any new memory is carved, so a
+// process that keeps compiling and discarding code stays within the memory
+// its peak needs instead of mapping pages for every function.
+
+#define CODE_HEAP_LARGE UINT32_MAX
+
+static size_t page_size()
+{
+    static size_t size = 0;
+    if (size == 0)
+        size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t class_size(int size_class)
+{
+    return (size_t)CODE_HEAP_MIN_CHUNK << size_class;
+}
+
+static int size_class_of(size_t chunk_size)
+{
+    for (int size_class = 0; size_class < CODE_HEAP_CLASS_COUNT; size_class++)
+    {
+        if (class_size(size_class) >= chunk_size)
+            return size_class;
+    }
+    return -1;
+}
+
+static bool map_dual(CodeRegion *region, size_t size);
+
+// memfd_create may be missing or forbidden, the heap then flips page
+// protections instead. Decided once so all regions of a heap agree.
+static bool dual_mapping_works()
+{
+    CodeRegion probe;
+    if (!map_dual(&probe, page_size()))
+        return false;
+    munmap(probe.writable, page_size());
+    munmap(probe.executable, page_size());
+    return true;
+}
+
+CodeHeap *init_code_heap()
+{
+    CodeHeap *heap = calloc(1, sizeof(CodeHeap));
+    if (!heap)
+    {
+        wprintf(L"Memory allocation failed for the code heap.\n");
+        exit(1);
+    }
+    pthread_mutex_init(&heap->lock, NULL);
+    heap->current = -1;
+    heap->dual_mapped = dual_mapping_works();
+    return heap;
+}
+
+void free_code_heap(CodeHeap *heap)
+{
+    for (int r = 0; r < heap->region_count; r++)
+    {
+        CodeRegion *region = &heap->regions[r];
+        if (region->size == 0)
+            continue;
+        munmap(region->executable, region->size);
+        if (region->writable != region->executable)
+            munmap(region->writable, region->size);
+    }
+    for (int size_class = 0; size_class < CODE_HEAP_CLASS_COUNT; size_class++)
+    {
+        free(heap->free_lists[size_class].items);
+    }
+    free(heap->regions);
+    pthread_mutex_destroy(&heap->lock);
+    free(heap);
+}
+
+static bool map_dual(CodeRegion *region, size_t size)
+{
+    int fd = memfd_create("cjit-code", MFD_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    region->writable = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    region->executable = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region->writable == MAP_FAILED || region->executable == MAP_FAILED)
+    {
+        if (region->writable != MAP_FAILED)
+            munmap(region->writable, size);
+        if (region->executable != MAP_FAILED)
+            munmap(region->executable, size);
+        return false;
+    }
+    return true;
+}
+
+static int map_region(CodeHeap *heap, size_t size, bool dedicated)
+{
+    size = (size + page_size() - 1) & ~(page_size() - 1);
+
+    // slots of unmapped dedicated regions are reused, chunk headers keep region indices
+    int index = -1;
+    for (int r = 0; r < heap->region_count; r++)
+    {
+        if (heap->regions[r].size == 0)
+        {
+            index = r;
+            break;
+        }
+    }
+    if (index < 0)
+    {
+        if (heap->region_count >= heap->region_size)
+        {
+            heap->region_size += CODE_HEAP_REGION_INCREMENT;
+            heap->regions = realloc(heap->regions, heap->region_size * sizeof(CodeRegion));
+            if (!heap->regions)
+            {
+                wprintf(L"Memory allocation failed while resizing code regions.\n");
+                exit(1);
+            }
+        }
+        index = heap->region_count++;
+    }
+
+    CodeRegion *region = &heap->regions[index];
+    if (heap->dual_mapped && !map_dual(region, size))
+    {
+        wprintf(L"jit: cannot map code memory\n");
+        exit(1);
+    }
+    if (!heap->dual_mapped)
+    {
+        region->executable = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        region->writable = region->executable;
+        if (region->executable == MAP_FAILED)
+        {
+            wprintf(L"jit: cannot map code memory\n");
+            exit(1);
+        }
+    }
+    region->size = size;
+    region->used = 0;
+    region->dedicated = dedicated;
+    heap->stats.reserved += size;
+    return index;
+}
+
+static void region_write(CodeRegion *region, size_t offset, const void *source, size_t size)
+{
+    if (region->writable != region->executable)
+    {
+        memcpy(region->writable + offset, source, size);
+        return;
+    }
+
+    size_t first = offset & ~(page_size() - 1);
+    size_t length = offset + size - first;
+    if (mprotect(region->writable + first, length, PROT_READ | PROT_WRITE) != 0)
+    {
+        wprintf(L"jit: cannot make code writable\n");
+        exit(1);
+    }
+    memcpy(region->writable + offset, source, size);
+    if (mprotect(region->writable + first, length, PROT_READ | PROT_EXEC) != 0)
+    {
+        wprintf(L"jit: cannot make code executable\n");
+        exit(1);
+    }
+}
+
+static uint8_t *place_chunk(CodeHeap *heap, int region_index, size_t offset, uint32_t size_class, size_t size)
+{
+    CodeChunk chunk = {size_class, (uint32_t)region_index, size};
+    region_write(&heap->regions[region_index], offset, &chunk, sizeof(CodeChunk));
+    return heap->regions[region_index].executable + offset + sizeof(CodeChunk);
+}
+
+static void push_free(CodeHeap *heap, int size_class, uint8_t *code)
+{
+    CodeFreeList *list = &heap->free_lists[size_class];
+    if (list->count >= list->size)
+    {
+        list->size = list->size ? list->size * 2 : 16;
+        list->items = realloc(list->items, list->size * sizeof(uint8_t *));
+        if (!list->items)
+        {
+            wprintf(L"Memory allocation failed while resizing a code free list.\n");
+            exit(1);
+        }
+    }
+    list->items[list->count++] = code;
+    heap->stats.free += class_size(size_class);
+}
+
+// The tail of a full region is split into the largest chunks that fit, so
+// moving on to a new region wastes nothing.
+static void retire_region(CodeHeap *heap, int region_index)
+{
+    CodeRegion *region = &heap->regions[region_index];
+    for (int size_class = CODE_HEAP_CLASS_COUNT - 1; size_class >= 0; size_class--)
+    {
+        while (region->size - region->used >= class_size(size_class))
+        {
+            push_free(heap, size_class, place_chunk(heap, region_index, region->used, size_class, 0));
+            region->used += class_size(size_class);
+        }
+    }
+}
+
+static CodeChunk *chunk_of(uint8_t *code)
+{
+    return (CodeChunk *)(code - sizeof(CodeChunk));
+}
+
+static uint8_t *allocate_locked(CodeHeap *heap, size_t size)
+{
+    size_t chunk_size = size + sizeof(CodeChunk);
+    // a chunk sharing a page with another would make running code of that
+    // one unexecutable while it is written, see region_write
+    if (!heap->dual_mapped && chunk_size < page_size())
+        chunk_size = page_size();
+    int size_class = size_class_of(chunk_size);
+    uint8_t *code;
+
+    heap->stats.allocations++;
+    heap->stats.live += size;
+    if (size_class < 0)
+    {
+        int region = map_region(heap, chunk_size, true);
+        code = place_chunk(heap, region, 0, CODE_HEAP_LARGE, size);
+        heap->regions[region].used = heap->regions[region].size;
+        heap->stats.used += heap->regions[region].size;
+        return code;
+    }
+
+    heap->stats.used += class_size(size_class);
+    CodeFreeList *list = &heap->free_lists[size_class];
+    if (list->count > 0)
+    {
+        code = list->items[--list->count];
+        heap->stats.free -= class_size(size_class);
+        heap->stats.reused++;
+        CodeChunk chunk = *chunk_of(code);
+        chunk.size = size;
+        region_write(&heap->regions[chunk.region], code - sizeof(CodeChunk) - heap->regions[chunk.region].executable, &chunk, sizeof(CodeChunk));
+        return code;
+    }
+
+    if (heap->current < 0 || heap->regions[heap->current].size - heap->regions[heap->current].used < class_size(size_class))
+    {
+        if (heap->current >= 0)
+            retire_region(heap, heap->current);
+        heap->current = map_region(heap, CODE_HEAP_REGION_SIZE, false);
+    }
+    CodeRegion *region = &heap->regions[heap->current];
+    code = place_chunk(heap, heap->current, region->used, size_class, size);
+    region->used += class_size(size_class);
+    return code;
+}
+
+// Returns the executable address of at least size bytes, 16 byte aligned.
+// The memory can only be filled through code_heap_write.
+uint8_t *code_heap_allocate(CodeHeap *heap, size_t size)
+{
+    pthread_mutex_lock(&heap->lock);
+    uint8_t *code = allocate_locked(heap, size);
+    pthread_mutex_unlock(&heap->lock);
+    return code;
+}
+
+void code_heap_write(CodeHeap *heap, uint8_t *code, size_t offset, const void *source, size_t size)
+{
+    pthread_mutex_lock(&heap->lock);
+    CodeChunk *chunk = chunk_of(code);
+    CodeRegion *region = &heap->regions[chunk->region];
+    if (offset + size > chunk->size)
+    {
+        wprintf(L"jit: write past the end of a code allocation\n");
+        exit(1);
+    }
+    region_write(region, code - region->executable + offset, source, size);
+    pthread_mutex_unlock(&heap->lock);
+}
+
+// Released code is overwritten with int3 so a stale call traps instead of
+// running whatever is compiled into the chunk next.
+static void release_locked(CodeHeap *heap, uint8_t *code)
+{
+    CodeChunk chunk = *chunk_of(code);
+    CodeRegion *region = &heap->regions[chunk.region];
+
+    heap->stats.releases++;
+    heap->stats.live -= chunk.size;
+    if (chunk.size_class == CODE_HEAP_LARGE)
+    {
+        heap->stats.used -= region->size;
+        heap->stats.reserved -= region->size;
+        munmap(region->executable, region->size);
+        if (region->writable != region->executable)
+            munmap(region->writable, region->size);
+        memset(region, 0, sizeof(CodeRegion));
+        return;
+    }
+
+    size_t size = class_size(chunk.size_class) - sizeof(CodeChunk);
+    uint8_t *fill = malloc(size);
+    memset(fill, 0xCC, size);
+    region_write(region, code - region->executable, fill, size);
+    free(fill);
+
+    heap->stats.used -= class_size(chunk.size_class);
+    push_free(heap, chunk.size_class, code);
+}
+
+void code_heap_release(CodeHeap *heap, uint8_t *code)
+{
+    pthread_mutex_lock(&heap->lock);
+    release_locked(heap, code);
+    pthread_mutex_unlock(&heap->lock);
+}
+
+void dump_code_heap_stats(CodeHeap *heap, OutputBuffer *buffer)
+{
+    pthread_mutex_lock(&heap->lock);
+    CodeHeapStats *stats = &heap->stats;
+    int mapped = 0;
+    for (int r = 0; r < heap->region_count; r++)
+    {
+        if (heap->regions[r].size > 0)
+            mapped++;
+    }
+    buffer_printf(buffer, "code heap: %zu bytes reserved in %d regions (%s)\n", stats->reserved, mapped, heap->dual_mapped ? "dual mapped" : "mprotect");
+    buffer_printf(buffer, "  live %zu bytes in %zu chunks of %zu bytes, %zu wasted\n", stats->live, stats->allocations - stats->releases, stats->used, stats->used - stats->live);
+    buffer_printf(buffer, "  free %zu bytes, %zu allocations, %zu releases, %zu reused\n", stats->free, stats->allocations, stats->releases, stats->reused);
+    pthread_mutex_unlock(&heap->lock);
+}
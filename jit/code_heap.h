@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "../buffer/buffer.h"
+#include "../defc/defc.h"
+
+#ifndef CODE_HEAP_H
+#define CODE_HEAP_H
+
+// A region is one memory object mapped twice: the JIT writes through the
+// writable view and runs the executable view, so no page is ever both. When
+// the kernel has no memfd both views are the same private mapping and every
+// write flips its pages to writable and back. Other threads may run code
+// while one writes, so in that mode every chunk has pages of its own and a
+// page is only written before its code is published or after its release.
+typedef struct
+{
+    uint8_t *writable;
+    uint8_t *executable;
+    size_t size;
+    size_t used; // carved from the front
+    bool dedicated; // holds a single allocation larger than every size class
+} CodeRegion;
+
+typedef struct
+{
+    uint32_t size_class;
+    uint32_t region;
+    uint64_t size; // requested bytes
+} CodeChunk;
+
+typedef struct
+{
+    uint8_t **items;
+    int count;
+    int size;
+} CodeFreeList;
+
+typedef struct
+{
+    size_t reserved; // mapped bytes
+    size_t live; // requested bytes of live allocations
+    size_t used; // chunk bytes of live allocations, headers and rounding included
+    size_t free; // chunk bytes waiting in the free lists
+    size_t allocations;
+    size_t releases;
+    size_t reused;
+} CodeHeapStats;
+
+// Background compiler threads share one heap, every entry point takes the lock.
+typedef struct
+{
+    pthread_mutex_t lock;
+    CodeRegion *regions;
+    int region_count;
+    int region_size;
+    int current; // region chunks are carved from, -1 before the first
+    bool dual_mapped;
+    CodeFreeList free_lists[CODE_HEAP_CLASS_COUNT];
+    CodeHeapStats stats;
+} CodeHeap;
+
+CodeHeap *init_code_heap();
+void free_code_heap(CodeHeap *heap);
+uint8_t *code_heap_allocate(CodeHeap *heap, size_t size);
+void code_heap_write(CodeHeap *heap, uint8_t *code, size_t offset, const void *source, size_t size);
+void code_heap_release(CodeHeap *heap, uint8_t *code);
+void dump_code_heap_stats(CodeHeap *heap, OutputBuffer *buffer);
+
+#endif
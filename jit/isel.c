@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "isel.h"
+
+// Instruction selection by tree pattern matching with costs, BURS style as
+// in iburg. A value read once, by a later instruction of its block, is an
+// interior node of the tree of that user; the others are roots, computed by
+// an instruction of their own. Nodes are labeled bottom up with the cheapest
+// rule deriving each nonterminal:
+//
+//     reg    the value in a register
+//     imm    an integer constant that fits a sign extended 32 bit immediate
+//     index  a register times 1, 2, 4 or 8
+//     addr   base + index * scale + disp
+//     mem    a load, as the memory operand of an ALU instruction
+//
+// and the roots are reduced top down as reg. The rules are the table below.
+// A pattern is in prefix order, an opcode followed by the patterns of its
+// value operands, a nonterminal standing for an operand derived that way.
+// A pattern made of one nonterminal is a chain rule. The slots place the
+// nonterminal leaves in order: b is the base, i the index, s both, d adds
+// the constant to the displacement and n subtracts it, x puts the leaf's
+// own derivation in. Costs count about two per instruction and three for
+// multiplies, a root without a cheaper rule is emitted on its own.
+//
+// Constants are no nodes of one tree, any number of users take them as
+// immediates and they only get a register when a user reads one.
+
+#define INFINITE_COST (INT_MAX / 4)
+#define DEFAULT_RULE -1
+#define MAX_PATTERN 6
+
+// nonterminals follow the opcodes in the symbols of a pattern
+enum
+{
+    REG = IR_OPCODE_COUNT,
+    IMM,
+    INDEX,
+    ADDR,
+    MEM,
+    SYMBOL_COUNT
+};
+
+#define NONTERMINAL_COUNT (SYMBOL_COUNT - REG)
+
+// what a rule adds to the choice besides its leaves
+typedef enum
+{
+    ACTION_NONE,
+    ACTION_SHIFT_SCALE, // x << count is x * 2^count
+    ACTION_MULTIPLIER_SCALE, // x * constant
+    ACTION_SELF_SCALE, // x * constant is x + x * (constant - 1)
+    ACTION_LOAD_OFFSET // the offset of the load
+} IselAction;
+
+typedef struct
+{
+    int16_t result; // nonterminal derived
+    int16_t pattern[MAX_PATTERN];
+    const char *slots;
+    int cost;
+    uint8_t form; // how a root this rule derives as reg is emitted
+    uint8_t action;
+    bool (*accepts)(IRFunction *function, int value); // checks the root, NULL accepts all
+} IselRule;
+
+static bool is_constant(IRFunction *function, int value)
+{
+    return value >= 0 && function->instructions[value].op == IR_CONST;
+}
+
+static int64_t right_constant(IRFunction *function, int value)
+{
+    return function->instructions[function->instructions[value].args[1]].imm.i;
+}
+
+// subtracted too, so INT32_MIN does not qualify
+static bool fits_immediate(IRFunction *function, int value)
+{
+    int64_t constant = function->instructions[value].imm.i;
+    return constant > INT32_MIN && constant <= INT32_MAX;
+}
+
+static bool small_shift(IRFunction *function, int value)
+{
+    int64_t count = function->instructions[value].imm.i;
+    return count >= 1 && count <= 3;
+}
+
+static bool scale_multiplier(IRFunction *function, int value)
+{
+    if (!is_constant(function, function->instructions[value].args[1]))
+        return false;
+    int64_t constant = right_constant(function, value);
+    return constant == 2 || constant == 4 || constant == 8;
+}
+
+static bool self_multiplier(IRFunction *function, int value)
+{
+    if (!is_constant(function, function->instructions[value].args[1]))
+        return false;
+    int64_t constant = right_constant(function, value);
+    return constant == 3 || constant == 5 || constant == 9;
+}
+
+static const IselRule isel_rules[] = {
+    // operands
+    {IMM, {IR_CONST}, "", 0, ISEL_DEFAULT, ACTION_NONE, fits_immediate},
+    {INDEX, {REG}, "", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {INDEX, {IR_SHL, REG}, "i", 0, ISEL_DEFAULT, ACTION_SHIFT_SCALE, small_shift},
+    {INDEX, {IR_MUL, REG, IR_CONST}, "i", 0, ISEL_DEFAULT, ACTION_MULTIPLIER_SCALE, scale_multiplier},
+    {ADDR, {REG}, "", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_MUL, REG, IR_CONST}, "s", 0, ISEL_DEFAULT, ACTION_SELF_SCALE, self_multiplier},
+    {ADDR, {IR_ADD, REG, INDEX}, "bx", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_ADD, INDEX, REG}, "xb", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_ADD, REG, IMM}, "bd", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_ADD, IMM, REG}, "db", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_SUB, REG, IMM}, "bn", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_ADD, IR_ADD, REG, INDEX, IMM}, "bxd", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_ADD, IR_ADD, INDEX, REG, IMM}, "xbd", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_ADD, IR_ADD, REG, IMM, INDEX}, "bdx", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_ADD, IR_SUB, REG, IMM, INDEX}, "bnx", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {ADDR, {IR_ADD, INDEX, IR_ADD, REG, IMM}, "xbd", 0, ISEL_DEFAULT, ACTION_NONE, NULL},
+    {MEM, {IR_LOAD, REG}, "i", 0, ISEL_DEFAULT, ACTION_LOAD_OFFSET, NULL},
+
+    // instructions
+    {REG, {ADDR}, "", 2, ISEL_LEA, ACTION_NONE, NULL},
+    {REG, {IR_MUL, REG, IMM}, "bd", 3, ISEL_MULTIPLY_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_MUL, IMM, REG}, "db", 3, ISEL_MULTIPLY_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_AND, REG, IMM}, "bd", 2, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_AND, IMM, REG}, "db", 2, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_OR, REG, IMM}, "bd", 2, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_OR, IMM, REG}, "db", 2, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_EQ, REG, IMM}, "bd", 4, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_NE, REG, IMM}, "bd", 4, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_LT, REG, IMM}, "bd", 4, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_LE, REG, IMM}, "bd", 4, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_GT, REG, IMM}, "bd", 4, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_GE, REG, IMM}, "bd", 4, ISEL_IMMEDIATE, ACTION_NONE, NULL},
+    {REG, {IR_ADD, REG, MEM}, "bx", 2, ISEL_MEMORY, ACTION_NONE, NULL},
+    {REG, {IR_ADD, MEM, REG}, "xb", 2, ISEL_MEMORY, ACTION_NONE, NULL},
+    {REG, {IR_SUB, REG, MEM}, "bx", 2, ISEL_MEMORY, ACTION_NONE, NULL},
+    {REG, {IR_AND, REG, MEM}, "bx", 2, ISEL_MEMORY, ACTION_NONE, NULL},
+    {REG, {IR_AND, MEM, REG}, "xb", 2, ISEL_MEMORY, ACTION_NONE, NULL},
+    {REG, {IR_OR, REG, MEM}, "bx", 2, ISEL_MEMORY, ACTION_NONE, NULL},
+    {REG, {IR_OR, MEM, REG}, "xb", 2, ISEL_MEMORY, ACTION_NONE, NULL},
+    {REG, {IR_MUL, REG, MEM}, "bx", 3, ISEL_MEMORY, ACTION_NONE, NULL},
+    {REG, {IR_MUL, MEM, REG}, "xb", 3, ISEL_MEMORY, ACTION_NONE, NULL},
+};
+
+#define RULE_COUNT ((int)(sizeof(isel_rules) / sizeof(isel_rules[0])))
+
+typedef struct
+{
+    IRFunction *function;
+    Selection *selection;
+    int *use_counts;
+    int *users; // the last user of each value
+    int *costs; // by value and nonterminal
+    int *rules;
+    int *register_uses; // users reading the value in a register
+} Selector;
+
+static void count_uses(Selector *selector)
+{
+    IRFunction *function = selector->function;
+    for (int i = 0; i < function->instruction_count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+        for (int k = 0; k < info->value_args; k++)
+        {
+            if (instruction->args[k] >= 0)
+            {
+                selector->use_counts[instruction->args[k]]++;
+                selector->users[instruction->args[k]] = i;
+            }
+        }
+        if (!info->has_list)
+            continue;
+        int stride = instruction->op == IR_PHI ? 2 : 1;
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            int operand = function->operands[instruction->imm.list.first + k * stride + stride - 1];
+            selector->use_counts[operand]++;
+            selector->users[operand] = i;
+        }
+    }
+}
+
+// whether value can be an interior node of its user's tree
+static bool foldable(Selector *selector, int value)
+{
+    IRFunction *function = selector->function;
+    IRInstruction *instruction = &function->instructions[value];
+    if (instruction->op != IR_ADD && instruction->op != IR_SUB && instruction->op != IR_MUL && instruction->op != IR_SHL && instruction->op != IR_LOAD)
+        return false;
+    int user = selector->users[value];
+    return selector->use_counts[value] == 1 && user > value && function->instructions[user].block == instruction->block && function->instructions[user].op != IR_PHI;
+}
+
+// Cost of value as a leaf derived as nonterminal. A value that is no node
+// of the tree is computed anyway, its register is free.
+static int leaf_cost(Selector *selector, int value, int nonterminal)
+{
+    IRInstruction *instruction = &selector->function->instructions[value];
+    if (instruction->type != IR_INT)
+        return INFINITE_COST;
+    if (instruction->op == IR_CONST || foldable(selector, value))
+        return selector->costs[value * NONTERMINAL_COUNT + nonterminal - REG];
+    return nonterminal == REG || nonterminal == INDEX || nonterminal == ADDR ? 0 : INFINITE_COST;
+}
+
+static int default_cost(Selector *selector, int value)
+{
+    IRFunction *function = selector->function;
+    IRInstruction *instruction = &function->instructions[value];
+    int cost = instruction->op == IR_MUL ? 3 : instruction->op >= IR_EQ && instruction->op <= IR_GE ? 4 : 2;
+    for (int k = 0; k < ir_opcode_info[instruction->op].value_args; k++)
+    {
+        int operand = instruction->args[k];
+        if (operand >= 0 && function->instructions[operand].type == IR_INT)
+            cost += leaf_cost(selector, operand, REG);
+    }
+    return cost;
+}
+
+// Cost of the leaves of the pattern at *at matched against value, which
+// moves *at past it; INFINITE_COST when it does not match
+static int match(Selector *selector, const IselRule *rule, int *at, int value, bool root)
+{
+    int symbol = rule->pattern[(*at)++];
+    if (symbol >= REG)
+        return leaf_cost(selector, value, symbol);
+    IRInstruction *instruction = &selector->function->instructions[value];
+    if (instruction->op != symbol || instruction->type != IR_INT || !(root || symbol == IR_CONST || foldable(selector, value)))
+        return INFINITE_COST;
+    int cost = 0;
+    for (int k = 0; k < ir_opcode_info[symbol].value_args; k++)
+    {
+        int operand = match(selector, rule, at, instruction->args[k], false);
+        if (operand >= INFINITE_COST)
+            return INFINITE_COST;
+        cost += operand;
+    }
+    return cost;
+}
+
+static void label(Selector *selector, int value)
+{
+    IRFunction *function = selector->function;
+    IRInstruction *instruction = &function->instructions[value];
+    int *costs = &selector->costs[value * NONTERMINAL_COUNT];
+    int *rules = &selector->rules[value * NONTERMINAL_COUNT];
+    for (int n = 0; n < NONTERMINAL_COUNT; n++)
+    {
+        costs[n] = INFINITE_COST;
+        rules[n] = DEFAULT_RULE;
+    }
+    costs[REG - REG] = default_cost(selector, value);
+    if (instruction->type != IR_INT)
+        return;
+
+    for (int r = 0; r < RULE_COUNT; r++)
+    {
+        const IselRule *rule = &isel_rules[r];
+        if (rule->pattern[0] != instruction->op || (rule->accepts && !rule->accepts(function, value)))
+            continue;
+        int at = 0;
+        int cost = match(selector, rule, &at, value, true);
+        if (cost < INFINITE_COST && rule->cost + cost < costs[rule->result - REG])
+        {
+            costs[rule->result - REG] = rule->cost + cost;
+            rules[rule->result - REG] = r;
+        }
+    }
+
+    // chain rules, until no nonterminal gets cheaper
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int r = 0; r < RULE_COUNT; r++)
+        {
+            const IselRule *rule = &isel_rules[r];
+            if (rule->pattern[0] < REG || costs[rule->pattern[0] - REG] >= INFINITE_COST)
+                continue;
+            int cost = rule->cost + costs[rule->pattern[0] - REG];
+            if (cost < costs[rule->result - REG])
+            {
+                costs[rule->result - REG] = cost;
+                rules[rule->result - REG] = r;
+                changed = true;
+            }
+        }
+    }
+}
+
+static int register_operand(Selector *selector, int value)
+{
+    selector->register_uses[value]++;
+    return value;
+}
+
+static void expand(Selector *selector, int value, int nonterminal, IselChoice *choice);
+
+// A leaf of its own is read in a register, a foldable one is folded with
+// the rule it got for nonterminal
+static void derive(Selector *selector, int value, int nonterminal, IselChoice *choice)
+{
+    int rule = selector->rules[value * NONTERMINAL_COUNT + nonterminal - REG];
+    if (!foldable(selector, value) || isel_rules[rule].pattern[0] == REG)
+    {
+        if (nonterminal == INDEX)
+        {
+            choice->index = register_operand(selector, value);
+            choice->scale = 1;
+        }
+        else
+            choice->base = register_operand(selector, value);
+        return;
+    }
+    selector->selection->choices[value].form = ISEL_FOLDED;
+    expand(selector, value, nonterminal, choice);
+}
+
+static void walk(Selector *selector, const IselRule *rule, int *at, const char **slot, int value, bool root, IselChoice *choice)
+{
+    IRInstruction *instruction = &selector->function->instructions[value];
+    int symbol = rule->pattern[(*at)++];
+    if (symbol < REG)
+    {
+        if (!root && symbol != IR_CONST)
+            selector->selection->choices[value].form = ISEL_FOLDED;
+        for (int k = 0; k < ir_opcode_info[symbol].value_args; k++)
+        {
+            walk(selector, rule, at, slot, instruction->args[k], false, choice);
+        }
+        return;
+    }
+    switch (*(*slot)++)
+    {
+    case 'b':
+        choice->base = register_operand(selector, value);
+        break;
+    case 'i':
+        choice->index = register_operand(selector, value);
+        break;
+    case 's':
+        choice->base = choice->index = register_operand(selector, value);
+        break;
+    case 'd':
+        choice->disp += (int32_t)instruction->imm.i;
+        break;
+    case 'n':
+        choice->disp -= (int32_t)instruction->imm.i;
+        break;
+    default:
+        derive(selector, value, symbol, choice);
+        break;
+    }
+}
+
+static void expand(Selector *selector, int value, int nonterminal, IselChoice *choice)
+{
+    IRFunction *function = selector->function;
+    const IselRule *rule = &isel_rules[selector->rules[value * NONTERMINAL_COUNT + nonterminal - REG]];
+    if (rule->pattern[0] >= REG)
+    {
+        expand(selector, value, rule->pattern[0], choice);
+        return;
+    }
+    int at = 0;
+    const char *slot = rule->slots;
+    walk(selector, rule, &at, &slot, value, true, choice);
+    switch ((IselAction)rule->action)
+    {
+    case ACTION_SHIFT_SCALE:
+        choice->scale = 1 << function->instructions[value].imm.i;
+        break;
+    case ACTION_MULTIPLIER_SCALE:
+        choice->scale = (int)right_constant(function, value);
+        break;
+    case ACTION_SELF_SCALE:
+        choice->scale = (int)right_constant(function, value) - 1;
+        break;
+    case ACTION_LOAD_OFFSET:
+        choice->disp += (int32_t)function->instructions[value].imm.i;
+        break;
+    default:
+        break;
+    }
+}
+
+static void reduce(Selector *selector, int value)
+{
+    IRFunction *function = selector->function;
+    IRInstruction *instruction = &function->instructions[value];
+    int rule = selector->rules[value * NONTERMINAL_COUNT];
+    if (rule != DEFAULT_RULE)
+    {
+        selector->selection->choices[value].form = isel_rules[rule].form;
+        expand(selector, value, REG, &selector->selection->choices[value]);
+        return;
+    }
+    const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+    for (int k = 0; k < info->value_args; k++)
+    {
+        if (instruction->args[k] >= 0)
+            register_operand(selector, instruction->args[k]);
+    }
+    if (!info->has_list)
+        return;
+    int stride = instruction->op == IR_PHI ? 2 : 1;
+    for (int k = 0; k < instruction->imm.list.count; k++)
+    {
+        register_operand(selector, function->operands[instruction->imm.list.first + k * stride + stride - 1]);
+    }
+}
+
+// Every value gets ISEL_DEFAULT unless patterns is set
+Selection *select_instructions(IRFunction *function, bool patterns)
+{
+    int count = function->instruction_count;
+    Selection *selection = calloc(1, sizeof(Selection));
+    selection->choices = malloc((count + 1) * sizeof(IselChoice));
+    for (int v = 0; v < count; v++)
+    {
+        IselChoice choice = {ISEL_DEFAULT, 1, -1, -1, 0};
+        selection->choices[v] = choice;
+    }
+    if (!patterns)
+        return selection;
+
+    Selector selector;
+    selector.function = function;
+    selector.selection = selection;
+    selector.use_counts = calloc(count + 1, sizeof(int));
+    selector.users = calloc(count + 1, sizeof(int));
+    selector.costs = malloc(((size_t)count * NONTERMINAL_COUNT + 1) * sizeof(int));
+    selector.rules = malloc(((size_t)count * NONTERMINAL_COUNT + 1) * sizeof(int));
+    selector.register_uses = calloc(count + 1, sizeof(int));
+    count_uses(&selector);
+
+    // operands come before their users in a block, constants are labeled
+    // first as they are taken as immediates wherever they are
+    for (int v = 0; v < count; v++)
+    {
+        if (function->instructions[v].op == IR_CONST)
+            label(&selector, v);
+    }
+    for (int v = 0; v < count; v++)
+    {
+        if (function->instructions[v].op != IR_CONST)
+            label(&selector, v);
+    }
+
+    // users are reduced before the values they fold
+    for (int b = 0; b < function->block_count; b++)
+    {
+        IRBlock *block = &function->blocks[b];
+        for (int v = block->first + block->count - 1; v >= block->first; v--)
+        {
+            IROpcode op = function->instructions[v].op;
+            if (op != IR_NOP && op != IR_CONST && selection->choices[v].form != ISEL_FOLDED)
+                reduce(&selector, v);
+        }
+    }
+
+    for (int v = 0; v < count; v++)
+    {
+        if (function->instructions[v].op == IR_CONST && selector.register_uses[v] == 0 && selector.use_counts[v] > 0)
+            selection->choices[v].form = ISEL_FOLDED;
+        if (selection->choices[v].form == ISEL_FOLDED)
+            selection->folded++;
+    }
+
+    free(selector.use_counts);
+    free(selector.users);
+    free(selector.costs);
+    free(selector.rules);
+    free(selector.register_uses);
+    return selection;
+}
+
+void free_selection(Selection *selection)
+{
+    free(selection->choices);
+    free(selection);
+}
@@ -0,0 +1,40 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "../ir/ir.h"
+
+#ifndef JIT_ISEL_H
+#define JIT_ISEL_H
+
+// How the code generator emits a value. A folded value is part of the
+// instruction of its user, it is not computed on its own and gets no
+// register.
+typedef enum
+{
+    ISEL_DEFAULT, // the instruction on its own, see emit_instruction
+    ISEL_FOLDED,
+    ISEL_LEA, // lea [base + index * scale + disp]
+    ISEL_IMMEDIATE, // base op disp: and, or and compares
+    ISEL_MULTIPLY_IMMEDIATE, // imul base, disp into the result
+    ISEL_MEMORY // base op [index + disp], the right operand a folded load
+} IselForm;
+
+// values read in registers are -1 when unused
+typedef struct
+{
+    uint8_t form;
+    uint8_t scale;
+    int32_t base;
+    int32_t index;
+    int32_t disp; // displacement or immediate
+} IselChoice;
+
+typedef struct
+{
+    IselChoice *choices; // by value
+    int folded; // values folded into the instruction of a user
+} Selection;
+
+Selection *select_instructions(IRFunction *function, bool patterns);
+void free_selection(Selection *selection);
+
+#endif
@@ -0,0 +1,1963 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <math.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include "jit.h"
+#include "x86_64.h"
+#include "code_heap.h"
+#include "isel.h"
+#include "regalloc.h"
+#include "../ir/ir.h"
+#include "../defc/defc.h"
+
+// Code generator from SSA IR to x86-64. Values live where the linear scan
+// allocator put them, in a register or in a spill slot below the saved
+// registers of the frame; every instruction accepts either. rax, rdx, r11
+// and xmm14, xmm15 are never allocated, they are the scratch registers of
+// division, memory to memory moves and cycles in parallel moves. The
+// selector, see isel.c, picks the instruction of each value; values it folds
+// into the lea, immediate or memory operand of a user are not emitted.
+//
+// Moves between intervals of a value, phi copies and the moves into argument
+// registers are parallel moves: all sources are read before any destination
+// is written. Edge moves are emitted on the edge itself, a branch whose
+// taken edge needs moves jumps over them for the other edge.
+//
+// Functions follow the System V calling convention, so native code calls
+// other functions directly and jit_call enters it from C. C helpers are
+// called through the helper table behind the code, which keeps the code
+// itself position independent for the code cache. The extern functions of
+// the program get slots after the helpers and are called the same way.
+
+#define INT_ARGUMENT_REGISTERS 6
+#define FLOAT_ARGUMENT_REGISTERS 8
+#define MAX_SAVED_REGISTERS 5
+
+static const int int_argument_registers[INT_ARGUMENT_REGISTERS] = {RDI, RSI, RDX, RCX, R8, R9};
+static const int float_argument_registers[FLOAT_ARGUMENT_REGISTERS] = {XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7};
+static const X86Register callee_saved_registers[MAX_SAVED_REGISTERS] = {RBX, R12, R13, R14, R15};
+
+typedef struct
+{
+    bool in_memory;
+    uint8_t register_class;
+    int reg;
+    int32_t disp; // from rbp when in memory
+} Location;
+
+typedef struct
+{
+    Location destination;
+    Location source;
+    uint8_t register_class;
+} Move;
+
+typedef struct
+{
+    Move *items;
+    int count;
+    int size;
+} MoveList;
+
+typedef struct
+{
+    X86Assembler *assembler;
+    IRModule *module;
+    JITModule *native;
+    const JITOptions *options;
+    RegisterTarget target;
+    IRFunction *function;
+    Selection *selection;
+    Allocation *allocation;
+    int *function_labels;
+    int helper_labels[JIT_HELPER_COUNT]; // slots of the helper table
+    int *extern_labels; // slots of the extern functions
+    int *stack_checks; // labels of the stack limit compares, one per compiled function
+    int stack_check_count;
+    int *block_labels;
+    int epilogue;
+    int division_trap;
+    int overflow_trap;
+    int saved_count;
+    X86Register saved[MAX_SAVED_REGISTERS];
+    MoveList moves;
+    int *splits; // intervals that continue a split value, by start
+    int split_count;
+    int next_split;
+    int *use_counts; // by value
+    int flags_value; // compare computed into the flags only, -1 if none
+    X86Condition flags_condition; // holds when that compare is true
+} CodegenContext;
+
+static __thread jmp_buf *trap_target;
+
+// Prologues trap when rsp falls below the limit of their thread. It is
+// initial exec so it sits at the same offset from the thread pointer in
+// every thread and native code reads it as fs:[offset].
+static __thread uintptr_t stack_limit __attribute__((tls_model("initial-exec")));
+
+int32_t jit_stack_limit_offset()
+{
+    // keeps gcc from folding the subtraction into a 32 bit GOT load the linker cannot relax
+    uintptr_t *address = &stack_limit;
+    __asm__("" : "+r"(address));
+    return (int32_t)((intptr_t)address - (intptr_t)__builtin_thread_pointer());
+}
+
+// native code entered through a plain function pointer has no trap target
+static void jit_trap(int64_t trap)
+{
+    if (trap_target == NULL)
+    {
+        wprintf(L"runtime error: %s\n", jit_trap_message(trap));
+        abort();
+    }
+    longjmp(*trap_target, (int)trap);
+}
+
+void *jit_helper_address(JITHelper helper)
+{
+    switch (helper)
+    {
+    case JIT_HELPER_TRAP:
+        return (void *)jit_trap;
+    case JIT_HELPER_POW:
+        return (void *)pow;
+    case JIT_HELPER_FMA:
+        return (void *)fma;
+    default:
+        return NULL;
+    }
+}
+
+const char *jit_trap_message(JITTrap trap)
+{
+    switch (trap)
+    {
+    case JIT_TRAP_DIVISION_BY_ZERO:
+        return "division by zero";
+    case JIT_TRAP_STACK_OVERFLOW:
+        return "stack overflow";
+    default:
+        return "unknown trap";
+    }
+}
+
+// four lane vector loops take ymm registers
+bool jit_supports_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// the JITExtension flags of this processor
+unsigned jit_cpu_extensions()
+{
+    __builtin_cpu_init();
+    unsigned extensions = 0;
+    if (__builtin_cpu_supports("popcnt"))
+        extensions |= JIT_EXTENSION_POPCNT;
+    if (__builtin_cpu_supports("lzcnt"))
+        extensions |= JIT_EXTENSION_LZCNT;
+    if (__builtin_cpu_supports("bmi"))
+        extensions |= JIT_EXTENSION_BMI1;
+    if (__builtin_cpu_supports("fma"))
+        extensions |= JIT_EXTENSION_FMA;
+    return extensions;
+}
+
+static void init_register_target(RegisterTarget *target)
+{
+    static const int general[] = {RCX, RSI, RDI, R8, R9, R10, RBX, R12, R13, R14, R15};
+    static const int caller_saved[] = {RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11};
+
+    memset(target, 0, sizeof(RegisterTarget));
+    // caller saved registers come first, they cost no save in the prologue
+    for (int k = 0; k < (int)(sizeof(general) / sizeof(general[0])); k++)
+    {
+        target->allocatable[REGISTER_GENERAL][target->allocatable_count[REGISTER_GENERAL]++] = general[k];
+    }
+    for (int k = 0; k < (int)(sizeof(caller_saved) / sizeof(caller_saved[0])); k++)
+    {
+        target->caller_saved[REGISTER_GENERAL][caller_saved[k]] = true;
+    }
+    for (int reg = XMM0; reg <= XMM13; reg++)
+    {
+        target->allocatable[REGISTER_FLOAT][target->allocatable_count[REGISTER_FLOAT]++] = reg;
+    }
+    for (int reg = XMM0; reg <= XMM15; reg++)
+    {
+        target->caller_saved[REGISTER_FLOAT][reg] = true;
+    }
+    target->arguments[REGISTER_GENERAL] = int_argument_registers;
+    target->argument_count[REGISTER_GENERAL] = INT_ARGUMENT_REGISTERS;
+    target->arguments[REGISTER_FLOAT] = float_argument_registers;
+    target->argument_count[REGISTER_FLOAT] = FLOAT_ARGUMENT_REGISTERS;
+}
+
+static Location register_location(RegisterClass register_class, int reg)
+{
+    Location location = {false, register_class, reg, 0};
+    return location;
+}
+
+static Location memory_location(int32_t disp)
+{
+    Location location = {true, REGISTER_GENERAL, X86_NO_REGISTER, disp};
+    return location;
+}
+
+static X86Memory location_memory(Location location)
+{
+    return x86_memory(RBP, location.disp);
+}
+
+static bool same_location(Location a, Location b)
+{
+    if (a.in_memory != b.in_memory)
+        return false;
+    return a.in_memory ? a.disp == b.disp : a.register_class == b.register_class && a.reg == b.reg;
+}
+
+static Location location_of(CodegenContext *context, int value, int position)
+{
+    LiveInterval *interval = interval_at(context->allocation, value, position);
+    if (interval->reg != NO_REGISTER)
+        return register_location(interval->register_class, interval->reg);
+    // spill slots sit below the callee saved registers pushed after rbp
+    int slot = context->allocation->value_slot[value];
+    return memory_location(-8 * (context->saved_count + 1 + slot));
+}
+
+static RegisterClass class_of_value(CodegenContext *context, int value)
+{
+    return register_class_of(context->function->instructions[value].type);
+}
+
+static void emit_move(CodegenContext *context, Location destination, Location source)
+{
+    X86Assembler *assembler = context->assembler;
+    if (same_location(destination, source))
+        return;
+    context->native->stats.moves++;
+
+    // slots hold raw 64 bit values, the register side picks the instruction
+    if (destination.in_memory && source.in_memory)
+    {
+        x86_load(assembler, RAX, location_memory(source));
+        x86_store(assembler, location_memory(destination), RAX);
+    }
+    else if (destination.in_memory)
+    {
+        if (source.register_class == REGISTER_FLOAT)
+            x86_movsd_store(assembler, location_memory(destination), source.reg);
+        else
+            x86_store(assembler, location_memory(destination), source.reg);
+    }
+    else if (source.in_memory)
+    {
+        if (destination.register_class == REGISTER_FLOAT)
+            x86_movsd_load(assembler, destination.reg, location_memory(source));
+        else
+            x86_load(assembler, destination.reg, location_memory(source));
+    }
+    else if (destination.register_class == REGISTER_FLOAT && source.register_class == REGISTER_FLOAT)
+        x86_movapd(assembler, destination.reg, source.reg);
+    else if (destination.register_class == REGISTER_FLOAT)
+        x86_movq_to_xmm(assembler, destination.reg, source.reg);
+    else if (source.register_class == REGISTER_FLOAT)
+        x86_movq_from_xmm(assembler, destination.reg, source.reg);
+    else
+        x86_mov(assembler, destination.reg, source.reg);
+}
+
+static void add_move(CodegenContext *context, Location destination, Location source, RegisterClass register_class)
+{
+    MoveList *moves = &context->moves;
+    if (same_location(destination, source))
+        return;
+    if (moves->count >= moves->size)
+    {
+        moves->size = moves->size ? moves->size * 2 : 16;
+        moves->items = realloc(moves->items, moves->size * sizeof(Move));
+        if (!moves->items)
+        {
+            wprintf(L"Memory allocation failed while resizing jit moves.\n");
+            exit(1);
+        }
+    }
+    moves->items[moves->count++] = (Move){destination, source, register_class};
+}
+
+static bool is_read(MoveList *moves, Location location, int except)
+{
+    for (int k = 0; k < moves->count; k++)
+    {
+        if (k != except && same_location(moves->items[k].source, location))
+            return true;
+    }
+    return false;
+}
+
+// Emits the pending moves as if they happened at once. A move is safe when
+// no other pending move still reads its destination; when only cycles are
+// left, one destination is saved to r11 or xmm15 and its readers are
+// redirected there.
+static void emit_parallel_moves(CodegenContext *context)
+{
+    MoveList *moves = &context->moves;
+    while (moves->count > 0)
+    {
+        bool progress = false;
+        for (int k = 0; k < moves->count; k++)
+        {
+            Move move = moves->items[k];
+            if (is_read(moves, move.destination, k))
+                continue;
+            emit_move(context, move.destination, move.source);
+            moves->items[k] = moves->items[--moves->count];
+            progress = true;
+            k--;
+        }
+        if (progress)
+            continue;
+
+        Move *blocked = &moves->items[0];
+        Location scratch = register_location(blocked->register_class, blocked->register_class == REGISTER_FLOAT ? XMM15 : R11);
+        emit_move(context, scratch, blocked->destination);
+        for (int k = 0; k < moves->count; k++)
+        {
+            if (same_location(moves->items[k].source, blocked->destination))
+                moves->items[k].source = scratch;
+        }
+    }
+}
+
+// register holding value at position, loaded into scratch when it is spilled
+static int general_register(CodegenContext *context, int value, int position, X86Register scratch)
+{
+    Location location = location_of(context, value, position);
+    if (!location.in_memory)
+        return location.reg;
+    x86_load(context->assembler, scratch, location_memory(location));
+    return scratch;
+}
+
+static int float_register(CodegenContext *context, int value, int position, X86XmmRegister scratch)
+{
+    Location location = location_of(context, value, position);
+    if (!location.in_memory)
+        return location.reg;
+    x86_movsd_load(context->assembler, scratch, location_memory(location));
+    return scratch;
+}
+
+static void call_helper(CodegenContext *context, JITHelper helper)
+{
+    x86_call_indirect(context->assembler, context->helper_labels[helper]);
+}
+
+static void add_edge_moves(CodegenContext *context, int predecessor, int successor)
+{
+    IRFunction *function = context->function;
+    Allocation *allocation = context->allocation;
+    IRBlock *block = &function->blocks[successor];
+    IRBlock *from_block = &function->blocks[predecessor];
+    int from = POSITION_USE(from_block->first + from_block->count) - 1;
+    int to = POSITION_USE(block->first);
+
+    for (int v = block->first; v < block->first + block->count && function->instructions[v].op == IR_PHI; v++)
+    {
+        IRInstruction *phi = &function->instructions[v];
+        for (int k = 0; k < phi->imm.list.count; k++)
+        {
+            int32_t *pair = &function->operands[phi->imm.list.first + 2 * k];
+            if (pair[0] == predecessor)
+                add_move(context, location_of(context, v, to), location_of(context, pair[1], from), class_of_value(context, v));
+        }
+    }
+    // split values may sit somewhere else at the start of the successor
+    for (int v = 0; v < function->instruction_count; v++)
+    {
+        if (allocation->value_interval[v] >= 0 && is_live_in(allocation, successor, v))
+            add_move(context, location_of(context, v, to), location_of(context, v, from), class_of_value(context, v));
+    }
+}
+
+static void emit_edge(CodegenContext *context, int predecessor, int successor, int next_block)
+{
+    add_edge_moves(context, predecessor, successor);
+    emit_parallel_moves(context);
+    if (successor != next_block)
+        x86_jmp(context->assembler, context->block_labels[successor]);
+}
+
+static X86Condition int_condition(IROpcode op)
+{
+    switch (op)
+    {
+    case IR_EQ:
+        return CC_E;
+    case IR_NE:
+        return CC_NE;
+    case IR_LT:
+        return CC_L;
+    case IR_LE:
+        return CC_LE;
+    case IR_GT:
+        return CC_G;
+    default:
+        return CC_GE;
+    }
+}
+
+// register the result is computed in, scratch when the result lives in a slot
+static int result_register(Location result, int scratch)
+{
+    return result.in_memory ? scratch : result.reg;
+}
+
+// A compare only read as the condition of branches and selects that follow
+// it, with nothing but constants and folded values in between, is left in the flags for them
+// to test. Floats test equality with two flags, those compares still
+// produce a value.
+static bool fuses_compare(CodegenContext *context, int value, int block)
+{
+    IRFunction *function = context->function;
+    IRInstruction *instruction = &function->instructions[value];
+    IRBlock *range = &function->blocks[block];
+    if (class_of_value(context, instruction->args[0]) == REGISTER_FLOAT && (instruction->op == IR_EQ || instruction->op == IR_NE))
+        return false;
+    int remaining = context->use_counts[value];
+    for (int i = value + 1; i < range->first + range->count && remaining > 0; i++)
+    {
+        IRInstruction *user = &function->instructions[i];
+        if (user->op == IR_CONST || context->selection->choices[i].form == ISEL_FOLDED)
+            continue;
+        if ((user->op != IR_BRANCH && user->op != IR_SELECT) || user->args[0] != value)
+            return false;
+        if (user->op == IR_SELECT && (user->args[1] == value || user->args[2] == value))
+            return false;
+        remaining--;
+    }
+    return remaining == 0 && context->use_counts[value] > 0;
+}
+
+static void keep_in_flags(CodegenContext *context, int value, X86Condition condition)
+{
+    context->flags_value = value;
+    context->flags_condition = condition;
+    context->native->stats.fused++;
+}
+
+// Sets the flags for a branch or select on condition, returns the condition
+// code that holds when it is not zero
+static X86Condition test_condition(CodegenContext *context, int condition, int position)
+{
+    if (condition == context->flags_value)
+        return context->flags_condition;
+    Location location = location_of(context, condition, position);
+    if (location.in_memory)
+        x86_compare_memory_immediate(context->assembler, location_memory(location), 0);
+    else
+        x86_test(context->assembler, location.reg, location.reg);
+    return CC_NE;
+}
+
+static X86Condition negated(X86Condition condition)
+{
+    return (X86Condition)(condition ^ 1);
+}
+
+static void emit_float_compare(CodegenContext *context, IRInstruction *instruction, int value, bool fused)
+{
+    X86Assembler *assembler = context->assembler;
+    IROpcode op = instruction->op;
+    int position = POSITION_USE(value);
+    int left = instruction->args[0];
+    int right = instruction->args[1];
+
+    // ucomisd sets CF and ZF like an unsigned compare, unordered sets ZF, PF
+    // and CF; a < b is tested as b > a so NaN falls on the false side
+    if (op == IR_LT || op == IR_LE)
+    {
+        int swap = left;
+        left = right;
+        right = swap;
+    }
+    int left_register = float_register(context, left, position, XMM14);
+    int right_register = float_register(context, right, position, XMM15);
+    x86_ucomisd(assembler, left_register, right_register);
+    if (fused)
+    {
+        keep_in_flags(context, value, op == IR_LT || op == IR_GT ? CC_A : CC_AE);
+        return;
+    }
+
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int target = result_register(result, RAX);
+    switch (op)
+    {
+    case IR_EQ:
+        x86_setcc(assembler, CC_E, target);
+        x86_setcc(assembler, CC_NP, RDX);
+        x86_movzx_byte(assembler, target, target);
+        x86_movzx_byte(assembler, RDX, RDX);
+        x86_alu(assembler, ALU_AND, target, RDX);
+        break;
+    case IR_NE:
+        x86_setcc(assembler, CC_NE, target);
+        x86_setcc(assembler, CC_P, RDX);
+        x86_movzx_byte(assembler, target, target);
+        x86_movzx_byte(assembler, RDX, RDX);
+        x86_alu(assembler, ALU_OR, target, RDX);
+        break;
+    case IR_LT:
+    case IR_GT:
+        x86_setcc(assembler, CC_A, target);
+        x86_movzx_byte(assembler, target, target);
+        break;
+    default:
+        x86_setcc(assembler, CC_AE, target);
+        x86_movzx_byte(assembler, target, target);
+        break;
+    }
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+static void emit_alu(CodegenContext *context, X86AluOperation operation, int destination, Location source)
+{
+    if (source.in_memory)
+        x86_alu_memory(context->assembler, operation, destination, location_memory(source));
+    else
+        x86_alu(context->assembler, operation, destination, source.reg);
+}
+
+static X86AluOperation alu_operation(IROpcode op)
+{
+    return op == IR_ADD ? ALU_ADD : op == IR_SUB ? ALU_SUB : op == IR_AND ? ALU_AND : ALU_OR;
+}
+
+static void emit_int_operation(CodegenContext *context, IROpcode op, int destination, Location source)
+{
+    if (op == IR_MUL)
+    {
+        if (source.in_memory)
+            x86_imul_memory(context->assembler, destination, location_memory(source));
+        else
+            x86_imul(context->assembler, destination, source.reg);
+        return;
+    }
+    emit_alu(context, alu_operation(op), destination, source);
+}
+
+static void emit_float_operation(CodegenContext *context, IROpcode op, int destination, Location source)
+{
+    X86SseOperation operation = op == IR_ADD ? SSE_ADD : op == IR_SUB ? SSE_SUB : op == IR_MUL ? SSE_MUL : op == IR_MIN ? SSE_MIN : op == IR_MAX ? SSE_MAX : SSE_DIV;
+    if (source.in_memory)
+        x86_sse_memory(context->assembler, operation, destination, location_memory(source));
+    else
+        x86_sse(context->assembler, operation, destination, source.reg);
+}
+
+// Two address form: the result register takes the left operand and the
+// right one is combined into it. If the result already holds the right
+// operand, commutative operations swap the operands, the rest go through a
+// scratch register. minsd and maxsd return the right operand for NaN and
+// equal zeros, they do not commute.
+static void emit_binary(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    int position = POSITION_USE(value);
+    RegisterClass register_class = register_class_of(instruction->type);
+    Location left = location_of(context, instruction->args[0], position);
+    Location right = location_of(context, instruction->args[1], position);
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    bool commutative = instruction->op != IR_SUB && instruction->op != IR_DIV && instruction->op != IR_MIN && instruction->op != IR_MAX;
+    int scratch = register_class == REGISTER_FLOAT ? XMM14 : RAX;
+    int target;
+
+    if (!result.in_memory && !same_location(result, right))
+    {
+        target = result.reg;
+        emit_move(context, result, left);
+    }
+    else if (!result.in_memory && commutative)
+    {
+        target = result.reg;
+        right = left;
+    }
+    else
+    {
+        target = scratch;
+        emit_move(context, register_location(register_class, scratch), left);
+    }
+
+    if (register_class == REGISTER_FLOAT)
+        emit_float_operation(context, instruction->op, target, right);
+    else
+        emit_int_operation(context, instruction->op, target, right);
+    emit_move(context, result, register_location(register_class, target));
+}
+
+static void emit_division(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    int position = POSITION_USE(value);
+    int divide = x86_new_label(assembler);
+    int done = x86_new_label(assembler);
+
+    // idiv faults on INT64_MIN / -1, dividing by -1 is a negation
+    int divisor = general_register(context, instruction->args[1], position, R11);
+    emit_move(context, register_location(REGISTER_GENERAL, RAX), location_of(context, instruction->args[0], position));
+    x86_test(assembler, divisor, divisor);
+    x86_jcc(assembler, CC_E, context->division_trap);
+    x86_alu_immediate(assembler, ALU_CMP, divisor, -1);
+    x86_jcc(assembler, CC_NE, divide);
+    x86_neg(assembler, RAX);
+    x86_jmp(assembler, done);
+    x86_bind_label(assembler, divide);
+    x86_cqo(assembler);
+    x86_idiv(assembler, divisor);
+    x86_bind_label(assembler, done);
+    emit_move(context, location_of(context, value, POSITION_DEFINE(value)), register_location(REGISTER_GENERAL, RAX));
+}
+
+// Integer powers square and multiply inline, negative exponents give the
+// interpreter's results: 1 for 1, 1 or -1 for -1 and 0 for everything else
+static void emit_power(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    int position = POSITION_USE(value);
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    if (instruction->type == IR_FLOAT)
+    {
+        add_move(context, register_location(REGISTER_FLOAT, XMM0), location_of(context, instruction->args[0], position), REGISTER_FLOAT);
+        add_move(context, register_location(REGISTER_FLOAT, XMM1), location_of(context, instruction->args[1], position), REGISTER_FLOAT);
+        emit_parallel_moves(context);
+        call_helper(context, JIT_HELPER_POW);
+        emit_move(context, result, register_location(REGISTER_FLOAT, XMM0));
+        return;
+    }
+
+    int loop = x86_new_label(assembler);
+    int skip = x86_new_label(assembler);
+    int zero = x86_new_label(assembler);
+    int done = x86_new_label(assembler);
+    // no allocated value lives in r11 or rdx
+    emit_move(context, register_location(REGISTER_GENERAL, R11), location_of(context, instruction->args[0], position));
+    emit_move(context, register_location(REGISTER_GENERAL, RDX), location_of(context, instruction->args[1], position));
+    x86_mov_immediate(assembler, RAX, 1);
+    x86_test(assembler, RDX, RDX);
+    x86_jcc(assembler, CC_E, done);
+    x86_jcc(assembler, CC_NS, loop);
+
+    x86_alu_immediate(assembler, ALU_CMP, R11, 1);
+    x86_jcc(assembler, CC_E, done);
+    x86_alu_immediate(assembler, ALU_CMP, R11, -1);
+    x86_jcc(assembler, CC_NE, zero);
+    // carry takes the lowest bit, odd exponents keep the sign
+    x86_shift_immediate(assembler, SHIFT_SHR, RDX, 1);
+    x86_jcc(assembler, CC_AE, done);
+    x86_neg(assembler, RAX);
+    x86_jmp(assembler, done);
+    x86_bind_label(assembler, zero);
+    x86_alu(assembler, ALU_XOR, RAX, RAX);
+    x86_jmp(assembler, done);
+
+    x86_bind_label(assembler, loop);
+    x86_shift_immediate(assembler, SHIFT_SHR, RDX, 1);
+    x86_jcc(assembler, CC_AE, skip);
+    x86_imul(assembler, RAX, R11);
+    x86_bind_label(assembler, skip);
+    x86_imul(assembler, R11, R11);
+    x86_test(assembler, RDX, RDX);
+    x86_jcc(assembler, CC_NE, loop);
+    x86_bind_label(assembler, done);
+    emit_move(context, result, register_location(REGISTER_GENERAL, RAX));
+}
+
+// rdx takes the high half of the product
+static void emit_multiply_high(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    int position = POSITION_USE(value);
+    int right = general_register(context, instruction->args[1], position, R11);
+    emit_move(context, register_location(REGISTER_GENERAL, RAX), location_of(context, instruction->args[0], position));
+    x86_imul_wide(context->assembler, right);
+    emit_move(context, location_of(context, value, POSITION_DEFINE(value)), register_location(REGISTER_GENERAL, RDX));
+}
+
+static void emit_shift(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86ShiftOperation operation = instruction->op == IR_SHL ? SHIFT_SHL : instruction->op == IR_SHR ? SHIFT_SHR : SHIFT_SAR;
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int target = result_register(result, RAX);
+    emit_move(context, register_location(REGISTER_GENERAL, target), location_of(context, instruction->args[0], POSITION_USE(value)));
+    x86_shift_immediate(context->assembler, operation, target, (int)instruction->imm.i);
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+// the left operand unless the right one is smaller, or larger for max
+static void emit_int_min_max(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    int position = POSITION_USE(value);
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int right = general_register(context, instruction->args[1], position, R11);
+    int target = result_register(result, RAX);
+    if (target == right)
+        target = RAX;
+    emit_move(context, register_location(REGISTER_GENERAL, target), location_of(context, instruction->args[0], position));
+    x86_alu(assembler, ALU_CMP, target, right);
+    x86_cmov(assembler, instruction->op == IR_MIN ? CC_G : CC_L, target, right);
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+// Floats combine their bits with mask through rax: the sign bit flipped
+// for neg, cleared for abs
+static void emit_float_sign(CodegenContext *context, IRInstruction *instruction, int value, X86AluOperation operation, int64_t mask)
+{
+    X86Assembler *assembler = context->assembler;
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    Location operand = location_of(context, instruction->args[0], POSITION_USE(value));
+    if (operand.in_memory)
+        x86_load(assembler, RAX, location_memory(operand));
+    else
+        x86_movq_from_xmm(assembler, RAX, operand.reg);
+    x86_mov_immediate(assembler, R11, mask);
+    x86_alu(assembler, operation, RAX, R11);
+    if (result.in_memory)
+        x86_store(assembler, location_memory(result), RAX);
+    else
+        x86_movq_to_xmm(assembler, result.reg, RAX);
+}
+
+// integers negate and keep the operand when the negation is negative,
+// INT64_MIN stays itself
+static void emit_absolute(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    if (instruction->type == IR_FLOAT)
+    {
+        emit_float_sign(context, instruction, value, ALU_AND, INT64_MAX);
+        return;
+    }
+    X86Assembler *assembler = context->assembler;
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int target = result_register(result, RAX);
+    emit_move(context, register_location(REGISTER_GENERAL, target), location_of(context, instruction->args[0], POSITION_USE(value)));
+    x86_mov(assembler, R11, target);
+    x86_neg(assembler, target);
+    x86_cmov(assembler, CC_S, target, R11);
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+// sqrtsd keeps the upper half of its destination, taking the square root
+// in place after the move waits for nothing but the operand
+static void emit_square_root(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int target = result_register(result, XMM14);
+    emit_move(context, register_location(REGISTER_FLOAT, target), location_of(context, instruction->args[0], POSITION_USE(value)));
+    x86_sse(context->assembler, SSE_SQRT, target, target);
+    emit_move(context, result, register_location(REGISTER_FLOAT, target));
+}
+
+// vfmadd213sd multiplies into the register of the first operand, which must
+// not hold the other two unless it holds the first one. Without FMA it is
+// a call of fma, which rounds once as well.
+static void emit_fused_multiply_add(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    int position = POSITION_USE(value);
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    Location first = location_of(context, instruction->args[0], position);
+    Location second = location_of(context, instruction->args[1], position);
+    Location addend = location_of(context, instruction->args[2], position);
+    if (!(context->options->extensions & JIT_EXTENSION_FMA))
+    {
+        add_move(context, register_location(REGISTER_FLOAT, XMM0), first, REGISTER_FLOAT);
+        add_move(context, register_location(REGISTER_FLOAT, XMM1), second, REGISTER_FLOAT);
+        add_move(context, register_location(REGISTER_FLOAT, XMM2), addend, REGISTER_FLOAT);
+        emit_parallel_moves(context);
+        call_helper(context, JIT_HELPER_FMA);
+        emit_move(context, result, register_location(REGISTER_FLOAT, XMM0));
+        return;
+    }
+
+    int target = result_register(result, XMM14);
+    if (!same_location(result, first) && (same_location(result, second) || same_location(result, addend)))
+        target = XMM14;
+    emit_move(context, register_location(REGISTER_FLOAT, target), first);
+    int multiplier = float_register(context, instruction->args[1], position, XMM15);
+    if (addend.in_memory)
+        x86_vfmadd213sd_memory(assembler, target, multiplier, location_memory(addend));
+    else
+        x86_vfmadd213sd(assembler, target, multiplier, addend.reg);
+    emit_move(context, result, register_location(REGISTER_FLOAT, target));
+}
+
+// popcount without popcnt: the bits summed in pairs, nibbles and bytes,
+// the multiply adds the bytes up into the top one
+static void emit_population_count(X86Assembler *assembler, int target, int source)
+{
+    if (target != source)
+        x86_mov(assembler, target, source);
+    x86_mov(assembler, RDX, target);
+    x86_shift_immediate(assembler, SHIFT_SHR, RDX, 1);
+    x86_mov_immediate(assembler, R11, 0x5555555555555555);
+    x86_alu(assembler, ALU_AND, RDX, R11);
+    x86_alu(assembler, ALU_SUB, target, RDX);
+    x86_mov(assembler, RDX, target);
+    x86_shift_immediate(assembler, SHIFT_SHR, RDX, 2);
+    x86_mov_immediate(assembler, R11, 0x3333333333333333);
+    x86_alu(assembler, ALU_AND, RDX, R11);
+    x86_alu(assembler, ALU_AND, target, R11);
+    x86_alu(assembler, ALU_ADD, target, RDX);
+    x86_mov(assembler, RDX, target);
+    x86_shift_immediate(assembler, SHIFT_SHR, RDX, 4);
+    x86_alu(assembler, ALU_ADD, target, RDX);
+    x86_mov_immediate(assembler, R11, 0x0F0F0F0F0F0F0F0F);
+    x86_alu(assembler, ALU_AND, target, R11);
+    x86_mov_immediate(assembler, R11, 0x0101010101010101);
+    x86_imul(assembler, target, R11);
+    x86_shift_immediate(assembler, SHIFT_SHR, target, 56);
+}
+
+// popcnt, lzcnt and tzcnt wait for the old value of their destination on
+// some Intel cores, clearing it first breaks that dependency. Without
+// lzcnt and tzcnt, bsr and bsf leave zero to a cmov and 63 - bsr counts
+// the leading zeros.
+static void emit_bit_count(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    IROpcode op = instruction->op;
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int source = general_register(context, instruction->args[0], POSITION_USE(value), R11);
+    int target = result_register(result, RAX);
+    X86BitOperation operation = op == IR_POPCNT ? BIT_POPCNT : op == IR_CLZ ? BIT_LZCNT : BIT_TZCNT;
+    JITExtension extension = op == IR_POPCNT ? JIT_EXTENSION_POPCNT : op == IR_CLZ ? JIT_EXTENSION_LZCNT : JIT_EXTENSION_BMI1;
+
+    if (context->options->extensions & extension)
+    {
+        if (target != source)
+            x86_alu(assembler, ALU_XOR, target, target);
+        x86_bit_count(assembler, operation, target, source);
+    }
+    else if (op == IR_POPCNT)
+        emit_population_count(assembler, target, source);
+    else
+    {
+        x86_mov_immediate(assembler, RDX, op == IR_CLZ ? -1 : 64);
+        x86_bit_scan(assembler, op == IR_CLZ, target, source);
+        x86_cmov(assembler, CC_E, target, RDX);
+        if (op == IR_CLZ)
+        {
+            x86_neg(assembler, target);
+            x86_alu_immediate(assembler, ALU_ADD, target, 63);
+        }
+    }
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+// lea of the address the selector folded the value and its operands into
+static void emit_lea(CodegenContext *context, IselChoice *choice, int value)
+{
+    int position = POSITION_USE(value);
+    X86Memory address = x86_memory(general_register(context, choice->base, position, RAX), choice->disp);
+    if (choice->index == choice->base)
+        address.index = address.base;
+    else if (choice->index >= 0)
+        address.index = general_register(context, choice->index, position, RDX);
+    address.scale = choice->scale;
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int target = result_register(result, RAX);
+    x86_lea(context->assembler, target, address);
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+static void emit_multiply_immediate(CodegenContext *context, IselChoice *choice, int value)
+{
+    int source = general_register(context, choice->base, POSITION_USE(value), RAX);
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int target = result_register(result, RAX);
+    x86_imul_immediate(context->assembler, target, source, choice->disp);
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+// Two address form with an immediate or a folded load on the right, the
+// result register takes the left operand unless it holds the load's address
+static void emit_selected_binary(CodegenContext *context, IRInstruction *instruction, IselChoice *choice, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    int position = POSITION_USE(value);
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int target = result_register(result, RAX);
+    X86Memory source = x86_memory(RBP, 0);
+    if (choice->form == ISEL_MEMORY)
+    {
+        source = x86_memory(general_register(context, choice->index, position, RDX), choice->disp);
+        if ((int)source.base == target)
+            target = RAX;
+    }
+    emit_move(context, register_location(REGISTER_GENERAL, target), location_of(context, choice->base, position));
+    if (choice->form == ISEL_IMMEDIATE)
+        x86_alu_immediate(assembler, alu_operation(instruction->op), target, choice->disp);
+    else if (instruction->op == IR_MUL)
+        x86_imul_memory(assembler, target, source);
+    else
+        x86_alu_memory(assembler, alu_operation(instruction->op), target, source);
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+// one lane per vector, from a general register or a spill slot
+static void broadcast_value(CodegenContext *context, X86VectorWidth width, int reg, int value, int position)
+{
+    x86_packed_from_general(context->assembler, width, reg, general_register(context, value, position, RAX));
+    x86_packed_broadcast(context->assembler, width, reg);
+}
+
+// 64 bit products from the 32 bit pmuludq: the low halves multiplied plus
+// the cross products shifted up, the high halves multiplied drop out. A
+// square has two equal cross products, and a constant under 2^32 has none
+// of its own.
+static void emit_vector_multiply(X86Assembler *assembler, X86VectorWidth width, IRVectorLoop *loop, int destination, int first, int second)
+{
+    IRVectorNode *constant = &loop->nodes[second];
+    if (loop->nodes[first].op == IR_CONST)
+    {
+        constant = &loop->nodes[first];
+        first = second;
+        second = constant - loop->nodes;
+    }
+    if (first == second || (constant->op == IR_CONST && constant->imm >= 0 && constant->imm <= UINT32_MAX))
+    {
+        x86_packed_shift(assembler, width, PACKED_SHIFT_RIGHT, XMM14, first, 32);
+        x86_packed(assembler, width, PACKED_MULTIPLY_LOW, XMM14, XMM14, second);
+        x86_packed_shift(assembler, width, PACKED_SHIFT_LEFT, XMM14, XMM14, first == second ? 33 : 32);
+    }
+    else
+    {
+        x86_packed_shift(assembler, width, PACKED_SHIFT_RIGHT, XMM14, first, 32);
+        x86_packed(assembler, width, PACKED_MULTIPLY_LOW, XMM14, XMM14, second);
+        x86_packed_shift(assembler, width, PACKED_SHIFT_RIGHT, XMM15, second, 32);
+        x86_packed(assembler, width, PACKED_MULTIPLY_LOW, XMM15, XMM15, first);
+        x86_packed(assembler, width, PACKED_ADD, XMM14, XMM14, XMM15);
+        x86_packed_shift(assembler, width, PACKED_SHIFT_LEFT, XMM14, XMM14, 32);
+    }
+    x86_packed(assembler, width, PACKED_MULTIPLY_LOW, destination, first, second);
+    x86_packed(assembler, width, PACKED_ADD, destination, destination, XMM14);
+}
+
+static void emit_vector_node(X86Assembler *assembler, X86VectorWidth width, IRVectorLoop *loop, int destination)
+{
+    IRVectorNode *node = &loop->nodes[destination];
+    int first = node->args[0];
+    int second = node->args[1];
+    switch ((IROpcode)node->op)
+    {
+    case IR_ADD:
+        x86_packed(assembler, width, PACKED_ADD, destination, first, second);
+        break;
+    case IR_SUB:
+        x86_packed(assembler, width, PACKED_SUB, destination, first, second);
+        break;
+    case IR_AND:
+        x86_packed(assembler, width, PACKED_AND, destination, first, second);
+        break;
+    case IR_OR:
+        x86_packed(assembler, width, PACKED_OR, destination, first, second);
+        break;
+    case IR_MUL:
+        emit_vector_multiply(assembler, width, loop, destination, first, second);
+        break;
+    case IR_NEG:
+        x86_packed(assembler, width, PACKED_XOR, destination, destination, destination);
+        x86_packed(assembler, width, PACKED_SUB, destination, destination, first);
+        break;
+    case IR_NOT:
+        x86_packed(assembler, width, PACKED_EQUAL, destination, destination, destination);
+        x86_packed(assembler, width, PACKED_XOR, destination, destination, first);
+        break;
+    case IR_SHL:
+        x86_packed_shift(assembler, width, PACKED_SHIFT_LEFT, destination, first, (int)node->imm);
+        break;
+    case IR_SHR:
+        x86_packed_shift(assembler, width, PACKED_SHIFT_RIGHT, destination, first, (int)node->imm);
+        break;
+    default:
+        wprintf(L"jit: cannot vectorize %s\n", ir_opcode_info[node->op].name);
+        exit(1);
+    }
+}
+
+// Vectorized loop of a vreduce, see IRVectorLoop. Node n lives in xmm n and
+// the induction step in the register after the last node, the register
+// allocator keeps nothing in vector registers across it. Four lanes take
+// ymm registers and need AVX2, two are plain SSE2.
+static void emit_vector_reduce(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    IRVectorLoop *loop = &context->function->vector_loops[instruction->args[0]];
+    int32_t *operands = &context->function->operands[instruction->imm.list.first];
+    int position = POSITION_USE(value);
+    X86VectorWidth width = loop->lanes == 4 ? VECTOR_AVX_256 : VECTOR_SSE;
+    X86VectorWidth half = loop->lanes == 4 ? VECTOR_AVX_128 : VECTOR_SSE;
+    int step = loop->node_count;
+    int induction = -1;
+    int accumulator = -1;
+
+    // lane k of the induction vector is start + k, the offsets go through the stack
+    for (int k = loop->lanes - 1; k >= 0; k--)
+    {
+        x86_mov_immediate(assembler, RAX, k);
+        x86_push(assembler, RAX);
+    }
+    x86_mov_immediate(assembler, RAX, loop->lanes);
+    x86_packed_from_general(assembler, width, step, RAX);
+    x86_packed_broadcast(assembler, width, step);
+    for (int n = 0; n < loop->node_count; n++)
+    {
+        IRVectorNode *node = &loop->nodes[n];
+        if (node->op == IR_PHI && node->imm == 0)
+        {
+            induction = n;
+            broadcast_value(context, width, n, operands[0], position);
+            x86_packed_load(assembler, width, XMM14, x86_memory(RSP, 0));
+            x86_packed(assembler, width, PACKED_ADD, n, n, XMM14);
+        }
+        else if (node->op == IR_PHI)
+        {
+            // the initial value in the first lane, zero in the others
+            accumulator = n;
+            x86_packed_from_general(assembler, width, n, general_register(context, operands[2], position, RAX));
+        }
+        else if (node->op == IR_CONST)
+        {
+            x86_mov_immediate(assembler, RAX, node->imm);
+            x86_packed_from_general(assembler, width, n, RAX);
+            x86_packed_broadcast(assembler, width, n);
+        }
+        else if (node->op == IR_PARAM)
+            broadcast_value(context, width, n, operands[3 + node->imm], position);
+    }
+    x86_alu_immediate(assembler, ALU_ADD, RSP, 8 * loop->lanes);
+
+    int body = x86_new_label(assembler);
+    int done = x86_new_label(assembler);
+    emit_move(context, register_location(REGISTER_GENERAL, R11), location_of(context, operands[1], position));
+    x86_test(assembler, R11, R11);
+    x86_jcc(assembler, CC_E, done);
+    x86_bind_label(assembler, body);
+    for (int n = 0; n < loop->node_count; n++)
+    {
+        IROpcode op = loop->nodes[n].op;
+        if (op != IR_PHI && op != IR_CONST && op != IR_PARAM)
+            emit_vector_node(assembler, width, loop, n);
+    }
+    x86_packed(assembler, width, PACKED_MOVE, accumulator, accumulator, loop->result);
+    if (induction >= 0)
+        x86_packed(assembler, width, PACKED_ADD, induction, induction, step);
+    x86_alu_immediate(assembler, ALU_SUB, R11, loop->lanes);
+    x86_jcc(assembler, CC_NE, body);
+    x86_bind_label(assembler, done);
+
+    // horizontal sum of the lanes
+    if (width == VECTOR_AVX_256)
+    {
+        x86_extract_high_lanes(assembler, XMM14, accumulator);
+        x86_packed(assembler, half, PACKED_ADD, accumulator, accumulator, XMM14);
+    }
+    x86_packed_swap_halves(assembler, half, XMM14, accumulator);
+    x86_packed(assembler, half, PACKED_ADD, accumulator, accumulator, XMM14);
+    if (width == VECTOR_AVX_256)
+        x86_vzeroupper(assembler);
+    x86_movq_from_xmm(assembler, RAX, accumulator);
+    emit_move(context, location_of(context, value, POSITION_DEFINE(value)), register_location(REGISTER_GENERAL, RAX));
+}
+
+static void push_argument(CodegenContext *context, Location location, RegisterClass register_class)
+{
+    X86Assembler *assembler = context->assembler;
+    if (location.in_memory)
+        x86_load(assembler, RAX, location_memory(location));
+    else if (register_class == REGISTER_FLOAT)
+        x86_movq_from_xmm(assembler, RAX, location.reg);
+    else
+    {
+        x86_push(assembler, location.reg);
+        return;
+    }
+    x86_push(assembler, RAX);
+}
+
+static void emit_call(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    int position = POSITION_USE(value);
+    int32_t *arguments = &context->function->operands[instruction->imm.list.first];
+    int count = instruction->imm.list.count;
+    int used[REGISTER_CLASS_COUNT] = {0, 0};
+    const int limits[REGISTER_CLASS_COUNT] = {INT_ARGUMENT_REGISTERS, FLOAT_ARGUMENT_REGISTERS};
+    bool *on_stack = malloc((count + 1) * sizeof(bool));
+    int stack_count = 0;
+
+    for (int k = 0; k < count; k++)
+    {
+        RegisterClass register_class = class_of_value(context, arguments[k]);
+        on_stack[k] = used[register_class]++ >= limits[register_class];
+        if (on_stack[k])
+            stack_count++;
+    }
+
+    // arguments past the registers are pushed last to first, rsp stays 16 byte aligned
+    if (stack_count & 1)
+        x86_alu_immediate(assembler, ALU_SUB, RSP, 8);
+    for (int k = count - 1; k >= 0; k--)
+    {
+        if (on_stack[k])
+            push_argument(context, location_of(context, arguments[k], position), class_of_value(context, arguments[k]));
+    }
+
+    used[REGISTER_GENERAL] = used[REGISTER_FLOAT] = 0;
+    for (int k = 0; k < count; k++)
+    {
+        RegisterClass register_class = class_of_value(context, arguments[k]);
+        int index = used[register_class]++;
+        if (on_stack[k])
+            continue;
+        int reg = register_class == REGISTER_FLOAT ? float_argument_registers[index] : int_argument_registers[index];
+        add_move(context, register_location(register_class, reg), location_of(context, arguments[k], position), register_class);
+    }
+    emit_parallel_moves(context);
+    free(on_stack);
+
+    if (instruction->op == IR_CALL_EXTERN)
+    {
+        x86_call_indirect(assembler, context->extern_labels[instruction->args[0]]);
+        if (context->module->externs[instruction->args[0]].int32_result)
+            x86_movsxd(assembler, RAX, RAX);
+    }
+    else
+        x86_call(assembler, context->function_labels[instruction->args[0]]);
+    if (stack_count > 0)
+        x86_alu_immediate(assembler, ALU_ADD, RSP, 8 * (stack_count + (stack_count & 1)));
+
+    if (instruction->type == IR_FLOAT)
+        emit_move(context, location_of(context, value, POSITION_DEFINE(value)), register_location(REGISTER_FLOAT, XMM0));
+    else if (instruction->type == IR_INT)
+        emit_move(context, location_of(context, value, POSITION_DEFINE(value)), register_location(REGISTER_GENERAL, RAX));
+}
+
+static void emit_constant(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    X86Assembler *assembler = context->assembler;
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    if (result.in_memory)
+    {
+        x86_mov_immediate(assembler, RAX, instruction->imm.i);
+        x86_store(assembler, location_memory(result), RAX);
+    }
+    else if (instruction->type == IR_FLOAT)
+    {
+        if (instruction->imm.i == 0)
+            x86_xorpd(assembler, result.reg, result.reg);
+        else
+        {
+            x86_mov_immediate(assembler, RAX, instruction->imm.i);
+            x86_movq_to_xmm(assembler, result.reg, RAX);
+        }
+    }
+    else
+        x86_mov_immediate(assembler, result.reg, instruction->imm.i);
+}
+
+static void emit_branch(CodegenContext *context, IRInstruction *instruction, int value, int block, int next_block)
+{
+    X86Assembler *assembler = context->assembler;
+    int target = instruction->imm.jump.target;
+    int other = instruction->imm.jump.other;
+    X86Condition condition = test_condition(context, instruction->args[0], POSITION_USE(value));
+
+    add_edge_moves(context, block, target);
+    if (context->moves.count == 0 && target == next_block)
+    {
+        // the layout put the taken side next, branch to the other one
+        add_edge_moves(context, block, other);
+        if (context->moves.count == 0)
+        {
+            x86_jcc(assembler, negated(condition), context->block_labels[other]);
+            return;
+        }
+        int true_edge = x86_new_label(assembler);
+        x86_jcc(assembler, condition, true_edge);
+        emit_parallel_moves(context);
+        x86_jmp(assembler, context->block_labels[other]);
+        x86_bind_label(assembler, true_edge);
+        return;
+    }
+    if (context->moves.count == 0)
+    {
+        x86_jcc(assembler, condition, context->block_labels[target]);
+        emit_edge(context, block, other, next_block);
+        return;
+    }
+    int false_edge = x86_new_label(assembler);
+    x86_jcc(assembler, negated(condition), false_edge);
+    emit_parallel_moves(context);
+    x86_jmp(assembler, context->block_labels[target]);
+    x86_bind_label(assembler, false_edge);
+    emit_edge(context, block, other, next_block);
+}
+
+// cmov picks the taken value over the other one
+static void emit_select(CodegenContext *context, IRInstruction *instruction, int value)
+{
+    int position = POSITION_USE(value);
+    X86Condition condition = test_condition(context, instruction->args[0], position);
+    Location taken = location_of(context, instruction->args[1], position);
+    Location other = location_of(context, instruction->args[2], position);
+    Location result = location_of(context, value, POSITION_DEFINE(value));
+    int target = result_register(result, RAX);
+
+    // moves leave the flags alone, the taken value may be in the register
+    // the result gets
+    if (!taken.in_memory && taken.reg == target)
+    {
+        Location swap = taken;
+        taken = other;
+        other = swap;
+        condition = negated(condition);
+    }
+    emit_move(context, register_location(REGISTER_GENERAL, target), other);
+    int source = RDX;
+    if (!taken.in_memory)
+        source = taken.reg;
+    else
+        emit_move(context, register_location(REGISTER_GENERAL, RDX), taken);
+    x86_cmov(context->assembler, condition, target, source);
+    emit_move(context, result, register_location(REGISTER_GENERAL, target));
+}
+
+static void emit_instruction(CodegenContext *context, int value, int block, int next_block)
+{
+    X86Assembler *assembler = context->assembler;
+    IRInstruction *instruction = &context->function->instructions[value];
+    int position = POSITION_USE(value);
+    bool is_float = instruction->type == IR_FLOAT;
+    IselChoice *choice = &context->selection->choices[value];
+
+    switch ((IselForm)choice->form)
+    {
+    case ISEL_FOLDED:
+        return;
+    case ISEL_LEA:
+        emit_lea(context, choice, value);
+        return;
+    case ISEL_MULTIPLY_IMMEDIATE:
+        emit_multiply_immediate(context, choice, value);
+        return;
+    case ISEL_MEMORY:
+        emit_selected_binary(context, instruction, choice, value);
+        return;
+    case ISEL_IMMEDIATE:
+        // compares with an immediate are emitted below
+        if (instruction->op == IR_AND || instruction->op == IR_OR)
+        {
+            emit_selected_binary(context, instruction, choice, value);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+
+    switch ((IROpcode)instruction->op)
+    {
+    case IR_NOP:
+    case IR_PHI:
+    case IR_PARAM:
+        break;
+    case IR_CONST:
+        emit_constant(context, instruction, value);
+        break;
+    case IR_ADD:
+    case IR_MUL:
+    case IR_SUB:
+    case IR_AND:
+    case IR_OR:
+        emit_binary(context, instruction, value);
+        break;
+    case IR_MULHI:
+        emit_multiply_high(context, instruction, value);
+        break;
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR:
+        emit_shift(context, instruction, value);
+        break;
+    case IR_DIV:
+        if (is_float)
+            emit_binary(context, instruction, value);
+        else
+            emit_division(context, instruction, value);
+        break;
+    case IR_POW:
+        emit_power(context, instruction, value);
+        break;
+    case IR_NEG:
+    case IR_NOT:
+    {
+        if (is_float)
+        {
+            emit_float_sign(context, instruction, value, ALU_XOR, INT64_MIN);
+            break;
+        }
+        Location result = location_of(context, value, POSITION_DEFINE(value));
+        Location operand = location_of(context, instruction->args[0], position);
+        int target = result_register(result, RAX);
+        emit_move(context, register_location(REGISTER_GENERAL, target), operand);
+        if (instruction->op == IR_NEG)
+            x86_neg(assembler, target);
+        else
+            x86_not(assembler, target);
+        emit_move(context, result, register_location(REGISTER_GENERAL, target));
+        break;
+    }
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    {
+        bool fused = fuses_compare(context, value, block);
+        if (class_of_value(context, instruction->args[0]) == REGISTER_FLOAT)
+        {
+            emit_float_compare(context, instruction, value, fused);
+            break;
+        }
+        int left = general_register(context, instruction->args[0], position, RAX);
+        if (choice->form == ISEL_IMMEDIATE)
+            x86_alu_immediate(assembler, ALU_CMP, left, choice->disp);
+        else
+            emit_alu(context, ALU_CMP, left, location_of(context, instruction->args[1], position));
+        if (fused)
+        {
+            keep_in_flags(context, value, int_condition(instruction->op));
+            break;
+        }
+        Location result = location_of(context, value, POSITION_DEFINE(value));
+        int target = result_register(result, RAX);
+        x86_setcc(assembler, int_condition(instruction->op), target);
+        x86_movzx_byte(assembler, target, target);
+        emit_move(context, result, register_location(REGISTER_GENERAL, target));
+        break;
+    }
+    case IR_SELECT:
+        emit_select(context, instruction, value);
+        break;
+    case IR_ITOF:
+    {
+        int source = general_register(context, instruction->args[0], position, RAX);
+        Location result = location_of(context, value, POSITION_DEFINE(value));
+        int target = result_register(result, XMM14);
+        // cvtsi2sd keeps the upper half of target, clearing it first breaks
+        // the dependency on whatever wrote target last
+        x86_xorpd(assembler, target, target);
+        x86_cvtsi2sd(assembler, target, source);
+        emit_move(context, result, register_location(REGISTER_FLOAT, target));
+        break;
+    }
+    case IR_FTOI:
+    {
+        int source = float_register(context, instruction->args[0], position, XMM14);
+        Location result = location_of(context, value, POSITION_DEFINE(value));
+        int target = result_register(result, RAX);
+        x86_cvttsd2si(assembler, target, source);
+        emit_move(context, result, register_location(REGISTER_GENERAL, target));
+        break;
+    }
+    case IR_SQRT:
+        emit_square_root(context, instruction, value);
+        break;
+    case IR_FMA:
+        emit_fused_multiply_add(context, instruction, value);
+        break;
+    case IR_MIN:
+    case IR_MAX:
+        if (is_float)
+            emit_binary(context, instruction, value);
+        else
+            emit_int_min_max(context, instruction, value);
+        break;
+    case IR_ABS:
+        emit_absolute(context, instruction, value);
+        break;
+    case IR_POPCNT:
+    case IR_CLZ:
+    case IR_CTZ:
+        emit_bit_count(context, instruction, value);
+        break;
+    case IR_CALL:
+    case IR_CALL_EXTERN:
+        emit_call(context, instruction, value);
+        break;
+    case IR_VREDUCE:
+        emit_vector_reduce(context, instruction, value);
+        break;
+    case IR_LOAD:
+    {
+        X86Memory source = x86_memory(general_register(context, instruction->args[0], position, RAX), (int32_t)instruction->imm.i);
+        Location result = location_of(context, value, POSITION_DEFINE(value));
+        int target = result_register(result, is_float ? XMM14 : RAX);
+        if (is_float)
+            x86_movsd_load(assembler, target, source);
+        else
+            x86_load(assembler, target, source);
+        emit_move(context, result, register_location(register_class_of(instruction->type), target));
+        break;
+    }
+    case IR_JUMP:
+        emit_edge(context, block, instruction->imm.jump.target, next_block);
+        break;
+    case IR_BRANCH:
+        emit_branch(context, instruction, value, block, next_block);
+        break;
+    case IR_RETURN:
+        if (instruction->args[0] >= 0)
+        {
+            int reg = context->function->return_type == IR_FLOAT ? XMM0 : RAX;
+            emit_move(context, register_location(class_of_value(context, instruction->args[0]), reg), location_of(context, instruction->args[0], position));
+        }
+        if (next_block >= 0)
+            x86_jmp(assembler, context->epilogue);
+        break;
+    default:
+        if (instruction->op < IR_OPCODE_COUNT)
+            wprintf(L"jit: cannot compile %s\n", ir_opcode_info[instruction->op].name);
+        else
+            wprintf(L"jit: cannot compile opcode %d\n", (int)instruction->op);
+        exit(1);
+    }
+}
+
+static void emit_prologue(CodegenContext *context)
+{
+    X86Assembler *assembler = context->assembler;
+    IRFunction *function = context->function;
+    Allocation *allocation = context->allocation;
+
+    x86_push(assembler, RBP);
+    x86_mov(assembler, RBP, RSP);
+    for (int k = 0; k < context->saved_count; k++)
+    {
+        x86_push(assembler, context->saved[k]);
+    }
+    // rsp is 16 byte aligned again after the return address, rbp and the saved registers
+    int frame_size = 8 * allocation->slot_count;
+    if ((context->saved_count * 8 + frame_size) % 16 != 0)
+        frame_size += 8;
+    if (frame_size > 0)
+        x86_alu_immediate(assembler, ALU_SUB, RSP, frame_size);
+
+    int check = x86_new_label(assembler);
+    x86_bind_label(assembler, check);
+    context->stack_checks[context->stack_check_count++] = check;
+    x86_alu_thread_local(assembler, ALU_CMP, RSP, jit_stack_limit_offset());
+    x86_jcc(assembler, CC_B, context->overflow_trap);
+
+    // parameters move from the argument registers and the caller's frame to their intervals
+    int used[REGISTER_CLASS_COUNT] = {0, 0};
+    int stack_count = 0;
+    int *param_values = malloc((function->param_count + 1) * sizeof(int));
+    for (int i = 0; i < function->param_count; i++)
+    {
+        param_values[i] = -1;
+    }
+    for (int value = 0; value < function->instruction_count; value++)
+    {
+        if (function->instructions[value].op == IR_PARAM)
+            param_values[function->instructions[value].imm.i] = value;
+    }
+    for (int i = 0; i < function->param_count; i++)
+    {
+        RegisterClass register_class = register_class_of(function->param_types[i]);
+        int index = used[register_class]++;
+        Location source;
+        if (register_class == REGISTER_FLOAT && index < FLOAT_ARGUMENT_REGISTERS)
+            source = register_location(REGISTER_FLOAT, float_argument_registers[index]);
+        else if (register_class == REGISTER_GENERAL && index < INT_ARGUMENT_REGISTERS)
+            source = register_location(REGISTER_GENERAL, int_argument_registers[index]);
+        else
+            source = memory_location(16 + 8 * stack_count++);
+        int value = param_values[i];
+        if (value >= 0)
+            add_move(context, location_of(context, value, 0), source, register_class);
+    }
+    emit_parallel_moves(context);
+    free(param_values);
+}
+
+static void emit_epilogue(CodegenContext *context)
+{
+    X86Assembler *assembler = context->assembler;
+    x86_bind_label(assembler, context->epilogue);
+    if (context->saved_count > 0)
+    {
+        x86_lea(assembler, RSP, x86_memory(RBP, -8 * context->saved_count));
+        for (int k = context->saved_count - 1; k >= 0; k--)
+        {
+            x86_pop(assembler, context->saved[k]);
+        }
+    }
+    else
+        x86_mov(assembler, RSP, RBP);
+    x86_pop(assembler, RBP);
+    x86_ret(assembler);
+}
+
+static int compare_split_starts(const void *left, const void *right, void *data)
+{
+    Allocation *allocation = data;
+    return allocation->intervals[*(const int *)left].ranges[0].from - allocation->intervals[*(const int *)right].ranges[0].from;
+}
+
+static void collect_splits(CodegenContext *context)
+{
+    Allocation *allocation = context->allocation;
+    context->splits = malloc((allocation->interval_count + 1) * sizeof(int));
+    context->split_count = 0;
+    context->next_split = 0;
+    for (int index = 0; index < allocation->interval_count; index++)
+    {
+        if (allocation->intervals[index].next >= 0)
+            context->splits[context->split_count++] = allocation->intervals[index].next;
+    }
+    qsort_r(context->splits, context->split_count, sizeof(int), compare_split_starts, allocation);
+}
+
+// moves at the split points in front of value, split points at block starts are edge moves
+static void emit_split_moves(CodegenContext *context, int value, bool block_start)
+{
+    Allocation *allocation = context->allocation;
+    int position = POSITION_USE(value);
+    while (context->next_split < context->split_count)
+    {
+        LiveInterval *interval = &allocation->intervals[context->splits[context->next_split]];
+        if (interval->ranges[0].from > position)
+            break;
+        context->next_split++;
+        if (interval->ranges[0].from == position && !block_start)
+            add_move(context, location_of(context, interval->value, position), location_of(context, interval->value, position - 1), interval->register_class);
+    }
+    emit_parallel_moves(context);
+}
+
+// Blocks are emitted in layout order, the split points of a block are the
+// ones after the last instruction of the block before it in IR order
+static void seek_splits(CodegenContext *context, int first)
+{
+    int low = 0;
+    int high = context->split_count;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (context->allocation->intervals[context->splits[middle]].ranges[0].from <= POSITION_USE(first - 1))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    context->next_split = low;
+}
+
+static int *count_uses(IRFunction *function)
+{
+    int *counts = calloc(function->instruction_count + 1, sizeof(int));
+    for (int i = 0; i < function->instruction_count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+        for (int k = 0; k < info->value_args; k++)
+        {
+            if (instruction->args[k] >= 0)
+                counts[instruction->args[k]]++;
+        }
+        if (!info->has_list)
+            continue;
+        int stride = instruction->op == IR_PHI ? 2 : 1;
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            counts[function->operands[instruction->imm.list.first + k * stride + stride - 1]]++;
+        }
+    }
+    return counts;
+}
+
+static void compile_function(CodegenContext *context, IRFunction *function, int label)
+{
+    X86Assembler *assembler = context->assembler;
+    JITStats *stats = &context->native->stats;
+    context->function = function;
+    context->selection = select_instructions(function, context->options->select_patterns);
+    context->allocation = allocate_registers(function, context->selection, &context->target, !context->options->allocate_registers);
+    context->epilogue = x86_new_label(assembler);
+    context->division_trap = x86_new_label(assembler);
+    context->overflow_trap = x86_new_label(assembler);
+    context->block_labels = malloc((function->block_count + 1) * sizeof(int));
+    context->use_counts = count_uses(function);
+
+    Allocation *allocation = context->allocation;
+    context->saved_count = 0;
+    for (int k = 0; k < MAX_SAVED_REGISTERS; k++)
+    {
+        if (allocation->used_registers[REGISTER_GENERAL] & (1u << callee_saved_registers[k]))
+            context->saved[context->saved_count++] = callee_saved_registers[k];
+    }
+    stats->values += function->instruction_count;
+    stats->intervals += allocation->interval_count;
+    stats->splits += allocation->split_count;
+    stats->spilled += allocation->spilled_count;
+    stats->spill_slots += allocation->slot_count;
+    stats->folded += context->selection->folded;
+
+    for (int b = 0; b < function->block_count; b++)
+    {
+        context->block_labels[b] = x86_new_label(assembler);
+    }
+    collect_splits(context);
+    int *order = malloc((function->block_count + 1) * sizeof(int));
+    layout_blocks(function, context->module->profile, order, &stats->layout);
+
+    x86_bind_label(assembler, label);
+    emit_prologue(context);
+
+    for (int k = 0; k < function->block_count; k++)
+    {
+        int b = order[k];
+        IRBlock *block = &function->blocks[b];
+        int next_block = k + 1 < function->block_count ? order[k + 1] : -1;
+        x86_bind_label(assembler, context->block_labels[b]);
+        seek_splits(context, block->first);
+        context->flags_value = -1;
+        for (int value = block->first; value < block->first + block->count; value++)
+        {
+            emit_split_moves(context, value, value == block->first);
+            emit_instruction(context, value, b, next_block);
+        }
+    }
+
+    emit_epilogue(context);
+
+    x86_bind_label(assembler, context->division_trap);
+    x86_mov_immediate(assembler, RDI, JIT_TRAP_DIVISION_BY_ZERO);
+    call_helper(context, JIT_HELPER_TRAP);
+
+    x86_bind_label(assembler, context->overflow_trap);
+    x86_mov_immediate(assembler, RDI, JIT_TRAP_STACK_OVERFLOW);
+    call_helper(context, JIT_HELPER_TRAP);
+
+    free(order);
+    free(context->block_labels);
+    free(context->use_counts);
+    free(context->splits);
+    free_allocation(allocation);
+    free_selection(context->selection);
+}
+
+static void describe_function(JITFunction *native, IRFunction *function, void *entry)
+{
+    native->entry = entry;
+    native->param_count = function->param_count;
+    native->param_types = malloc(function->param_count + 1);
+    memcpy(native->param_types, function->param_types, function->param_count);
+    native->return_type = function->return_type;
+}
+
+// compiles the functions marked in selected and osr when there is one, the
+// others keep a NULL entry
+// The calls through the helper table and the reads of the stack limit, the
+// code an object file cannot take as it is
+static void record_relocations(CodegenContext *context)
+{
+    X86Assembler *assembler = context->assembler;
+    JITModule *jit = context->native;
+    jit->relocations = malloc((assembler->fixup_count + context->stack_check_count + 1) * sizeof(JITRelocation));
+    for (int f = 0; f < assembler->fixup_count; f++)
+    {
+        for (int h = 0; h < JIT_HELPER_COUNT; h++)
+        {
+            if (assembler->fixups[f].label == context->helper_labels[h])
+                jit->relocations[jit->relocation_count++] = (JITRelocation){assembler->fixups[f].position, JIT_RELOCATION_HELPER, h};
+        }
+        for (int e = 0; e < context->module->extern_count; e++)
+        {
+            if (assembler->fixups[f].label == context->extern_labels[e])
+                jit->relocations[jit->relocation_count++] = (JITRelocation){assembler->fixups[f].position, JIT_RELOCATION_HELPER, JIT_HELPER_COUNT + e};
+        }
+    }
+    for (int c = 0; c < context->stack_check_count; c++)
+    {
+        int position = assembler->labels[context->stack_checks[c]] + X86_THREAD_LOCAL_OFFSET;
+        jit->relocations[jit->relocation_count++] = (JITRelocation){position, JIT_RELOCATION_STACK_LIMIT, 0};
+    }
+}
+
+static JITModule *compile_functions(CodeHeap *heap, IRModule *module, const bool *selected, IRFunction *osr, const JITOptions *options)
+{
+    X86Assembler *assembler = init_assembler();
+    JITModule *jit = calloc(1, sizeof(JITModule));
+    CodegenContext context;
+    memset(&context, 0, sizeof(CodegenContext));
+    context.assembler = assembler;
+    context.module = module;
+    context.native = jit;
+    context.options = options;
+    init_register_target(&context.target);
+    context.target.fma_calls = !(options->extensions & JIT_EXTENSION_FMA);
+    context.function_labels = malloc((module->function_count + 1) * sizeof(int));
+    context.stack_checks = malloc((module->function_count + 1) * sizeof(int));
+
+    for (int f = 0; f < module->function_count; f++)
+    {
+        context.function_labels[f] = x86_new_label(assembler);
+    }
+    for (int h = 0; h < JIT_HELPER_COUNT; h++)
+    {
+        context.helper_labels[h] = x86_new_label(assembler);
+    }
+    context.extern_labels = malloc((module->extern_count + 1) * sizeof(int));
+    for (int e = 0; e < module->extern_count; e++)
+    {
+        context.extern_labels[e] = x86_new_label(assembler);
+    }
+    for (int f = 0; f < module->function_count; f++)
+    {
+        if (selected[f])
+            compile_function(&context, module->functions[f], context.function_labels[f]);
+    }
+    int osr_label = x86_new_label(assembler);
+    if (osr)
+        compile_function(&context, osr, osr_label);
+
+    if (options->peephole)
+        peephole_pass(assembler, &jit->stats.peephole);
+    x86_align(assembler, 8);
+    jit->helpers = assembler->size;
+    for (int h = 0; h < JIT_HELPER_COUNT; h++)
+    {
+        x86_bind_label(assembler, context.helper_labels[h]);
+        x86_data64(assembler, (int64_t)(intptr_t)jit_helper_address(h));
+    }
+    for (int e = 0; e < module->extern_count; e++)
+    {
+        x86_bind_label(assembler, context.extern_labels[e]);
+        x86_data64(assembler, (int64_t)(intptr_t)module->externs[e].address);
+    }
+    if (!x86_resolve_fixups(assembler))
+    {
+        wprintf(L"jit: unresolved label\n");
+        exit(1);
+    }
+
+    record_relocations(&context);
+
+    uint8_t *memory = code_heap_allocate(heap, assembler->size);
+    code_heap_write(heap, memory, 0, assembler->code, assembler->size);
+
+    jit->heap = heap;
+    jit->memory = memory;
+    jit->size = assembler->size;
+    jit->stats.instructions = assembler->instruction_count;
+    jit->function_count = module->function_count;
+    jit->extern_count = module->extern_count;
+    jit->entry = module->entry;
+    jit->functions = malloc((module->function_count + 1) * sizeof(JITFunction));
+    for (int f = 0; f < module->function_count; f++)
+    {
+        describe_function(&jit->functions[f], module->functions[f], selected[f] ? memory + assembler->labels[context.function_labels[f]] : NULL);
+    }
+    if (osr)
+        describe_function(&jit->osr, osr, memory + assembler->labels[osr_label]);
+
+    free(context.function_labels);
+    free(context.extern_labels);
+    free(context.stack_checks);
+    free(context.moves.items);
+    free_assembler(assembler);
+    return jit;
+}
+
+JITModule *jit_compile_module(CodeHeap *heap, IRModule *module, const JITOptions *options)
+{
+    bool *selected = malloc((module->function_count + 1) * sizeof(bool));
+    memset(selected, true, module->function_count * sizeof(bool));
+    JITModule *jit = compile_functions(heap, module, selected, NULL, options);
+    free(selected);
+    return jit;
+}
+
+// marks the functions root can reach through calls
+static void select_callees(IRModule *module, IRFunction *root, bool *selected)
+{
+    int *work = malloc((module->function_count + 1) * sizeof(int));
+    int work_count = 0;
+    IRFunction *ir_function = root;
+    while (ir_function)
+    {
+        for (int value = 0; value < ir_function->instruction_count; value++)
+        {
+            int callee = ir_function->instructions[value].args[0];
+            if (ir_function->instructions[value].op != IR_CALL || selected[callee])
+                continue;
+            selected[callee] = true;
+            work[work_count++] = callee;
+        }
+        ir_function = work_count > 0 ? module->functions[work[--work_count]] : NULL;
+    }
+    free(work);
+}
+
+// Compiles function together with every function it can reach through
+// calls, so the native code never has to call back into the interpreter.
+JITModule *jit_compile_function(CodeHeap *heap, IRModule *module, int function, const JITOptions *options)
+{
+    bool *selected = calloc(module->function_count + 1, sizeof(bool));
+    selected[function] = true;
+    select_callees(module, module->functions[function], selected);
+    JITModule *jit = compile_functions(heap, module, selected, NULL, options);
+    free(selected);
+    return jit;
+}
+
+// Compiles an on-stack replacement variant from lower_osr_function with
+// the functions it can reach, its entry is JITModule.osr.
+JITModule *jit_compile_osr(CodeHeap *heap, IRModule *module, IRFunction *osr, const JITOptions *options)
+{
+    bool *selected = calloc(module->function_count + 1, sizeof(bool));
+    select_callees(module, osr, selected);
+    JITModule *jit = compile_functions(heap, module, selected, osr, options);
+    free(selected);
+    return jit;
+}
+
+// jit_call passes arguments in registers only
+bool jit_call_supported(int param_count, const uint8_t *param_types)
+{
+    int int_count = 0;
+    int float_count = 0;
+    for (int i = 0; i < param_count; i++)
+    {
+        if (param_types[i] == IR_FLOAT)
+            float_count++;
+        else
+            int_count++;
+    }
+    return int_count <= INT_ARGUMENT_REGISTERS && float_count <= FLOAT_ARGUMENT_REGISTERS;
+}
+
+void free_jit_module(JITModule *module)
+{
+    for (int f = 0; f < module->function_count; f++)
+    {
+        free(module->functions[f].param_types);
+    }
+    free(module->osr.param_types);
+    free(module->functions);
+    free(module->relocations);
+    code_heap_release(module->heap, module->memory);
+    free(module);
+}
+
+// lowest address of the stack of this thread, 0 until entry_stack_limit
+// looks it up
+static __thread uintptr_t stack_end;
+
+// Native frames may use JIT_STACK_RESERVE bytes below the caller at sp,
+// less when the stack of the thread ends before that
+static uintptr_t entry_stack_limit(uintptr_t sp)
+{
+    if (stack_end == 0)
+    {
+        pthread_attr_t attributes;
+        void *address;
+        size_t size;
+        if (pthread_getattr_np(pthread_self(), &attributes) == 0)
+        {
+            if (pthread_attr_getstack(&attributes, &address, &size) == 0)
+                stack_end = (uintptr_t)address;
+            pthread_attr_destroy(&attributes);
+        }
+    }
+    uintptr_t limit = sp > JIT_STACK_RESERVE ? sp - JIT_STACK_RESERVE : 0;
+    if (stack_end != 0 && stack_end + JIT_STACK_MARGIN > limit)
+        limit = stack_end + JIT_STACK_MARGIN;
+    return limit;
+}
+
+typedef int64_t (*IntEntry)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, double, double, double, double, double, double, double, double);
+typedef double (*FloatEntry)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, double, double, double, double, double, double, double, double);
+
+// Calls a compiled function from C. Int and float arguments are assigned to
+// registers independently, so passing every argument register and letting
+// the callee ignore the unused ones works for any signature that fits in
+// registers.
+static JITStatus call_entry(JITFunction *function, const JITValue *arguments, JITValue *result, const char **error)
+{
+    int64_t ints[INT_ARGUMENT_REGISTERS] = {0};
+    double floats[FLOAT_ARGUMENT_REGISTERS] = {0};
+    int int_count = 0;
+    int float_count = 0;
+
+    for (int i = 0; i < function->param_count; i++)
+    {
+        if (function->param_types[i] == IR_FLOAT ? float_count >= FLOAT_ARGUMENT_REGISTERS : int_count >= INT_ARGUMENT_REGISTERS)
+        {
+            *error = "too many arguments for jit_call";
+            return JIT_ERROR;
+        }
+        if (function->param_types[i] == IR_FLOAT)
+            floats[float_count++] = arguments[i].f;
+        else
+            ints[int_count++] = arguments[i].i;
+    }
+
+    jmp_buf target;
+    jmp_buf *outer = trap_target;
+    uintptr_t outer_limit = stack_limit;
+    if (outer_limit == 0)
+        stack_limit = entry_stack_limit((uintptr_t)&target);
+    int trap = setjmp(target);
+    if (trap != JIT_TRAP_NONE)
+    {
+        trap_target = outer;
+        stack_limit = outer_limit;
+        *error = jit_trap_message(trap);
+        return JIT_ERROR;
+    }
+    trap_target = &target;
+
+    if (function->return_type == IR_FLOAT)
+        result->f = ((FloatEntry)function->entry)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], floats[0], floats[1], floats[2], floats[3], floats[4], floats[5], floats[6], floats[7]);
+    else
+        result->i = ((IntEntry)function->entry)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], floats[0], floats[1], floats[2], floats[3], floats[4], floats[5], floats[6], floats[7]);
+
+    trap_target = outer;
+    stack_limit = outer_limit;
+    return JIT_OK;
+}
+
+JITStatus jit_call(JITModule *module, int function, const JITValue *arguments, JITValue *result, const char **error)
+{
+    return call_entry(&module->functions[function], arguments, result, error);
+}
+
+// Continues an interpreted activation in the OSR variant of module. frame
+// holds the variables of the function by slot and is only read.
+JITStatus jit_call_osr(JITModule *module, const JITValue *frame, JITValue *result, const char **error)
+{
+    JITValue address = {.i = (int64_t)(intptr_t)frame};
+    return call_entry(&module->osr, &address, result, error);
+}
@@ -0,0 +1,135 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../ir/ir.h"
+#include "code_heap.h"
+#include "peephole.h"
+#include "layout.h"
+
+#ifndef JIT_H
+#define JIT_H
+
+// arguments jit_call can pass, all of them in registers
+#define JIT_CALL_ARGUMENTS 14
+
+typedef union
+{
+    int64_t i;
+    double f;
+} JITValue;
+
+typedef enum
+{
+    JIT_OK,
+    JIT_ERROR
+} JITStatus;
+
+// runtime errors raised by native code, passed to longjmp
+typedef enum
+{
+    JIT_TRAP_NONE,
+    JIT_TRAP_DIVISION_BY_ZERO,
+    JIT_TRAP_STACK_OVERFLOW
+} JITTrap;
+
+// C functions native code calls. It calls them through a table of their
+// addresses behind the code of its module, the only part of the code that
+// depends on where the process loaded them.
+typedef enum
+{
+    JIT_HELPER_TRAP,
+    JIT_HELPER_POW,
+    JIT_HELPER_FMA, // without JIT_EXTENSION_FMA
+    JIT_HELPER_COUNT
+} JITHelper;
+
+typedef struct
+{
+    void *entry; // System V callable with the IR signature
+    int param_count;
+    uint8_t *param_types;
+    uint8_t return_type;
+} JITFunction;
+
+// Instruction set extensions beyond the x86-64 baseline the code may use,
+// the intrinsics take a longer sequence or a call without them
+typedef enum
+{
+    JIT_EXTENSION_POPCNT = 1,
+    JIT_EXTENSION_LZCNT = 2,
+    JIT_EXTENSION_BMI1 = 4, // tzcnt
+    JIT_EXTENSION_FMA = 8
+} JITExtension;
+
+typedef struct
+{
+    bool allocate_registers; // false keeps every value in a stack slot
+    bool select_patterns; // false emits every value with an instruction of its own
+    bool peephole; // false leaves the code as emitted, see jit/peephole.c
+    unsigned extensions; // JITExtension flags, see jit_cpu_extensions
+} JITOptions;
+
+// totals over the functions of a module, printed by --jit-stats
+typedef struct
+{
+    int values;
+    int intervals;
+    int splits;
+    int spilled; // intervals living in a spill slot
+    int spill_slots;
+    int moves; // register and stack moves between value locations
+    int fused; // compares left in the flags for the branch or select after them
+    int folded; // values folded into the instruction of a user, see jit/isel.c
+    int instructions; // machine instructions emitted
+    PeepholeStats peephole;
+    LayoutStats layout;
+} JITStats;
+
+// place in the code of a module that an object file leaves to the linker,
+// see jit/elf.c
+typedef enum
+{
+    JIT_RELOCATION_HELPER, // rel32 of a call through a slot of the helper table
+    JIT_RELOCATION_STACK_LIMIT // thread pointer offset of the stack limit
+} JITRelocationKind;
+
+typedef struct
+{
+    int position; // first byte of the 32 bit field
+    uint8_t kind;
+    int slot; // a JITHelper, or JIT_HELPER_COUNT plus an extern function
+} JITRelocation;
+
+// Native code of an IR module, or of the functions reachable from one of
+// its functions, in one code heap allocation. Functions that were not
+// compiled have a NULL entry.
+typedef struct
+{
+    CodeHeap *heap;
+    uint8_t *memory;
+    size_t size;
+    JITFunction *functions;
+    int function_count;
+    int entry;
+    JITFunction osr; // entry of an on-stack replacement variant, NULL when there is none
+    size_t helpers; // offset of the helper table in memory, JIT_HELPER_COUNT addresses
+    int extern_count; // addresses of the extern functions after those of the helpers
+    JITRelocation *relocations;
+    int relocation_count;
+    JITStats stats;
+} JITModule;
+
+JITModule *jit_compile_module(CodeHeap *heap, IRModule *module, const JITOptions *options);
+JITModule *jit_compile_function(CodeHeap *heap, IRModule *module, int function, const JITOptions *options);
+JITModule *jit_compile_osr(CodeHeap *heap, IRModule *module, IRFunction *osr, const JITOptions *options);
+bool jit_call_supported(int param_count, const uint8_t *param_types);
+void free_jit_module(JITModule *module);
+JITStatus jit_call(JITModule *module, int function, const JITValue *arguments, JITValue *result, const char **error);
+JITStatus jit_call_osr(JITModule *module, const JITValue *frame, JITValue *result, const char **error);
+const char *jit_trap_message(JITTrap trap);
+bool jit_supports_avx2();
+unsigned jit_cpu_extensions();
+void *jit_helper_address(JITHelper helper);
+int32_t jit_stack_limit_offset();
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "layout.h"
+#include "../defc/defc.h"
+
+// Order in which the code generator emits the blocks of a function. Without
+// a profile that is the IR order. With one, every block is followed by its
+// more frequent successor where it can be, so the hot path of a biased
+// branch falls through and the branch jumps to the rare side. Blocks only
+// reached over branch sides the profile saw often enough but never taken
+// are cold and go to the end of the function, out of the way of the warm
+// code. A branch finds its counts by its source node, see ir/ir_profile.c.
+
+typedef struct
+{
+    IRFunction *function;
+    uint64_t (*weights)[2]; // of the branch ending a block: other, target
+    bool *sampled; // the branch ending a block ran PROFILE_MIN_SAMPLES times
+    bool *warm;
+    bool *placed;
+} Layout;
+
+static IRInstruction *terminator(IRFunction *function, int block)
+{
+    IRBlock *range = &function->blocks[block];
+    return &function->instructions[range->first + range->count - 1];
+}
+
+// a branch side the profile never saw taken after enough samples
+static bool is_cold_edge(Layout *layout, int block, int side)
+{
+    return layout->sampled[block] && layout->weights[block][side] == 0;
+}
+
+static void push_warm(Layout *layout, int *worklist, int *count, int block)
+{
+    if (layout->warm[block])
+        return;
+    layout->warm[block] = true;
+    worklist[(*count)++] = block;
+}
+
+// blocks reached from the entry without taking a cold edge
+static void mark_warm(Layout *layout)
+{
+    int *worklist = malloc((layout->function->block_count + 1) * sizeof(int));
+    int count = 0;
+    push_warm(layout, worklist, &count, 0);
+    while (count > 0)
+    {
+        int block = worklist[--count];
+        IRInstruction *instruction = terminator(layout->function, block);
+        if (instruction->op == IR_JUMP)
+            push_warm(layout, worklist, &count, instruction->imm.jump.target);
+        else if (instruction->op == IR_BRANCH)
+        {
+            if (!is_cold_edge(layout, block, 1))
+                push_warm(layout, worklist, &count, instruction->imm.jump.target);
+            if (!is_cold_edge(layout, block, 0))
+                push_warm(layout, worklist, &count, instruction->imm.jump.other);
+        }
+    }
+    free(worklist);
+}
+
+// the successor block should fall through to, -1 when it has none left
+static int preferred_successor(Layout *layout, int block)
+{
+    IRInstruction *instruction = terminator(layout->function, block);
+    int choices[2] = {-1, -1};
+    if (instruction->op == IR_JUMP)
+        choices[0] = instruction->imm.jump.target;
+    else if (instruction->op == IR_BRANCH)
+    {
+        int target = instruction->imm.jump.target;
+        int other = instruction->imm.jump.other;
+        bool target_first = layout->weights[block][1] != layout->weights[block][0] ? layout->weights[block][1] > layout->weights[block][0] : target <= other;
+        choices[0] = target_first ? target : other;
+        choices[1] = target_first ? other : target;
+    }
+    for (int k = 0; k < 2; k++)
+    {
+        if (choices[k] >= 0 && layout->warm[choices[k]] && !layout->placed[choices[k]])
+            return choices[k];
+    }
+    return -1;
+}
+
+void layout_blocks(IRFunction *function, const IRProfile *profile, int *order, LayoutStats *stats)
+{
+    int block_count = function->block_count;
+    for (int b = 0; b < block_count; b++)
+    {
+        order[b] = b;
+    }
+
+    Layout layout;
+    layout.function = function;
+    layout.weights = calloc(block_count + 1, sizeof(uint64_t[2]));
+    layout.sampled = calloc(block_count + 1, sizeof(bool));
+    bool profiled = false;
+    for (int b = 0; b < block_count; b++)
+    {
+        IRInstruction *instruction = terminator(function, b);
+        if (instruction->op != IR_BRANCH || !ir_profile_counts(profile, instruction->source, layout.weights[b]))
+            continue;
+        if (layout.weights[b][0] + layout.weights[b][1] == 0)
+            continue;
+        profiled = true;
+        layout.sampled[b] = layout.weights[b][0] + layout.weights[b][1] >= PROFILE_MIN_SAMPLES;
+    }
+    if (!profiled)
+    {
+        free(layout.weights);
+        free(layout.sampled);
+        return;
+    }
+
+    layout.warm = calloc(block_count + 1, sizeof(bool));
+    layout.placed = calloc(block_count + 1, sizeof(bool));
+    mark_warm(&layout);
+
+    // chains of preferred successors, each starting at the first warm block left
+    int count = 0;
+    int next = 0;
+    while (next < block_count)
+    {
+        if (!layout.warm[next] || layout.placed[next])
+        {
+            next++;
+            continue;
+        }
+        for (int b = next; b >= 0; b = preferred_successor(&layout, b))
+        {
+            layout.placed[b] = true;
+            order[count++] = b;
+        }
+    }
+    stats->profiled++;
+    stats->cold += block_count - count;
+    for (int b = 0; b < block_count; b++)
+    {
+        if (!layout.warm[b])
+            order[count++] = b;
+    }
+
+    free(layout.weights);
+    free(layout.sampled);
+    free(layout.warm);
+    free(layout.placed);
+}
@@ -0,0 +1,17 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "../ir/ir.h"
+
+#ifndef JIT_LAYOUT_H
+#define JIT_LAYOUT_H
+
+// summed over the functions of a module
+typedef struct
+{
+    int profiled; // functions laid out by their branch profile
+    int cold; // blocks moved to the end of their function
+} LayoutStats;
+
+void layout_blocks(IRFunction *function, const IRProfile *profile, int *order, LayoutStats *stats);
+
+#endif
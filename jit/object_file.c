@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <elf.h>
+#include "object_file.h"
+
+// Relocatable ELF64 objects of the native code of a module, for the system
+// linker. The code goes to .text as jit_compile_module left it but for the
+// helper table, which becomes .data with an absolute relocation per slot.
+// Calls through a slot get a pc relative relocation to it, and the stack
+// limit compares of the prologues a thread pointer relocation to the
+// thread local the program defines, so the object only links into
+// executables.
+//
+// Every compiled function is global as cjit_<name> with the System V
+// signature of its IR function, the entry of the program as cjit_main. The
+// program linking the object defines
+//
+//     __thread uintptr_t cjit_stack_limit; // 0 turns the checks off
+//     void cjit_trap(int64_t trap); // a JITTrap, must not return
+//
+// and links libm for pow and fma. The extern functions of the program keep their
+// own names and are left to the linker like the helpers.
+
+#define OBJECT_PREFIX "cjit_"
+#define OBJECT_ENTRY "cjit_main"
+#define OBJECT_STACK_LIMIT "cjit_stack_limit"
+
+static const char *helper_symbols[JIT_HELPER_COUNT] = {"cjit_trap", "pow", "fma"};
+
+enum
+{
+    SECTION_NULL,
+    SECTION_TEXT,
+    SECTION_DATA,
+    SECTION_RELA_TEXT,
+    SECTION_RELA_DATA,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_SHSTRTAB,
+    SECTION_NOTE_STACK,
+    SECTION_COUNT
+};
+
+// symbols before the first global, the null symbol and those of .text and .data
+#define LOCAL_SYMBOLS 3
+
+typedef struct
+{
+    uint8_t *bytes;
+    size_t size;
+    size_t capacity;
+} ObjectBuffer;
+
+static size_t append(ObjectBuffer *buffer, const void *data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        while (buffer->size + size > buffer->capacity)
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        buffer->bytes = realloc(buffer->bytes, buffer->capacity);
+        if (!buffer->bytes)
+        {
+            wprintf(L"Memory allocation failed for the object file.\n");
+            exit(1);
+        }
+    }
+    size_t offset = buffer->size;
+    if (data)
+        memcpy(buffer->bytes + offset, data, size);
+    else
+        memset(buffer->bytes + offset, 0, size);
+    buffer->size += size;
+    return offset;
+}
+
+static size_t align_buffer(ObjectBuffer *buffer, size_t alignment)
+{
+    size_t padding = (alignment - buffer->size % alignment) % alignment;
+    append(buffer, NULL, padding);
+    return buffer->size;
+}
+
+static Elf64_Word add_string(ObjectBuffer *strings, const char *prefix, const char *name)
+{
+    Elf64_Word offset = (Elf64_Word)append(strings, prefix, strlen(prefix));
+    append(strings, name, strlen(name) + 1);
+    return offset;
+}
+
+static void add_symbol(ObjectBuffer *symbols, Elf64_Word name, unsigned char binding, unsigned char type, Elf64_Section section, Elf64_Addr value, Elf64_Xword size)
+{
+    Elf64_Sym symbol = {name, ELF64_ST_INFO(binding, type), STV_DEFAULT, section, value, size};
+    append(symbols, &symbol, sizeof(symbol));
+}
+
+static void add_relocation(ObjectBuffer *relocations, size_t offset, Elf64_Word symbol, Elf64_Word type, int64_t addend)
+{
+    Elf64_Rela relocation = {offset, ELF64_R_INFO(symbol, type), addend};
+    append(relocations, &relocation, sizeof(relocation));
+}
+
+// Bytes of the function starting at entry, up to the next function or the
+// helper table
+static size_t function_size(const JITModule *module, int function)
+{
+    uint8_t *entry = module->functions[function].entry;
+    uint8_t *end = module->memory + module->helpers;
+    for (int f = 0; f < module->function_count; f++)
+    {
+        uint8_t *other = module->functions[f].entry;
+        if (other && other > entry && other < end)
+            end = other;
+    }
+    return end - entry;
+}
+
+bool write_object_file(const char *path, const JITModule *module, const IRModule *ir)
+{
+    for (int f = 0; f < ir->function_count; f++)
+    {
+        const char *name = ir->functions[f]->name;
+        if (f != module->entry && (strcmp(name, "main") == 0 || strcmp(name, "trap") == 0 || strcmp(name, "stack_limit") == 0))
+        {
+            wprintf(L"%s: function %s would clash with the symbol %s%s\n", path, name, OBJECT_PREFIX, name);
+            return false;
+        }
+    }
+
+    ObjectBuffer strings = {0};
+    ObjectBuffer symbols = {0};
+    ObjectBuffer text_relocations = {0};
+    ObjectBuffer data_relocations = {0};
+    append(&strings, "", 1);
+    add_symbol(&symbols, 0, STB_LOCAL, STT_NOTYPE, SHN_UNDEF, 0, 0);
+    add_symbol(&symbols, 0, STB_LOCAL, STT_SECTION, SECTION_TEXT, 0, 0);
+    add_symbol(&symbols, 0, STB_LOCAL, STT_SECTION, SECTION_DATA, 0, 0);
+
+    Elf64_Word symbol_count = LOCAL_SYMBOLS;
+    for (int f = 0; f < module->function_count; f++)
+    {
+        if (module->functions[f].entry == NULL)
+            continue;
+        Elf64_Word name = f == module->entry ? add_string(&strings, "", OBJECT_ENTRY) : add_string(&strings, OBJECT_PREFIX, ir->functions[f]->name);
+        add_symbol(&symbols, name, STB_GLOBAL, STT_FUNC, SECTION_TEXT, (uint8_t *)module->functions[f].entry - module->memory, function_size(module, f));
+        symbol_count++;
+    }
+    Elf64_Word stack_limit = symbol_count++;
+    add_symbol(&symbols, add_string(&strings, "", OBJECT_STACK_LIMIT), STB_GLOBAL, STT_TLS, SHN_UNDEF, 0, 0);
+    // the helpers, then the extern functions, one undefined symbol per name:
+    // a program may declare a helper such as fma as an extern function
+    int slot_count = JIT_HELPER_COUNT + module->extern_count;
+    Elf64_Word *slot_symbols = malloc(slot_count * sizeof(Elf64_Word));
+    for (int slot = 0; slot < slot_count; slot++)
+    {
+        const char *name = slot < JIT_HELPER_COUNT ? helper_symbols[slot] : ir->externs[slot - JIT_HELPER_COUNT].name;
+        slot_symbols[slot] = 0;
+        for (int other = 0; other < slot && slot_symbols[slot] == 0; other++)
+        {
+            const char *other_name = other < JIT_HELPER_COUNT ? helper_symbols[other] : ir->externs[other - JIT_HELPER_COUNT].name;
+            if (strcmp(name, other_name) == 0)
+                slot_symbols[slot] = slot_symbols[other];
+        }
+        if (slot_symbols[slot] == 0)
+        {
+            add_symbol(&symbols, add_string(&strings, "", name), STB_GLOBAL, STT_FUNC, SHN_UNDEF, 0, 0);
+            slot_symbols[slot] = symbol_count++;
+        }
+        add_relocation(&data_relocations, slot * sizeof(uint64_t), slot_symbols[slot], R_X86_64_64, 0);
+    }
+    free(slot_symbols);
+
+    for (int r = 0; r < module->relocation_count; r++)
+    {
+        const JITRelocation *relocation = &module->relocations[r];
+        if (relocation->kind == JIT_RELOCATION_HELPER)
+            add_relocation(&text_relocations, relocation->position, SECTION_DATA, R_X86_64_PC32, (int64_t)(relocation->slot * sizeof(uint64_t)) - 4);
+        else
+            add_relocation(&text_relocations, relocation->position, stack_limit, R_X86_64_TPOFF32, 0);
+    }
+
+    ObjectBuffer section_names = {0};
+    static const char *names[SECTION_COUNT] = {"", ".text", ".data", ".rela.text", ".rela.data", ".symtab", ".strtab", ".shstrtab", ".note.GNU-stack"};
+    Elf64_Word name_offsets[SECTION_COUNT];
+    for (int s = 0; s < SECTION_COUNT; s++)
+    {
+        name_offsets[s] = add_string(&section_names, "", names[s]);
+    }
+
+    // the ELF header, then the contents of the sections, then the section headers
+    ObjectBuffer file = {0};
+    append(&file, NULL, sizeof(Elf64_Ehdr));
+    Elf64_Shdr sections[SECTION_COUNT];
+    memset(sections, 0, sizeof(sections));
+    size_t text = align_buffer(&file, 16);
+    append(&file, module->memory, module->helpers);
+    size_t data = align_buffer(&file, 8);
+    size_t data_size = (JIT_HELPER_COUNT + module->extern_count) * sizeof(uint64_t);
+    append(&file, NULL, data_size);
+    size_t rela_text = align_buffer(&file, 8);
+    append(&file, text_relocations.bytes, text_relocations.size);
+    size_t rela_data = align_buffer(&file, 8);
+    append(&file, data_relocations.bytes, data_relocations.size);
+    size_t symtab = align_buffer(&file, 8);
+    append(&file, symbols.bytes, symbols.size);
+    size_t strtab = file.size;
+    append(&file, strings.bytes, strings.size);
+    size_t shstrtab = file.size;
+    append(&file, section_names.bytes, section_names.size);
+    size_t headers = align_buffer(&file, 8);
+
+    sections[SECTION_TEXT] = (Elf64_Shdr){name_offsets[SECTION_TEXT], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0, text, module->helpers, 0, 0, 16, 0};
+    sections[SECTION_DATA] = (Elf64_Shdr){name_offsets[SECTION_DATA], SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 0, data, data_size, 0, 0, 8, 0};
+    sections[SECTION_RELA_TEXT] = (Elf64_Shdr){name_offsets[SECTION_RELA_TEXT], SHT_RELA, SHF_INFO_LINK, 0, rela_text, text_relocations.size, SECTION_SYMTAB, SECTION_TEXT, 8, sizeof(Elf64_Rela)};
+    sections[SECTION_RELA_DATA] = (Elf64_Shdr){name_offsets[SECTION_RELA_DATA], SHT_RELA, SHF_INFO_LINK, 0, rela_data, data_relocations.size, SECTION_SYMTAB, SECTION_DATA, 8, sizeof(Elf64_Rela)};
+    sections[SECTION_SYMTAB] = (Elf64_Shdr){name_offsets[SECTION_SYMTAB], SHT_SYMTAB, 0, 0, symtab, symbols.size, SECTION_STRTAB, LOCAL_SYMBOLS, 8, sizeof(Elf64_Sym)};
+    sections[SECTION_STRTAB] = (Elf64_Shdr){name_offsets[SECTION_STRTAB], SHT_STRTAB, 0, 0, strtab, strings.size, 0, 0, 1, 0};
+    sections[SECTION_SHSTRTAB] = (Elf64_Shdr){name_offsets[SECTION_SHSTRTAB], SHT_STRTAB, 0, 0, shstrtab, section_names.size, 0, 0, 1, 0};
+    // no executable stack
+    sections[SECTION_NOTE_STACK] = (Elf64_Shdr){name_offsets[SECTION_NOTE_STACK], SHT_PROGBITS, 0, 0, headers, 0, 0, 0, 1, 0};
+    append(&file, sections, sizeof(sections));
+
+    Elf64_Ehdr *header = (Elf64_Ehdr *)file.bytes;
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header->e_type = ET_REL;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_shoff = headers;
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+    header->e_shentsize = sizeof(Elf64_Shdr);
+    header->e_shnum = SECTION_COUNT;
+    header->e_shstrndx = SECTION_SHSTRTAB;
+
+    bool written = false;
+    FILE *output = fopen(path, "wb");
+    if (output == NULL)
+        wprintf(L"Error opening file: %s\n", path);
+    else
+    {
+        written = fwrite(file.bytes, 1, file.size, output) == file.size;
+        written = fclose(output) == 0 && written;
+        if (!written)
+            wprintf(L"Error writing file: %s\n", path);
+    }
+    free(file.bytes);
+    free(section_names.bytes);
+    free(strings.bytes);
+    free(symbols.bytes);
+    free(text_relocations.bytes);
+    free(data_relocations.bytes);
+    return written;
+}
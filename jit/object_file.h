@@ -0,0 +1,10 @@
+#include <stdbool.h>
+#include "jit.h"
+#include "../ir/ir.h"
+
+#ifndef JIT_OBJECT_FILE_H
+#define JIT_OBJECT_FILE_H
+
+bool write_object_file(const char *path, const JITModule *module, const IRModule *ir);
+
+#endif
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "peephole.h"
+
+// Peephole rewrites of the assembled code, before the labels are resolved.
+// The encoders record every instruction they emit, see begin_instruction,
+// and the pass walks that list over the code buffer:
+//
+//     mov a, b; mov b, a            the second moves nothing
+//     mov [m], r; mov r2, [m]       the reload becomes mov r2, r or goes
+//     mov r, [m]; mov [m], r        the store writes what is there
+//     jmp L; L:                     jumps and branches to the next instruction
+//     jcc L1; jmp L2; L1:           j!cc L2
+//     add r, x; test r, r           the add already set the flags
+//     mov r, 0                      xor r, r when the flags are dead after it
+//
+// A rule never looks across an instruction a label is bound to, except to
+// find the flags dead: code generation never reads flags after a label
+// before writing them. Deleted instructions take their bytes and fixups
+// with them, labels bound to them slide to the next instruction that is
+// left. Rounds repeat until one rewrites nothing.
+
+typedef struct
+{
+    X86Assembler *assembler;
+    int *lengths; // bytes of every instruction, 0 once deleted
+    bool *targets; // some label is bound to the instruction
+    int *fixups; // fixup of a jump or branch, -1 for the others
+    PeepholeStats *stats;
+    bool changed;
+} Peephole;
+
+static X86Instruction *instruction_at(Peephole *peephole, int i)
+{
+    return &peephole->assembler->instructions[i];
+}
+
+// the first instruction at or after i that is left, instruction_count when none
+static int next_live(Peephole *peephole, int i)
+{
+    while (i < peephole->assembler->instruction_count && peephole->lengths[i] == 0)
+        i++;
+    return i;
+}
+
+// the instruction starting at offset, or the first one after it
+static int instruction_from_offset(X86Assembler *assembler, int offset)
+{
+    int low = 0;
+    int high = assembler->instruction_count;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (assembler->instructions[middle].offset < offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// the instruction a jump or branch lands on once the deleted ones are gone
+static int label_target(Peephole *peephole, int label)
+{
+    if (peephole->assembler->labels[label] < 0)
+        return -1;
+    return next_live(peephole, instruction_from_offset(peephole->assembler, peephole->assembler->labels[label]));
+}
+
+static void delete_instruction(Peephole *peephole, int i)
+{
+    peephole->lengths[i] = 0;
+    int next = next_live(peephole, i + 1);
+    if (peephole->targets[i] && next < peephole->assembler->instruction_count)
+        peephole->targets[next] = true;
+    peephole->changed = true;
+}
+
+static bool same_memory(X86Memory a, X86Memory b)
+{
+    return a.base == b.base && a.index == b.index && (a.index == X86_NO_REGISTER || a.scale == b.scale) && a.disp == b.disp;
+}
+
+static bool uses_register(X86Memory memory, int reg)
+{
+    return memory.base == reg || memory.index == reg;
+}
+
+// rewrites an instruction in place with an encoding no longer than its own
+static void replace_bytes(Peephole *peephole, int i, const uint8_t *bytes, int length)
+{
+    X86Assembler *assembler = peephole->assembler;
+    memcpy(&assembler->code[instruction_at(peephole, i)->offset], bytes, length);
+    peephole->lengths[i] = length;
+    peephole->changed = true;
+}
+
+// mov destination, source, the 64 bit register form
+static void replace_with_move(Peephole *peephole, int i, int destination, int source)
+{
+    uint8_t bytes[3] = {0x48 | (source >> 3) << 2 | destination >> 3, 0x89, 0xC0 | (source & 7) << 3 | (destination & 7)};
+    replace_bytes(peephole, i, bytes, 3);
+    X86Instruction *instruction = instruction_at(peephole, i);
+    instruction->kind = X86_MOVE;
+    instruction->destination = destination;
+    instruction->source = source;
+}
+
+static bool redundant_move(Peephole *peephole, int i)
+{
+    X86Instruction *first = instruction_at(peephole, i);
+    if (first->kind == X86_MOVE && first->destination == first->source)
+    {
+        delete_instruction(peephole, i);
+        return true;
+    }
+    int j = next_live(peephole, i + 1);
+    if (j >= peephole->assembler->instruction_count || peephole->targets[j])
+        return false;
+    X86Instruction *second = instruction_at(peephole, j);
+    if (first->kind == X86_MOVE && second->kind == X86_MOVE)
+    {
+        bool copy = second->destination == first->destination && second->source == first->source;
+        bool back = second->destination == first->source && second->source == first->destination;
+        if (copy || back)
+        {
+            delete_instruction(peephole, j);
+            return true;
+        }
+    }
+    else if (first->kind == X86_STORE && second->kind == X86_LOAD && same_memory(first->memory, second->memory))
+    {
+        if (second->destination == first->source)
+            delete_instruction(peephole, j);
+        else
+            replace_with_move(peephole, j, second->destination, first->source);
+        return true;
+    }
+    else if (first->kind == X86_LOAD && second->kind == X86_STORE && second->source == first->destination && same_memory(first->memory, second->memory) && !uses_register(first->memory, first->destination))
+    {
+        delete_instruction(peephole, j);
+        return true;
+    }
+    return false;
+}
+
+static bool jump_to_next(Peephole *peephole, int i)
+{
+    X86Instruction *jump = instruction_at(peephole, i);
+    if (jump->kind != X86_JUMP && jump->kind != X86_BRANCH)
+        return false;
+    if (label_target(peephole, jump->label) != next_live(peephole, i + 1))
+        return false;
+    delete_instruction(peephole, i);
+    return true;
+}
+
+static bool branch_over_jump(Peephole *peephole, int i)
+{
+    X86Instruction *branch = instruction_at(peephole, i);
+    int j = next_live(peephole, i + 1);
+    if (branch->kind != X86_BRANCH || j >= peephole->assembler->instruction_count || peephole->targets[j])
+        return false;
+    X86Instruction *jump = instruction_at(peephole, j);
+    if (jump->kind != X86_JUMP || label_target(peephole, branch->label) != next_live(peephole, j + 1))
+        return false;
+    // 0F 80+cc, the condition codes come in pairs that negate each other
+    branch->condition ^= 1;
+    branch->label = jump->label;
+    peephole->assembler->code[branch->offset + 1] ^= 1;
+    peephole->assembler->fixups[peephole->fixups[i]].label = jump->label;
+    delete_instruction(peephole, j);
+    return true;
+}
+
+// a test of r after arithmetic on r with only moves that leave r alone in
+// between; add and sub set the carry and overflow flags test clears, so
+// only the readers of the zero and sign flags may follow them
+static bool redundant_test(Peephole *peephole, int i)
+{
+    X86Instruction *test = instruction_at(peephole, i);
+    if (test->kind != X86_TEST || test->destination != test->source)
+        return false;
+    int reg = test->destination;
+    int p = i;
+    while (true)
+    {
+        if (peephole->targets[p])
+            return false;
+        do
+            p--;
+        while (p >= 0 && peephole->lengths[p] == 0);
+        if (p < 0)
+            return false;
+        X86Instruction *previous = instruction_at(peephole, p);
+        if (previous->kind == X86_STORE)
+            continue;
+        if ((previous->kind == X86_MOVE || previous->kind == X86_MOVE_IMMEDIATE || previous->kind == X86_LOAD) && previous->destination != reg)
+            continue;
+        break;
+    }
+    X86Instruction *arithmetic = instruction_at(peephole, p);
+    if (arithmetic->kind != X86_ALU || arithmetic->destination != reg || arithmetic->operation == ALU_CMP)
+        return false;
+    bool logical = arithmetic->operation == ALU_AND || arithmetic->operation == ALU_OR || arithmetic->operation == ALU_XOR;
+
+    for (int k = next_live(peephole, i + 1); k < peephole->assembler->instruction_count; k = next_live(peephole, k + 1))
+    {
+        X86Instruction *reader = instruction_at(peephole, k);
+        if (peephole->targets[k] || reader->flags & (X86_FLAGS_WRITE | X86_FLAGS_BARRIER))
+            break;
+        if (reader->flags & X86_FLAGS_READ && !logical && reader->condition != CC_E && reader->condition != CC_NE && reader->condition != CC_S && reader->condition != CC_NS)
+            return false;
+    }
+    delete_instruction(peephole, i);
+    return true;
+}
+
+// true when no instruction after i reads the flags before they are written
+static bool flags_dead_after(Peephole *peephole, int i)
+{
+    for (int k = next_live(peephole, i + 1); k < peephole->assembler->instruction_count; k = next_live(peephole, k + 1))
+    {
+        X86Instruction *instruction = instruction_at(peephole, k);
+        if (peephole->targets[k] || instruction->flags & (X86_FLAGS_WRITE | X86_FLAGS_BARRIER))
+            return true;
+        if (instruction->flags & X86_FLAGS_READ)
+            return false;
+    }
+    return true;
+}
+
+// xor of the 32 bit register, which zeroes the upper half too
+static bool zero_by_xor(Peephole *peephole, int i)
+{
+    X86Instruction *move = instruction_at(peephole, i);
+    if (move->kind != X86_MOVE_IMMEDIATE || move->immediate != 0 || !flags_dead_after(peephole, i))
+        return false;
+    int reg = move->destination;
+    uint8_t bytes[3];
+    int length = 0;
+    if (reg >= R8)
+        bytes[length++] = 0x45;
+    bytes[length++] = 0x31;
+    bytes[length++] = 0xC0 | (reg & 7) << 3 | (reg & 7);
+    replace_bytes(peephole, i, bytes, length);
+    move->kind = X86_ALU;
+    move->flags = X86_FLAGS_WRITE;
+    move->operation = ALU_XOR;
+    move->source = reg;
+    return true;
+}
+
+// Moves the instructions that are left together and shifts labels and
+// fixups with them
+static void compact(Peephole *peephole)
+{
+    X86Assembler *assembler = peephole->assembler;
+    int count = assembler->instruction_count;
+    int *offsets = malloc((count + 1) * sizeof(int));
+    int size = 0;
+    for (int i = 0; i < count; i++)
+    {
+        offsets[i] = size;
+        size += peephole->lengths[i];
+    }
+    offsets[count] = size;
+
+    for (int l = 0; l < assembler->label_count; l++)
+    {
+        if (assembler->labels[l] >= 0)
+            assembler->labels[l] = offsets[instruction_from_offset(assembler, assembler->labels[l])];
+    }
+    int fixup_count = 0;
+    for (int f = 0, i = 0; f < assembler->fixup_count; f++)
+    {
+        X86Fixup fixup = assembler->fixups[f];
+        while (i + 1 < count && assembler->instructions[i + 1].offset <= fixup.position)
+            i++;
+        if (peephole->lengths[i] == 0)
+            continue;
+        fixup.position = offsets[i] + fixup.position - assembler->instructions[i].offset;
+        assembler->fixups[fixup_count++] = fixup;
+    }
+    assembler->fixup_count = fixup_count;
+
+    int kept = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (peephole->lengths[i] == 0)
+            continue;
+        X86Instruction instruction = assembler->instructions[i];
+        memmove(&assembler->code[offsets[i]], &assembler->code[instruction.offset], peephole->lengths[i]);
+        instruction.offset = offsets[i];
+        assembler->instructions[kept++] = instruction;
+    }
+    peephole->stats->bytes += assembler->size - size;
+    assembler->instruction_count = kept;
+    assembler->size = size;
+    free(offsets);
+}
+
+void peephole_pass(X86Assembler *assembler, PeepholeStats *stats)
+{
+    Peephole peephole = {assembler, NULL, NULL, NULL, stats, true};
+    while (peephole.changed && assembler->instruction_count > 0)
+    {
+        int count = assembler->instruction_count;
+        peephole.changed = false;
+        peephole.lengths = malloc(count * sizeof(int));
+        peephole.targets = calloc(count + 1, sizeof(bool));
+        peephole.fixups = malloc(count * sizeof(int));
+        for (int i = 0; i < count; i++)
+        {
+            int end = i + 1 < count ? assembler->instructions[i + 1].offset : assembler->size;
+            peephole.lengths[i] = end - assembler->instructions[i].offset;
+            peephole.fixups[i] = -1;
+        }
+        for (int l = 0; l < assembler->label_count; l++)
+        {
+            if (assembler->labels[l] >= 0)
+                peephole.targets[instruction_from_offset(assembler, assembler->labels[l])] = true;
+        }
+        for (int f = 0, i = 0; f < assembler->fixup_count; f++)
+        {
+            while (i + 1 < count && assembler->instructions[i + 1].offset <= assembler->fixups[f].position)
+                i++;
+            peephole.fixups[i] = f;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (peephole.lengths[i] == 0)
+                continue;
+            if (redundant_move(&peephole, i))
+                stats->moves++;
+            else if (jump_to_next(&peephole, i))
+                stats->jumps++;
+            else if (branch_over_jump(&peephole, i))
+                stats->branches++;
+            else if (redundant_test(&peephole, i))
+                stats->tests++;
+            else if (zero_by_xor(&peephole, i))
+                stats->zeroes++;
+        }
+        if (peephole.changed)
+            compact(&peephole);
+        free(peephole.lengths);
+        free(peephole.targets);
+        free(peephole.fixups);
+    }
+}
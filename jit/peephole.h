@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "x86_64.h"
+
+#ifndef JIT_PEEPHOLE_H
+#define JIT_PEEPHOLE_H
+
+// rewrites of each rule, summed over the functions of a module
+typedef struct
+{
+    int moves; // register moves, stores and reloads that copy nothing new
+    int jumps; // jumps and branches to the next instruction
+    int branches; // branches over a jump, inverted to take its target
+    int tests; // tests of a result the arithmetic already compared with zero
+    int zeroes; // mov r, 0 turned into xor r, r
+    int bytes; // code bytes saved
+} PeepholeStats;
+
+void peephole_pass(X86Assembler *assembler, PeepholeStats *stats);
+
+#endif
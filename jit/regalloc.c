@@ -0,0 +1,948 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <wchar.h>
+#include "regalloc.h"
+#include "../defc/defc.h"
+
+// Linear scan over SSA live intervals, after Wimmer and Franz. Liveness is
+// solved per block with bitsets, intervals are built in one backward pass in
+// block layout order and keep their lifetime holes, so a value that is dead
+// across a stretch of code leaves its register to others there.
+//
+// Intervals are handed out registers in order of their start. When a
+// register is free only for a prefix of an interval the interval is split
+// and the rest is allocated again later. When no register is free, either
+// the current interval or the one whose next use is furthest away is split
+// and its remainder moved to the value's spill slot. Values live across a
+// call can not stay in a caller saved register, their intervals are split in
+// front of the call the same way.
+//
+// Spill slots are shared by values whose spilled parts do not overlap, and
+// hints (the register of the previous split part, parameter and argument
+// registers, phi operands and the left operand of two address operations)
+// let most moves between intervals disappear.
+
+#define NO_POSITION INT_MAX
+
+typedef struct
+{
+    int *items;
+    int count;
+    int size;
+} IntervalList;
+
+typedef struct
+{
+    IRFunction *function;
+    const Selection *selection;
+    const RegisterTarget *target;
+    Allocation *allocation;
+    bool allocatable[REGISTER_CLASS_COUNT][MAX_CLASS_REGISTERS];
+
+    int *clobbers; // POSITION_CLOBBER of every call, ascending
+    int clobber_count;
+
+    int *hint_register;
+    int *hint_value;
+    int *value_end;
+
+    int *slot_free; // position from which each spill slot is unused
+    int slot_size;
+
+    IntervalList unhandled; // sorted by descending start, the next interval is last
+    IntervalList active;
+    IntervalList inactive;
+} ScanContext;
+
+static void *grow(void *array, int *size, int needed, size_t element_size)
+{
+    if (needed <= *size)
+        return array;
+    *size = *size ? *size : 8;
+    while (*size < needed)
+    {
+        *size *= 2;
+    }
+    array = realloc(array, *size * element_size);
+    if (!array)
+    {
+        wprintf(L"Memory allocation failed in the register allocator.\n");
+        exit(1);
+    }
+    return array;
+}
+
+static void list_push(IntervalList *list, int interval)
+{
+    list->items = grow(list->items, &list->size, list->count + 1, sizeof(int));
+    list->items[list->count++] = interval;
+}
+
+static void list_remove(IntervalList *list, int index)
+{
+    list->items[index] = list->items[--list->count];
+}
+
+RegisterClass register_class_of(IRType type)
+{
+    return type == IR_FLOAT ? REGISTER_FLOAT : REGISTER_GENERAL;
+}
+
+static bool has_result(ScanContext *context, int value)
+{
+    IRInstruction *instruction = &context->function->instructions[value];
+    if (context->selection->choices[value].form == ISEL_FOLDED)
+        return false;
+    return instruction->type != IR_VOID && !ir_opcode_info[instruction->op].is_terminator && instruction->op != IR_NOP;
+}
+
+static int new_interval(Allocation *allocation, int value, RegisterClass register_class)
+{
+    allocation->intervals = grow(allocation->intervals, &allocation->interval_size, allocation->interval_count + 1, sizeof(LiveInterval));
+    LiveInterval *interval = &allocation->intervals[allocation->interval_count];
+    memset(interval, 0, sizeof(LiveInterval));
+    interval->value = value;
+    interval->register_class = register_class;
+    interval->reg = NO_REGISTER;
+    interval->next = -1;
+    return allocation->interval_count++;
+}
+
+// Ranges arrive from the back of the function to the front while intervals
+// are built, so the last range is the earliest until build_intervals reverses them.
+static void add_range(LiveInterval *interval, int from, int to)
+{
+    if (interval->range_count > 0)
+    {
+        LiveRange *last = &interval->ranges[interval->range_count - 1];
+        if (to >= last->from)
+        {
+            if (from < last->from)
+                last->from = from;
+            if (to > last->to)
+                last->to = to;
+            return;
+        }
+    }
+    interval->ranges = grow(interval->ranges, &interval->range_size, interval->range_count + 1, sizeof(LiveRange));
+    interval->ranges[interval->range_count++] = (LiveRange){from, to};
+}
+
+static void add_range_forward(LiveInterval *interval, int from, int to)
+{
+    interval->ranges = grow(interval->ranges, &interval->range_size, interval->range_count + 1, sizeof(LiveRange));
+    interval->ranges[interval->range_count++] = (LiveRange){from, to};
+}
+
+static void add_use(LiveInterval *interval, int position)
+{
+    interval->uses = grow(interval->uses, &interval->use_size, interval->use_count + 1, sizeof(int));
+    interval->uses[interval->use_count++] = position;
+}
+
+static void define_at(LiveInterval *interval, int block_from, int position)
+{
+    if (interval->range_count > 0 && interval->ranges[interval->range_count - 1].from >= block_from)
+        interval->ranges[interval->range_count - 1].from = position;
+    else
+        add_range(interval, position, position + 1);
+    add_use(interval, position);
+}
+
+static int compare_positions(const void *left, const void *right)
+{
+    return *(const int *)left - *(const int *)right;
+}
+
+static int interval_start(LiveInterval *interval)
+{
+    return interval->ranges[0].from;
+}
+
+static int interval_end(LiveInterval *interval)
+{
+    return interval->ranges[interval->range_count - 1].to;
+}
+
+static bool covers(LiveInterval *interval, int position)
+{
+    for (int r = 0; r < interval->range_count; r++)
+    {
+        if (interval->ranges[r].from > position)
+            return false;
+        if (position < interval->ranges[r].to)
+            return true;
+    }
+    return false;
+}
+
+static int first_intersection(LiveInterval *a, LiveInterval *b)
+{
+    int i = 0;
+    int j = 0;
+    while (i < a->range_count && j < b->range_count)
+    {
+        LiveRange *x = &a->ranges[i];
+        LiveRange *y = &b->ranges[j];
+        if (x->to <= y->from)
+            i++;
+        else if (y->to <= x->from)
+            j++;
+        else
+            return x->from > y->from ? x->from : y->from;
+    }
+    return NO_POSITION;
+}
+
+static int next_use(LiveInterval *interval, int position)
+{
+    for (int u = 0; u < interval->use_count; u++)
+    {
+        if (interval->uses[u] >= position)
+            return interval->uses[u];
+    }
+    return NO_POSITION;
+}
+
+static int first_clobber(ScanContext *context, LiveInterval *interval)
+{
+    for (int c = 0; c < context->clobber_count; c++)
+    {
+        if (context->clobbers[c] >= interval_end(interval))
+            break;
+        if (context->clobbers[c] >= interval_start(interval) && covers(interval, context->clobbers[c]))
+            return context->clobbers[c];
+    }
+    return NO_POSITION;
+}
+
+static int block_from(IRFunction *function, int block)
+{
+    return POSITION_USE(function->blocks[block].first);
+}
+
+static int block_to(IRFunction *function, int block)
+{
+    IRBlock *ir_block = &function->blocks[block];
+    return POSITION_USE(ir_block->first + ir_block->count);
+}
+
+static void set_bit(uint64_t *bits, int index)
+{
+    bits[index / 64] |= 1ull << (index % 64);
+}
+
+static bool test_bit(const uint64_t *bits, int index)
+{
+    return (bits[index / 64] >> (index % 64)) & 1;
+}
+
+bool is_live_in(Allocation *allocation, int block, int value)
+{
+    return test_bit(&allocation->live_in[block * allocation->live_words], value);
+}
+
+// iterates the operands an instruction reads, phis excluded: the leaves of
+// its selected pattern, none when it is folded into a user
+static int instruction_operands(ScanContext *context, int value, int32_t *buffer, const int32_t **operands)
+{
+    IRFunction *function = context->function;
+    IRInstruction *instruction = &function->instructions[value];
+    const IselChoice *choice = &context->selection->choices[value];
+    if (choice->form != ISEL_DEFAULT)
+    {
+        int count = 0;
+        if (choice->form != ISEL_FOLDED)
+            buffer[count++] = choice->base;
+        if (choice->form != ISEL_FOLDED && choice->index >= 0 && choice->index != choice->base)
+            buffer[count++] = choice->index;
+        *operands = buffer;
+        return count;
+    }
+    const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+    if (info->has_list)
+    {
+        *operands = &function->operands[instruction->imm.list.first];
+        return instruction->imm.list.count;
+    }
+    int count = 0;
+    for (int k = 0; k < info->value_args; k++)
+    {
+        if (instruction->args[k] >= 0)
+            buffer[count++] = instruction->args[k];
+    }
+    *operands = buffer;
+    return count;
+}
+
+static void compute_liveness(ScanContext *context, uint64_t *live_out)
+{
+    IRFunction *function = context->function;
+    Allocation *allocation = context->allocation;
+    int words = allocation->live_words;
+    uint64_t *gen = calloc((size_t)function->block_count * words + 1, sizeof(uint64_t));
+    uint64_t *kill = calloc((size_t)function->block_count * words + 1, sizeof(uint64_t));
+
+    for (int b = 0; b < function->block_count; b++)
+    {
+        IRBlock *block = &function->blocks[b];
+        for (int v = block->first; v < block->first + block->count; v++)
+        {
+            IRInstruction *instruction = &function->instructions[v];
+            if (instruction->op != IR_PHI)
+            {
+                int32_t buffer[3];
+                const int32_t *operands;
+                int count = instruction_operands(context, v, buffer, &operands);
+                for (int k = 0; k < count; k++)
+                {
+                    if (!test_bit(&kill[b * words], operands[k]))
+                        set_bit(&gen[b * words], operands[k]);
+                }
+            }
+            if (has_result(context, v))
+                set_bit(&kill[b * words], v);
+        }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int b = function->block_count - 1; b >= 0; b--)
+        {
+            uint64_t *out = &live_out[b * words];
+            int32_t successors[2];
+            int successor_count = ir_successors(function, b, successors);
+            for (int s = 0; s < successor_count; s++)
+            {
+                int successor = successors[s];
+                IRBlock *block = &function->blocks[successor];
+                for (int w = 0; w < words; w++)
+                {
+                    out[w] |= allocation->live_in[successor * words + w];
+                }
+                for (int v = block->first; v < block->first + block->count && function->instructions[v].op == IR_PHI; v++)
+                {
+                    IRInstruction *phi = &function->instructions[v];
+                    for (int k = 0; k < phi->imm.list.count; k++)
+                    {
+                        int32_t *pair = &function->operands[phi->imm.list.first + 2 * k];
+                        if (pair[0] == b)
+                            set_bit(out, pair[1]);
+                    }
+                }
+            }
+            uint64_t *in = &allocation->live_in[b * words];
+            for (int w = 0; w < words; w++)
+            {
+                uint64_t value = gen[b * words + w] | (out[w] & ~kill[b * words + w]);
+                if (value != in[w])
+                {
+                    in[w] = value;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    free(gen);
+    free(kill);
+}
+
+static void build_intervals(ScanContext *context)
+{
+    IRFunction *function = context->function;
+    Allocation *allocation = context->allocation;
+    int words = allocation->live_words;
+    uint64_t *live_out = calloc((size_t)function->block_count * words + 1, sizeof(uint64_t));
+
+    for (int v = 0; v < function->instruction_count; v++)
+    {
+        IRInstruction *instruction = &function->instructions[v];
+        allocation->value_interval[v] = has_result(context, v) ? new_interval(allocation, v, register_class_of(instruction->type)) : -1;
+    }
+
+    compute_liveness(context, live_out);
+
+    for (int b = function->block_count - 1; b >= 0; b--)
+    {
+        IRBlock *block = &function->blocks[b];
+        int from = block_from(function, b);
+        int to = block_to(function, b);
+        uint64_t *out = &live_out[b * words];
+
+        for (int v = 0; v < function->instruction_count; v++)
+        {
+            if (test_bit(out, v))
+                add_range(&allocation->intervals[allocation->value_interval[v]], from, to);
+        }
+
+        // phi operands are read on the way out of the predecessor
+        int32_t successors[2];
+        int successor_count = ir_successors(function, b, successors);
+        int terminator = block->first + block->count - 1;
+        for (int s = 0; s < successor_count; s++)
+        {
+            IRBlock *successor = &function->blocks[successors[s]];
+            for (int v = successor->first; v < successor->first + successor->count && function->instructions[v].op == IR_PHI; v++)
+            {
+                IRInstruction *phi = &function->instructions[v];
+                for (int k = 0; k < phi->imm.list.count; k++)
+                {
+                    int32_t *pair = &function->operands[phi->imm.list.first + 2 * k];
+                    if (pair[0] == b)
+                        add_use(&allocation->intervals[allocation->value_interval[pair[1]]], POSITION_USE(terminator));
+                }
+            }
+        }
+
+        for (int v = block->first + block->count - 1; v >= block->first; v--)
+        {
+            IRInstruction *instruction = &function->instructions[v];
+            // phis are written on the incoming edges and parameters by the prologue's parallel move
+            if (instruction->op == IR_PHI || instruction->op == IR_PARAM)
+            {
+                define_at(&allocation->intervals[allocation->value_interval[v]], from, from);
+                continue;
+            }
+            if (has_result(context, v))
+                define_at(&allocation->intervals[allocation->value_interval[v]], from, POSITION_DEFINE(v));
+
+            int32_t buffer[3];
+            const int32_t *operands;
+            int count = instruction_operands(context, v, buffer, &operands);
+            for (int k = 0; k < count; k++)
+            {
+                LiveInterval *interval = &allocation->intervals[allocation->value_interval[operands[k]]];
+                add_range(interval, from, POSITION_USE(v) + 1);
+                add_use(interval, POSITION_USE(v));
+            }
+        }
+    }
+
+    for (int i = 0; i < allocation->interval_count; i++)
+    {
+        LiveInterval *interval = &allocation->intervals[i];
+        for (int r = 0; r < interval->range_count / 2; r++)
+        {
+            LiveRange swap = interval->ranges[r];
+            interval->ranges[r] = interval->ranges[interval->range_count - 1 - r];
+            interval->ranges[interval->range_count - 1 - r] = swap;
+        }
+        qsort(interval->uses, interval->use_count, sizeof(int), compare_positions);
+    }
+
+    free(live_out);
+}
+
+static void compute_hints(ScanContext *context)
+{
+    IRFunction *function = context->function;
+    const RegisterTarget *target = context->target;
+
+    for (int v = 0; v < function->instruction_count; v++)
+    {
+        context->hint_register[v] = NO_REGISTER;
+        context->hint_value[v] = -1;
+    }
+
+    for (int v = 0; v < function->instruction_count; v++)
+    {
+        IRInstruction *instruction = &function->instructions[v];
+        const IselChoice *choice = &context->selection->choices[v];
+        if (choice->form != ISEL_DEFAULT)
+        {
+            if (choice->form != ISEL_FOLDED)
+                context->hint_value[v] = choice->base;
+            continue;
+        }
+        switch (instruction->op)
+        {
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_AND:
+        case IR_OR:
+        case IR_NEG:
+        case IR_NOT:
+        case IR_SHL:
+        case IR_SHR:
+        case IR_SAR:
+        case IR_SQRT:
+        case IR_FMA:
+        case IR_MIN:
+        case IR_MAX:
+        case IR_ABS:
+            context->hint_value[v] = instruction->args[0];
+            break;
+        case IR_CALL:
+        case IR_CALL_EXTERN:
+        {
+            int used[REGISTER_CLASS_COUNT] = {0, 0};
+            int32_t *arguments = &function->operands[instruction->imm.list.first];
+            for (int k = 0; k < instruction->imm.list.count; k++)
+            {
+                int register_class = register_class_of(function->instructions[arguments[k]].type);
+                int index = used[register_class]++;
+                if (index < target->argument_count[register_class] && context->hint_register[arguments[k]] == NO_REGISTER)
+                    context->hint_register[arguments[k]] = target->arguments[register_class][index];
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // parameters arrive in argument registers in declaration order
+    for (int v = 0; v < function->instruction_count; v++)
+    {
+        IRInstruction *instruction = &function->instructions[v];
+        if (instruction->op != IR_PARAM)
+            continue;
+        int register_class = register_class_of(instruction->type);
+        int index = 0;
+        for (int p = 0; p < instruction->imm.i; p++)
+        {
+            if ((int)register_class_of(function->param_types[p]) == register_class)
+                index++;
+        }
+        if (index < target->argument_count[register_class])
+            context->hint_register[v] = target->arguments[register_class][index];
+    }
+
+    // a phi and its operands want the same register, then the edge copies vanish
+    for (int v = 0; v < function->instruction_count; v++)
+    {
+        IRInstruction *phi = &function->instructions[v];
+        if (phi->op != IR_PHI)
+            continue;
+        for (int k = 0; k < phi->imm.list.count; k++)
+        {
+            int operand = function->operands[phi->imm.list.first + 2 * k + 1];
+            if (k == 0)
+                context->hint_value[v] = operand;
+            else if (operand != v)
+                context->hint_value[operand] = v;
+        }
+    }
+}
+
+static int hint_for(ScanContext *context, int index)
+{
+    Allocation *allocation = context->allocation;
+    LiveInterval *interval = &allocation->intervals[index];
+    int first = allocation->value_interval[interval->value];
+
+    if (first != index)
+    {
+        int previous = first;
+        while (allocation->intervals[previous].next != index)
+        {
+            previous = allocation->intervals[previous].next;
+        }
+        if (allocation->intervals[previous].reg != NO_REGISTER)
+            return allocation->intervals[previous].reg;
+    }
+    if (context->hint_register[interval->value] != NO_REGISTER)
+        return context->hint_register[interval->value];
+    int value = context->hint_value[interval->value];
+    if (value >= 0 && allocation->value_interval[value] >= 0)
+    {
+        LiveInterval *other = interval_at(allocation, value, interval_start(interval));
+        if (other->register_class == interval->register_class)
+            return other->reg;
+    }
+    return NO_REGISTER;
+}
+
+static void push_unhandled(ScanContext *context, int index)
+{
+    IntervalList *list = &context->unhandled;
+    int start = interval_start(&context->allocation->intervals[index]);
+    list_push(list, index);
+    int k = list->count - 1;
+    while (k > 0 && interval_start(&context->allocation->intervals[list->items[k - 1]]) < start)
+    {
+        list->items[k] = list->items[k - 1];
+        k--;
+    }
+    list->items[k] = index;
+}
+
+// Cuts interval at position, the part from position on becomes a new interval
+static int split_interval(ScanContext *context, int index, int position)
+{
+    Allocation *allocation = context->allocation;
+    LiveInterval *interval = &allocation->intervals[index];
+    int tail_index = new_interval(allocation, interval->value, interval->register_class);
+    interval = &allocation->intervals[index];
+    LiveInterval *tail = &allocation->intervals[tail_index];
+
+    int keep = 0;
+    for (int r = 0; r < interval->range_count; r++)
+    {
+        LiveRange range = interval->ranges[r];
+        if (range.to <= position)
+            interval->ranges[keep++] = range;
+        else if (range.from >= position)
+            add_range_forward(tail, range.from, range.to);
+        else
+        {
+            interval->ranges[keep++] = (LiveRange){range.from, position};
+            add_range_forward(tail, position, range.to);
+        }
+    }
+    interval->range_count = keep;
+
+    keep = 0;
+    for (int u = 0; u < interval->use_count; u++)
+    {
+        if (interval->uses[u] < position)
+            interval->uses[keep++] = interval->uses[u];
+        else
+            add_use(tail, interval->uses[u]);
+    }
+    interval->use_count = keep;
+
+    tail->next = interval->next;
+    interval->next = tail_index;
+    allocation->split_count++;
+    return tail_index;
+}
+
+static void spill_interval(ScanContext *context, int index)
+{
+    Allocation *allocation = context->allocation;
+    LiveInterval *interval = &allocation->intervals[index];
+    int value = interval->value;
+
+    interval->reg = NO_REGISTER;
+    allocation->spilled_count++;
+    if (allocation->value_slot[value] >= 0)
+        return;
+
+    int start = interval_start(interval);
+    int slot = -1;
+    for (int s = 0; s < allocation->slot_count; s++)
+    {
+        if (context->slot_free[s] <= start)
+        {
+            slot = s;
+            break;
+        }
+    }
+    if (slot < 0)
+    {
+        context->slot_free = grow(context->slot_free, &context->slot_size, allocation->slot_count + 1, sizeof(int));
+        slot = allocation->slot_count++;
+    }
+    context->slot_free[slot] = context->value_end[value];
+    allocation->value_slot[value] = slot;
+}
+
+static void assign_register(ScanContext *context, int index, int reg)
+{
+    LiveInterval *interval = &context->allocation->intervals[index];
+    interval->reg = reg;
+    context->allocation->used_registers[interval->register_class] |= 1u << reg;
+}
+
+static bool try_allocate_free(ScanContext *context, int index)
+{
+    Allocation *allocation = context->allocation;
+    LiveInterval *current = &allocation->intervals[index];
+    int register_class = current->register_class;
+    const RegisterTarget *target = context->target;
+    int free_until[MAX_CLASS_REGISTERS];
+
+    for (int r = 0; r < MAX_CLASS_REGISTERS; r++)
+    {
+        free_until[r] = context->allocatable[register_class][r] ? NO_POSITION : 0;
+    }
+    for (int k = 0; k < context->active.count; k++)
+    {
+        LiveInterval *other = &allocation->intervals[context->active.items[k]];
+        if (other->register_class == register_class)
+            free_until[other->reg] = 0;
+    }
+    for (int k = 0; k < context->inactive.count; k++)
+    {
+        LiveInterval *other = &allocation->intervals[context->inactive.items[k]];
+        if (other->register_class != register_class)
+            continue;
+        int intersection = first_intersection(other, current);
+        if (intersection < free_until[other->reg])
+            free_until[other->reg] = intersection;
+    }
+    int clobber = first_clobber(context, current);
+    for (int r = 0; r < MAX_CLASS_REGISTERS; r++)
+    {
+        if (target->caller_saved[register_class][r] && clobber < free_until[r])
+            free_until[r] = clobber;
+    }
+
+    int start = interval_start(current);
+    int end = interval_end(current);
+    int hint = hint_for(context, index);
+    int reg = NO_REGISTER;
+    if (hint != NO_REGISTER && context->allocatable[register_class][hint] && free_until[hint] >= end)
+        reg = hint;
+    for (int k = 0; reg == NO_REGISTER && k < target->allocatable_count[register_class]; k++)
+    {
+        int candidate = target->allocatable[register_class][k];
+        if (free_until[candidate] >= end)
+            reg = candidate;
+    }
+    if (reg == NO_REGISTER)
+    {
+        for (int k = 0; k < target->allocatable_count[register_class]; k++)
+        {
+            int candidate = target->allocatable[register_class][k];
+            if (reg == NO_REGISTER || free_until[candidate] > free_until[reg])
+                reg = candidate;
+        }
+    }
+
+    if (free_until[reg] >= end)
+    {
+        assign_register(context, index, reg);
+        return true;
+    }
+
+    // the register is free for a prefix, the rest is allocated again later
+    int position = free_until[reg] & ~3;
+    if (position <= start)
+        return false;
+    push_unhandled(context, split_interval(context, index, position));
+    assign_register(context, index, reg);
+    return true;
+}
+
+static void split_and_spill(ScanContext *context, int index, int position)
+{
+    position &= ~3;
+    if (position <= interval_start(&context->allocation->intervals[index]))
+        spill_interval(context, index);
+    else
+        spill_interval(context, split_interval(context, index, position));
+}
+
+static void allocate_blocked(ScanContext *context, int index)
+{
+    Allocation *allocation = context->allocation;
+    LiveInterval *current = &allocation->intervals[index];
+    int register_class = current->register_class;
+    const RegisterTarget *target = context->target;
+    int start = interval_start(current);
+    int use_position[MAX_CLASS_REGISTERS];
+    int blocked[MAX_CLASS_REGISTERS];
+
+    for (int r = 0; r < MAX_CLASS_REGISTERS; r++)
+    {
+        use_position[r] = NO_POSITION;
+        blocked[r] = NO_POSITION;
+    }
+    for (int k = 0; k < context->active.count; k++)
+    {
+        LiveInterval *other = &allocation->intervals[context->active.items[k]];
+        if (other->register_class != register_class)
+            continue;
+        int use = next_use(other, start);
+        if (use < use_position[other->reg])
+            use_position[other->reg] = use;
+    }
+    for (int k = 0; k < context->inactive.count; k++)
+    {
+        LiveInterval *other = &allocation->intervals[context->inactive.items[k]];
+        if (other->register_class != register_class || first_intersection(other, current) == NO_POSITION)
+            continue;
+        int use = next_use(other, start);
+        if (use < use_position[other->reg])
+            use_position[other->reg] = use;
+    }
+    int clobber = first_clobber(context, current);
+    for (int r = 0; r < MAX_CLASS_REGISTERS; r++)
+    {
+        if (target->caller_saved[register_class][r])
+        {
+            blocked[r] = clobber;
+            if (clobber < use_position[r])
+                use_position[r] = clobber;
+        }
+    }
+
+    int reg = NO_REGISTER;
+    for (int k = 0; k < target->allocatable_count[register_class]; k++)
+    {
+        int candidate = target->allocatable[register_class][k];
+        if ((blocked[candidate] & ~3) <= start)
+            continue;
+        if (reg == NO_REGISTER || use_position[candidate] > use_position[reg])
+            reg = candidate;
+    }
+
+    // every other value is needed sooner, this one goes to memory
+    if (reg == NO_REGISTER || use_position[reg] <= next_use(current, start))
+    {
+        spill_interval(context, index);
+        return;
+    }
+
+    for (int k = context->active.count - 1; k >= 0; k--)
+    {
+        int other = context->active.items[k];
+        if (allocation->intervals[other].register_class == register_class && allocation->intervals[other].reg == reg)
+        {
+            list_remove(&context->active, k);
+            split_and_spill(context, other, start);
+        }
+    }
+    for (int k = context->inactive.count - 1; k >= 0; k--)
+    {
+        int other = context->inactive.items[k];
+        LiveInterval *interval = &allocation->intervals[other];
+        if (interval->register_class == register_class && interval->reg == reg && first_intersection(interval, &allocation->intervals[index]) != NO_POSITION)
+        {
+            list_remove(&context->inactive, k);
+            split_and_spill(context, other, start);
+        }
+    }
+
+    assign_register(context, index, reg);
+    if (blocked[reg] < interval_end(&allocation->intervals[index]))
+        push_unhandled(context, split_interval(context, index, blocked[reg] & ~3));
+}
+
+static void scan(ScanContext *context, bool spill_all)
+{
+    Allocation *allocation = context->allocation;
+
+    while (context->unhandled.count > 0)
+    {
+        int index = context->unhandled.items[--context->unhandled.count];
+        int position = interval_start(&allocation->intervals[index]);
+
+        for (int k = context->active.count - 1; k >= 0; k--)
+        {
+            LiveInterval *interval = &allocation->intervals[context->active.items[k]];
+            if (interval_end(interval) <= position)
+                list_remove(&context->active, k);
+            else if (!covers(interval, position))
+            {
+                list_push(&context->inactive, context->active.items[k]);
+                list_remove(&context->active, k);
+            }
+        }
+        for (int k = context->inactive.count - 1; k >= 0; k--)
+        {
+            LiveInterval *interval = &allocation->intervals[context->inactive.items[k]];
+            if (interval_end(interval) <= position)
+                list_remove(&context->inactive, k);
+            else if (covers(interval, position))
+            {
+                list_push(&context->active, context->inactive.items[k]);
+                list_remove(&context->inactive, k);
+            }
+        }
+
+        if (spill_all)
+        {
+            spill_interval(context, index);
+            continue;
+        }
+        if (!try_allocate_free(context, index))
+            allocate_blocked(context, index);
+        if (allocation->intervals[index].reg != NO_REGISTER)
+            list_push(&context->active, index);
+    }
+}
+
+// spill_all gives every value a stack slot, the baseline the allocator is measured against
+Allocation *allocate_registers(IRFunction *function, const Selection *selection, const RegisterTarget *target, bool spill_all)
+{
+    Allocation *allocation = calloc(1, sizeof(Allocation));
+    int value_count = function->instruction_count;
+    allocation->value_interval = malloc((value_count + 1) * sizeof(int));
+    allocation->value_slot = malloc((value_count + 1) * sizeof(int));
+    allocation->live_words = (value_count + 63) / 64 + 1;
+    allocation->live_in = calloc((size_t)function->block_count * allocation->live_words + 1, sizeof(uint64_t));
+
+    ScanContext context;
+    memset(&context, 0, sizeof(ScanContext));
+    context.function = function;
+    context.selection = selection;
+    context.target = target;
+    context.allocation = allocation;
+    context.hint_register = malloc((value_count + 1) * sizeof(int));
+    context.hint_value = malloc((value_count + 1) * sizeof(int));
+    context.value_end = malloc((value_count + 1) * sizeof(int));
+    context.clobbers = malloc((value_count + 1) * sizeof(int));
+
+    for (int c = 0; c < REGISTER_CLASS_COUNT; c++)
+    {
+        for (int k = 0; k < target->allocatable_count[c]; k++)
+        {
+            context.allocatable[c][target->allocatable[c][k]] = true;
+        }
+    }
+    for (int v = 0; v < value_count; v++)
+    {
+        allocation->value_slot[v] = -1;
+        IROpcode op = function->instructions[v].op;
+        // integer powers are computed inline, vector loops take every caller saved register
+        if (op == IR_CALL || op == IR_CALL_EXTERN || op == IR_VREDUCE || (op == IR_POW && function->instructions[v].type == IR_FLOAT) || (op == IR_FMA && target->fma_calls))
+            context.clobbers[context.clobber_count++] = POSITION_CLOBBER(v);
+    }
+
+    build_intervals(&context);
+    compute_hints(&context);
+
+    for (int v = 0; v < value_count; v++)
+    {
+        int index = allocation->value_interval[v];
+        if (index < 0)
+            continue;
+        context.value_end[v] = interval_end(&allocation->intervals[index]);
+        push_unhandled(&context, index);
+    }
+    scan(&context, spill_all);
+
+    free(context.hint_register);
+    free(context.hint_value);
+    free(context.value_end);
+    free(context.clobbers);
+    free(context.slot_free);
+    free(context.unhandled.items);
+    free(context.active.items);
+    free(context.inactive.items);
+    return allocation;
+}
+
+void free_allocation(Allocation *allocation)
+{
+    for (int i = 0; i < allocation->interval_count; i++)
+    {
+        free(allocation->intervals[i].ranges);
+        free(allocation->intervals[i].uses);
+    }
+    free(allocation->intervals);
+    free(allocation->value_interval);
+    free(allocation->value_slot);
+    free(allocation->live_in);
+    free(allocation);
+}
+
+// the part of value's lifetime that contains position
+LiveInterval *interval_at(Allocation *allocation, int value, int position)
+{
+    int index = allocation->value_interval[value];
+    while (allocation->intervals[index].next >= 0 && interval_start(&allocation->intervals[allocation->intervals[index].next]) <= position)
+    {
+        index = allocation->intervals[index].next;
+    }
+    return &allocation->intervals[index];
+}
@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "../ir/ir.h"
+#include "isel.h"
+
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+// Every instruction v owns four positions: operands are read at 4v, calls
+// clobber the caller saved registers at 4v + 1 and the result is written at
+// 4v + 2. An interval that ends with a use at 4v is free again for the result
+// of the same instruction, and one that is live across a call covers 4v + 1.
+#define POSITION_USE(value) (4 * (value))
+#define POSITION_CLOBBER(value) (4 * (value) + 1)
+#define POSITION_DEFINE(value) (4 * (value) + 2)
+
+#define REGISTER_CLASS_COUNT 2
+#define MAX_CLASS_REGISTERS 16
+#define NO_REGISTER -1
+
+typedef enum
+{
+    REGISTER_GENERAL,
+    REGISTER_FLOAT
+} RegisterClass;
+
+typedef struct
+{
+    int from;
+    int to; // exclusive
+} LiveRange;
+
+// The lifetime of one value, or the part of it after a split. A split value
+// is a chain of intervals linked by next in position order, each in its own
+// register or in the value's spill slot.
+typedef struct
+{
+    int value;
+    uint8_t register_class;
+    int reg; // NO_REGISTER when the interval lives in the spill slot
+    int next; // interval continuing this one after a split, -1 for the last
+
+    LiveRange *ranges;
+    int range_count;
+    int range_size;
+
+    int *uses; // sorted positions
+    int use_count;
+    int use_size;
+} LiveInterval;
+
+// What the allocator needs to know about the machine. Registers are numbered
+// per class with the target's own encoding, caller saved registers are the
+// ones a call destroys.
+typedef struct
+{
+    int allocatable[REGISTER_CLASS_COUNT][MAX_CLASS_REGISTERS];
+    int allocatable_count[REGISTER_CLASS_COUNT];
+    bool caller_saved[REGISTER_CLASS_COUNT][MAX_CLASS_REGISTERS];
+    const int *arguments[REGISTER_CLASS_COUNT];
+    int argument_count[REGISTER_CLASS_COUNT];
+    bool fma_calls; // fused multiply adds are calls, the target has no instruction for them
+} RegisterTarget;
+
+typedef struct
+{
+    LiveInterval *intervals;
+    int interval_count;
+    int interval_size;
+
+    int *value_interval; // first interval of each value, -1 for values without a result
+    int *value_slot; // spill slot of each value, -1 while it has none
+    int slot_count;
+
+    uint64_t *live_in; // per block bitset over values
+    int live_words;
+
+    uint32_t used_registers[REGISTER_CLASS_COUNT];
+    int split_count;
+    int spilled_count; // intervals living in a spill slot
+} Allocation;
+
+RegisterClass register_class_of(IRType type);
+Allocation *allocate_registers(IRFunction *function, const Selection *selection, const RegisterTarget *target, bool spill_all);
+void free_allocation(Allocation *allocation);
+LiveInterval *interval_at(Allocation *allocation, int value, int position);
+bool is_live_in(Allocation *allocation, int block, int value);
+
+#endif
@@ -0,0 +1,792 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "x86_64.h"
+#include "../defc/defc.h"
+
+// Encoder for the subset of x86-64 the JIT emits. Every general purpose
+// instruction is 64 bit (REX.W), memory operands go through encode_memory
+// which picks the ModRM/SIB form and the shortest displacement. Jumps and
+// calls to labels always use rel32 and are patched once all labels are bound.
+// Every encoder records the instruction it emits, see begin_instruction.
+
+X86Assembler *init_assembler()
+{
+    X86Assembler *assembler = calloc(1, sizeof(X86Assembler));
+    assembler->capacity = JIT_CODE_INCREMENT;
+    assembler->code = malloc(assembler->capacity);
+    if (!assembler->code)
+    {
+        wprintf(L"Memory allocation failed for the assembler.\n");
+        exit(1);
+    }
+    return assembler;
+}
+
+void free_assembler(X86Assembler *assembler)
+{
+    free(assembler->code);
+    free(assembler->labels);
+    free(assembler->fixups);
+    free(assembler->instructions);
+    free(assembler);
+}
+
+X86Memory x86_memory(X86Register base, int32_t disp)
+{
+    X86Memory memory = {base, X86_NO_REGISTER, 1, disp};
+    return memory;
+}
+
+static void emit_byte(X86Assembler *assembler, uint8_t byte)
+{
+    if (assembler->size >= assembler->capacity)
+    {
+        assembler->capacity *= 2;
+        assembler->code = realloc(assembler->code, assembler->capacity);
+        if (!assembler->code)
+        {
+            wprintf(L"Memory allocation failed while resizing machine code.\n");
+            exit(1);
+        }
+    }
+    assembler->code[assembler->size++] = byte;
+}
+
+static void emit_int32(X86Assembler *assembler, int32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        emit_byte(assembler, (uint8_t)((uint32_t)value >> (8 * i)));
+    }
+}
+
+static void emit_int64(X86Assembler *assembler, int64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        emit_byte(assembler, (uint8_t)((uint64_t)value >> (8 * i)));
+    }
+}
+
+static bool fits_int8(int64_t value)
+{
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static bool fits_int32(int64_t value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// force also emits an empty REX, needed to address spl, bpl, sil and dil
+static void emit_rex(X86Assembler *assembler, bool w, int reg, int index, int base, bool force)
+{
+    uint8_t rex = 0x40 | (w ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1);
+    if (rex != 0x40 || force)
+        emit_byte(assembler, rex);
+}
+
+static void emit_rex_memory(X86Assembler *assembler, bool w, int reg, X86Memory memory)
+{
+    emit_rex(assembler, w, reg, memory.index == X86_NO_REGISTER ? 0 : memory.index, memory.base, false);
+}
+
+static void encode_register(X86Assembler *assembler, int reg, int rm)
+{
+    emit_byte(assembler, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void encode_memory(X86Assembler *assembler, int reg, X86Memory memory)
+{
+    int base = memory.base & 7;
+    bool needs_sib = memory.index != X86_NO_REGISTER || base == RSP;
+    int mod;
+
+    // rbp and r13 as base have no mod 00 form, they always carry a displacement
+    if (memory.disp == 0 && base != RBP)
+        mod = 0;
+    else if (fits_int8(memory.disp))
+        mod = 1;
+    else
+        mod = 2;
+
+    emit_byte(assembler, mod << 6 | (reg & 7) << 3 | (needs_sib ? 4 : base));
+    if (needs_sib)
+    {
+        int scale = memory.scale == 8 ? 3 : memory.scale == 4 ? 2 : memory.scale == 2 ? 1 : 0;
+        int index = memory.index == X86_NO_REGISTER ? 4 : memory.index & 7;
+        emit_byte(assembler, scale << 6 | index << 3 | base);
+    }
+
+    if (mod == 1)
+        emit_byte(assembler, (uint8_t)memory.disp);
+    else if (mod == 2)
+        emit_int32(assembler, memory.disp);
+}
+
+// Records the instruction starting at the current offset, the encoder fills
+// in the fields it has
+static X86Instruction *begin_instruction(X86Assembler *assembler, X86InstructionKind kind, int flags)
+{
+    if (assembler->instruction_count >= assembler->instruction_size)
+    {
+        assembler->instruction_size = assembler->instruction_size ? assembler->instruction_size * 2 : 256;
+        assembler->instructions = realloc(assembler->instructions, assembler->instruction_size * sizeof(X86Instruction));
+    }
+    X86Instruction *instruction = &assembler->instructions[assembler->instruction_count++];
+    instruction->offset = assembler->size;
+    instruction->kind = kind;
+    instruction->flags = flags;
+    instruction->condition = -1;
+    instruction->operation = -1;
+    instruction->destination = X86_NO_REGISTER;
+    instruction->source = X86_NO_REGISTER;
+    instruction->memory = x86_memory(X86_NO_REGISTER, 0);
+    instruction->immediate = 0;
+    instruction->label = -1;
+    return instruction;
+}
+
+int x86_new_label(X86Assembler *assembler)
+{
+    if (assembler->label_count >= assembler->label_size)
+    {
+        assembler->label_size = assembler->label_size ? assembler->label_size * 2 : 64;
+        assembler->labels = realloc(assembler->labels, assembler->label_size * sizeof(int));
+    }
+    assembler->labels[assembler->label_count] = -1;
+    return assembler->label_count++;
+}
+
+void x86_bind_label(X86Assembler *assembler, int label)
+{
+    assembler->labels[label] = assembler->size;
+}
+
+static void emit_label_reference(X86Assembler *assembler, int label)
+{
+    if (assembler->fixup_count >= assembler->fixup_size)
+    {
+        assembler->fixup_size = assembler->fixup_size ? assembler->fixup_size * 2 : 64;
+        assembler->fixups = realloc(assembler->fixups, assembler->fixup_size * sizeof(X86Fixup));
+    }
+    assembler->fixups[assembler->fixup_count].position = assembler->size;
+    assembler->fixups[assembler->fixup_count].label = label;
+    assembler->fixup_count++;
+    emit_int32(assembler, 0);
+}
+
+// Patches every rel32 with the distance from the end of its field to the
+// label. Fails when a referenced label was never bound.
+bool x86_resolve_fixups(X86Assembler *assembler)
+{
+    for (int i = 0; i < assembler->fixup_count; i++)
+    {
+        X86Fixup *fixup = &assembler->fixups[i];
+        int target = assembler->labels[fixup->label];
+        if (target < 0)
+            return false;
+        int32_t displacement = target - (fixup->position + 4);
+        memcpy(&assembler->code[fixup->position], &displacement, 4);
+    }
+    return true;
+}
+
+void x86_mov(X86Assembler *assembler, X86Register destination, X86Register source)
+{
+    X86Instruction *instruction = begin_instruction(assembler, X86_MOVE, 0);
+    instruction->destination = destination;
+    instruction->source = source;
+    emit_rex(assembler, true, source, 0, destination, false);
+    emit_byte(assembler, 0x89);
+    encode_register(assembler, source, destination);
+}
+
+void x86_mov_immediate(X86Assembler *assembler, X86Register destination, int64_t value)
+{
+    X86Instruction *instruction = begin_instruction(assembler, X86_MOVE_IMMEDIATE, 0);
+    instruction->destination = destination;
+    instruction->immediate = value;
+    if (fits_int32(value))
+    {
+        emit_rex(assembler, true, 0, 0, destination, false);
+        emit_byte(assembler, 0xC7);
+        encode_register(assembler, 0, destination);
+        emit_int32(assembler, (int32_t)value);
+    }
+    else if (value >= 0 && value <= UINT32_MAX)
+    {
+        // 32 bit moves zero the upper half
+        emit_rex(assembler, false, 0, 0, destination, false);
+        emit_byte(assembler, 0xB8 + (destination & 7));
+        emit_int32(assembler, (int32_t)(uint32_t)value);
+    }
+    else
+    {
+        emit_rex(assembler, true, 0, 0, destination, false);
+        emit_byte(assembler, 0xB8 + (destination & 7));
+        emit_int64(assembler, value);
+    }
+}
+
+void x86_load(X86Assembler *assembler, X86Register destination, X86Memory source)
+{
+    X86Instruction *instruction = begin_instruction(assembler, X86_LOAD, 0);
+    instruction->destination = destination;
+    instruction->memory = source;
+    emit_rex_memory(assembler, true, destination, source);
+    emit_byte(assembler, 0x8B);
+    encode_memory(assembler, destination, source);
+}
+
+void x86_store(X86Assembler *assembler, X86Memory destination, X86Register source)
+{
+    X86Instruction *instruction = begin_instruction(assembler, X86_STORE, 0);
+    instruction->source = source;
+    instruction->memory = destination;
+    emit_rex_memory(assembler, true, source, destination);
+    emit_byte(assembler, 0x89);
+    encode_memory(assembler, source, destination);
+}
+
+void x86_lea(X86Assembler *assembler, X86Register destination, X86Memory source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_rex_memory(assembler, true, destination, source);
+    emit_byte(assembler, 0x8D);
+    encode_memory(assembler, destination, source);
+}
+
+void x86_alu(X86Assembler *assembler, X86AluOperation operation, X86Register destination, X86Register source)
+{
+    X86Instruction *instruction = begin_instruction(assembler, X86_ALU, X86_FLAGS_WRITE);
+    instruction->operation = operation;
+    instruction->destination = destination;
+    instruction->source = source;
+    emit_rex(assembler, true, source, 0, destination, false);
+    emit_byte(assembler, operation * 8 + 1);
+    encode_register(assembler, source, destination);
+}
+
+void x86_alu_memory(X86Assembler *assembler, X86AluOperation operation, X86Register destination, X86Memory source)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_rex_memory(assembler, true, destination, source);
+    emit_byte(assembler, operation * 8 + 3);
+    encode_memory(assembler, destination, source);
+}
+
+// destination op= fs:[offset], offset is from the thread pointer
+void x86_alu_thread_local(X86Assembler *assembler, X86AluOperation operation, X86Register destination, int32_t offset)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_byte(assembler, 0x64);
+    emit_rex(assembler, true, destination, 0, 0, false);
+    emit_byte(assembler, operation * 8 + 3);
+    // SIB without base and index is an absolute disp32, mod 00 r/m 101 would be rip relative
+    emit_byte(assembler, (destination & 7) << 3 | 4);
+    emit_byte(assembler, 0x25);
+    emit_int32(assembler, offset);
+}
+
+void x86_alu_immediate(X86Assembler *assembler, X86AluOperation operation, X86Register destination, int32_t value)
+{
+    X86Instruction *instruction = begin_instruction(assembler, X86_ALU, X86_FLAGS_WRITE);
+    instruction->operation = operation;
+    instruction->destination = destination;
+    instruction->immediate = value;
+    emit_rex(assembler, true, 0, 0, destination, false);
+    if (fits_int8(value))
+    {
+        emit_byte(assembler, 0x83);
+        encode_register(assembler, operation, destination);
+        emit_byte(assembler, (uint8_t)value);
+    }
+    else
+    {
+        emit_byte(assembler, 0x81);
+        encode_register(assembler, operation, destination);
+        emit_int32(assembler, value);
+    }
+}
+
+void x86_compare_memory_immediate(X86Assembler *assembler, X86Memory destination, int32_t value)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_rex_memory(assembler, true, 0, destination);
+    emit_byte(assembler, fits_int8(value) ? 0x83 : 0x81);
+    encode_memory(assembler, ALU_CMP, destination);
+    if (fits_int8(value))
+        emit_byte(assembler, (uint8_t)value);
+    else
+        emit_int32(assembler, value);
+}
+
+void x86_imul(X86Assembler *assembler, X86Register destination, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_rex(assembler, true, destination, 0, source, false);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, 0xAF);
+    encode_register(assembler, destination, source);
+}
+
+void x86_imul_memory(X86Assembler *assembler, X86Register destination, X86Memory source)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_rex_memory(assembler, true, destination, source);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, 0xAF);
+    encode_memory(assembler, destination, source);
+}
+
+// imul destination, source, value
+void x86_imul_immediate(X86Assembler *assembler, X86Register destination, X86Register source, int32_t value)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_rex(assembler, true, destination, 0, source, false);
+    if (fits_int8(value))
+    {
+        emit_byte(assembler, 0x6B);
+        encode_register(assembler, destination, source);
+        emit_byte(assembler, (uint8_t)value);
+    }
+    else
+    {
+        emit_byte(assembler, 0x69);
+        encode_register(assembler, destination, source);
+        emit_int32(assembler, value);
+    }
+}
+
+static void emit_group3(X86Assembler *assembler, int digit, X86Register reg)
+{
+    emit_rex(assembler, true, 0, 0, reg, false);
+    emit_byte(assembler, 0xF7);
+    encode_register(assembler, digit, reg);
+}
+
+void x86_neg(X86Assembler *assembler, X86Register reg)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_group3(assembler, 3, reg);
+}
+
+void x86_not(X86Assembler *assembler, X86Register reg)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_group3(assembler, 2, reg);
+}
+
+// rdx:rax = rax * source, signed
+void x86_imul_wide(X86Assembler *assembler, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_group3(assembler, 5, source);
+}
+
+void x86_shift_immediate(X86Assembler *assembler, X86ShiftOperation operation, X86Register reg, int count)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_rex(assembler, true, 0, 0, reg, false);
+    if (count == 1)
+    {
+        emit_byte(assembler, 0xD1);
+        encode_register(assembler, operation, reg);
+        return;
+    }
+    emit_byte(assembler, 0xC1);
+    encode_register(assembler, operation, reg);
+    emit_byte(assembler, (uint8_t)count);
+}
+
+void x86_cqo(X86Assembler *assembler)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_byte(assembler, 0x48);
+    emit_byte(assembler, 0x99);
+}
+
+void x86_idiv(X86Assembler *assembler, X86Register divisor)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_group3(assembler, 7, divisor);
+}
+
+void x86_test(X86Assembler *assembler, X86Register left, X86Register right)
+{
+    X86Instruction *instruction = begin_instruction(assembler, X86_TEST, X86_FLAGS_WRITE);
+    instruction->destination = left;
+    instruction->source = right;
+    emit_rex(assembler, true, right, 0, left, false);
+    emit_byte(assembler, 0x85);
+    encode_register(assembler, right, left);
+}
+
+void x86_setcc(X86Assembler *assembler, X86Condition condition, X86Register destination)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_READ)->condition = condition;
+    emit_rex(assembler, false, 0, 0, destination, destination >= RSP);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, 0x90 + condition);
+    encode_register(assembler, 0, destination);
+}
+
+void x86_cmov(X86Assembler *assembler, X86Condition condition, X86Register destination, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_READ)->condition = condition;
+    emit_rex(assembler, true, destination, 0, source, false);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, 0x40 + condition);
+    encode_register(assembler, destination, source);
+}
+
+void x86_bit_count(X86Assembler *assembler, X86BitOperation operation, X86Register destination, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_byte(assembler, 0xF3);
+    emit_rex(assembler, true, destination, 0, source, false);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, operation);
+    encode_register(assembler, destination, source);
+}
+
+void x86_bit_scan(X86Assembler *assembler, bool reverse, X86Register destination, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_rex(assembler, true, destination, 0, source, false);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, reverse ? 0xBD : 0xBC);
+    encode_register(assembler, destination, source);
+}
+
+void x86_movzx_byte(X86Assembler *assembler, X86Register destination, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_rex(assembler, true, destination, 0, source, false);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, 0xB6);
+    encode_register(assembler, destination, source);
+}
+
+void x86_movsxd(X86Assembler *assembler, X86Register destination, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_rex(assembler, true, destination, 0, source, false);
+    emit_byte(assembler, 0x63);
+    encode_register(assembler, destination, source);
+}
+
+void x86_push(X86Assembler *assembler, X86Register reg)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_rex(assembler, false, 0, 0, reg, false);
+    emit_byte(assembler, 0x50 + (reg & 7));
+}
+
+void x86_pop(X86Assembler *assembler, X86Register reg)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_rex(assembler, false, 0, 0, reg, false);
+    emit_byte(assembler, 0x58 + (reg & 7));
+}
+
+void x86_ret(X86Assembler *assembler)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_BARRIER);
+    emit_byte(assembler, 0xC3);
+}
+
+void x86_jmp(X86Assembler *assembler, int label)
+{
+    begin_instruction(assembler, X86_JUMP, X86_FLAGS_BARRIER)->label = label;
+    emit_byte(assembler, 0xE9);
+    emit_label_reference(assembler, label);
+}
+
+void x86_jcc(X86Assembler *assembler, X86Condition condition, int label)
+{
+    X86Instruction *instruction = begin_instruction(assembler, X86_BRANCH, X86_FLAGS_READ);
+    instruction->condition = condition;
+    instruction->label = label;
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, 0x80 + condition);
+    emit_label_reference(assembler, label);
+}
+
+void x86_call(X86Assembler *assembler, int label)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_BARRIER);
+    emit_byte(assembler, 0xE8);
+    emit_label_reference(assembler, label);
+}
+
+void x86_call_register(X86Assembler *assembler, X86Register target)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_BARRIER);
+    emit_rex(assembler, false, 0, 0, target, false);
+    emit_byte(assembler, 0xFF);
+    encode_register(assembler, 2, target);
+}
+
+// call [rip + label], through an address kept in the code
+void x86_call_indirect(X86Assembler *assembler, int label)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_BARRIER);
+    emit_byte(assembler, 0xFF);
+    // mod 00 r/m 101 is rip relative
+    emit_byte(assembler, 2 << 3 | 5);
+    emit_label_reference(assembler, label);
+}
+
+// Padding and data are not instructions, they follow the code once the
+// peephole pass is done with it
+void x86_align(X86Assembler *assembler, int alignment)
+{
+    while (assembler->size % alignment != 0)
+    {
+        emit_byte(assembler, 0xCC);
+    }
+}
+
+void x86_data64(X86Assembler *assembler, int64_t value)
+{
+    emit_int64(assembler, value);
+}
+
+// SSE instructions are a mandatory prefix, optional REX, 0F and the opcode
+static void emit_sse_prefix(X86Assembler *assembler, uint8_t prefix, bool w, int reg, int base, uint8_t opcode)
+{
+    emit_byte(assembler, prefix);
+    emit_rex(assembler, w, reg, 0, base, false);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, opcode);
+}
+
+static void emit_sse_memory(X86Assembler *assembler, uint8_t prefix, uint8_t opcode, int reg, X86Memory memory)
+{
+    emit_byte(assembler, prefix);
+    emit_rex_memory(assembler, false, reg, memory);
+    emit_byte(assembler, 0x0F);
+    emit_byte(assembler, opcode);
+    encode_memory(assembler, reg, memory);
+}
+
+void x86_movsd_load(X86Assembler *assembler, X86XmmRegister destination, X86Memory source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_memory(assembler, 0xF2, 0x10, destination, source);
+}
+
+void x86_movsd_store(X86Assembler *assembler, X86Memory destination, X86XmmRegister source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_memory(assembler, 0xF2, 0x11, source, destination);
+}
+
+// copies the whole register, unlike movsd it does not wait for the old
+// value of destination
+void x86_movapd(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_prefix(assembler, 0x66, false, destination, source, 0x28);
+    encode_register(assembler, destination, source);
+}
+
+void x86_sse(X86Assembler *assembler, X86SseOperation operation, X86XmmRegister destination, X86XmmRegister source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_prefix(assembler, 0xF2, false, destination, source, operation);
+    encode_register(assembler, destination, source);
+}
+
+void x86_sse_memory(X86Assembler *assembler, X86SseOperation operation, X86XmmRegister destination, X86Memory source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_memory(assembler, 0xF2, operation, destination, source);
+}
+
+void x86_ucomisd(X86Assembler *assembler, X86XmmRegister left, X86XmmRegister right)
+{
+    begin_instruction(assembler, X86_OTHER, X86_FLAGS_WRITE);
+    emit_sse_prefix(assembler, 0x66, false, left, right, 0x2E);
+    encode_register(assembler, left, right);
+}
+
+void x86_xorpd(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_prefix(assembler, 0x66, false, destination, source, 0x57);
+    encode_register(assembler, destination, source);
+}
+
+void x86_cvtsi2sd(X86Assembler *assembler, X86XmmRegister destination, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_prefix(assembler, 0xF2, true, destination, source, 0x2A);
+    encode_register(assembler, destination, source);
+}
+
+// out of range and NaN give INT64_MIN
+void x86_cvttsd2si(X86Assembler *assembler, X86Register destination, X86XmmRegister source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_prefix(assembler, 0xF2, true, destination, source, 0x2C);
+    encode_register(assembler, destination, source);
+}
+
+void x86_movq_to_xmm(X86Assembler *assembler, X86XmmRegister destination, X86Register source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_prefix(assembler, 0x66, true, destination, source, 0x6E);
+    encode_register(assembler, destination, source);
+}
+
+void x86_movq_from_xmm(X86Assembler *assembler, X86Register destination, X86XmmRegister source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_prefix(assembler, 0x66, true, source, destination, 0x7E);
+    encode_register(assembler, source, destination);
+}
+
+// three byte VEX: map 1 is 0F, 2 0F38, 3 0F3A, pp 1 is 66, 2 F3
+static void emit_vex(X86Assembler *assembler, int map, int pp, bool w, bool wide, int reg, int vvvv, int index, int base)
+{
+    emit_byte(assembler, 0xC4);
+    emit_byte(assembler, (~reg >> 3 & 1) << 7 | (~index >> 3 & 1) << 6 | (~base >> 3 & 1) << 5 | map);
+    emit_byte(assembler, (w ? 0x80 : 0) | (~vvvv & 15) << 3 | (wide ? 4 : 0) | pp);
+}
+
+void x86_vfmadd213sd(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister first, X86XmmRegister second)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_vex(assembler, 2, 1, true, false, destination, first, 0, second);
+    emit_byte(assembler, 0xA9);
+    encode_register(assembler, destination, second);
+}
+
+void x86_vfmadd213sd_memory(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister first, X86Memory second)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_vex(assembler, 2, 1, true, false, destination, first, second.index == X86_NO_REGISTER ? 0 : second.index, second.base);
+    emit_byte(assembler, 0xA9);
+    encode_memory(assembler, destination, second);
+}
+
+void x86_packed(X86Assembler *assembler, X86VectorWidth width, X86PackedOperation operation, X86XmmRegister destination, X86XmmRegister first, X86XmmRegister second)
+{
+    if (width != VECTOR_SSE)
+    {
+        begin_instruction(assembler, X86_OTHER, 0);
+        emit_vex(assembler, 1, 1, false, width == VECTOR_AVX_256, destination, operation == PACKED_MOVE ? 0 : first, 0, second);
+        emit_byte(assembler, operation);
+        encode_register(assembler, destination, second);
+        return;
+    }
+    if (operation != PACKED_MOVE && destination != first)
+        x86_packed(assembler, width, PACKED_MOVE, destination, destination, first);
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_sse_prefix(assembler, 0x66, false, destination, second, operation);
+    encode_register(assembler, destination, second);
+}
+
+void x86_packed_shift(X86Assembler *assembler, X86VectorWidth width, X86PackedShift shift, X86XmmRegister destination, X86XmmRegister source, int count)
+{
+    if (width == VECTOR_SSE && destination != source)
+        x86_packed(assembler, width, PACKED_MOVE, destination, destination, source);
+    begin_instruction(assembler, X86_OTHER, 0);
+    if (width == VECTOR_SSE)
+    {
+        emit_sse_prefix(assembler, 0x66, false, 0, destination, 0x73);
+        source = destination;
+    }
+    else
+    {
+        emit_vex(assembler, 1, 1, false, width == VECTOR_AVX_256, 0, destination, 0, source);
+        emit_byte(assembler, 0x73);
+    }
+    encode_register(assembler, shift, source);
+    emit_byte(assembler, (uint8_t)count);
+}
+
+// movdqu, no alignment needed
+void x86_packed_load(X86Assembler *assembler, X86VectorWidth width, X86XmmRegister destination, X86Memory source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    if (width != VECTOR_SSE)
+    {
+        emit_vex(assembler, 1, 2, false, width == VECTOR_AVX_256, destination, 0, source.index == X86_NO_REGISTER ? 0 : source.index, source.base);
+        emit_byte(assembler, 0x6F);
+        encode_memory(assembler, destination, source);
+        return;
+    }
+    emit_sse_memory(assembler, 0xF3, 0x6F, destination, source);
+}
+
+// movq, the other lanes are zeroed
+void x86_packed_from_general(X86Assembler *assembler, X86VectorWidth width, X86XmmRegister destination, X86Register source)
+{
+    if (width == VECTOR_SSE)
+    {
+        x86_movq_to_xmm(assembler, destination, source);
+        return;
+    }
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_vex(assembler, 1, 1, true, false, destination, 0, 0, source);
+    emit_byte(assembler, 0x6E);
+    encode_register(assembler, destination, source);
+}
+
+// copies the lowest lane into every lane, vpbroadcastq or punpcklqdq
+void x86_packed_broadcast(X86Assembler *assembler, X86VectorWidth width, X86XmmRegister reg)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    if (width == VECTOR_AVX_256)
+    {
+        emit_vex(assembler, 2, 1, false, true, reg, 0, 0, reg);
+        emit_byte(assembler, 0x59);
+    }
+    else if (width == VECTOR_AVX_128)
+    {
+        emit_vex(assembler, 1, 1, false, false, reg, reg, 0, reg);
+        emit_byte(assembler, 0x6C);
+    }
+    else
+        emit_sse_prefix(assembler, 0x66, false, reg, reg, 0x6C);
+    encode_register(assembler, reg, reg);
+}
+
+// pshufd with 0x4E on the low 128 bits: the two 64 bit lanes trade places
+void x86_packed_swap_halves(X86Assembler *assembler, X86VectorWidth width, X86XmmRegister destination, X86XmmRegister source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    if (width != VECTOR_SSE)
+    {
+        emit_vex(assembler, 1, 1, false, false, destination, 0, 0, source);
+        emit_byte(assembler, 0x70);
+    }
+    else
+        emit_sse_prefix(assembler, 0x66, false, destination, source, 0x70);
+    encode_register(assembler, destination, source);
+    emit_byte(assembler, 0x4E);
+}
+
+// vextracti128 destination, source, 1
+void x86_extract_high_lanes(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister source)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_vex(assembler, 3, 1, false, true, source, 0, 0, destination);
+    emit_byte(assembler, 0x39);
+    encode_register(assembler, source, destination);
+    emit_byte(assembler, 1);
+}
+
+void x86_vzeroupper(X86Assembler *assembler)
+{
+    begin_instruction(assembler, X86_OTHER, 0);
+    emit_byte(assembler, 0xC5);
+    emit_byte(assembler, 0xF8);
+    emit_byte(assembler, 0x77);
+}
@@ -0,0 +1,284 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef JIT_X86_64_H
+#define JIT_X86_64_H
+
+typedef enum
+{
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+    X86_NO_REGISTER = -1
+} X86Register;
+
+typedef enum
+{
+    XMM0,
+    XMM1,
+    XMM2,
+    XMM3,
+    XMM4,
+    XMM5,
+    XMM6,
+    XMM7,
+    XMM8,
+    XMM9,
+    XMM10,
+    XMM11,
+    XMM12,
+    XMM13,
+    XMM14,
+    XMM15
+} X86XmmRegister;
+
+// condition codes in encoding order, added to the base of jcc/setcc
+typedef enum
+{
+    CC_O,
+    CC_NO,
+    CC_B,
+    CC_AE,
+    CC_E,
+    CC_NE,
+    CC_BE,
+    CC_A,
+    CC_S,
+    CC_NS,
+    CC_P,
+    CC_NP,
+    CC_L,
+    CC_GE,
+    CC_LE,
+    CC_G
+} X86Condition;
+
+// [base + index * scale + disp], index is X86_NO_REGISTER when unused
+typedef struct
+{
+    X86Register base;
+    X86Register index;
+    int scale;
+    int32_t disp;
+} X86Memory;
+
+// the /digit of the 0x81/0x83 group and the opcode of the r/m, reg forms
+typedef enum
+{
+    ALU_ADD = 0,
+    ALU_OR = 1,
+    ALU_AND = 4,
+    ALU_SUB = 5,
+    ALU_XOR = 6,
+    ALU_CMP = 7
+} X86AluOperation;
+
+// the /digit of the 0xC1/0xD1 shift group
+typedef enum
+{
+    SHIFT_SHL = 4,
+    SHIFT_SHR = 5,
+    SHIFT_SAR = 7
+} X86ShiftOperation;
+
+typedef enum
+{
+    SSE_SQRT = 0x51,
+    SSE_ADD = 0x58,
+    SSE_MUL = 0x59,
+    SSE_SUB = 0x5C,
+    SSE_MIN = 0x5D,
+    SSE_DIV = 0x5E,
+    SSE_MAX = 0x5F
+} X86SseOperation;
+
+// the opcode after F3 0F of the bit counts, bsf and bsr are 0F BC and 0F BD
+typedef enum
+{
+    BIT_POPCNT = 0xB8,
+    BIT_TZCNT = 0xBC,
+    BIT_LZCNT = 0xBD
+} X86BitOperation;
+
+// packed 64 bit integer operations, the opcode after 66 0F
+typedef enum
+{
+    PACKED_MOVE = 0x6F, // movdqa
+    PACKED_ADD = 0xD4, // paddq
+    PACKED_SUB = 0xFB, // psubq
+    PACKED_MULTIPLY_LOW = 0xF4, // pmuludq, low 32 bits of each lane
+    PACKED_AND = 0xDB,
+    PACKED_OR = 0xEB,
+    PACKED_XOR = 0xEF,
+    PACKED_EQUAL = 0x76 // pcmpeqd
+} X86PackedOperation;
+
+// the /digit of the 66 0F 73 shift group
+typedef enum
+{
+    PACKED_SHIFT_RIGHT = 2,
+    PACKED_SHIFT_LEFT = 6
+} X86PackedShift;
+
+// legacy SSE on xmm, VEX on xmm with the upper ymm lanes zeroed, VEX on ymm
+typedef enum
+{
+    VECTOR_SSE,
+    VECTOR_AVX_128,
+    VECTOR_AVX_256
+} X86VectorWidth;
+
+typedef struct
+{
+    int position; // first byte of the rel32 field
+    int label;
+} X86Fixup;
+
+// what jit/peephole.c reads of an emitted instruction
+typedef enum
+{
+    X86_OTHER,
+    X86_MOVE, // mov destination, source
+    X86_MOVE_IMMEDIATE, // mov destination, immediate
+    X86_LOAD, // mov destination, [memory]
+    X86_STORE, // mov [memory], source
+    X86_ALU, // destination operation= source or immediate
+    X86_TEST, // test destination, source
+    X86_JUMP,
+    X86_BRANCH
+} X86InstructionKind;
+
+// how an instruction uses the flags, none are live across a barrier
+#define X86_FLAGS_READ 1
+#define X86_FLAGS_WRITE 2
+#define X86_FLAGS_BARRIER 4
+
+// registers are X86_NO_REGISTER and the rest -1 when unused
+typedef struct
+{
+    int offset;
+    uint8_t kind;
+    uint8_t flags;
+    int8_t condition; // jcc, setcc and cmov
+    int8_t operation; // X86AluOperation
+    int8_t destination;
+    int8_t source;
+    X86Memory memory;
+    int64_t immediate;
+    int label;
+} X86Instruction;
+
+// Code is assembled into a growable buffer, labels are bound to offsets and
+// rel32 references to them are patched by x86_resolve_fixups. Every emitted
+// instruction is recorded in order for the peephole pass.
+typedef struct
+{
+    uint8_t *code;
+    int size;
+    int capacity;
+
+    int *labels; // offset of every label, -1 while unbound
+    int label_size;
+    int label_count;
+
+    X86Fixup *fixups;
+    int fixup_size;
+    int fixup_count;
+
+    X86Instruction *instructions;
+    int instruction_size;
+    int instruction_count;
+} X86Assembler;
+
+X86Assembler *init_assembler();
+void free_assembler(X86Assembler *assembler);
+X86Memory x86_memory(X86Register base, int32_t disp);
+
+int x86_new_label(X86Assembler *assembler);
+void x86_bind_label(X86Assembler *assembler, int label);
+bool x86_resolve_fixups(X86Assembler *assembler);
+
+void x86_mov(X86Assembler *assembler, X86Register destination, X86Register source);
+void x86_mov_immediate(X86Assembler *assembler, X86Register destination, int64_t value);
+void x86_load(X86Assembler *assembler, X86Register destination, X86Memory source);
+void x86_store(X86Assembler *assembler, X86Memory destination, X86Register source);
+void x86_lea(X86Assembler *assembler, X86Register destination, X86Memory source);
+void x86_alu(X86Assembler *assembler, X86AluOperation operation, X86Register destination, X86Register source);
+void x86_alu_memory(X86Assembler *assembler, X86AluOperation operation, X86Register destination, X86Memory source);
+// the offset of x86_alu_thread_local is this many bytes into the instruction
+#define X86_THREAD_LOCAL_OFFSET 5
+void x86_alu_thread_local(X86Assembler *assembler, X86AluOperation operation, X86Register destination, int32_t offset);
+void x86_alu_immediate(X86Assembler *assembler, X86AluOperation operation, X86Register destination, int32_t value);
+void x86_compare_memory_immediate(X86Assembler *assembler, X86Memory destination, int32_t value);
+void x86_imul(X86Assembler *assembler, X86Register destination, X86Register source);
+void x86_imul_memory(X86Assembler *assembler, X86Register destination, X86Memory source);
+void x86_imul_immediate(X86Assembler *assembler, X86Register destination, X86Register source, int32_t value);
+void x86_imul_wide(X86Assembler *assembler, X86Register source);
+void x86_shift_immediate(X86Assembler *assembler, X86ShiftOperation operation, X86Register reg, int count);
+void x86_neg(X86Assembler *assembler, X86Register reg);
+void x86_not(X86Assembler *assembler, X86Register reg);
+void x86_cqo(X86Assembler *assembler);
+void x86_idiv(X86Assembler *assembler, X86Register divisor);
+void x86_test(X86Assembler *assembler, X86Register left, X86Register right);
+void x86_setcc(X86Assembler *assembler, X86Condition condition, X86Register destination);
+void x86_cmov(X86Assembler *assembler, X86Condition condition, X86Register destination, X86Register source);
+void x86_movzx_byte(X86Assembler *assembler, X86Register destination, X86Register source);
+// sign extends the low 32 bits of source
+void x86_movsxd(X86Assembler *assembler, X86Register destination, X86Register source);
+void x86_bit_count(X86Assembler *assembler, X86BitOperation operation, X86Register destination, X86Register source);
+// bsr when reverse, else bsf: index of the highest or lowest set bit, for
+// zero ZF is set and destination keeps its value
+void x86_bit_scan(X86Assembler *assembler, bool reverse, X86Register destination, X86Register source);
+void x86_push(X86Assembler *assembler, X86Register reg);
+void x86_pop(X86Assembler *assembler, X86Register reg);
+void x86_ret(X86Assembler *assembler);
+
+void x86_jmp(X86Assembler *assembler, int label);
+void x86_jcc(X86Assembler *assembler, X86Condition condition, int label);
+void x86_call(X86Assembler *assembler, int label);
+void x86_call_register(X86Assembler *assembler, X86Register target);
+void x86_call_indirect(X86Assembler *assembler, int label);
+void x86_align(X86Assembler *assembler, int alignment);
+void x86_data64(X86Assembler *assembler, int64_t value);
+
+void x86_movsd_load(X86Assembler *assembler, X86XmmRegister destination, X86Memory source);
+void x86_movsd_store(X86Assembler *assembler, X86Memory destination, X86XmmRegister source);
+void x86_movapd(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister source);
+void x86_sse(X86Assembler *assembler, X86SseOperation operation, X86XmmRegister destination, X86XmmRegister source);
+void x86_sse_memory(X86Assembler *assembler, X86SseOperation operation, X86XmmRegister destination, X86Memory source);
+void x86_ucomisd(X86Assembler *assembler, X86XmmRegister left, X86XmmRegister right);
+void x86_xorpd(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister source);
+void x86_cvtsi2sd(X86Assembler *assembler, X86XmmRegister destination, X86Register source);
+void x86_cvttsd2si(X86Assembler *assembler, X86Register destination, X86XmmRegister source);
+void x86_movq_to_xmm(X86Assembler *assembler, X86XmmRegister destination, X86Register source);
+void x86_movq_from_xmm(X86Assembler *assembler, X86Register destination, X86XmmRegister source);
+// destination = first * destination + second, rounded once
+void x86_vfmadd213sd(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister first, X86XmmRegister second);
+void x86_vfmadd213sd_memory(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister first, X86Memory second);
+
+// destination = first op second, SSE copies first into destination first,
+// so destination must not be second unless it is first too
+void x86_packed(X86Assembler *assembler, X86VectorWidth width, X86PackedOperation operation, X86XmmRegister destination, X86XmmRegister first, X86XmmRegister second);
+void x86_packed_shift(X86Assembler *assembler, X86VectorWidth width, X86PackedShift shift, X86XmmRegister destination, X86XmmRegister source, int count);
+void x86_packed_load(X86Assembler *assembler, X86VectorWidth width, X86XmmRegister destination, X86Memory source);
+void x86_packed_from_general(X86Assembler *assembler, X86VectorWidth width, X86XmmRegister destination, X86Register source);
+void x86_packed_broadcast(X86Assembler *assembler, X86VectorWidth width, X86XmmRegister reg);
+void x86_packed_swap_halves(X86Assembler *assembler, X86VectorWidth width, X86XmmRegister destination, X86XmmRegister source);
+void x86_extract_high_lanes(X86Assembler *assembler, X86XmmRegister destination, X86XmmRegister source);
+void x86_vzeroupper(X86Assembler *assembler);
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include "libcjit.h"
+#include "../defc/defc.h"
+#include "../src_lexer/lexer.h"
+#include "../hashmap/hashmap.h"
+#include "../parser/parser.h"
+#include "../semantic/semantic.h"
+#include "../ir/ir.h"
+#include "../ffi/ffi.h"
+#include "../opt/opt.h"
+#include "../jit/jit.h"
+
+// The library runs the pipeline of cjit --engine=jit up to the native code
+// and keeps only that: the AST and the IR are freed before cjit_compile
+// returns, a program is its JIT module and the names and signatures of its
+// functions. All programs of a context share its code heap.
+
+struct CJITContext
+{
+    pthread_mutex_t lock;
+    CodeHeap *heap;
+    JITOptions jit_options;
+    OptOptions opt_options;
+    FFISymbol *symbols; // registered by the host, names owned
+    int symbol_count;
+    char error[PARSER_ERROR_SIZE]; // of the last cjit_compile, empty when it compiled
+};
+
+struct CJITFunction
+{
+    CJITProgram *program;
+    int index;
+    char *name;
+    char *signature;
+};
+
+struct CJITProgram
+{
+    CJITContext *context;
+    JITModule *native;
+    CJITFunction *functions;
+    int function_count;
+};
+
+CJITContext *cjit_create_context(void)
+{
+    CJITContext *context = calloc(1, sizeof(CJITContext));
+    if (!context)
+    {
+        wprintf(L"Memory allocation failed for the context.\n");
+        exit(1);
+    }
+    pthread_mutex_init(&context->lock, NULL);
+    context->heap = init_code_heap();
+    context->jit_options = (JITOptions){true, true, true, jit_cpu_extensions()};
+    init_opt_options(&context->opt_options);
+    context->opt_options.vector_lanes = jit_supports_avx2() ? 4 : 2;
+    return context;
+}
+
+void cjit_destroy_context(CJITContext *context)
+{
+    for (int s = 0; s < context->symbol_count; s++)
+    {
+        free((char *)context->symbols[s].name);
+    }
+    free(context->symbols);
+    free_code_heap(context->heap);
+    pthread_mutex_destroy(&context->lock);
+    free(context);
+}
+
+void cjit_register_symbol(CJITContext *context, const char *name, void *address)
+{
+    pthread_mutex_lock(&context->lock);
+    context->symbols = realloc(context->symbols, (context->symbol_count + 1) * sizeof(FFISymbol));
+    context->symbols[context->symbol_count++] = (FFISymbol){strdup(name), address};
+    pthread_mutex_unlock(&context->lock);
+}
+
+static char type_letter(uint8_t type)
+{
+    return type == IR_FLOAT ? 'f' : type == IR_INT ? 'i' : 'v';
+}
+
+static char *describe_signature(const JITFunction *function)
+{
+    char *signature = malloc(function->param_count + 4);
+    int length = 0;
+    signature[length++] = type_letter(function->return_type);
+    signature[length++] = '(';
+    for (int i = 0; i < function->param_count; i++)
+    {
+        signature[length++] = type_letter(function->param_types[i]);
+    }
+    signature[length++] = ')';
+    signature[length] = '\0';
+    return signature;
+}
+
+// Lowers, optimizes and compiles a checked program, NULL when it does not verify
+static JITModule *compile_native(CJITContext *context, Parser *parser, IRModule **ir)
+{
+    IRModule *module = lower_program(parser);
+    if (module == NULL)
+        return NULL;
+    OptStats stats;
+    memset(&stats, 0, sizeof(OptStats));
+    optimize_module(module, &context->opt_options, &stats);
+    if (verify_ir_module(module) > 0)
+    {
+        free_ir_module(module);
+        return NULL;
+    }
+    *ir = module;
+    return jit_compile_module(context->heap, module, &context->jit_options);
+}
+
+CJITProgram *cjit_compile(CJITContext *context, const char *name, const char *source)
+{
+    pthread_mutex_lock(&context->lock);
+    Lexer *lexer = lex_source(strdup(source), strdup(name));
+    Parser *parser = init_parser(lexer);
+
+    // a syntax error returns here instead of exiting the host
+    jmp_buf recover;
+    bool checked = false;
+    parser->recover = &recover;
+    if (setjmp(recover) == 0)
+    {
+        parse_program(parser);
+        checked = analyze_program(parser) == 0 && resolve_extern_functions(parser, context->symbols, context->symbol_count) == 0;
+    }
+    parser->recover = NULL;
+
+    CJITProgram *program = NULL;
+    IRModule *module = NULL;
+    JITModule *native = checked ? compile_native(context, parser, &module) : NULL;
+    if (native)
+    {
+        program = calloc(1, sizeof(CJITProgram));
+        program->context = context;
+        program->native = native;
+        program->function_count = native->function_count;
+        program->functions = calloc(native->function_count + 1, sizeof(CJITFunction));
+        for (int f = 0; f < native->function_count; f++)
+        {
+            CJITFunction *function = &program->functions[f];
+            function->program = program;
+            function->index = f;
+            function->name = strdup(module->functions[f]->name);
+            function->signature = describe_signature(&native->functions[f]);
+        }
+    }
+    if (native)
+        context->error[0] = '\0';
+    else if (parser->error[0] != '\0')
+        strcpy(context->error, parser->error);
+    else
+        snprintf(context->error, PARSER_ERROR_SIZE, "%s: program does not compile", name);
+    if (module)
+        free_ir_module(module);
+    // the parser frees the tokens, the lexer its source and name
+    free_parser(parser, true);
+    free_lexer(lexer, false);
+    pthread_mutex_unlock(&context->lock);
+    return program;
+}
+
+const char *cjit_last_error(const CJITContext *context)
+{
+    return context->error;
+}
+
+void cjit_unload(CJITProgram *program)
+{
+    CJITContext *context = program->context;
+    pthread_mutex_lock(&context->lock);
+    for (int f = 0; f < program->function_count; f++)
+    {
+        free(program->functions[f].name);
+        free(program->functions[f].signature);
+    }
+    free(program->functions);
+    free_jit_module(program->native);
+    free(program);
+    pthread_mutex_unlock(&context->lock);
+}
+
+const CJITFunction *cjit_lookup(const CJITProgram *program, const char *name)
+{
+    for (int f = 0; f < program->function_count; f++)
+    {
+        if (f != program->native->entry && strcmp(program->functions[f].name, name) == 0)
+            return &program->functions[f];
+    }
+    return NULL;
+}
+
+const CJITFunction *cjit_entry(const CJITProgram *program)
+{
+    return &program->functions[program->native->entry];
+}
+
+const char *cjit_signature(const CJITFunction *function)
+{
+    return function->signature;
+}
+
+void *cjit_function_pointer(const CJITFunction *function, const char *signature)
+{
+    if (function == NULL || strcmp(function->signature, signature) != 0)
+        return NULL;
+    return function->program->native->functions[function->index].entry;
+}
+
+bool cjit_call(const CJITFunction *function, const CJITValue *arguments, CJITValue *result, const char **error)
+{
+    JITValue value;
+    if (jit_call(function->program->native, function->index, (const JITValue *)arguments, &value, error) != JIT_OK)
+        return false;
+    result->i = value.i;
+    return true;
+}
@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef LIBCJIT_H
+#define LIBCJIT_H
+
+// Embedding API: compile a program once, then call its functions from C as
+// often as needed.
+//
+//     CJITContext *context = cjit_create_context();
+//     CJITProgram *program = cjit_compile(context, "add.cj", "int add(int a, int b) { return a + b; }");
+//     int64_t (*add)(int64_t, int64_t) = (int64_t (*)(int64_t, int64_t))cjit_function_pointer(cjit_lookup(program, "add"), "i(ii)");
+//     ...
+//     cjit_unload(program);
+//     cjit_destroy_context(context);
+//
+// Contexts may be shared by threads: compiling and unloading take its lock,
+// lookups and calls take none. A program must not be unloaded while a
+// thread still runs its code. Compile errors are printed with wprintf like
+// the cjit command prints them and the first one is kept for
+// cjit_last_error, a syntax error never exits the process.
+
+typedef struct CJITContext CJITContext;
+typedef struct CJITProgram CJITProgram;
+typedef struct CJITFunction CJITFunction;
+
+typedef union
+{
+    int64_t i;
+    double f;
+} CJITValue;
+
+CJITContext *cjit_create_context(void);
+// every program compiled in context must have been unloaded
+void cjit_destroy_context(CJITContext *context);
+
+// Makes the C function at address the extern function name of the programs
+// compiled in context afterwards, before the symbols of the process. The
+// program declares it with its C types, long for int64_t and float for
+// double:
+//
+//     int clamp(int x, int low, int high);             // C
+//     extern int clamp(int x, int low, int high);      // program
+//     cjit_register_symbol(context, "clamp", (void *)clamp);
+void cjit_register_symbol(CJITContext *context, const char *name, void *address);
+
+// NULL when source does not compile, name is the file name of its messages
+CJITProgram *cjit_compile(CJITContext *context, const char *name, const char *source);
+// First error message of the last cjit_compile of context, empty when it
+// compiled. The next cjit_compile overwrites it.
+const char *cjit_last_error(const CJITContext *context);
+void cjit_unload(CJITProgram *program);
+
+// NULL when program has no function name. The top level statements are the
+// function cjit_entry returns.
+const CJITFunction *cjit_lookup(const CJITProgram *program, const char *name);
+const CJITFunction *cjit_entry(const CJITProgram *program);
+
+// Signature of function as its return type and its parameter types in
+// parentheses, i for int, f for float and v for no value: "f(if)".
+const char *cjit_signature(const CJITFunction *function);
+
+// Native entry of function for a System V function pointer of signature,
+// NULL when function is NULL or has another signature. Calls through it
+// cost what a call between C functions does, but a division by zero in
+// them aborts the process and the depth of their recursion is not checked.
+void *cjit_function_pointer(const CJITFunction *function, const char *signature);
+
+// Calls function with one argument per parameter and catches runtime
+// errors, false with error set to their message when one was raised. Any
+// number of threads may call at once.
+bool cjit_call(const CJITFunction *function, const CJITValue *arguments, CJITValue *result, const char **error);
+
+#endif
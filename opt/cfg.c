@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+
+// Straightens the control flow graph: a block that ends with a jump to a
+// block with no other predecessor takes over the code of that block. Split
+// call sites and folded branches leave such chains behind, and every link
+// costs the JIT a jump.
+//
+// The merged code is appended to the function as copies and the originals
+// are replaced by them, so it stays behind the code of the block that takes
+// it whatever the order the two blocks were lowered in.
+
+static void rename_predecessor(IRFunction *function, int target, int block, int successor)
+{
+    IRBlock *range = &function->blocks[target];
+    for (int i = range->first; i < range->first + range->count && function->instructions[i].op == IR_PHI; i++)
+    {
+        IRInstruction *phi = &function->instructions[i];
+        for (int k = 0; k < phi->imm.list.count; k++)
+        {
+            if (function->operands[phi->imm.list.first + 2 * k] == block)
+                function->operands[phi->imm.list.first + 2 * k] = successor;
+        }
+    }
+}
+
+// Returns the number of blocks merged into their predecessor
+int cfg_pass(IRFunction *function)
+{
+    ir_build_dominators(function);
+
+    int merged = 0;
+    for (int r = 0; r < function->block_count && function->rpo[r] >= 0; r++)
+    {
+        int block = function->rpo[r];
+        int jump = function->blocks[block].first + function->blocks[block].count - 1;
+        while (function->instructions[jump].op == IR_JUMP)
+        {
+            int next = function->instructions[jump].imm.jump.target;
+            if (next == block || function->pred_offsets[next + 1] - function->pred_offsets[next] != 1)
+                break;
+
+            // a single predecessor leaves no phis after ir_compact
+            IRBlock range = function->blocks[next];
+            function->instructions[jump].op = IR_NOP;
+            for (int i = range.first; i < range.first + range.count; i++)
+            {
+                int copy = ir_emit(function, block, IR_NOP, IR_VOID, -1, -1);
+                function->instructions[copy] = function->instructions[i];
+                function->instructions[copy].block = block;
+                function->instructions[i].op = IR_NOP;
+                if (function->instructions[copy].type != IR_VOID)
+                    ir_replace_value(function, i, copy);
+                jump = copy;
+            }
+
+            int32_t successors[2];
+            int successor_count = 0;
+            IRInstruction *terminator = &function->instructions[jump];
+            if (terminator->op == IR_JUMP || terminator->op == IR_BRANCH)
+                successors[successor_count++] = terminator->imm.jump.target;
+            if (terminator->op == IR_BRANCH && terminator->imm.jump.other != terminator->imm.jump.target)
+                successors[successor_count++] = terminator->imm.jump.other;
+            for (int k = 0; k < successor_count; k++)
+            {
+                rename_predecessor(function, successors[k], next, block);
+            }
+            merged++;
+        }
+    }
+
+    if (merged > 0)
+        ir_compact(function);
+    return merged;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+
+// Mark and sweep dead code elimination. Instructions with side effects are
+// live, so is every operand of a live instruction, phi operands included.
+// Everything else goes, which also takes out cycles of phis that only feed
+// each other, such as a variable assigned in a loop and never read after it.
+
+static void mark(bool *live, int *worklist, int *worklist_count, int value)
+{
+    if (value < 0 || live[value])
+        return;
+    live[value] = true;
+    worklist[(*worklist_count)++] = value;
+}
+
+// Returns the number of instructions removed
+int dce_pass(IRFunction *function)
+{
+    int count = function->instruction_count;
+    bool *live = calloc(count + 1, sizeof(bool));
+    int *worklist = malloc((count + 1) * sizeof(int));
+    int worklist_count = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (opt_has_side_effects(function, &function->instructions[i]))
+            mark(live, worklist, &worklist_count, i);
+    }
+
+    while (worklist_count > 0)
+    {
+        IRInstruction *instruction = &function->instructions[worklist[--worklist_count]];
+        const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+        for (int k = 0; k < info->value_args; k++)
+        {
+            mark(live, worklist, &worklist_count, instruction->args[k]);
+        }
+        if (info->has_list)
+        {
+            int stride = instruction->op == IR_PHI ? 2 : 1;
+            for (int k = 0; k < instruction->imm.list.count; k++)
+            {
+                mark(live, worklist, &worklist_count, function->operands[instruction->imm.list.first + k * stride + stride - 1]);
+            }
+        }
+    }
+
+    int removed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (live[i])
+            continue;
+        function->instructions[i].op = IR_NOP;
+        removed++;
+    }
+
+    free(live);
+    free(worklist);
+    if (removed > 0)
+        ir_compact(function);
+    return removed;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+
+// Dominator based global value numbering. Blocks are visited in reverse
+// post order, so the dominators of a block come before it, and every pure
+// instruction is looked up in a table keyed by opcode, type, operands and
+// constant. A match whose block dominates the instruction replaces it.
+// Matches from sibling branches stay in the table for the blocks they do
+// dominate.
+//
+// Constants are only merged inside a block. The register allocator does not
+// rematerialize them, a constant shared by the whole function would keep a
+// register for its whole length.
+
+static bool is_commutative(IRFunction *function, IRInstruction *instruction)
+{
+    switch (instruction->op)
+    {
+    case IR_EQ:
+    case IR_NE:
+        return true;
+    case IR_ADD:
+    case IR_MUL:
+    case IR_MULHI:
+    case IR_AND:
+    case IR_OR:
+    case IR_MIN:
+    case IR_MAX:
+        // x86 keeps the NaN payload of the first operand, minsd and maxsd
+        // the second operand for NaN and equal zeros
+        return function->instructions[instruction->args[0]].type == IR_INT;
+    default:
+        return false;
+    }
+}
+
+// operands resolved and in canonical order
+static void key_of(IRFunction *function, IRInstruction *instruction, int32_t *args)
+{
+    const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+    for (int k = 0; k < 3; k++)
+    {
+        args[k] = k < info->value_args ? ir_resolve_value(function, instruction->args[k]) : -1;
+    }
+    if (is_commutative(function, instruction) && args[0] > args[1])
+    {
+        int32_t swap = args[0];
+        args[0] = args[1];
+        args[1] = swap;
+    }
+}
+
+// constants and shifts carry a value in imm.i
+static bool has_immediate(IRInstruction *instruction)
+{
+    return instruction->op == IR_CONST || instruction->op == IR_SHL || instruction->op == IR_SHR || instruction->op == IR_SAR;
+}
+
+static uint64_t hash_of(IRInstruction *instruction, const int32_t *args)
+{
+    uint64_t hash = instruction->op * 31u + instruction->type;
+    hash = hash * 0x9e3779b97f4a7c15u + (uint32_t)args[0];
+    hash = hash * 0x9e3779b97f4a7c15u + (uint32_t)args[1];
+    hash = hash * 0x9e3779b97f4a7c15u + (uint32_t)args[2];
+    if (has_immediate(instruction))
+        hash = hash * 0x9e3779b97f4a7c15u + (uint64_t)instruction->imm.i;
+    return hash ^ (hash >> 29);
+}
+
+static bool same_value(IRFunction *function, IRInstruction *a, const int32_t *a_args, int b)
+{
+    IRInstruction *other = &function->instructions[b];
+    int32_t b_args[3];
+    if (a->op != other->op || a->type != other->type)
+        return false;
+    key_of(function, other, b_args);
+    if (a_args[0] != b_args[0] || a_args[1] != b_args[1] || a_args[2] != b_args[2])
+        return false;
+    return !has_immediate(a) || a->imm.i == other->imm.i;
+}
+
+// Returns the number of instructions replaced by an equal dominating one
+int gvn_pass(IRFunction *function)
+{
+    ir_build_dominators(function);
+
+    int capacity = 16;
+    while (capacity < 2 * function->instruction_count)
+        capacity *= 2;
+    int32_t *table = malloc(capacity * sizeof(int32_t));
+    for (int k = 0; k < capacity; k++)
+    {
+        table[k] = -1;
+    }
+
+    int merged = 0;
+    for (int r = 0; r < function->block_count && function->rpo[r] >= 0; r++)
+    {
+        int b = function->rpo[r];
+        IRBlock *block = &function->blocks[b];
+        for (int i = block->first; i < block->first + block->count; i++)
+        {
+            IRInstruction *instruction = &function->instructions[i];
+            bool division = instruction->op == IR_DIV;
+            // a division equal to one that did not trap cannot trap either
+            if (!division && !opt_is_movable(function, instruction))
+                continue;
+
+            int32_t args[3];
+            key_of(function, instruction, args);
+            int slot = hash_of(instruction, args) & (capacity - 1);
+            int found = -1;
+            for (; table[slot] >= 0; slot = (slot + 1) & (capacity - 1))
+            {
+                int candidate = table[slot];
+                int candidate_block = function->instructions[candidate].block;
+                if (instruction->op == IR_CONST && candidate_block != b)
+                    continue;
+                if (same_value(function, instruction, args, candidate) && ir_dominates(function, candidate_block, b))
+                {
+                    found = candidate;
+                    break;
+                }
+            }
+
+            if (found >= 0)
+            {
+                ir_replace_value(function, i, found);
+                instruction->op = IR_NOP;
+                merged++;
+            }
+            else
+                table[slot] = i;
+        }
+    }
+
+    free(table);
+    ir_compact(function);
+    return merged;
+}
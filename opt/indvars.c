@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+
+// Induction variable simplification on counted loops, see opt_counted_loop:
+//
+// - the exit compare gets the induction variable on its left, and i <= C
+//   becomes i < C + 1 and i >= C becomes i > C - 1 when that does not wrap,
+//   so the vectorizer and the unroller see one form
+// - induction variables with the same start and step are one
+// - when the trip count follows from the start and the bound, the values
+//   induction variables leave the loop with are computed after it, from the
+//   trip count, so the ones only read after the loop are left to dce
+// - a loop with nothing left to do, no side effects and no value read after
+//   it but those, is skipped altogether
+//
+// The trip count is known for loops counting up by one to a bound they
+// compare less than, and down by one to one they compare greater than. A
+// count up from start to n is (n - start) * (start < n), which wraps to the
+// right value even when n - start does not fit.
+
+// constants are copied into the block using them, like the lowering does
+static int value_in(IRFunction *function, int value, int block)
+{
+    IRInstruction *instruction = &function->instructions[value];
+    if (instruction->op != IR_CONST || instruction->block == block)
+        return value;
+    return ir_emit_const_int(function, block, instruction->imm.i);
+}
+
+static bool canonicalize_compare(IRFunction *function, OptCountedLoop *counted)
+{
+    IRInstruction *compare = &function->instructions[counted->compare];
+    IRInstruction *bound = &function->instructions[counted->bound];
+    IROpcode condition = counted->condition;
+    int64_t limit = 0;
+    bool shifted = false;
+    if (bound->op == IR_CONST && condition == IR_LE && bound->imm.i != INT64_MAX)
+    {
+        condition = IR_LT;
+        limit = bound->imm.i + 1;
+        shifted = true;
+    }
+    else if (bound->op == IR_CONST && condition == IR_GE && bound->imm.i != INT64_MIN)
+    {
+        condition = IR_GT;
+        limit = bound->imm.i - 1;
+        shifted = true;
+    }
+    if (!shifted && compare->op == condition && compare->args[0] == counted->induction)
+        return false;
+
+    int right = shifted ? ir_emit_const_int(function, counted->header, limit) : counted->bound;
+    int replacement = ir_emit(function, counted->header, condition, IR_INT, counted->induction, right);
+    function->instructions[replacement].source = function->instructions[counted->compare].source;
+    ir_replace_value(function, counted->compare, replacement);
+    function->instructions[counted->compare].op = IR_NOP;
+    counted->compare = replacement;
+    counted->condition = condition;
+    counted->bound = right;
+    return true;
+}
+
+static bool same_start(IRFunction *function, int a, int b)
+{
+    IRInstruction *left = &function->instructions[a];
+    IRInstruction *right = &function->instructions[b];
+    if (left->op == IR_CONST && right->op == IR_CONST)
+        return left->imm.i == right->imm.i;
+    return a == b;
+}
+
+// Returns the number of induction variables merged into an earlier one
+static int merge_inductions(IRFunction *function, OptCountedLoop *counted)
+{
+    int merged = 0;
+    IRBlock *range = &function->blocks[counted->header];
+    for (int b = range->first; b < range->first + range->count && function->instructions[b].op == IR_PHI; b++)
+    {
+        int64_t step;
+        if (!opt_induction_step(function, b, counted->body, &step))
+            continue;
+        for (int a = range->first; a < b; a++)
+        {
+            int64_t other;
+            if (function->instructions[a].op != IR_PHI || !opt_induction_step(function, a, counted->body, &other))
+                continue;
+            if (step != other || !same_start(function, opt_loop_init(function, counted, a), opt_loop_init(function, counted, b)))
+                continue;
+            ir_replace_value(function, b, a);
+            function->instructions[b].op = IR_NOP;
+            merged++;
+            break;
+        }
+    }
+    return merged;
+}
+
+static bool in_loop(IRFunction *function, OptCountedLoop *counted, int value)
+{
+    int block = function->instructions[value].block;
+    return block == counted->header || block == counted->body;
+}
+
+static bool used_after(IRFunction *function, OptCountedLoop *counted, int value)
+{
+    for (int k = function->use_offsets[value]; k < function->use_offsets[value + 1]; k++)
+    {
+        if (!in_loop(function, counted, function->uses[k]))
+            return true;
+    }
+    return false;
+}
+
+// Points the users of value outside the loop at replacement
+static void replace_after(IRFunction *function, OptCountedLoop *counted, int value, int replacement)
+{
+    for (int k = function->use_offsets[value]; k < function->use_offsets[value + 1]; k++)
+    {
+        int user = function->uses[k];
+        if (in_loop(function, counted, user))
+            continue;
+        IRInstruction *instruction = &function->instructions[user];
+        const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+        for (int a = 0; a < info->value_args; a++)
+        {
+            if (instruction->args[a] == value)
+                instruction->args[a] = replacement;
+        }
+        if (info->has_list)
+        {
+            int stride = instruction->op == IR_PHI ? 2 : 1;
+            for (int a = 0; a < instruction->imm.list.count; a++)
+            {
+                int32_t *operand = &function->operands[instruction->imm.list.first + a * stride + stride - 1];
+                if (*operand == value)
+                    *operand = replacement;
+            }
+        }
+    }
+}
+
+static void rename_predecessor(IRFunction *function, int target, int block, int successor)
+{
+    IRBlock *range = &function->blocks[target];
+    for (int i = range->first; i < range->first + range->count && function->instructions[i].op == IR_PHI; i++)
+    {
+        IRInstruction *phi = &function->instructions[i];
+        for (int k = 0; k < phi->imm.list.count; k++)
+        {
+            if (function->operands[phi->imm.list.first + 2 * k] == block)
+                function->operands[phi->imm.list.first + 2 * k] = successor;
+        }
+    }
+}
+
+// Whether nothing but the induction variables is needed from the loop
+static bool is_removable(IRFunction *function, OptCountedLoop *counted)
+{
+    int blocks[2] = {counted->header, counted->body};
+    for (int b = 0; b < 2; b++)
+    {
+        IRBlock *range = &function->blocks[blocks[b]];
+        for (int i = range->first; i < range->first + range->count; i++)
+        {
+            IRInstruction *instruction = &function->instructions[i];
+            int64_t step;
+            if (ir_opcode_info[instruction->op].is_terminator)
+                continue;
+            if (opt_has_side_effects(function, instruction) || instruction->op == IR_VREDUCE)
+                return false;
+            if (used_after(function, counted, i) && (instruction->op != IR_PHI || !opt_induction_step(function, i, counted->body, &step)))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Returns whether the loop's exit values were rewritten
+static bool rewrite_exit_values(IRFunction *function, OptCountedLoop *counted)
+{
+    bool up = counted->condition == IR_LT && counted->step == 1;
+    bool down = counted->condition == IR_GT && counted->step == -1;
+    if (!up && !down)
+        return false;
+
+    bool removable = is_removable(function, counted);
+    bool rewritten = false;
+    IRBlock *range = &function->blocks[counted->header];
+    for (int i = range->first; i < range->first + range->count && function->instructions[i].op == IR_PHI; i++)
+    {
+        int64_t step;
+        if ((i != counted->induction || removable) && opt_induction_step(function, i, counted->body, &step) && used_after(function, counted, i))
+            rewritten = true;
+    }
+    if (!rewritten && !removable)
+        return false;
+
+    int block = ir_add_block(function);
+    int start = value_in(function, opt_loop_init(function, counted, counted->induction), block);
+    int bound = value_in(function, counted->bound, block);
+    int entered = ir_emit(function, block, up ? IR_LT : IR_GT, IR_INT, start, bound);
+    int distance = up ? ir_emit(function, block, IR_SUB, IR_INT, bound, start) : ir_emit(function, block, IR_SUB, IR_INT, start, bound);
+    int trip = ir_emit(function, block, IR_MUL, IR_INT, distance, entered);
+
+    // the header phis are read before any of them is replaced
+    range = &function->blocks[counted->header];
+    int last = range->first + range->count;
+    for (int i = range->first; i < last && function->instructions[i].op == IR_PHI; i++)
+    {
+        int64_t step;
+        if ((i == counted->induction && !removable) || !opt_induction_step(function, i, counted->body, &step) || !used_after(function, counted, i))
+            continue;
+        int init = value_in(function, opt_loop_init(function, counted, i), block);
+        int final;
+        if (step == 1 || step == -1)
+            final = ir_emit(function, block, step == 1 ? IR_ADD : IR_SUB, IR_INT, init, trip);
+        else
+            final = ir_emit(function, block, IR_ADD, IR_INT, init, ir_emit(function, block, IR_MUL, IR_INT, trip, ir_emit_const_int(function, block, step)));
+        replace_after(function, counted, i, final);
+    }
+
+    int jump = ir_emit(function, block, IR_JUMP, IR_VOID, -1, -1);
+    function->instructions[jump].imm.jump.target = counted->exit;
+    function->instructions[jump].imm.jump.other = -1;
+    rename_predecessor(function, counted->exit, counted->header, block);
+    function->instructions[ir_terminator(function, counted->header)].imm.jump.other = block;
+    if (removable)
+        function->instructions[ir_terminator(function, counted->preheader)].imm.jump.target = block;
+    return true;
+}
+
+// Returns the number of compares canonicalized, induction variables merged
+// and loops whose exit values were rewritten
+int indvars_pass(IRFunction *function)
+{
+    int changed = 0;
+    int loop_count;
+    OptLoop *loops = opt_find_loops(function, &loop_count);
+    for (int l = 0; l < loop_count; l++)
+    {
+        OptCountedLoop counted;
+        if (!opt_counted_loop(function, &loops[l], &counted))
+            continue;
+        changed += canonicalize_compare(function, &counted);
+        changed += merge_inductions(function, &counted);
+    }
+    opt_free_loops(loops, loop_count);
+    if (changed > 0)
+        ir_compact(function);
+
+    // the rewrites add blocks, the loops are all looked at first
+    ir_build_uses(function);
+    loops = opt_find_loops(function, &loop_count);
+    OptCountedLoop *counted = malloc((loop_count + 1) * sizeof(OptCountedLoop));
+    int counted_count = 0;
+    for (int l = 0; l < loop_count; l++)
+    {
+        if (opt_counted_loop(function, &loops[l], &counted[counted_count]))
+            counted_count++;
+    }
+    opt_free_loops(loops, loop_count);
+
+    int rewritten = 0;
+    for (int c = 0; c < counted_count; c++)
+    {
+        rewritten += rewrite_exit_values(function, &counted[c]);
+    }
+    free(counted);
+    if (rewritten > 0)
+        ir_compact(function);
+    return changed + rewritten;
+}
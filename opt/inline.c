@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "opt.h"
+#include "../defc/defc.h"
+
+// Inlining copies the body of a callee into its caller at a call site. The
+// block of the call is split behind the call, the call turns into a jump to
+// the copy of the callee entry, parameters become the arguments, and every
+// return jumps to the second half of the block, where a phi collects the
+// result when there is more than one return.
+//
+// The cost model compares the size of the callee with a budget: calls in
+// loops get INLINE_LOOP_FACTOR times more, constant arguments add
+// INLINE_CONSTANT_BONUS each since the passes after inlining fold the code
+// they feed, and the caller stops growing at INLINE_GROWTH_LIMIT. With a
+// profile, calls made PROFILE_HOT_CALLS times get the loop budget wherever
+// they are and calls it never saw made get the plain one. A function
+// never inlines a call to itself, and calls copied out of inlined bodies are
+// only inlined again up to INLINE_DEPTH_LIMIT, which bounds how far mutual
+// recursion is unrolled.
+
+// Post order of the call graph from every function, callees before callers
+// except along cycles
+int *bottom_up_order(IRModule *module)
+{
+    int count = module->function_count;
+    int *order = malloc((count + 1) * sizeof(int));
+    int *stack = malloc((count + 1) * sizeof(int));
+    int *next = calloc(count + 1, sizeof(int));
+    bool *visited = calloc(count + 1, sizeof(bool));
+    int order_count = 0;
+
+    for (int root = 0; root < count; root++)
+    {
+        if (visited[root])
+            continue;
+        int stack_count = 0;
+        stack[stack_count++] = root;
+        visited[root] = true;
+        while (stack_count > 0)
+        {
+            IRFunction *function = module->functions[stack[stack_count - 1]];
+            int *position = &next[stack[stack_count - 1]];
+            int callee = -1;
+            while (*position < function->instruction_count && callee < 0)
+            {
+                IRInstruction *instruction = &function->instructions[(*position)++];
+                if (instruction->op == IR_CALL && !visited[instruction->args[0]])
+                    callee = instruction->args[0];
+            }
+            if (callee >= 0)
+            {
+                visited[callee] = true;
+                stack[stack_count++] = callee;
+                continue;
+            }
+            order[order_count++] = stack[--stack_count];
+        }
+    }
+
+    free(stack);
+    free(next);
+    free(visited);
+    return order;
+}
+
+static bool enters_entry_block(IRFunction *function)
+{
+    for (int i = 0; i < function->instruction_count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        if ((instruction->op == IR_JUMP || instruction->op == IR_BRANCH) && instruction->imm.jump.target == 0)
+            return true;
+        if (instruction->op == IR_BRANCH && instruction->imm.jump.other == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool worth_inlining(IRFunction *function, IRModule *module, int call, bool in_loop)
+{
+    IRInstruction *instruction = &function->instructions[call];
+    IRFunction *callee = module->functions[instruction->args[0]];
+    int caller = function->symbol >= 0 ? module->function_of_symbol[function->symbol] : -1;
+    if (instruction->args[0] == caller || instruction->flags >= INLINE_DEPTH_LIMIT)
+        return false;
+    if (function->instruction_count + callee->instruction_count > INLINE_GROWTH_LIMIT)
+        return false;
+
+    uint64_t counts[2];
+    if (ir_profile_counts(module->profile, instruction->source, counts))
+        in_loop = counts[1] >= PROFILE_HOT_CALLS || (in_loop && counts[1] > 0);
+    int budget = in_loop ? INLINE_BUDGET * INLINE_LOOP_FACTOR : INLINE_BUDGET;
+    for (int k = 0; k < instruction->imm.list.count; k++)
+    {
+        if (function->instructions[function->operands[instruction->imm.list.first + k]].op == IR_CONST)
+            budget += INLINE_CONSTANT_BONUS;
+    }
+    // parameters and the return disappear
+    int size = callee->instruction_count - callee->param_count - 1;
+    return size <= budget && !enters_entry_block(callee);
+}
+
+// Turns every phi operand coming from block into one coming from successor
+static void rename_predecessor(IRFunction *function, int target, int block, int successor)
+{
+    IRBlock *range = &function->blocks[target];
+    for (int i = range->first; i < range->first + range->count && function->instructions[i].op == IR_PHI; i++)
+    {
+        IRInstruction *phi = &function->instructions[i];
+        for (int k = 0; k < phi->imm.list.count; k++)
+        {
+            if (function->operands[phi->imm.list.first + 2 * k] == block)
+                function->operands[phi->imm.list.first + 2 * k] = successor;
+        }
+    }
+}
+
+static void inline_call(IRFunction *function, IRModule *module, int call)
+{
+    IRInstruction *instruction = &function->instructions[call];
+    IRFunction *callee = module->functions[instruction->args[0]];
+    int block = instruction->block;
+    int depth = instruction->flags + 1;
+    IRType type = instruction->type;
+
+    int32_t *arguments = malloc((callee->param_count + 1) * sizeof(int32_t));
+    memcpy(arguments, &function->operands[instruction->imm.list.first], callee->param_count * sizeof(int32_t));
+
+    // the rest of the block, with its terminator, moves behind the callee
+    int rest = ir_add_block(function);
+    IRBlock range = function->blocks[block];
+    int terminator = range.first + range.count - 1;
+    int32_t successors[2];
+    int successor_count = ir_successors(function, block, successors);
+    for (int k = 0; k < successor_count; k++)
+    {
+        rename_predecessor(function, successors[k], block, rest);
+    }
+    for (int i = call + 1; i <= terminator; i++)
+    {
+        function->instructions[i].block = rest;
+    }
+
+    int *block_map = malloc((callee->block_count + 1) * sizeof(int));
+    int *value_map = malloc((callee->instruction_count + 1) * sizeof(int));
+    for (int b = 0; b < callee->block_count; b++)
+    {
+        block_map[b] = ir_add_block(function);
+    }
+
+    // copies first, operands are mapped once every value has its copy
+    int32_t *results = malloc((2 * callee->block_count + 1) * sizeof(int32_t));
+    int result_count = 0;
+    for (int i = 0; i < callee->instruction_count; i++)
+    {
+        IRInstruction *source = &callee->instructions[i];
+        if (source->op == IR_PARAM)
+        {
+            value_map[i] = arguments[source->imm.i];
+            continue;
+        }
+        int copy = ir_emit(function, block_map[source->block], IR_NOP, IR_VOID, -1, -1);
+        function->instructions[copy] = *source;
+        function->instructions[copy].block = block_map[source->block];
+        value_map[i] = copy;
+    }
+
+    for (int i = 0; i < callee->instruction_count; i++)
+    {
+        IRInstruction *source = &callee->instructions[i];
+        if (source->op == IR_PARAM)
+            continue;
+        int copy = value_map[i];
+        IRInstruction *target = &function->instructions[copy];
+        const IROpcodeInfo *info = &ir_opcode_info[source->op];
+        for (int k = 0; k < info->value_args; k++)
+        {
+            if (source->args[k] >= 0)
+                target->args[k] = value_map[source->args[k]];
+        }
+
+        switch (source->op)
+        {
+        case IR_PHI:
+        {
+            int first = function->operand_count;
+            for (int k = 0; k < source->imm.list.count; k++)
+            {
+                int32_t pair[2] = {block_map[callee->operands[source->imm.list.first + 2 * k]], value_map[callee->operands[source->imm.list.first + 2 * k + 1]]};
+                ir_add_operands(function, pair, 2);
+            }
+            function->instructions[copy].imm.list.first = first;
+            break;
+        }
+        case IR_CALL:
+        case IR_CALL_EXTERN:
+        {
+            int first = function->operand_count;
+            for (int k = 0; k < source->imm.list.count; k++)
+            {
+                int32_t argument = value_map[callee->operands[source->imm.list.first + k]];
+                ir_add_operands(function, &argument, 1);
+            }
+            function->instructions[copy].imm.list.first = first;
+            function->instructions[copy].flags = depth;
+            break;
+        }
+        case IR_VREDUCE:
+        {
+            int first = function->operand_count;
+            for (int k = 0; k < source->imm.list.count; k++)
+            {
+                int32_t operand = value_map[callee->operands[source->imm.list.first + k]];
+                ir_add_operands(function, &operand, 1);
+            }
+            IRVectorLoop *loop = &callee->vector_loops[source->args[0]];
+            int copy_loop = ir_add_vector_loop(function, loop->nodes, loop->node_count, loop->result, loop->lanes);
+            function->instructions[copy].imm.list.first = first;
+            function->instructions[copy].args[0] = copy_loop;
+            break;
+        }
+        case IR_JUMP:
+            target->imm.jump.target = block_map[source->imm.jump.target];
+            break;
+        case IR_BRANCH:
+            target->imm.jump.target = block_map[source->imm.jump.target];
+            target->imm.jump.other = block_map[source->imm.jump.other];
+            break;
+        case IR_RETURN:
+            results[result_count++] = target->block;
+            results[result_count++] = target->args[0];
+            target->op = IR_JUMP;
+            target->args[0] = -1;
+            target->imm.jump.target = rest;
+            target->imm.jump.other = -1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // a callee that never returns leaves the rest of the block unreachable
+    if (type != IR_VOID && result_count == 2)
+        ir_replace_value(function, call, results[1]);
+    else if (type != IR_VOID && result_count > 2)
+    {
+        int phi = ir_emit(function, rest, IR_PHI, type, -1, -1);
+        function->instructions[phi].imm.list.first = ir_add_operands(function, results, result_count);
+        function->instructions[phi].imm.list.count = result_count / 2;
+        ir_replace_value(function, call, phi);
+    }
+
+    instruction = &function->instructions[call];
+    instruction->op = IR_JUMP;
+    instruction->type = IR_VOID;
+    instruction->flags = 0;
+    instruction->imm.jump.target = block_map[0];
+    instruction->imm.jump.other = -1;
+
+    free(arguments);
+    free(block_map);
+    free(value_map);
+    free(results);
+    ir_compact(function);
+}
+
+// Returns the number of calls inlined
+int inline_pass(IRFunction *function, IRModule *module)
+{
+    int inlined = 0;
+    while (true)
+    {
+        int loop_count = 0;
+        OptLoop *loops = NULL;
+        int call = -1;
+        for (int i = 0; i < function->instruction_count && call < 0; i++)
+        {
+            IRInstruction *instruction = &function->instructions[i];
+            if (instruction->op != IR_CALL)
+                continue;
+            if (loops == NULL)
+                loops = opt_find_loops(function, &loop_count);
+            bool in_loop = false;
+            for (int l = 0; l < loop_count; l++)
+            {
+                in_loop |= loops[l].blocks[instruction->block];
+            }
+            if (worth_inlining(function, module, i, in_loop))
+                call = i;
+        }
+        if (loops)
+            opt_free_loops(loops, loop_count);
+        if (call < 0)
+            break;
+
+        inline_call(function, module, call);
+        inlined++;
+    }
+    return inlined;
+}
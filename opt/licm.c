@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+
+// Loop invariant code motion. A loop can take code when it has a preheader,
+// see opt_find_loops. The lowering leaves one in front of every while and
+// for, on-stack replacement variants have one at their entry.
+//
+// Instructions are visited in reverse post order, so operands are placed
+// before their users, and each movable one whose operands are all defined
+// outside some loop around it goes to the preheader of the outermost such
+// loop. The copy is appended to the function, behind everything already in
+// the preheader, and the original is replaced by it. Constants inside the
+// loop are copied along with the first user that leaves, the ones left in the
+// loop keep serving the rest.
+
+typedef struct
+{
+    IRFunction *function;
+    OptLoop *loops;
+    int loop_count;
+    int32_t *hoisted_constants; // copy of a constant in the preheader it went to last, -1 if none
+} Licm;
+
+static bool invariant_in(Licm *licm, OptLoop *loop, IRInstruction *instruction)
+{
+    IRFunction *function = licm->function;
+    const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+    for (int k = 0; k < info->value_args; k++)
+    {
+        IRInstruction *operand = &function->instructions[ir_resolve_value(function, instruction->args[k])];
+        if (loop->blocks[operand->block] && operand->op != IR_CONST)
+            return false;
+    }
+    return true;
+}
+
+static int copy_to(Licm *licm, int value, int block)
+{
+    IRFunction *function = licm->function;
+    int copy = ir_emit(function, block, IR_NOP, IR_VOID, -1, -1);
+    function->instructions[copy] = function->instructions[value];
+    function->instructions[copy].block = block;
+    return copy;
+}
+
+static int hoist(Licm *licm, OptLoop *loop, int value)
+{
+    IRFunction *function = licm->function;
+    const IROpcodeInfo *info = &ir_opcode_info[function->instructions[value].op];
+    int32_t args[3] = {-1, -1, -1};
+    for (int k = 0; k < info->value_args; k++)
+    {
+        args[k] = ir_resolve_value(function, function->instructions[value].args[k]);
+        if (!loop->blocks[function->instructions[args[k]].block])
+            continue;
+        // a constant of the loop, copied once per preheader
+        int copy = licm->hoisted_constants[args[k]];
+        if (copy < 0 || function->instructions[copy].block != loop->preheader)
+        {
+            copy = copy_to(licm, args[k], loop->preheader);
+            licm->hoisted_constants[args[k]] = copy;
+        }
+        args[k] = copy;
+    }
+
+    int copy = copy_to(licm, value, loop->preheader);
+    for (int k = 0; k < info->value_args; k++)
+    {
+        function->instructions[copy].args[k] = args[k];
+    }
+    ir_replace_value(function, value, copy);
+    function->instructions[value].op = IR_NOP;
+    return copy;
+}
+
+// Returns the number of instructions moved out of loops
+int licm_pass(IRFunction *function)
+{
+    ir_build_dominators(function);
+
+    Licm licm;
+    licm.function = function;
+    licm.loops = opt_find_loops(function, &licm.loop_count);
+    if (licm.loop_count == 0)
+    {
+        opt_free_loops(licm.loops, licm.loop_count);
+        return 0;
+    }
+
+    int count = function->instruction_count;
+    licm.hoisted_constants = malloc((count + 1) * sizeof(int32_t));
+    for (int i = 0; i < count; i++)
+    {
+        licm.hoisted_constants[i] = -1;
+    }
+
+    int hoisted = 0;
+    for (int r = 0; r < function->block_count && function->rpo[r] >= 0; r++)
+    {
+        int b = function->rpo[r];
+        int first = function->blocks[b].first;
+        int last = first + function->blocks[b].count;
+        for (int i = first; i < last; i++)
+        {
+            IRInstruction *instruction = &function->instructions[i];
+            if (instruction->op == IR_CONST || !opt_is_movable(function, instruction))
+                continue;
+
+            OptLoop *target = NULL;
+            for (int l = 0; l < licm.loop_count; l++)
+            {
+                OptLoop *loop = &licm.loops[l];
+                if (!loop->blocks[b] || loop->preheader < 0 || (target && target->size >= loop->size))
+                    continue;
+                if (invariant_in(&licm, loop, instruction))
+                    target = loop;
+            }
+            if (target)
+            {
+                hoist(&licm, target, i);
+                hoisted++;
+            }
+        }
+    }
+
+    opt_free_loops(licm.loops, licm.loop_count);
+    free(licm.hoisted_constants);
+
+    if (hoisted > 0)
+        ir_compact(function);
+    return hoisted;
+}
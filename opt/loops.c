@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+
+// Natural loops are found from the back edges of the dominator tree, a back
+// edge being an edge to a block that dominates its source, and loops with
+// the same header are one loop. The preheader is the single predecessor of
+// the header outside the loop when that block only jumps to the header.
+// Headers are visited in reverse post order, so an outer loop comes before
+// the loops nested in it.
+OptLoop *opt_find_loops(IRFunction *function, int *loop_count)
+{
+    ir_build_dominators(function);
+
+    int count = function->block_count;
+    int *stack = malloc((count + 1) * sizeof(int));
+    OptLoop *loops = malloc((count + 1) * sizeof(OptLoop));
+    *loop_count = 0;
+
+    for (int r = 0; r < count && function->rpo[r] >= 0; r++)
+    {
+        int header = function->rpo[r];
+        OptLoop *loop = NULL;
+        int stack_count = 0;
+        for (int k = function->pred_offsets[header]; k < function->pred_offsets[header + 1]; k++)
+        {
+            int latch = function->preds[k];
+            if (!ir_dominates(function, header, latch))
+                continue;
+            if (loop == NULL)
+            {
+                loop = &loops[(*loop_count)++];
+                loop->header = header;
+                loop->preheader = -1;
+                loop->size = 1;
+                loop->blocks = calloc(count, sizeof(bool));
+                loop->blocks[header] = true;
+            }
+            if (!loop->blocks[latch])
+            {
+                loop->blocks[latch] = true;
+                loop->size++;
+                stack[stack_count++] = latch;
+            }
+        }
+        if (loop == NULL)
+            continue;
+
+        // everything that reaches a latch without passing the header
+        while (stack_count > 0)
+        {
+            int block = stack[--stack_count];
+            for (int k = function->pred_offsets[block]; k < function->pred_offsets[block + 1]; k++)
+            {
+                int predecessor = function->preds[k];
+                if (loop->blocks[predecessor] || function->idom[predecessor] < 0)
+                    continue;
+                loop->blocks[predecessor] = true;
+                loop->size++;
+                stack[stack_count++] = predecessor;
+            }
+        }
+
+        int outside = -1;
+        int outside_count = 0;
+        for (int k = function->pred_offsets[header]; k < function->pred_offsets[header + 1]; k++)
+        {
+            if (!loop->blocks[function->preds[k]] && function->idom[function->preds[k]] >= 0)
+            {
+                outside = function->preds[k];
+                outside_count++;
+            }
+        }
+        if (outside_count == 1 && function->succ_offsets[outside + 1] - function->succ_offsets[outside] == 1)
+            loop->preheader = outside;
+    }
+
+    free(stack);
+    return loops;
+}
+
+void opt_free_loops(OptLoop *loops, int loop_count)
+{
+    for (int l = 0; l < loop_count; l++)
+    {
+        free(loops[l].blocks);
+    }
+    free(loops);
+}
+
+// Step of a header phi whose value from block is the phi plus or minus a
+// constant
+bool opt_induction_step(IRFunction *function, int phi, int block, int64_t *step)
+{
+    IRInstruction *instruction = &function->instructions[phi];
+    int next = -1;
+    for (int k = 0; k < instruction->imm.list.count; k++)
+    {
+        if (function->operands[instruction->imm.list.first + 2 * k] == block)
+            next = function->operands[instruction->imm.list.first + 2 * k + 1];
+    }
+    if (next < 0 || instruction->type != IR_INT)
+        return false;
+
+    IRInstruction *update = &function->instructions[next];
+    if (update->block != block || (update->op != IR_ADD && update->op != IR_SUB))
+        return false;
+    for (int k = 0; k < 2; k++)
+    {
+        IRInstruction *constant = &function->instructions[update->args[1 - k]];
+        if (update->args[k] != phi || constant->op != IR_CONST)
+            continue;
+        if (update->op == IR_SUB && k == 1)
+            return false;
+        *step = update->op == IR_SUB ? (int64_t)(0 - (uint64_t)constant->imm.i) : constant->imm.i;
+        return true;
+    }
+    return false;
+}
+
+static bool is_invariant(IRFunction *function, OptLoop *loop, int value)
+{
+    IRInstruction *instruction = &function->instructions[value];
+    return !loop->blocks[instruction->block] || instruction->op == IR_CONST;
+}
+
+// A loop of a header and one body block: the header holds its phis, with one
+// value from the preheader and one from the body, constants and an integer
+// compare of an induction variable against a value that does not change in
+// the loop, and leaves the loop when the compare fails
+bool opt_counted_loop(IRFunction *function, OptLoop *loop, OptCountedLoop *counted)
+{
+    if (loop->size != 2 || loop->preheader < 0)
+        return false;
+    int header = loop->header;
+    int body = -1;
+    for (int b = 0; b < function->block_count; b++)
+    {
+        if (loop->blocks[b] && b != header)
+            body = b;
+    }
+
+    IRInstruction *branch = &function->instructions[ir_terminator(function, header)];
+    IRInstruction *jump = &function->instructions[ir_terminator(function, body)];
+    if (branch->op != IR_BRANCH || branch->imm.jump.target != body || loop->blocks[branch->imm.jump.other])
+        return false;
+    if (jump->op != IR_JUMP || jump->imm.jump.target != header)
+        return false;
+
+    int compare = branch->args[0];
+    IRInstruction *instruction = &function->instructions[compare];
+    if (instruction->block != header || instruction->op < IR_NE || instruction->op > IR_GE)
+        return false;
+    if (function->instructions[instruction->args[0]].type != IR_INT)
+        return false;
+
+    IRBlock *range = &function->blocks[header];
+    for (int i = range->first; i < range->first + range->count - 1; i++)
+    {
+        IRInstruction *other = &function->instructions[i];
+        if (other->op != IR_PHI && other->op != IR_CONST && i != compare)
+            return false;
+        if (other->op == IR_PHI && other->imm.list.count != 2)
+            return false;
+    }
+
+    // the induction variable on the left, the compare turned around when it is on the right
+    static const IROpcode swapped[IR_OPCODE_COUNT] = {[IR_NE] = IR_NE, [IR_LT] = IR_GT, [IR_LE] = IR_GE, [IR_GT] = IR_LT, [IR_GE] = IR_LE};
+    for (int k = 0; k < 2; k++)
+    {
+        int induction = instruction->args[k];
+        IRInstruction *phi = &function->instructions[induction];
+        if (phi->op != IR_PHI || phi->block != header || !is_invariant(function, loop, instruction->args[1 - k]))
+            continue;
+        if (!opt_induction_step(function, induction, body, &counted->step))
+            continue;
+        counted->header = header;
+        counted->preheader = loop->preheader;
+        counted->body = body;
+        counted->exit = branch->imm.jump.other;
+        counted->compare = compare;
+        counted->induction = induction;
+        counted->bound = instruction->args[1 - k];
+        counted->condition = k == 0 ? (IROpcode)instruction->op : swapped[instruction->op];
+        return true;
+    }
+    return false;
+}
+
+// average iterations per entry of a loop the profile saw run, -1 without.
+// The branch of the header counts both, iterations where it goes on to the
+// body and entries where it leaves.
+int64_t opt_profiled_trip_count(IRFunction *function, OptCountedLoop *counted, const IRProfile *profile)
+{
+    IRBlock *header = &function->blocks[counted->header];
+    IRInstruction *branch = &function->instructions[header->first + header->count - 1];
+    uint64_t counts[2];
+    if (branch->imm.jump.target != counted->body || !ir_profile_counts(profile, branch->source, counts) || counts[0] == 0)
+        return -1;
+    return (int64_t)(counts[1] / counts[0]);
+}
+
+// value of phi on entry to its loop
+int opt_loop_init(IRFunction *function, OptCountedLoop *counted, int phi)
+{
+    IRInstruction *instruction = &function->instructions[phi];
+    for (int k = 0; k < instruction->imm.list.count; k++)
+    {
+        if (function->operands[instruction->imm.list.first + 2 * k] != counted->body)
+            return function->operands[instruction->imm.list.first + 2 * k + 1];
+    }
+    return -1;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "opt.h"
+
+// The pass manager runs the enabled passes over one function at a time in a
+// fixed order: inlining first, so everything after it simplifies the copied
+// bodies together with their caller, constant propagation next so the others
+// see folded code, strength reduction once the constants are known, joining
+// the blocks split by inlining and folding so value numbering sees longer
+// blocks, if conversion once the sides of a branch are single blocks, value
+// numbering before code motion so a value is hoisted once,
+// induction variables simplified once the loops hold only what they compute,
+// vectorization before unrolling so the loops it takes still step by one,
+// and dead code elimination last to sweep what the others left behind. Every
+// pass ends with ir_compact, so the next one starts from contiguous blocks.
+
+const char *opt_pass_names[OPT_PASS_COUNT] = {
+    [OPT_INLINE] = "inline",
+    [OPT_SCCP] = "sccp",
+    [OPT_STRENGTH] = "strength",
+    [OPT_CFG] = "cfg",
+    [OPT_SELECT] = "select",
+    [OPT_GVN] = "gvn",
+    [OPT_LICM] = "licm",
+    [OPT_INDVARS] = "indvars",
+    [OPT_VECTORIZE] = "vectorize",
+    [OPT_UNROLL] = "unroll",
+    [OPT_DCE] = "dce",
+};
+
+static const char *changed_names[OPT_PASS_COUNT] = {
+    [OPT_INLINE] = "inlined",
+    [OPT_SCCP] = "folded",
+    [OPT_STRENGTH] = "reduced",
+    [OPT_CFG] = "joined",
+    [OPT_SELECT] = "converted",
+    [OPT_GVN] = "merged",
+    [OPT_LICM] = "hoisted",
+    [OPT_INDVARS] = "simplified",
+    [OPT_VECTORIZE] = "vectorized",
+    [OPT_UNROLL] = "unrolled",
+    [OPT_DCE] = "removed",
+};
+
+// the inliner also needs the module, the vectorizer the lanes, and the
+// vectorizer and unroller the profile, they are called on their own
+static int (*const passes[OPT_PASS_COUNT])(IRFunction *function) = {
+    [OPT_SCCP] = sccp_pass,
+    [OPT_STRENGTH] = strength_pass,
+    [OPT_CFG] = cfg_pass,
+    [OPT_SELECT] = select_pass,
+    [OPT_GVN] = gvn_pass,
+    [OPT_LICM] = licm_pass,
+    [OPT_INDVARS] = indvars_pass,
+    [OPT_DCE] = dce_pass,
+};
+
+void init_opt_options(OptOptions *options)
+{
+    for (int p = 0; p < OPT_PASS_COUNT; p++)
+    {
+        options->enabled[p] = true;
+    }
+    options->vector_lanes = 2;
+}
+
+// Comma separated pass names, or "none", returns false for an unknown name
+bool parse_opt_passes(const char *list, OptOptions *options)
+{
+    bool enabled[OPT_PASS_COUNT] = {false};
+    if (strcmp(list, "none") != 0)
+    {
+        const char *name = list;
+        while (true)
+        {
+            size_t length = strcspn(name, ",");
+            int found = -1;
+            for (int p = 0; p < OPT_PASS_COUNT; p++)
+            {
+                if (strlen(opt_pass_names[p]) == length && strncmp(name, opt_pass_names[p], length) == 0)
+                    found = p;
+            }
+            if (found < 0)
+                return false;
+            enabled[found] = true;
+            if (name[length] == '\0')
+                break;
+            name += length + 1;
+        }
+    }
+    memcpy(options->enabled, enabled, sizeof(enabled));
+    return true;
+}
+
+static uint64_t now_nanoseconds()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + time.tv_nsec;
+}
+
+void optimize_function(IRFunction *function, IRModule *module, const OptOptions *options, OptStats *stats)
+{
+    for (int p = 0; p < OPT_PASS_COUNT; p++)
+    {
+        if (!options->enabled[p])
+            continue;
+        uint64_t start = stats ? now_nanoseconds() : 0;
+        int count = function->instruction_count;
+        int changed;
+        if (p == OPT_INLINE)
+            changed = inline_pass(function, module);
+        else if (p == OPT_VECTORIZE)
+            changed = vectorize_pass(function, options->vector_lanes, module->profile);
+        else if (p == OPT_UNROLL)
+            changed = unroll_pass(function, module->profile);
+        else
+            changed = passes[p](function);
+        if (stats == NULL)
+            continue;
+        OptPassStats *pass = &stats->passes[p];
+        pass->functions++;
+        pass->changed += changed;
+        pass->removed += count - function->instruction_count;
+        pass->nanoseconds += now_nanoseconds() - start;
+    }
+}
+
+// Callees are optimized before their callers, so the inliner copies bodies
+// that are already simplified and sizes them by what they became
+void optimize_module(IRModule *module, const OptOptions *options, OptStats *stats)
+{
+    int *order = bottom_up_order(module);
+    for (int i = 0; i < module->function_count; i++)
+    {
+        optimize_function(module->functions[order[i]], module, options, stats);
+    }
+    free(order);
+}
+
+void dump_opt_stats(OptStats *stats, OutputBuffer *buffer)
+{
+    for (int p = 0; p < OPT_PASS_COUNT; p++)
+    {
+        OptPassStats *pass = &stats->passes[p];
+        if (pass->functions == 0)
+            continue;
+        buffer_printf(buffer, "opt: %-9s %4d functions, %6d %-10s %6d instructions removed, %.3f ms\n", opt_pass_names[p], pass->functions, pass->changed, changed_names[p], pass->removed, pass->nanoseconds / 1e6);
+    }
+}
+
+static bool is_nonzero_constant(IRFunction *function, int value)
+{
+    IRInstruction *instruction = &function->instructions[ir_resolve_value(function, value)];
+    return instruction->op == IR_CONST && instruction->type == IR_INT && instruction->imm.i != 0;
+}
+
+// Instructions that must run even when nothing uses their value: calls,
+// terminators, parameters and integer division that may trap
+bool opt_has_side_effects(IRFunction *function, IRInstruction *instruction)
+{
+    switch (instruction->op)
+    {
+    case IR_CALL:
+    case IR_CALL_EXTERN:
+    case IR_PARAM:
+        return true;
+    case IR_DIV:
+        return instruction->type == IR_INT && !is_nonzero_constant(function, instruction->args[1]);
+    default:
+        return ir_opcode_info[instruction->op].is_terminator;
+    }
+}
+
+// Instructions whose value only depends on their operands and that cannot
+// trap, they may be computed anywhere their operands are available. Loads
+// stay where the lowering put them.
+bool opt_is_movable(IRFunction *function, IRInstruction *instruction)
+{
+    switch (instruction->op)
+    {
+    case IR_NOP:
+    case IR_PARAM:
+    case IR_PHI:
+    case IR_CALL:
+    case IR_CALL_EXTERN:
+    case IR_VREDUCE:
+    case IR_LOAD:
+        return false;
+    default:
+        return !opt_has_side_effects(function, instruction);
+    }
+}
@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "../ir/ir.h"
+#include "../buffer/buffer.h"
+
+#ifndef OPT_H
+#define OPT_H
+
+// passes in the order the pipeline runs them
+typedef enum
+{
+    OPT_INLINE,
+    OPT_SCCP,
+    OPT_STRENGTH,
+    OPT_CFG,
+    OPT_SELECT,
+    OPT_GVN,
+    OPT_LICM,
+    OPT_INDVARS,
+    OPT_VECTORIZE,
+    OPT_UNROLL,
+    OPT_DCE,
+    OPT_PASS_COUNT
+} OptPass;
+
+typedef struct
+{
+    bool enabled[OPT_PASS_COUNT];
+    int vector_lanes; // 64 bit lanes the JIT's vector registers hold
+} OptOptions;
+
+typedef struct
+{
+    int functions;
+    int changed; // inlined calls, joined blocks, converted branches, simplified, vectorized or unrolled loops, or folded, reduced, merged, hoisted or removed instructions
+    int removed; // instructions the function lost over the pass
+    uint64_t nanoseconds;
+} OptPassStats;
+
+typedef struct
+{
+    OptPassStats passes[OPT_PASS_COUNT];
+} OptStats;
+
+// natural loop, see opt_find_loops
+typedef struct
+{
+    int header;
+    int preheader; // -1 when the loop has none
+    int size; // blocks in the loop
+    bool *blocks;
+} OptLoop;
+
+// loop of a header and one body block exiting on a compare of an induction
+// variable, see opt_counted_loop
+typedef struct
+{
+    int header;
+    int preheader;
+    int body;
+    int exit; // block the header branches to when the compare fails
+    int compare;
+    int induction;
+    int bound; // defined outside the loop or a constant
+    IROpcode condition; // the compare with the induction variable on the left
+    int64_t step;
+} OptCountedLoop;
+
+extern const char *opt_pass_names[OPT_PASS_COUNT];
+
+void init_opt_options(OptOptions *options);
+bool parse_opt_passes(const char *list, OptOptions *options);
+
+// Every pass takes a compacted function and leaves it compacted, stats may be
+// NULL. The inliner copies callees out of module, which it only reads.
+void optimize_function(IRFunction *function, IRModule *module, const OptOptions *options, OptStats *stats);
+void optimize_module(IRModule *module, const OptOptions *options, OptStats *stats);
+void dump_opt_stats(OptStats *stats, OutputBuffer *buffer);
+
+// shared by the passes
+bool opt_has_side_effects(IRFunction *function, IRInstruction *instruction);
+bool opt_is_movable(IRFunction *function, IRInstruction *instruction);
+OptLoop *opt_find_loops(IRFunction *function, int *loop_count);
+void opt_free_loops(OptLoop *loops, int loop_count);
+bool opt_induction_step(IRFunction *function, int phi, int block, int64_t *step);
+bool opt_counted_loop(IRFunction *function, OptLoop *loop, OptCountedLoop *counted);
+int opt_loop_init(IRFunction *function, OptCountedLoop *counted, int phi);
+int64_t opt_profiled_trip_count(IRFunction *function, OptCountedLoop *counted, const IRProfile *profile);
+int *bottom_up_order(IRModule *module);
+
+int inline_pass(IRFunction *function, IRModule *module);
+
+int sccp_pass(IRFunction *function);
+int strength_pass(IRFunction *function);
+int cfg_pass(IRFunction *function);
+int select_pass(IRFunction *function);
+int gvn_pass(IRFunction *function);
+int licm_pass(IRFunction *function);
+int indvars_pass(IRFunction *function);
+int vectorize_pass(IRFunction *function, int lanes, const IRProfile *profile);
+int unroll_pass(IRFunction *function, const IRProfile *profile);
+int dce_pass(IRFunction *function);
+
+#endif
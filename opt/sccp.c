@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <wchar.h>
+#include "opt.h"
+
+// Sparse conditional constant propagation, Wegman and Zadeck, "Constant
+// Propagation with Conditional Branches". Values start unknown and only move
+// down to constant and then to varying, blocks and CFG edges start dead and
+// become executable when a terminator that is executable can take them. Phis
+// only meet the operands of executable edges, so a constant branch keeps the
+// values of the side it never takes out of the join.
+//
+// Folding follows the run time semantics exactly: integers wrap, division
+// by -1 negates, and a division by zero is left for the program to trap on.
+
+typedef enum
+{
+    SCCP_UNKNOWN,
+    SCCP_CONSTANT,
+    SCCP_VARYING
+} SccpState;
+
+typedef union
+{
+    int64_t i;
+    double f;
+} SccpConstant;
+
+typedef struct
+{
+    uint8_t state;
+    SccpConstant constant;
+} SccpValue;
+
+typedef struct
+{
+    IRFunction *function;
+    SccpValue *values;
+    bool *executable; // by block
+    bool *edges; // by successor slot, see IRFunction.succ_offsets
+
+    int *blocks;
+    int block_count;
+
+    int *worklist; // values whose operands changed
+    int worklist_size;
+    int worklist_count;
+} Sccp;
+
+static void push_value(Sccp *sccp, int value)
+{
+    if (sccp->worklist_count == sccp->worklist_size)
+    {
+        sccp->worklist_size *= 2;
+        sccp->worklist = realloc(sccp->worklist, sccp->worklist_size * sizeof(int));
+        if (!sccp->worklist)
+        {
+            wprintf(L"Memory allocation failed while propagating constants.\n");
+            exit(1);
+        }
+    }
+    sccp->worklist[sccp->worklist_count++] = value;
+}
+
+static void mark_edge(Sccp *sccp, int slot)
+{
+    IRFunction *function = sccp->function;
+    if (sccp->edges[slot])
+        return;
+    sccp->edges[slot] = true;
+
+    int target = function->succs[slot];
+    if (!sccp->executable[target])
+    {
+        sccp->executable[target] = true;
+        sccp->blocks[sccp->block_count++] = target;
+        return;
+    }
+    // the phis of a block already visited see one more operand
+    IRBlock *block = &function->blocks[target];
+    for (int i = block->first; i < block->first + block->count && function->instructions[i].op == IR_PHI; i++)
+    {
+        push_value(sccp, i);
+    }
+}
+
+static void mark_successor(Sccp *sccp, int block, int successor)
+{
+    IRFunction *function = sccp->function;
+    for (int k = function->succ_offsets[block]; k < function->succ_offsets[block + 1]; k++)
+    {
+        if (function->succs[k] == successor)
+            mark_edge(sccp, k);
+    }
+}
+
+static bool edge_executable(Sccp *sccp, int block, int successor)
+{
+    IRFunction *function = sccp->function;
+    for (int k = function->succ_offsets[block]; k < function->succ_offsets[block + 1]; k++)
+    {
+        if (function->succs[k] == successor && sccp->edges[k])
+            return true;
+    }
+    return false;
+}
+
+static int64_t power_int(int64_t base, int64_t exponent)
+{
+    if (exponent < 0)
+    {
+        if (base == 1)
+            return 1;
+        if (base == -1)
+            return exponent & 1 ? -1 : 1;
+        return 0;
+    }
+
+    uint64_t result = 1;
+    uint64_t factor = (uint64_t)base;
+    while (exponent > 0)
+    {
+        if (exponent & 1)
+            result *= factor;
+        factor *= factor;
+        exponent >>= 1;
+    }
+    return (int64_t)result;
+}
+
+// out of range and NaN give INT64_MIN, the same as cvttsd2si
+static int64_t float_to_int(double value)
+{
+    if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0))
+        return INT64_MIN;
+    return (int64_t)value;
+}
+
+// false when the instruction has no constant result, a division by zero
+static bool fold(IRInstruction *instruction, IRType operand_type, SccpConstant x, SccpConstant y, SccpConstant z, SccpConstant *result)
+{
+    uint64_t a = (uint64_t)x.i;
+    uint64_t b = (uint64_t)y.i;
+    if (operand_type == IR_FLOAT)
+    {
+        switch (instruction->op)
+        {
+        case IR_ADD:
+            result->f = x.f + y.f;
+            return true;
+        case IR_SUB:
+            result->f = x.f - y.f;
+            return true;
+        case IR_MUL:
+            result->f = x.f * y.f;
+            return true;
+        case IR_DIV:
+            result->f = x.f / y.f;
+            return true;
+        case IR_POW:
+            result->f = pow(x.f, y.f);
+            return true;
+        case IR_NEG:
+            result->f = -x.f;
+            return true;
+        case IR_EQ:
+            result->i = x.f == y.f;
+            return true;
+        case IR_NE:
+            result->i = x.f != y.f;
+            return true;
+        case IR_LT:
+            result->i = x.f < y.f;
+            return true;
+        case IR_LE:
+            result->i = x.f <= y.f;
+            return true;
+        case IR_GT:
+            result->i = x.f > y.f;
+            return true;
+        case IR_GE:
+            result->i = x.f >= y.f;
+            return true;
+        case IR_FTOI:
+            result->i = float_to_int(x.f);
+            return true;
+        case IR_SQRT:
+            result->f = sqrt(x.f);
+            return true;
+        case IR_FMA:
+            result->f = fma(x.f, y.f, z.f);
+            return true;
+        case IR_MIN:
+            result->f = x.f < y.f ? x.f : y.f;
+            return true;
+        case IR_MAX:
+            result->f = x.f > y.f ? x.f : y.f;
+            return true;
+        case IR_ABS:
+            result->f = fabs(x.f);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    switch (instruction->op)
+    {
+    case IR_ADD:
+        result->i = (int64_t)(a + b);
+        return true;
+    case IR_SUB:
+        result->i = (int64_t)(a - b);
+        return true;
+    case IR_MUL:
+        result->i = (int64_t)(a * b);
+        return true;
+    case IR_DIV:
+        if (y.i == 0)
+            return false;
+        result->i = y.i == -1 ? (int64_t)(0 - a) : x.i / y.i;
+        return true;
+    case IR_POW:
+        result->i = power_int(x.i, y.i);
+        return true;
+    case IR_NEG:
+        result->i = (int64_t)(0 - a);
+        return true;
+    case IR_AND:
+        result->i = x.i & y.i;
+        return true;
+    case IR_OR:
+        result->i = x.i | y.i;
+        return true;
+    case IR_NOT:
+        result->i = ~x.i;
+        return true;
+    case IR_SHL:
+        result->i = (int64_t)(a << instruction->imm.i);
+        return true;
+    case IR_SHR:
+        result->i = (int64_t)(a >> instruction->imm.i);
+        return true;
+    case IR_SAR:
+        result->i = x.i >> instruction->imm.i;
+        return true;
+    case IR_MULHI:
+        result->i = (int64_t)(((__int128)x.i * y.i) >> 64);
+        return true;
+    case IR_EQ:
+        result->i = x.i == y.i;
+        return true;
+    case IR_NE:
+        result->i = x.i != y.i;
+        return true;
+    case IR_LT:
+        result->i = x.i < y.i;
+        return true;
+    case IR_LE:
+        result->i = x.i <= y.i;
+        return true;
+    case IR_GT:
+        result->i = x.i > y.i;
+        return true;
+    case IR_GE:
+        result->i = x.i >= y.i;
+        return true;
+    case IR_ITOF:
+        result->f = (double)x.i;
+        return true;
+    case IR_MIN:
+        result->i = x.i < y.i ? x.i : y.i;
+        return true;
+    case IR_MAX:
+        result->i = x.i > y.i ? x.i : y.i;
+        return true;
+    case IR_ABS:
+        result->i = x.i < 0 ? (int64_t)(0 - a) : x.i;
+        return true;
+    case IR_POPCNT:
+        result->i = __builtin_popcountll(a);
+        return true;
+    case IR_CLZ:
+        result->i = a == 0 ? 64 : __builtin_clzll(a);
+        return true;
+    case IR_CTZ:
+        result->i = a == 0 ? 64 : __builtin_ctzll(a);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static SccpValue evaluate_phi(Sccp *sccp, IRInstruction *instruction)
+{
+    IRFunction *function = sccp->function;
+    SccpValue result = {SCCP_UNKNOWN, {0}};
+    for (int k = 0; k < instruction->imm.list.count; k++)
+    {
+        int predecessor = function->operands[instruction->imm.list.first + 2 * k];
+        SccpValue *operand = &sccp->values[function->operands[instruction->imm.list.first + 2 * k + 1]];
+        if (!edge_executable(sccp, predecessor, instruction->block) || operand->state == SCCP_UNKNOWN)
+            continue;
+        if (operand->state == SCCP_VARYING)
+            return *operand;
+        if (result.state == SCCP_UNKNOWN)
+            result = *operand;
+        // bitwise, 0.0 and -0.0 are different constants
+        else if (memcmp(&result.constant, &operand->constant, sizeof(SccpConstant)) != 0)
+            return (SccpValue){SCCP_VARYING, {0}};
+    }
+    return result;
+}
+
+// a known condition picks an arm, an unknown one may still meet equal arms
+static SccpValue evaluate_select(Sccp *sccp, IRInstruction *instruction)
+{
+    SccpValue *condition = &sccp->values[instruction->args[0]];
+    SccpValue *taken = &sccp->values[instruction->args[1]];
+    SccpValue *other = &sccp->values[instruction->args[2]];
+    if (condition->state == SCCP_CONSTANT)
+        return condition->constant.i != 0 ? *taken : *other;
+    if (condition->state == SCCP_UNKNOWN)
+        return *condition;
+    if (taken->state == SCCP_CONSTANT && other->state == SCCP_CONSTANT && memcmp(&taken->constant, &other->constant, sizeof(SccpConstant)) == 0)
+        return *taken;
+    return (SccpValue){SCCP_VARYING, {0}};
+}
+
+static SccpValue evaluate(Sccp *sccp, int index)
+{
+    IRFunction *function = sccp->function;
+    IRInstruction *instruction = &function->instructions[index];
+    const IROpcodeInfo *info = &ir_opcode_info[instruction->op];
+    SccpValue varying = {SCCP_VARYING, {0}};
+
+    switch (instruction->op)
+    {
+    case IR_CONST:
+        return (SccpValue){SCCP_CONSTANT, {.i = instruction->imm.i}};
+    case IR_PHI:
+        return evaluate_phi(sccp, instruction);
+    case IR_SELECT:
+        return evaluate_select(sccp, instruction);
+    case IR_PARAM:
+    case IR_CALL:
+    case IR_CALL_EXTERN:
+    case IR_VREDUCE:
+    case IR_LOAD:
+        return varying;
+    default:
+        break;
+    }
+
+    SccpConstant operands[3] = {{0}, {0}, {0}};
+    for (int k = 0; k < info->value_args; k++)
+    {
+        SccpValue *operand = &sccp->values[instruction->args[k]];
+        if (operand->state != SCCP_CONSTANT)
+            return *operand;
+        operands[k] = operand->constant;
+    }
+
+    SccpValue result = {SCCP_CONSTANT, {0}};
+    IRType operand_type = function->instructions[instruction->args[0]].type;
+    if (!fold(instruction, operand_type, operands[0], operands[1], operands[2], &result.constant))
+        return varying;
+    return result;
+}
+
+static void visit(Sccp *sccp, int index)
+{
+    IRFunction *function = sccp->function;
+    IRInstruction *instruction = &function->instructions[index];
+
+    if (instruction->op == IR_JUMP)
+    {
+        mark_successor(sccp, instruction->block, instruction->imm.jump.target);
+        return;
+    }
+    if (instruction->op == IR_BRANCH)
+    {
+        SccpValue *condition = &sccp->values[instruction->args[0]];
+        if (condition->state == SCCP_VARYING || (condition->state == SCCP_CONSTANT && condition->constant.i != 0))
+            mark_successor(sccp, instruction->block, instruction->imm.jump.target);
+        if (condition->state == SCCP_VARYING || (condition->state == SCCP_CONSTANT && condition->constant.i == 0))
+            mark_successor(sccp, instruction->block, instruction->imm.jump.other);
+        return;
+    }
+    if (instruction->type == IR_VOID)
+        return;
+
+    SccpValue *value = &sccp->values[index];
+    if (value->state == SCCP_VARYING)
+        return;
+    SccpValue result = evaluate(sccp, index);
+    if (result.state == value->state)
+        return;
+    *value = result;
+    for (int k = function->use_offsets[index]; k < function->use_offsets[index + 1]; k++)
+    {
+        push_value(sccp, function->uses[k]);
+    }
+}
+
+static void remove_phi_operands(IRFunction *function, int block, int predecessor)
+{
+    IRBlock *range = &function->blocks[block];
+    for (int i = range->first; i < range->first + range->count && function->instructions[i].op == IR_PHI; i++)
+    {
+        IRInstruction *phi = &function->instructions[i];
+        int32_t *pairs = &function->operands[phi->imm.list.first];
+        int count = 0;
+        for (int k = 0; k < phi->imm.list.count; k++)
+        {
+            if (pairs[2 * k] == predecessor)
+                continue;
+            pairs[2 * count] = pairs[2 * k];
+            pairs[2 * count + 1] = pairs[2 * k + 1];
+            count++;
+        }
+        phi->imm.list.count = count;
+    }
+}
+
+// Returns the number of values and branches folded
+int sccp_pass(IRFunction *function)
+{
+    ir_build_uses(function);
+    ir_build_cfg(function);
+
+    int count = function->instruction_count;
+    Sccp sccp;
+    sccp.function = function;
+    sccp.values = calloc(count + 1, sizeof(SccpValue));
+    sccp.executable = calloc(function->block_count + 1, sizeof(bool));
+    sccp.edges = calloc(function->succ_offsets[function->block_count] + 1, sizeof(bool));
+    sccp.blocks = malloc((function->block_count + 1) * sizeof(int));
+    sccp.block_count = 0;
+    sccp.worklist_size = count + 16;
+    sccp.worklist = malloc(sccp.worklist_size * sizeof(int));
+    sccp.worklist_count = 0;
+
+    sccp.executable[0] = true;
+    sccp.blocks[sccp.block_count++] = 0;
+    while (sccp.block_count > 0 || sccp.worklist_count > 0)
+    {
+        if (sccp.worklist_count > 0)
+        {
+            int value = sccp.worklist[--sccp.worklist_count];
+            if (sccp.executable[function->instructions[value].block])
+                visit(&sccp, value);
+            continue;
+        }
+        IRBlock *block = &function->blocks[sccp.blocks[--sccp.block_count]];
+        for (int i = block->first; i < block->first + block->count; i++)
+        {
+            visit(&sccp, i);
+        }
+    }
+
+    // branches first, the phis of the side dropped are still phis
+    int folded = 0;
+    for (int i = 0; i < count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        if (instruction->op != IR_BRANCH || !sccp.executable[instruction->block] || sccp.values[instruction->args[0]].state != SCCP_CONSTANT)
+            continue;
+        int taken = sccp.values[instruction->args[0]].constant.i != 0 ? instruction->imm.jump.target : instruction->imm.jump.other;
+        int dropped = taken == instruction->imm.jump.target ? instruction->imm.jump.other : instruction->imm.jump.target;
+        if (dropped != taken)
+            remove_phi_operands(function, dropped, instruction->block);
+        instruction->op = IR_JUMP;
+        instruction->args[0] = -1;
+        instruction->imm.jump.target = taken;
+        instruction->imm.jump.other = -1;
+        folded++;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        if (!sccp.executable[instruction->block] || instruction->op == IR_CONST || instruction->type == IR_VOID || sccp.values[i].state != SCCP_CONSTANT)
+            continue;
+        // rewritten in place, a phi keeps its position in front of its users
+        instruction->op = IR_CONST;
+        instruction->args[0] = instruction->args[1] = instruction->args[2] = -1;
+        instruction->imm.i = sccp.values[i].constant.i;
+        folded++;
+    }
+
+    free(sccp.values);
+    free(sccp.executable);
+    free(sccp.edges);
+    free(sccp.blocks);
+    free(sccp.worklist);
+
+    ir_compact(function);
+    return folded;
+}
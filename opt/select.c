@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+#include "../defc/defc.h"
+
+// If conversion. A branch whose sides only compute a few values for the
+// block they join becomes straight code that computes both sides and
+// selects between them:
+//
+//     a: branch c, t, f             a: t's code, f's code
+//     t: x = ...; jump j                p = select c, x, y
+//     f: y = ...; jump j       =>       jump j
+//     j: p = phi [t x], [f y]
+//
+// One side may be the join itself, as for an if without else or the right
+// operand of && and ||. A side qualifies when the branch is its only
+// predecessor and it holds at most SELECT_ARM_BUDGET cheap instructions
+// besides constants: movable ones, see opt_is_movable, but no division or
+// power. Computing a few values that are thrown away costs less than a
+// branch the data makes unpredictable. Joins of float values keep their
+// branch, a select of floats would take them through the integer registers.
+//
+// A select of comparisons picking either 0 or another comparison is their
+// and, one picking 1 or another comparison their or, so && and || of cheap
+// comparisons need no select either. The join is left with the branching
+// block as its only predecessor and cfg_pass merges the two, which lets an
+// if nested in a side qualify on the next round.
+
+typedef struct
+{
+    int block;
+    int sides[2]; // predecessor of the join when the condition holds and when it does not
+    int join;
+} Diamond;
+
+static int predecessor_count(IRFunction *function, int block)
+{
+    return function->pred_offsets[block + 1] - function->pred_offsets[block];
+}
+
+// block a side jumps to, -1 when it is not a side that can be computed
+// unconditionally
+static int side_target(IRFunction *function, int block, int side)
+{
+    if (side == block || predecessor_count(function, side) != 1)
+        return -1;
+    IRBlock *range = &function->blocks[side];
+    int cost = 0;
+    for (int i = range->first; i < range->first + range->count - 1; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        if (!opt_is_movable(function, instruction) || instruction->op == IR_DIV || instruction->op == IR_POW)
+            return -1;
+        if (instruction->op != IR_CONST)
+            cost++;
+    }
+    IRInstruction *jump = &function->instructions[range->first + range->count - 1];
+    if (cost > SELECT_ARM_BUDGET || jump->op != IR_JUMP)
+        return -1;
+    return jump->imm.jump.target;
+}
+
+static bool find_diamond(IRFunction *function, int block, Diamond *diamond)
+{
+    int terminator = ir_terminator(function, block);
+    if (terminator < 0)
+        return false;
+    IRInstruction *branch = &function->instructions[terminator];
+    if (branch->op != IR_BRANCH || branch->imm.jump.target == branch->imm.jump.other)
+        return false;
+    int taken = branch->imm.jump.target;
+    int other = branch->imm.jump.other;
+    int taken_target = side_target(function, block, taken);
+    int other_target = side_target(function, block, other);
+
+    diamond->block = block;
+    if (taken_target >= 0 && taken_target == other_target)
+    {
+        diamond->sides[0] = taken;
+        diamond->sides[1] = other;
+        diamond->join = taken_target;
+    }
+    else if (taken_target == other)
+    {
+        diamond->sides[0] = taken;
+        diamond->sides[1] = block;
+        diamond->join = other;
+    }
+    else if (other_target == taken)
+    {
+        diamond->sides[0] = block;
+        diamond->sides[1] = other;
+        diamond->join = taken;
+    }
+    else
+        return false;
+    if (diamond->join == block || predecessor_count(function, diamond->join) != 2)
+        return false;
+
+    IRBlock *range = &function->blocks[diamond->join];
+    int phi_count = 0;
+    while (phi_count < range->count && function->instructions[range->first + phi_count].op == IR_PHI)
+    {
+        if (function->instructions[range->first + phi_count].type != IR_INT)
+            return false;
+        phi_count++;
+    }
+    return phi_count <= SELECT_ARM_BUDGET;
+}
+
+// constants are copied into the block using them, like the lowering does
+static int value_in(IRFunction *function, int value, int block)
+{
+    IRInstruction constant = function->instructions[value];
+    if (constant.op != IR_CONST || constant.block == block)
+        return value;
+    int copy = ir_emit(function, block, IR_CONST, constant.type, -1, -1);
+    function->instructions[copy].imm = constant.imm;
+    return copy;
+}
+
+static int phi_operand(IRFunction *function, int phi, int predecessor)
+{
+    IRInstruction *instruction = &function->instructions[phi];
+    for (int k = 0; k < instruction->imm.list.count; k++)
+    {
+        if (function->operands[instruction->imm.list.first + 2 * k] == predecessor)
+            return function->operands[instruction->imm.list.first + 2 * k + 1];
+    }
+    return -1;
+}
+
+static bool is_comparison(IRFunction *function, int value)
+{
+    IROpcode op = function->instructions[value].op;
+    return op >= IR_EQ && op <= IR_GE;
+}
+
+static bool is_constant(IRFunction *function, int value, int64_t constant)
+{
+    IRInstruction *instruction = &function->instructions[value];
+    return instruction->op == IR_CONST && instruction->type == IR_INT && instruction->imm.i == constant;
+}
+
+static int emit_select(IRFunction *function, int block, IRType type, int condition, int taken, int other)
+{
+    if (is_comparison(function, condition) && is_comparison(function, taken) && is_constant(function, other, 0))
+        return ir_emit(function, block, IR_AND, IR_INT, condition, taken);
+    if (is_comparison(function, condition) && is_constant(function, taken, 1) && is_comparison(function, other))
+        return ir_emit(function, block, IR_OR, IR_INT, condition, other);
+    taken = value_in(function, taken, block);
+    other = value_in(function, other, block);
+    int select = ir_emit(function, block, IR_SELECT, type, condition, taken);
+    function->instructions[select].args[2] = other;
+    return select;
+}
+
+static void convert(IRFunction *function, Diamond *diamond)
+{
+    int block = diamond->block;
+    int terminator = ir_terminator(function, block);
+    int condition = ir_resolve_value(function, function->instructions[terminator].args[0]);
+
+    // the code of both sides goes in front of the branch
+    for (int s = 0; s < 2; s++)
+    {
+        if (diamond->sides[s] == block)
+            continue;
+        IRBlock range = function->blocks[diamond->sides[s]];
+        for (int i = range.first; i < range.first + range.count - 1; i++)
+        {
+            int copy = ir_emit(function, block, IR_NOP, IR_VOID, -1, -1);
+            function->instructions[copy] = function->instructions[i];
+            function->instructions[copy].block = block;
+            function->instructions[i].op = IR_NOP;
+            ir_replace_value(function, i, copy);
+        }
+    }
+
+    // a compare only the branch read moves behind that code, so the selects
+    // can test the flags it leaves
+    if (function->instructions[condition].block == block && is_comparison(function, condition) && function->use_offsets[condition + 1] - function->use_offsets[condition] == 1)
+    {
+        int copy = ir_emit(function, block, IR_NOP, IR_VOID, -1, -1);
+        function->instructions[copy] = function->instructions[condition];
+        function->instructions[condition].op = IR_NOP;
+        ir_replace_value(function, condition, copy);
+        condition = copy;
+    }
+
+    IRBlock range = function->blocks[diamond->join];
+    for (int i = range.first; i < range.first + range.count && function->instructions[i].op == IR_PHI; i++)
+    {
+        int taken = ir_resolve_value(function, phi_operand(function, i, diamond->sides[0]));
+        int other = ir_resolve_value(function, phi_operand(function, i, diamond->sides[1]));
+        int value = taken == other ? taken : emit_select(function, block, function->instructions[i].type, condition, taken, other);
+        ir_replace_value(function, i, value);
+        function->instructions[i].op = IR_NOP;
+    }
+
+    IRInstruction *jump = &function->instructions[terminator];
+    jump->op = IR_JUMP;
+    jump->args[0] = -1;
+    jump->imm.jump.target = diamond->join;
+    jump->imm.jump.other = -1;
+}
+
+// Returns the number of branches replaced by selects
+int select_pass(IRFunction *function)
+{
+    int converted = 0;
+    while (true)
+    {
+        ir_build_uses(function);
+        ir_build_cfg(function);
+        bool *touched = calloc(function->block_count + 1, sizeof(bool));
+        int round = 0;
+        for (int b = 0; b < function->block_count; b++)
+        {
+            Diamond diamond;
+            if (!find_diamond(function, b, &diamond))
+                continue;
+            // each block changes in one conversion a round
+            if (touched[diamond.block] || touched[diamond.sides[0]] || touched[diamond.sides[1]] || touched[diamond.join])
+                continue;
+            touched[diamond.block] = touched[diamond.sides[0]] = touched[diamond.sides[1]] = touched[diamond.join] = true;
+            convert(function, &diamond);
+            round++;
+        }
+        free(touched);
+        if (round == 0)
+            break;
+        converted += round;
+        ir_compact(function);
+        cfg_pass(function);
+    }
+    return converted;
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+#include "../defc/defc.h"
+
+// Strength reduction of arithmetic by constants:
+//
+// - integer powers with a constant exponent become a chain of multiplies,
+//   squaring for every bit of the exponent, as long as the chain stays under
+//   STRENGTH_POWER_MULTIPLIES
+// - integer division by a power of two becomes shifts that round toward
+//   zero, by any other constant a multiply high by a magic number, Warren,
+//   "Hacker's Delight", chapter 10
+// - integer multiplication by a power of two and by one off a power of two
+//   becomes shifts, the JIT takes 3, 5 and 9 with lea
+//
+// Floats only lose powers by 0 and 1, anything else rounds differently from
+// pow. Wrapping makes every rewrite exact on integers, and a division by a
+// constant other than 0 cannot trap.
+//
+// The instructions replacing one are appended to the function, so the rest
+// of its block is copied behind them, like cfg_pass does when it joins
+// blocks.
+
+typedef struct
+{
+    IRFunction *function;
+    int block;
+    int source;
+} Builder;
+
+static int emit(Builder *builder, IROpcode op, int a, int b)
+{
+    int value = ir_emit(builder->function, builder->block, op, IR_INT, a, b);
+    builder->function->instructions[value].source = builder->source;
+    return value;
+}
+
+static int emit_shift(Builder *builder, IROpcode op, int value, int count)
+{
+    int shift = emit(builder, op, value, -1);
+    builder->function->instructions[shift].imm.i = count;
+    return shift;
+}
+
+static int emit_constant(Builder *builder, int64_t constant)
+{
+    int value = ir_emit_const_int(builder->function, builder->block, constant);
+    builder->function->instructions[value].source = builder->source;
+    return value;
+}
+
+static bool is_constant(IRFunction *function, int value)
+{
+    return function->instructions[value].op == IR_CONST;
+}
+
+static bool is_power_of_two(uint64_t value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static int log2_of(uint64_t value)
+{
+    return 63 - __builtin_clzll(value);
+}
+
+// Hacker's Delight figure 10-1 for 64 bits, d is not 0, 1, -1 or a power of two
+static void magic_number(int64_t d, int64_t *magic, int *shift)
+{
+    const uint64_t two63 = (uint64_t)1 << 63;
+    uint64_t ad = d < 0 ? 0 - (uint64_t)d : (uint64_t)d;
+    uint64_t t = two63 + ((uint64_t)d >> 63);
+    uint64_t anc = t - 1 - t % ad;
+    uint64_t q1 = two63 / anc;
+    uint64_t r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad;
+    uint64_t r2 = two63 - q2 * ad;
+    uint64_t delta;
+    int p = 63;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *magic = (int64_t)(d < 0 ? 0 - (q2 + 1) : q2 + 1);
+    *shift = p - 64;
+}
+
+static int reduce_multiply(Builder *builder, int x, int64_t c)
+{
+    uint64_t magnitude = c < 0 ? 0 - (uint64_t)c : (uint64_t)c;
+    if (c == 0)
+        return emit_constant(builder, 0);
+    if (c == 1)
+        return x;
+    if (c == -1)
+        return emit(builder, IR_NEG, x, -1);
+    if (is_power_of_two(magnitude))
+    {
+        int shift = emit_shift(builder, IR_SHL, x, log2_of(magnitude));
+        return c < 0 && c != INT64_MIN ? emit(builder, IR_NEG, shift, -1) : shift;
+    }
+    if (c > 9 && is_power_of_two(magnitude - 1))
+        return emit(builder, IR_ADD, emit_shift(builder, IR_SHL, x, log2_of(magnitude - 1)), x);
+    if (c > 3 && is_power_of_two(magnitude + 1))
+        return emit(builder, IR_SUB, emit_shift(builder, IR_SHL, x, log2_of(magnitude + 1)), x);
+    return -1;
+}
+
+static int reduce_division(Builder *builder, int x, int64_t d)
+{
+    uint64_t magnitude = d < 0 ? 0 - (uint64_t)d : (uint64_t)d;
+    if (d == 0)
+        return -1;
+    if (d == 1)
+        return x;
+    if (d == -1)
+        return emit(builder, IR_NEG, x, -1);
+
+    int quotient;
+    if (is_power_of_two(magnitude))
+    {
+        // negative dividends are biased by the divisor minus one to round toward zero
+        int k = log2_of(magnitude);
+        int sign = k == 1 ? x : emit_shift(builder, IR_SAR, x, 63);
+        int bias = emit_shift(builder, IR_SHR, sign, 64 - k);
+        quotient = emit_shift(builder, IR_SAR, emit(builder, IR_ADD, x, bias), k);
+        return d < 0 ? emit(builder, IR_NEG, quotient, -1) : quotient;
+    }
+
+    int64_t magic;
+    int shift;
+    magic_number(d, &magic, &shift);
+    quotient = emit(builder, IR_MULHI, x, emit_constant(builder, magic));
+    if (d > 0 && magic < 0)
+        quotient = emit(builder, IR_ADD, quotient, x);
+    else if (d < 0 && magic > 0)
+        quotient = emit(builder, IR_SUB, quotient, x);
+    if (shift > 0)
+        quotient = emit_shift(builder, IR_SAR, quotient, shift);
+    // plus one for a negative quotient
+    return emit(builder, IR_ADD, quotient, emit_shift(builder, IR_SHR, quotient, 63));
+}
+
+// left to right binary powering, the same product as the interpreter's loop
+static int reduce_power(Builder *builder, int x, int64_t e)
+{
+    if (e < 0)
+        return -1;
+    if (e == 0)
+        return emit_constant(builder, 1);
+    int bits = log2_of((uint64_t)e);
+    if (bits + __builtin_popcountll((uint64_t)e) - 1 > STRENGTH_POWER_MULTIPLIES)
+        return -1;
+
+    int result = x;
+    for (int bit = bits - 1; bit >= 0; bit--)
+    {
+        result = emit(builder, IR_MUL, result, result);
+        if ((e >> bit) & 1)
+            result = emit(builder, IR_MUL, result, x);
+    }
+    return result;
+}
+
+// Returns the value replacing instruction i, -1 if it stays
+static int reduce(IRFunction *function, int block, int i)
+{
+    IRInstruction instruction = function->instructions[i];
+    Builder builder = {function, block, instruction.source};
+    int left = ir_resolve_value(function, instruction.args[0]);
+    int right = ir_resolve_value(function, instruction.args[1]);
+
+    if (instruction.op == IR_POW && instruction.type == IR_FLOAT && is_constant(function, right))
+    {
+        double e = function->instructions[right].imm.f;
+        if (e == 0.0)
+        {
+            int value = ir_emit_const_float(function, block, 1.0);
+            function->instructions[value].source = instruction.source;
+            return value;
+        }
+        return e == 1.0 ? left : -1;
+    }
+    if (instruction.type != IR_INT)
+        return -1;
+
+    switch (instruction.op)
+    {
+    case IR_MUL:
+        if (is_constant(function, left) && !is_constant(function, right))
+            return reduce_multiply(&builder, right, function->instructions[left].imm.i);
+        if (is_constant(function, right))
+            return reduce_multiply(&builder, left, function->instructions[right].imm.i);
+        return -1;
+    case IR_DIV:
+        if (is_constant(function, right))
+            return reduce_division(&builder, left, function->instructions[right].imm.i);
+        return -1;
+    case IR_POW:
+        if (is_constant(function, right))
+            return reduce_power(&builder, left, function->instructions[right].imm.i);
+        return -1;
+    default:
+        return -1;
+    }
+}
+
+static void move_to_end(IRFunction *function, int block, int i)
+{
+    int copy = ir_emit(function, block, IR_NOP, IR_VOID, -1, -1);
+    function->instructions[copy] = function->instructions[i];
+    function->instructions[i].op = IR_NOP;
+    if (function->instructions[copy].type != IR_VOID)
+        ir_replace_value(function, i, copy);
+}
+
+// Returns the number of instructions reduced
+int strength_pass(IRFunction *function)
+{
+    int reduced = 0;
+    for (int b = 0; b < function->block_count; b++)
+    {
+        IRBlock range = function->blocks[b];
+        bool moving = false;
+        for (int i = range.first; i < range.first + range.count; i++)
+        {
+            IROpcode op = function->instructions[i].op;
+            if (op == IR_PHI || ir_opcode_info[op].is_terminator)
+                continue;
+            int value = reduce(function, b, i);
+            if (value >= 0)
+            {
+                ir_replace_value(function, i, value);
+                function->instructions[i].op = IR_NOP;
+                moving = true;
+                reduced++;
+            }
+            else if (moving)
+                move_to_end(function, b, i);
+        }
+    }
+
+    if (reduced > 0)
+        ir_compact(function);
+    return reduced;
+}
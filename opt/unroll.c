@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+#include "../defc/defc.h"
+
+// Loop unrolling of counted loops, see opt_counted_loop.
+//
+// A loop whose start and bound are constants runs a trip count known here.
+// When its body copied that many times stays under UNROLL_FULL_BUDGET
+// instructions, the copies replace the loop in a block of their own and the
+// compare and branch are gone. The copies see the induction variable as a
+// constant, so the pass folds them with sccp and strength reduction before
+// it returns.
+//
+// Any other loop counting up by one to a bound it compares less than gets a
+// copy in front of it whose body runs UNROLL_FACTOR iterations, or fewer to
+// stay under UNROLL_PARTIAL_BUDGET, as many times as they fit, and the
+// original loop runs the rest:
+//
+//     preheader: jump setup
+//     setup:     end = start + ((n - start) * (start < n) & -factor)
+//     header':   branch i' < end, body', header
+//     body':     factor copies of the body, jump header'
+//
+// Bodies with calls are left alone, the compare and branch saved are nothing
+// next to a call, and so are loops the profile saw run fewer than two
+// copies' worth of iterations per entry on average, which would only ever
+// run the original loop.
+
+typedef struct
+{
+    IRFunction *function;
+    int32_t *map; // loop value to its copy, -1 outside the loop
+    int count; // values map covers
+    int block;
+} Copier;
+
+static int mapped(Copier *copier, int value)
+{
+    if (value < 0 || value >= copier->count || copier->map[value] < 0)
+        return value;
+    return copier->map[value];
+}
+
+// constants are copied into the block using them, like the lowering does
+static int value_in(IRFunction *function, int value, int block)
+{
+    IRInstruction *instruction = &function->instructions[value];
+    if (instruction->op != IR_CONST || instruction->block == block)
+        return value;
+    return ir_emit_const_int(function, block, instruction->imm.i);
+}
+
+static void copy_instruction(Copier *copier, int i)
+{
+    IRFunction *function = copier->function;
+    int copy = ir_emit(function, copier->block, IR_NOP, IR_VOID, -1, -1);
+    IRInstruction instruction = function->instructions[i];
+    const IROpcodeInfo *info = &ir_opcode_info[instruction.op];
+    instruction.block = copier->block;
+    for (int k = 0; k < info->value_args; k++)
+    {
+        instruction.args[k] = mapped(copier, instruction.args[k]);
+    }
+    if (info->has_list)
+    {
+        int first = function->operand_count;
+        for (int k = 0; k < instruction.imm.list.count; k++)
+        {
+            int32_t operand = mapped(copier, function->operands[instruction.imm.list.first + k]);
+            ir_add_operands(function, &operand, 1);
+        }
+        instruction.imm.list.first = first;
+    }
+    function->instructions[copy] = instruction;
+    copier->map[i] = copy;
+}
+
+// Copies the header's constants and then the body once per iteration, the
+// phis taking the values of the previous copy
+static void copy_iterations(Copier *copier, OptCountedLoop *counted, int iterations)
+{
+    IRFunction *function = copier->function;
+    IRBlock header = function->blocks[counted->header];
+    IRBlock body = function->blocks[counted->body];
+    int phi_count = 0;
+    while (phi_count < header.count && function->instructions[header.first + phi_count].op == IR_PHI)
+    {
+        phi_count++;
+    }
+    int32_t *next = malloc((phi_count + 1) * sizeof(int32_t));
+
+    for (int i = header.first; i < header.first + header.count; i++)
+    {
+        if (function->instructions[i].op == IR_CONST)
+            copy_instruction(copier, i);
+    }
+    for (int t = 0; t < iterations; t++)
+    {
+        for (int i = body.first; i < body.first + body.count - 1; i++)
+        {
+            copy_instruction(copier, i);
+        }
+        for (int p = 0; p < phi_count; p++)
+        {
+            IRInstruction *phi = &function->instructions[header.first + p];
+            for (int k = 0; k < phi->imm.list.count; k++)
+            {
+                if (function->operands[phi->imm.list.first + 2 * k] == counted->body)
+                    next[p] = mapped(copier, function->operands[phi->imm.list.first + 2 * k + 1]);
+            }
+        }
+        for (int p = 0; p < phi_count; p++)
+        {
+            copier->map[header.first + p] = next[p];
+        }
+    }
+    free(next);
+}
+
+static int body_size(IRFunction *function, OptCountedLoop *counted, bool *has_call)
+{
+    IRBlock *range = &function->blocks[counted->body];
+    int size = 0;
+    *has_call = false;
+    for (int i = range->first; i < range->first + range->count - 1; i++)
+    {
+        IROpcode op = function->instructions[i].op;
+        if (op == IR_CALL || op == IR_CALL_EXTERN)
+            *has_call = true;
+        if (op != IR_CONST)
+            size++;
+    }
+    return size;
+}
+
+// Trip count of a loop with constant start and bound, -1 when it is not
+// known or passes limit
+static int constant_trip_count(IRFunction *function, OptCountedLoop *counted, int limit)
+{
+    IRInstruction *start = &function->instructions[opt_loop_init(function, counted, counted->induction)];
+    IRInstruction *bound = &function->instructions[counted->bound];
+    if (start->op != IR_CONST || bound->op != IR_CONST)
+        return -1;
+
+    int64_t i = start->imm.i;
+    int64_t n = bound->imm.i;
+    for (int trip = 0; trip <= limit; trip++)
+    {
+        bool taken = false;
+        switch (counted->condition)
+        {
+        case IR_NE:
+            taken = i != n;
+            break;
+        case IR_LT:
+            taken = i < n;
+            break;
+        case IR_LE:
+            taken = i <= n;
+            break;
+        case IR_GT:
+            taken = i > n;
+            break;
+        case IR_GE:
+            taken = i >= n;
+            break;
+        default:
+            return -1;
+        }
+        if (!taken)
+            return trip;
+        i = (int64_t)((uint64_t)i + (uint64_t)counted->step);
+    }
+    return -1;
+}
+
+static void rename_predecessor(IRFunction *function, int target, int block, int successor)
+{
+    IRBlock *range = &function->blocks[target];
+    for (int i = range->first; i < range->first + range->count && function->instructions[i].op == IR_PHI; i++)
+    {
+        IRInstruction *phi = &function->instructions[i];
+        for (int k = 0; k < phi->imm.list.count; k++)
+        {
+            if (function->operands[phi->imm.list.first + 2 * k] == block)
+                function->operands[phi->imm.list.first + 2 * k] = successor;
+        }
+    }
+}
+
+// The copies take the loop's place, the header and body are left unreachable
+static void unroll_fully(IRFunction *function, OptCountedLoop *counted, int trip, int32_t *map, int count)
+{
+    Copier copier = {function, map, count, ir_add_block(function)};
+    IRBlock header = function->blocks[counted->header];
+    for (int i = header.first; i < header.first + header.count && function->instructions[i].op == IR_PHI; i++)
+    {
+        map[i] = opt_loop_init(function, counted, i);
+    }
+    copy_iterations(&copier, counted, trip);
+
+    // what the header defines is all the code after the loop can read
+    for (int i = header.first; i < header.first + header.count - 1; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        if (i == counted->compare)
+            ir_replace_value(function, i, ir_emit_const_int(function, copier.block, 0));
+        else if (instruction->op == IR_PHI || instruction->op == IR_CONST)
+            ir_replace_value(function, i, map[i]);
+    }
+    int jump = ir_emit(function, copier.block, IR_JUMP, IR_VOID, -1, -1);
+    function->instructions[jump].imm.jump.target = counted->exit;
+    function->instructions[jump].imm.jump.other = -1;
+    rename_predecessor(function, counted->exit, counted->header, copier.block);
+    function->instructions[ir_terminator(function, counted->preheader)].imm.jump.target = copier.block;
+}
+
+static void unroll_partially(IRFunction *function, OptCountedLoop *counted, int factor, int32_t *map, int count)
+{
+    int setup = ir_add_block(function);
+    int header = ir_add_block(function);
+    int body = ir_add_block(function);
+    function->instructions[ir_terminator(function, counted->preheader)].imm.jump.target = setup;
+
+    int start = value_in(function, opt_loop_init(function, counted, counted->induction), setup);
+    int bound = value_in(function, counted->bound, setup);
+    int entered = ir_emit(function, setup, IR_LT, IR_INT, start, bound);
+    int trip = ir_emit(function, setup, IR_MUL, IR_INT, ir_emit(function, setup, IR_SUB, IR_INT, bound, start), entered);
+    int whole = ir_emit(function, setup, IR_AND, IR_INT, trip, ir_emit_const_int(function, setup, -factor));
+    int end = ir_emit(function, setup, IR_ADD, IR_INT, start, whole);
+    int jump = ir_emit(function, setup, IR_JUMP, IR_VOID, -1, -1);
+    function->instructions[jump].imm.jump.target = header;
+    function->instructions[jump].imm.jump.other = -1;
+
+    // the copied header's phis are filled in once the body is copied
+    IRBlock range = function->blocks[counted->header];
+    int phi_count = 0;
+    while (phi_count < range.count && function->instructions[range.first + phi_count].op == IR_PHI)
+    {
+        int phi = range.first + phi_count;
+        map[phi] = ir_emit(function, header, IR_PHI, function->instructions[phi].type, -1, -1);
+        phi_count++;
+    }
+    int compare = ir_emit(function, header, IR_LT, IR_INT, map[counted->induction], end);
+    int branch = ir_emit(function, header, IR_BRANCH, IR_VOID, compare, -1);
+    function->instructions[branch].imm.jump.target = body;
+    function->instructions[branch].imm.jump.other = counted->header;
+
+    int32_t *entry = malloc((phi_count + 1) * sizeof(int32_t));
+    for (int p = 0; p < phi_count; p++)
+    {
+        entry[p] = map[range.first + p];
+    }
+    Copier copier = {function, map, count, body};
+    copy_iterations(&copier, counted, factor);
+    jump = ir_emit(function, body, IR_JUMP, IR_VOID, -1, -1);
+    function->instructions[jump].imm.jump.target = header;
+    function->instructions[jump].imm.jump.other = -1;
+
+    // the original loop is entered from the copy with the values it got to
+    for (int p = 0; p < phi_count; p++)
+    {
+        int phi = range.first + p;
+        int init = opt_loop_init(function, counted, phi);
+        int32_t pairs[4] = {setup, init, body, map[phi]};
+        function->instructions[entry[p]].imm.list.first = ir_add_operands(function, pairs, 4);
+        function->instructions[entry[p]].imm.list.count = 2;
+
+        IRInstruction *instruction = &function->instructions[phi];
+        for (int k = 0; k < instruction->imm.list.count; k++)
+        {
+            int32_t *pair = &function->operands[instruction->imm.list.first + 2 * k];
+            if (pair[0] != counted->body)
+            {
+                pair[0] = header;
+                pair[1] = entry[p];
+            }
+        }
+    }
+    free(entry);
+}
+
+// Returns the number of loops unrolled
+int unroll_pass(IRFunction *function, const IRProfile *profile)
+{
+    int loop_count;
+    OptLoop *loops = opt_find_loops(function, &loop_count);
+    OptCountedLoop *counted = malloc((loop_count + 1) * sizeof(OptCountedLoop));
+    int *trips = malloc((loop_count + 1) * sizeof(int));
+    int *factors = malloc((loop_count + 1) * sizeof(int));
+    int candidate_count = 0;
+
+    // the transformations add blocks, the loops are all looked at first
+    for (int l = 0; l < loop_count; l++)
+    {
+        OptCountedLoop *loop = &counted[candidate_count];
+        if (!opt_counted_loop(function, &loops[l], loop))
+            continue;
+        bool has_call;
+        int size = body_size(function, loop, &has_call);
+        int trip = constant_trip_count(function, loop, UNROLL_FULL_BUDGET);
+        int64_t profiled = opt_profiled_trip_count(function, loop, profile);
+        int factor = UNROLL_FACTOR;
+        while (factor > 1 && factor * size > UNROLL_PARTIAL_BUDGET)
+        {
+            factor /= 2;
+        }
+        if (trip >= 0 && trip * size <= UNROLL_FULL_BUDGET)
+            factor = 0;
+        else if (trip >= 0 || has_call || factor < 2 || loop->condition != IR_LT || loop->step != 1)
+            continue;
+        else if (profiled >= 0 && profiled < 2 * factor)
+            continue;
+        trips[candidate_count] = trip;
+        factors[candidate_count] = factor;
+        candidate_count++;
+    }
+    opt_free_loops(loops, loop_count);
+
+    // only values of the original loops are mapped
+    int count = function->instruction_count;
+    int32_t *map = malloc((count + 1) * sizeof(int32_t));
+    bool folding = false;
+    for (int c = 0; c < candidate_count; c++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            map[i] = -1;
+        }
+        if (factors[c] == 0)
+        {
+            unroll_fully(function, &counted[c], trips[c], map, count);
+            folding = true;
+        }
+        else
+            unroll_partially(function, &counted[c], factors[c], map, count);
+    }
+    free(map);
+    free(counted);
+    free(trips);
+    free(factors);
+
+    if (candidate_count > 0)
+        ir_compact(function);
+    if (folding)
+    {
+        sccp_pass(function);
+        strength_pass(function);
+    }
+    return candidate_count;
+}
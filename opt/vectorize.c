@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opt.h"
+#include "../defc/defc.h"
+
+// Loop vectorization. The language has no arrays, so what runs lanes at a
+// time are counted loops that sum integer expressions of their induction
+// variable:
+//
+//     for (int i = start; i < n; i++)
+//         sum = sum + (i * k & 255) - i * i;
+//
+// The loop must be a header and a single body block, the header comparing an
+// induction variable stepping by 1 against a value from outside the loop, and
+// every other header phi a reduction: its value in the body is the phi plus or
+// minus terms that do not read any phi but the induction variable. Wrapping
+// makes the sum of the lanes the same as the sum in order. Floats would round
+// differently and are left alone.
+//
+// Every reduction becomes a vreduce in front of the loop, which runs the
+// multiple of lanes iterations that fit between start and n, and the original
+// loop runs what is left with the sums so far:
+//
+//     preheader: jump guard
+//     guard:     branch start < n, kernel, header
+//     kernel:    trip = max(n - start, 0) & -lanes
+//                sum' = vreduce(start, trip, sum, invariants...)
+//                jump header with i = start + trip, sum = sum'
+//
+// Loops the profile saw run fewer than two vectors' worth of iterations per
+// entry on average are left alone, the kernel would rarely run.
+
+typedef struct
+{
+    IRFunction *function;
+    OptLoop *loop;
+    int body;
+    int induction;
+    int accumulator;
+
+    IRVectorNode nodes[VECTOR_MAX_NODES];
+    int node_count;
+    int *node_of; // value to node, -1 if none yet
+    int32_t inputs[VECTOR_MAX_NODES];
+    int input_count;
+    int accumulator_uses;
+} VectorBuilder;
+
+// a loop that can be vectorized, its reductions in a shared array
+typedef struct
+{
+    OptCountedLoop loop;
+    int first;
+    int count;
+} Candidate;
+
+typedef struct
+{
+    int phi;
+    int init;
+    IRVectorNode nodes[VECTOR_MAX_NODES];
+    int node_count;
+    int result;
+    int32_t inputs[VECTOR_MAX_NODES];
+    int input_count;
+} Reduction;
+
+static bool in_loop(VectorBuilder *builder, int value)
+{
+    return builder->loop->blocks[builder->function->instructions[value].block];
+}
+
+static int uses_inside(VectorBuilder *builder, int value)
+{
+    IRFunction *function = builder->function;
+    int count = 0;
+    for (int k = function->use_offsets[value]; k < function->use_offsets[value + 1]; k++)
+    {
+        if (in_loop(builder, function->uses[k]))
+            count++;
+    }
+    return count;
+}
+
+static int add_node(VectorBuilder *builder, IROpcode op, int a, int b, int64_t imm)
+{
+    if (builder->node_count == VECTOR_MAX_NODES)
+        return -1;
+    IRVectorNode *node = &builder->nodes[builder->node_count];
+    node->op = op;
+    node->args[0] = a;
+    node->args[1] = b;
+    node->imm = imm;
+    return builder->node_count++;
+}
+
+static bool vectorizable_op(IROpcode op)
+{
+    switch (op)
+    {
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_NOT:
+    case IR_NEG:
+    case IR_SHL:
+    case IR_SHR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Node computing value over all lanes, -1 if it cannot be vectorized. The
+// accumulator may only be reached through the left of a sub or either side
+// of an add, starting from the phi's value in the body.
+static int build_node(VectorBuilder *builder, int value, bool chain)
+{
+    IRFunction *function = builder->function;
+    IRInstruction *instruction = &function->instructions[value];
+
+    if (value == builder->accumulator)
+    {
+        if (!chain || builder->accumulator_uses++ > 0)
+            return -1;
+        return add_node(builder, IR_PHI, -1, -1, 1);
+    }
+    if (builder->node_of[value] >= 0)
+        return builder->node_of[value];
+
+    int node = -1;
+    if (value == builder->induction)
+        node = add_node(builder, IR_PHI, -1, -1, 0);
+    else if (instruction->op == IR_CONST && instruction->type == IR_INT)
+        node = add_node(builder, IR_CONST, -1, -1, instruction->imm.i);
+    else if (!in_loop(builder, value))
+    {
+        if (instruction->type != IR_INT || builder->input_count == VECTOR_MAX_NODES)
+            return -1;
+        builder->inputs[builder->input_count] = value;
+        node = add_node(builder, IR_PARAM, -1, -1, builder->input_count++);
+    }
+    else if (instruction->block == builder->body && instruction->type == IR_INT && vectorizable_op(instruction->op))
+    {
+        int args[2] = {-1, -1};
+        int before = builder->accumulator_uses;
+        for (int k = 0; k < ir_opcode_info[instruction->op].value_args; k++)
+        {
+            bool on_chain = chain && (instruction->op == IR_ADD || (instruction->op == IR_SUB && k == 0));
+            int uses = builder->accumulator_uses;
+            args[k] = build_node(builder, instruction->args[k], on_chain);
+            if (args[k] < 0)
+                return -1;
+            // a partial sum is only read by the next step of the chain
+            if (builder->accumulator_uses != uses && uses_inside(builder, instruction->args[k]) != 1)
+                return -1;
+        }
+        node = add_node(builder, instruction->op, args[0], args[1], instruction->imm.i);
+        // nodes holding part of the sum are not shared
+        if (builder->accumulator_uses != before)
+            return node;
+    }
+    if (node >= 0)
+        builder->node_of[value] = node;
+    return node;
+}
+
+static int phi_operand(IRFunction *function, int phi, int block)
+{
+    IRInstruction *instruction = &function->instructions[phi];
+    for (int k = 0; k < instruction->imm.list.count; k++)
+    {
+        if (function->operands[instruction->imm.list.first + 2 * k] == block)
+            return function->operands[instruction->imm.list.first + 2 * k + 1];
+    }
+    return -1;
+}
+
+// Fills the candidate and its reductions for a loop that can be vectorized,
+// returns the number of reductions or 0
+static int analyze_loop(IRFunction *function, OptLoop *loop, Candidate *candidate, Reduction *reductions)
+{
+    OptCountedLoop *counted = &candidate->loop;
+    if (!opt_counted_loop(function, loop, counted) || counted->condition != IR_LT || counted->step != 1)
+        return 0;
+    int header = counted->header;
+    int body = counted->body;
+
+    IRBlock *range = &function->blocks[body];
+    for (int i = range->first; i < range->first + range->count; i++)
+    {
+        IRInstruction *instruction = &function->instructions[i];
+        bool side_effects = instruction->op != IR_JUMP && opt_has_side_effects(function, instruction);
+        if (instruction->op == IR_LOAD || instruction->op == IR_VREDUCE || side_effects)
+            return 0;
+    }
+
+    VectorBuilder builder;
+    builder.function = function;
+    builder.loop = loop;
+    builder.body = body;
+    builder.induction = counted->induction;
+    builder.node_of = malloc((function->instruction_count + 1) * sizeof(int));
+
+    int count = 0;
+    range = &function->blocks[header];
+    for (int phi = range->first; phi < range->first + range->count && function->instructions[phi].op == IR_PHI; phi++)
+    {
+        if (phi == counted->induction)
+            continue;
+        int next = phi_operand(function, phi, body);
+        if (function->instructions[phi].type != IR_INT || next < 0 || uses_inside(&builder, phi) != 1 || uses_inside(&builder, next) != 1)
+        {
+            count = 0;
+            break;
+        }
+
+        for (int i = 0; i < function->instruction_count; i++)
+        {
+            builder.node_of[i] = -1;
+        }
+        builder.node_count = 0;
+        builder.input_count = 0;
+        builder.accumulator = phi;
+        builder.accumulator_uses = 0;
+        int result = build_node(&builder, next, true);
+        if (result < 0 || builder.accumulator_uses != 1)
+        {
+            count = 0;
+            break;
+        }
+
+        Reduction *reduction = &reductions[count++];
+        reduction->phi = phi;
+        reduction->init = opt_loop_init(function, counted, phi);
+        memcpy(reduction->nodes, builder.nodes, builder.node_count * sizeof(IRVectorNode));
+        reduction->node_count = builder.node_count;
+        reduction->result = result;
+        memcpy(reduction->inputs, builder.inputs, builder.input_count * sizeof(int32_t));
+        reduction->input_count = builder.input_count;
+    }
+
+    free(builder.node_of);
+    return count;
+}
+
+// value usable in block, constants are copied since they stay block local
+static int value_in(IRFunction *function, int value, int block)
+{
+    IRInstruction *instruction = &function->instructions[value];
+    if (instruction->op != IR_CONST)
+        return value;
+    return ir_emit_const_int(function, block, instruction->imm.i);
+}
+
+// The loop's blocks were found before any block was added, the candidate
+// holds what is needed of them
+static void transform_loop(IRFunction *function, Candidate *candidate, Reduction *reductions, int lanes)
+{
+    int header = candidate->loop.header;
+    int preheader = candidate->loop.preheader;
+    int body = candidate->loop.body;
+    int induction = candidate->loop.induction;
+    int bound = candidate->loop.bound;
+    int count = candidate->count;
+    int start = phi_operand(function, induction, preheader);
+
+    int guard = ir_add_block(function);
+    int kernel = ir_add_block(function);
+    function->instructions[ir_terminator(function, preheader)].imm.jump.target = guard;
+
+    int condition = ir_emit(function, guard, IR_LT, IR_INT, value_in(function, start, guard), value_in(function, bound, guard));
+    int branch = ir_emit(function, guard, IR_BRANCH, IR_VOID, condition, -1);
+    function->instructions[branch].imm.jump.target = kernel;
+    function->instructions[branch].imm.jump.other = header;
+
+    // the subtraction may wrap for bounds far apart, the vector loop then leaves all of it to the scalar one
+    int kernel_start = value_in(function, start, kernel);
+    int distance = ir_emit(function, kernel, IR_SUB, IR_INT, value_in(function, bound, kernel), kernel_start);
+    int sign = ir_emit(function, kernel, IR_SAR, IR_INT, distance, -1);
+    function->instructions[sign].imm.i = 63;
+    int positive = ir_emit(function, kernel, IR_AND, IR_INT, distance, ir_emit(function, kernel, IR_NOT, IR_INT, sign, -1));
+    int trip = ir_emit(function, kernel, IR_AND, IR_INT, positive, ir_emit_const_int(function, kernel, -lanes));
+    int next_start = ir_emit(function, kernel, IR_ADD, IR_INT, kernel_start, trip);
+
+    int *sums = malloc((count + 1) * sizeof(int));
+    for (int r = 0; r < count; r++)
+    {
+        Reduction *reduction = &reductions[r];
+        int32_t operands[VECTOR_MAX_NODES + 3] = {kernel_start, trip, value_in(function, reduction->init, kernel)};
+        memcpy(&operands[3], reduction->inputs, reduction->input_count * sizeof(int32_t));
+        int sum = ir_emit(function, kernel, IR_VREDUCE, IR_INT, -1, -1);
+        function->instructions[sum].args[0] = ir_add_vector_loop(function, reduction->nodes, reduction->node_count, reduction->result, lanes);
+        function->instructions[sum].imm.list.first = ir_add_operands(function, operands, reduction->input_count + 3);
+        function->instructions[sum].imm.list.count = reduction->input_count + 3;
+        sums[r] = sum;
+    }
+    int jump = ir_emit(function, kernel, IR_JUMP, IR_VOID, -1, -1);
+    function->instructions[jump].imm.jump.target = header;
+    function->instructions[jump].imm.jump.other = -1;
+
+    // the header is entered from the guard when the vector loop is skipped
+    IRBlock *range = &function->blocks[header];
+    for (int phi = range->first; phi < range->first + range->count && function->instructions[phi].op == IR_PHI; phi++)
+    {
+        int from_kernel = phi == induction ? next_start : -1;
+        for (int r = 0; r < count; r++)
+        {
+            if (reductions[r].phi == phi)
+                from_kernel = sums[r];
+        }
+        int32_t pairs[6] = {guard, phi_operand(function, phi, preheader), body, phi_operand(function, phi, body), kernel, from_kernel};
+        function->instructions[phi].imm.list.first = ir_add_operands(function, pairs, 6);
+        function->instructions[phi].imm.list.count = 3;
+    }
+    free(sums);
+}
+
+// Returns the number of loops vectorized
+int vectorize_pass(IRFunction *function, int lanes, const IRProfile *profile)
+{
+    if (lanes < 2)
+        return 0;
+    ir_build_uses(function);
+
+    int loop_count;
+    OptLoop *loops = opt_find_loops(function, &loop_count);
+    Candidate *candidates = malloc((loop_count + 1) * sizeof(Candidate));
+    int phi_count = 0;
+    for (int i = 0; i < function->instruction_count; i++)
+    {
+        if (function->instructions[i].op == IR_PHI)
+            phi_count++;
+    }
+    Reduction *reductions = malloc((phi_count + 1) * sizeof(Reduction));
+
+    // analyses first, the transformations add blocks and instructions
+    int candidate_count = 0;
+    int used = 0;
+    for (int l = 0; l < loop_count; l++)
+    {
+        Candidate *candidate = &candidates[candidate_count];
+        candidate->first = used;
+        candidate->count = analyze_loop(function, &loops[l], candidate, &reductions[used]);
+        if (candidate->count == 0)
+            continue;
+        int64_t trip = opt_profiled_trip_count(function, &candidate->loop, profile);
+        if (trip >= 0 && trip < 2 * lanes)
+            continue;
+        used += candidate->count;
+        candidate_count++;
+    }
+    opt_free_loops(loops, loop_count);
+
+    for (int c = 0; c < candidate_count; c++)
+    {
+        transform_loop(function, &candidates[c], &reductions[candidates[c].first], lanes);
+    }
+    free(candidates);
+    free(reductions);
+
+    if (candidate_count > 0)
+        ir_compact(function);
+    return candidate_count;
+}
@@ -42,6 +42,152 @@ ASTNode cast_assignment_node(char *name, int expression)
     node.type = N_ASSIGNMENT;
     node.data.assignment.name = name;
     node.data.assignment.expression = expression;
+    node.data.assignment.declaration = -1;
+
+    return node;
+}
+
+ASTNode cast_declaration_node(char *name, parser_literal var_type, int expression)
+{
+    ASTNode node;
+    node.type = N_VARIABLE_DECLARATION;
+    node.data.variable_declaration.name = name;
+    node.data.variable_declaration.literal = var_type;
+    node.data.variable_declaration.expression = expression;
+    node.data.variable_declaration.declaration = -1;
+
+    return node;
+}
+
+ASTNode cast_identifier_node(char *name)
+{
+    ASTNode node;
+    node.type = N_IDENTIFIER;
+    node.data.identifier.name = name;
+    node.data.identifier.declaration = -1;
+
+    return node;
+}
+
+ASTNode cast_call_node(char *name, int first_argument, int argument_count)
+{
+    ASTNode node;
+    node.type = N_CALL;
+    node.data.call.name = name;
+    node.data.call.first_argument = first_argument;
+    node.data.call.argument_count = argument_count;
+    node.data.call.declaration = -1;
+    node.data.call.intrinsic = -1;
+
+    return node;
+}
+
+ASTNode cast_conversion_node(int expression)
+{
+    ASTNode node;
+    node.type = N_CAST;
+    node.data.cast.expression = expression;
+
+    return node;
+}
+
+ASTNode cast_return_node(int expression)
+{
+    ASTNode node;
+    node.type = N_RETURN;
+    node.data.return_statement.expression = expression;
+
+    return node;
+}
+
+ASTNode cast_block_node(NodeType type, int first_statement, int statement_count, int scope_start)
+{
+    ASTNode node;
+    node.type = type;
+    node.data.block.first_statement = first_statement;
+    node.data.block.statement_count = statement_count;
+    node.data.block.scope_start = scope_start;
+
+    return node;
+}
+
+ASTNode cast_parameter_node(char *name, parser_literal literal)
+{
+    ASTNode node;
+    node.type = N_PARAMETER;
+    node.data.parameter.name = name;
+    node.data.parameter.literal = literal;
+
+    return node;
+}
+
+ASTNode cast_prototype_node(char *name, parser_literal return_literal, int first_parameter, int parameter_count, bool has_body)
+{
+    ASTNode node;
+    node.type = N_FUNCTION_PROTOTYPE;
+    node.data.function_prototype.name = name;
+    node.data.function_prototype.return_literal = return_literal;
+    node.data.function_prototype.first_parameter = first_parameter;
+    node.data.function_prototype.parameter_count = parameter_count;
+    node.data.function_prototype.has_body = has_body;
+    node.data.function_prototype.is_extern = false;
+    node.data.function_prototype.declaration = -1;
+
+    return node;
+}
+
+ASTNode cast_function_node(int prototype, int body)
+{
+    ASTNode node;
+    node.type = N_FUNCTION_DECLARATION;
+    node.data.function_declaration.prototype = prototype;
+    node.data.function_declaration.body = body;
+
+    return node;
+}
+
+ASTNode cast_update_node(char *name, TokenType type, bool prefix)
+{
+    ASTNode node;
+    node.type = N_UPDATE;
+    node.data.update.name = name;
+    node.data.update.operator= type;
+    node.data.update.prefix = prefix;
+    node.data.update.declaration = -1;
+
+    return node;
+}
+
+ASTNode cast_if_node(int condition, int then_branch, int else_branch)
+{
+    ASTNode node;
+    node.type = N_IF;
+    node.data.if_statement.condition = condition;
+    node.data.if_statement.then_branch = then_branch;
+    node.data.if_statement.else_branch = else_branch;
+
+    return node;
+}
+
+ASTNode cast_while_node(int condition, int body)
+{
+    ASTNode node;
+    node.type = N_WHILE;
+    node.data.while_statement.condition = condition;
+    node.data.while_statement.body = body;
+
+    return node;
+}
+
+ASTNode cast_for_node(int init, int condition, int update, int body, int scope_start)
+{
+    ASTNode node;
+    node.type = N_FOR;
+    node.data.for_statement.init = init;
+    node.data.for_statement.condition = condition;
+    node.data.for_statement.update = update;
+    node.data.for_statement.body = body;
+    node.data.for_statement.scope_start = scope_start;
 
     return node;
 }
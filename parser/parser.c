@@ -3,10 +3,12 @@
 #include "../hashmap/hashmap.h"
 #include "../defc/defc.h"
 #include "casting.h"
+#include "../semantic/types.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
+#include <stdarg.h>
 
 Token get_parser_token(Parser *parser)
 {
@@ -28,16 +30,23 @@ int primary(Parser *parser)
         break;
     case T_LPAREN:
         consume_parser_token(parser, T_LPAREN);
-        node = parse_expression(parser, 0);
+        node = parse_assignment_expression(parser);
         match_parser_token_type(parser, T_RPAREN, 0);
         break;
+    case T_IDENTIFIER:
+        if (peek_parser_token_type(parser, T_LPAREN, 1))
+            node = parse_call(parser);
+        else if (peek_parser_token_type(parser, T_INCREMENT, 1) || peek_parser_token_type(parser, T_DECREMENT, 1))
+        {
+            advance_parser(parser);
+            node = add_ast_node(parser, cast_update_node(token.value, get_parser_token(parser).type, false));
+        }
+        else
+            node = add_ast_node(parser, cast_identifier_node(token.value));
+        break;
 
     default:
-        parser->error_found = true;
-        // TODO: add error
-        wprintf(L"Error parsing expression: %s\n", token_to_string(token.type));
-        exit(1);
-        break;
+        syntax_error(parser, L"Error parsing expression: %s", token_to_string(token.type));
     }
 
     advance_parser(parser);
@@ -66,15 +75,45 @@ int match_parser_token_type(Parser *parser, TokenType expected_type, int offset)
     {
         return 1;
     }
-    else
+    syntax_error(parser, L"Expected %s but got %s", token_to_string(expected_type), token_to_string(token.type));
+    return 0;
+}
+
+// Leaves the closing parenthesis as the current token, primary() advances over it
+int parse_call(Parser *parser)
+{
+    Token name = consume_parser_token(parser, T_IDENTIFIER);
+    consume_parser_token(parser, T_LPAREN);
+
+    NodeList arguments;
+    open_node_list(parser, &arguments);
+    while (!peek_parser_token_type(parser, T_RPAREN, 0))
     {
-        wprintf(L"Expected %s but got %s\n", token_to_string(expected_type), token_to_string(token.type));
-        parser->error_found = true;
+        node_list_push(&arguments, parse_assignment_expression(parser));
+        if (!peek_parser_token_type(parser, T_COMMA, 0))
+            break;
+        advance_parser(parser);
+    }
+    match_parser_token_type(parser, T_RPAREN, 0);
 
-        // TODO: add error
-        exit(1);
+    int first_argument = close_node_list(parser, &arguments);
+    return add_ast_node(parser, cast_call_node(name.value, first_argument, arguments.count));
+}
+
+int parse_assignment_expression(Parser *parser)
+{
+    if (peek_parser_token_type(parser, T_IDENTIFIER, 0) && peek_parser_token_type(parser, T_ASSIGN, 1))
+    {
+        char *name = get_parser_token(parser).value;
+        advance_parser(parser);
+
+        consume_parser_token(parser, T_ASSIGN);
+
+        int expression = parse_assignment_expression(parser);
+        return add_ast_node(parser, cast_assignment_node(name, expression));
     }
-    return 0;
+
+    return parse_expression(parser, 0);
 }
 
 int parse_expression(Parser *parser, int precedence)
@@ -90,13 +129,14 @@ int parse_expression(Parser *parser, int precedence)
 
         int token_precedence = get_token_precedence(token.type);
 
-        if (token_precedence <= precedence || current_parser->is_eol)
+        if (token_precedence <= precedence || parser->is_eol)
         {
             break;
         }
 
-        advance_parser(current_parser);
-        int right = parse_expression(parser, token_precedence);
+        advance_parser(parser);
+        // ** is right associative, everything else groups to the left
+        int right = parse_expression(parser, token.type == T_POWER ? token_precedence - 1 : token_precedence);
 
         int node = add_ast_node(parser, cast_binary_node(token.type, left, right));
 
@@ -109,10 +149,17 @@ int parse_expression(Parser *parser, int precedence)
 int parse_unary_expression(Parser *parser)
 {
     Token token = get_parser_token(parser);
-    if (peek_parser_token_type(parser, T_PLUS, 0) || peek_parser_token_type(parser, T_MINUS, 0))
+    if (token.type == T_PLUS || token.type == T_MINUS || token.type == T_NOT || token.type == T_BNOT)
+    {
+        advance_parser(parser);
+        int operand = parse_unary_expression(parser);
+        return add_ast_node(parser, cast_unary_node(token.type, operand));
+    }
+    if (token.type == T_INCREMENT || token.type == T_DECREMENT)
     {
-        int operand = primary(parser);
-        return operand;
+        advance_parser(parser);
+        Token name = consume_parser_token(parser, T_IDENTIFIER);
+        return add_ast_node(parser, cast_update_node(name.value, token.type, true));
     }
 
     return primary(parser);
@@ -128,14 +175,29 @@ Parser *init_parser(Lexer *lexer)
     parser->current_token_index = 0;
     parser->is_eol = false;
     parser->error_found = false;
+    parser->recover = NULL;
+    parser->open_lists = NULL;
+    parser->error[0] = '\0';
 
     parser->ast_size = PARSER_INCREMENT;
     parser->ast_count = 0;
 
+    parser->ast_list_size = PARSER_INCREMENT;
+    parser->ast_list_count = 0;
+    parser->ast_lists = malloc(parser->ast_list_size * sizeof(int));
+
     parser->symbol_table = init_hashmap();
 
     parser->declarations = init_hashmap();
 
+    parser->symbol_size = PARSER_INCREMENT;
+    parser->symbol_count = 0;
+    parser->symbols = malloc(parser->symbol_size * sizeof(parser_declaration *));
+
+    parser->types = NULL;
+    parser->entry_function = -1;
+    parser->program = -1;
+
     parser->ast_nodes = malloc(parser->ast_size * sizeof(ASTNode));
     if (!parser->ast_nodes)
     {
@@ -156,8 +218,19 @@ void free_parser(Parser *parser, bool free_tokens)
         }
         free(parser->tokens);
     }
-    free_hashmap(parser->symbol_table, free);
-    free_hashmap(parser->declarations, free);
+    // both maps only borrow declarations owned by parser->symbols
+    free_hashmap(parser->symbol_table, NULL);
+    free_hashmap(parser->declarations, NULL);
+    for (int i = 0; i < parser->symbol_count; i++)
+    {
+        free_declaration(parser->symbols[i]);
+    }
+    free(parser->symbols);
+    if (parser->types)
+    {
+        free_type_table(parser->types);
+    }
+    free(parser->ast_lists);
     free(parser->ast_nodes);
     free(parser);
 }
@@ -195,9 +268,7 @@ Token consume_parser_token(Parser *parser, TokenType expected_type)
     }
     else
     {
-        // TODO: make proper error handling
-        wprintf(L"Expected %s but got %s\n", token_to_string(expected_type), token_to_string(current_token.type));
-        exit(1);
+        syntax_error(parser, L"Expected %s but got %s", token_to_string(expected_type), token_to_string(current_token.type));
         // char *line = lexer_get_line(parser->lexer);
         // char *wrapped_line = wrap_text_part(line, current_token.column - 1, current_token.column + strlen(current_token.value) - 2, "\033[1;4;31m", "\033[0m");
         // printf("%s:%d:%d ERROR: unknown token: \033[1;35m`%c`\033[0m\n\033[1m%d\033[0m | %s\n",
@@ -214,15 +285,32 @@ int get_token_precedence(TokenType type)
 {
     switch (type)
     {
+    case T_OR:
+        return 1;
+    case T_AND:
+        return 2;
+    case T_BOR:
+        return 3;
+    case T_BAND:
+        return 4;
+    case T_EQUAL:
+    case T_NOT_EQUAL:
+        return 5;
+    case T_LESS:
+    case T_LESS_EQUAL:
+    case T_GREATER:
+    case T_GREATER_EQUAL:
+        return 6;
     case T_PLUS:
     case T_MINUS:
-        return 1;
+        return 7;
     case T_MULTIPLY:
     case T_DIVIDE:
-        return 2;
+        return 8;
+    case T_POWER:
+        return 9;
     default:
-        wprintf(L"Unknown token type in get_token_precedence: %s\n", token_to_string(type));
-        exit(1);
+        // not a binary operator, ends the expression
         return 0;
     }
 }
@@ -235,8 +323,109 @@ int add_ast_node(Parser *parser, ASTNode node)
     }
 
     int index = parser->ast_count;
+    node.type_id = -1;
     parser->ast_nodes[index] = node;
     parser->ast_count++;
 
     return index;
 }
+
+int add_ast_list(Parser *parser, const int *items, int count)
+{
+    if (parser->ast_list_count + count >= parser->ast_list_size)
+    {
+        while (parser->ast_list_count + count >= parser->ast_list_size)
+            parser->ast_list_size += PARSER_INCREMENT;
+        parser->ast_lists = realloc(parser->ast_lists, parser->ast_list_size * sizeof(int));
+        if (!parser->ast_lists)
+        {
+            wprintf(L"Memory allocation failed while resizing AST lists.\n");
+            exit(1);
+        }
+    }
+
+    int first = parser->ast_list_count;
+    for (int i = 0; i < count; i++)
+    {
+        parser->ast_lists[first + i] = items[i];
+    }
+    parser->ast_list_count += count;
+
+    return first;
+}
+
+void open_node_list(Parser *parser, NodeList *list)
+{
+    *list = (NodeList){NULL, 0, 0, parser->open_lists};
+    parser->open_lists = list;
+}
+
+void node_list_push(NodeList *list, int item)
+{
+    if (list->count >= list->size)
+    {
+        list->size = list->size ? list->size * 2 : 8;
+        list->items = realloc(list->items, list->size * sizeof(int));
+    }
+    list->items[list->count++] = item;
+}
+
+// Moves the items to parser->ast_lists and returns the first, lists are
+// closed in the reverse order they were opened
+int close_node_list(Parser *parser, NodeList *list)
+{
+    int first = add_ast_list(parser, list->items, list->count);
+    parser->open_lists = list->outer;
+    free(list->items);
+    list->items = NULL;
+    return first;
+}
+
+static void report_error_args(Parser *parser, const wchar_t *format, va_list args)
+{
+    wchar_t message[PARSER_ERROR_SIZE];
+    if (vswprintf(message, PARSER_ERROR_SIZE, format, args) < 0)
+        message[PARSER_ERROR_SIZE - 1] = L'\0';
+    wprintf(L"%ls\n", message);
+    parser->error_found = true;
+    if (parser->error[0] != '\0')
+        return;
+    int length = 0;
+    for (; message[length] != L'\0'; length++)
+    {
+        parser->error[length] = message[length] < 128 ? (char)message[length] : '?';
+    }
+    parser->error[length] = '\0';
+}
+
+// Prints an error of the program on its own line and keeps the first one in
+// parser->error, the message has no trailing newline
+void report_error(Parser *parser, const wchar_t *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    report_error_args(parser, format, args);
+    va_end(args);
+}
+
+// Reports an error the parser cannot continue after and stops parsing
+void syntax_error(Parser *parser, const wchar_t *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    report_error_args(parser, format, args);
+    va_end(args);
+    if (parser->recover == NULL)
+        exit(1);
+    for (NodeList *list = parser->open_lists; list; list = list->outer)
+    {
+        free(list->items);
+    }
+    parser->open_lists = NULL;
+    longjmp(*parser->recover, 1);
+}
+
+void free_declaration(parser_declaration *declaration)
+{
+    free(declaration);
+}
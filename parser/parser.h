@@ -1,5 +1,9 @@
+#include <setjmp.h>
+#include <wchar.h>
 #include "../src_lexer/lexer.h"
 #include "../hashmap/hashmap.h"
+#include "../buffer/buffer.h"
+#include "../defc/defc.h"
 
 #ifndef PARSER_H
 #define PARSER_H
@@ -34,8 +38,27 @@ typedef enum
     N_LITERAL,
     N_VARIABLE_DECLARATION,
     N_ASSIGNMENT,
+    N_IDENTIFIER,
+    N_CALL,
+    N_CAST,
+    N_RETURN,
+    N_BLOCK,
+    N_PARAMETER,
+    N_FUNCTION_PROTOTYPE,
+    N_FUNCTION_DECLARATION,
+    N_PROGRAM,
+    N_UPDATE,
+    N_IF,
+    N_WHILE,
+    N_FOR,
 } NodeType;
 
+typedef enum
+{
+    AST_DUMP_TREE,
+    AST_DUMP_COMPACT
+} ASTDumpFormat;
+
 typedef struct
 {
     char *value;
@@ -43,6 +66,8 @@ typedef struct
     LiteralSign literal_sign;
 } parser_literal;
 
+// Symbols are created by the semantic pass and never freed before the parser,
+// AST nodes refer to them by index into parser->symbols.
 typedef struct
 {
     DeclarationType type;
@@ -50,11 +75,27 @@ typedef struct
     {
         parser_literal literal;
     };
+    int index;
+    int node;
+    int type_id;
+
+    // variables: owning function symbol and slot inside its frame
+    int function;
+    int slot;
+
+    // functions: defining N_FUNCTION_DECLARATION (-1 for prototypes) and frame size
+    int definition;
+    int local_count;
+
+    // extern functions: address resolve_extern_functions found, NULL before
+    bool is_extern;
+    void *address;
 } parser_declaration;
 
 typedef struct
 {
     NodeType type;
+    int type_id;
 
     union
     {
@@ -78,6 +119,7 @@ typedef struct
         {
             char *name;
             int expression;
+            int declaration;
         } assignment;
 
         struct
@@ -85,10 +127,109 @@ typedef struct
             char *name;
             parser_literal literal;
             int expression;
+            int declaration;
         } variable_declaration;
+
+        struct
+        {
+            char *name;
+            int declaration;
+        } identifier;
+
+        struct
+        {
+            char *name;
+            int first_argument;
+            int argument_count;
+            int declaration;
+            int intrinsic; // Intrinsic of a builtin call, -1 for declared functions
+        } call;
+
+        struct
+        {
+            int expression;
+        } cast;
+
+        struct
+        {
+            int expression;
+        } return_statement;
+
+        // also used by N_PROGRAM, scope_start is the first node of the subtree
+        struct
+        {
+            int first_statement;
+            int statement_count;
+            int scope_start;
+        } block;
+
+        struct
+        {
+            char *name;
+            parser_literal literal;
+        } parameter;
+
+        struct
+        {
+            char *name;
+            parser_literal return_literal;
+            int first_parameter;
+            int parameter_count;
+            bool has_body;
+            bool is_extern; // a C function, see ffi/ffi.c
+            int declaration;
+        } function_prototype;
+
+        struct
+        {
+            int prototype;
+            int body;
+        } function_declaration;
+
+        // ++x, x++, --x, x--
+        struct
+        {
+            char *name;
+            TokenType operator;
+            bool prefix;
+            int declaration;
+        } update;
+
+        struct
+        {
+            int condition;
+            int then_branch;
+            int else_branch;
+        } if_statement;
+
+        struct
+        {
+            int condition;
+            int body;
+        } while_statement;
+
+        // absent parts are -1
+        struct
+        {
+            int init;
+            int condition;
+            int update;
+            int body;
+            int scope_start;
+        } for_statement;
     } data;
 } ASTNode;
 
+// growable list used while collecting children before add_ast_list, open
+// lists are chained from parser->open_lists
+typedef struct NodeList
+{
+    int *items;
+    int count;
+    int size;
+    struct NodeList *outer;
+} NodeList;
+
 typedef struct
 {
     Lexer *lexer;
@@ -103,15 +244,46 @@ typedef struct
     int ast_size;
     int ast_count;
 
+    // child lists of blocks, calls and prototypes, indexed by first/count pairs
+    int *ast_lists;
+    int ast_list_size;
+    int ast_list_count;
+
     HashMap *symbol_table;
     HashMap *declarations;
 
+    parser_declaration **symbols;
+    int symbol_size;
+    int symbol_count;
+
+    struct TypeTable *types;
+    int entry_function;
+    int program;
+
+    // a syntax error jumps here when it is set and exits otherwise, the
+    // lists being collected are freed first
+    jmp_buf *recover;
+    NodeList *open_lists;
+    char error[PARSER_ERROR_SIZE]; // first error reported, empty when none
 } Parser;
 
+
 // parse structures
 int primary(Parser *parser);
 int parse_expression(Parser *parser, int precedence);
 int parse_unary_expression(Parser *parser);
+int parse_assignment_expression(Parser *parser);
+int parse_call(Parser *parser);
+parser_literal parse_var_type(Parser *parser);
+int parse_declaration(Parser *parser);
+int parse_statement(Parser *parser);
+int parse_block(Parser *parser);
+int parse_function(Parser *parser);
+int parse_extern(Parser *parser);
+int parse_if(Parser *parser);
+int parse_while(Parser *parser);
+int parse_for(Parser *parser);
+int parse_program(Parser *parser);
 
 // parser struct
 Parser *init_parser(Lexer *lexer);
@@ -126,16 +298,38 @@ int match_parser_token_type(Parser *parser, TokenType expected_type, int offset)
 Token peek_parser_token(Parser *parser, int offset);
 int peek_parser_token_type(Parser *parser, TokenType expected_type, int offset);
 void resize_ast_array(Parser *parser);
+int add_ast_list(Parser *parser, const int *items, int count);
+void open_node_list(Parser *parser, NodeList *list);
+void node_list_push(NodeList *list, int item);
+int close_node_list(Parser *parser, NodeList *list);
+void report_error(Parser *parser, const wchar_t *format, ...);
+_Noreturn void syntax_error(Parser *parser, const wchar_t *format, ...);
+bool is_type_token(TokenType type);
 
 // casting
 ASTNode cast_binary_node(TokenType type, int left, int right);
 ASTNode cast_unary_node(TokenType type, int expression);
 ASTNode cast_literal_node(LiteralType type, void *value);
 ASTNode cast_assignment_node(char *name, int expression);
+ASTNode cast_declaration_node(char *name, parser_literal var_type, int expression);
+ASTNode cast_identifier_node(char *name);
+ASTNode cast_call_node(char *name, int first_argument, int argument_count);
+ASTNode cast_conversion_node(int expression);
+ASTNode cast_return_node(int expression);
+ASTNode cast_block_node(NodeType type, int first_statement, int statement_count, int scope_start);
+ASTNode cast_parameter_node(char *name, parser_literal literal);
+ASTNode cast_prototype_node(char *name, parser_literal return_literal, int first_parameter, int parameter_count, bool has_body);
+ASTNode cast_function_node(int prototype, int body);
+ASTNode cast_update_node(char *name, TokenType type, bool prefix);
+ASTNode cast_if_node(int condition, int then_branch, int else_branch);
+ASTNode cast_while_node(int condition, int body);
+ASTNode cast_for_node(int init, int condition, int update, int body, int scope_start);
 
 // utils
-void print_ast_indent(int indent_level);
+void dump_ast(Parser *parser, int node_index, int indent_level, ASTDumpFormat format, OutputBuffer *buffer);
+void print_ast(Parser *parser, int node_index, ASTDumpFormat format);
 void print_ast_node(Parser *parser, int node_index, int indent_level);
+const char *operator_to_string(TokenType type);
 char *node_type_to_string(NodeType type);
 
 #endif
\ No newline at end of file
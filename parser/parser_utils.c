@@ -1,103 +1,336 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <unistd.h>
 #include <wchar.h>
 #include "parser.h"
+#include "visitor.h"
 #include "../src_lexer/lexer.h"
+#include "../buffer/buffer.h"
+#include "../semantic/types.h"
+#include "../defc/defc.h"
 
-void print_ast_indent(int indent_level)
+typedef struct
 {
-    for (int i = 0; i < indent_level; i++)
+    OutputBuffer *buffer;
+    int base_indent;
+} ASTDumpContext;
+
+const char *operator_to_string(TokenType type)
+{
+    switch (type)
     {
-        wprintf(L"\t");
+    case T_PLUS:
+        return "+";
+    case T_MINUS:
+        return "-";
+    case T_MULTIPLY:
+        return "*";
+    case T_DIVIDE:
+        return "/";
+    case T_POWER:
+        return "**";
+    case T_EQUAL:
+        return "==";
+    case T_NOT_EQUAL:
+        return "!=";
+    case T_LESS:
+        return "<";
+    case T_LESS_EQUAL:
+        return "<=";
+    case T_GREATER:
+        return ">";
+    case T_GREATER_EQUAL:
+        return ">=";
+    case T_AND:
+        return "&&";
+    case T_OR:
+        return "||";
+    case T_NOT:
+        return "!";
+    case T_BAND:
+        return "&";
+    case T_BOR:
+        return "|";
+    case T_BNOT:
+        return "~";
+    case T_INCREMENT:
+        return "++";
+    case T_DECREMENT:
+        return "--";
+    default:
+        return NULL;
     }
 }
 
-void print_ast_node(Parser *parser, int node_index, int indent_level)
+static const char *literal_type_to_string(LiteralType type)
 {
-    if (node_index >= parser->ast_count)
-        return;
+    switch (type)
+    {
+    case LITERAL_INT:
+        return "int";
+    case LITERAL_FLOAT:
+        return "float";
+    case LITERAL_LONG:
+        return "long";
+    default:
+        return "unknown";
+    }
+}
 
-    ASTNode node = parser->ast_nodes[node_index];
-    print_ast_indent(indent_level);
+static VisitAction dump_tree_node(Parser *parser, const ASTVisit *visit, void *context)
+{
+    ASTDumpContext *dump = context;
+    OutputBuffer *buffer = dump->buffer;
+    ASTNode *node = &parser->ast_nodes[visit->node];
+    int indent = dump->base_indent + visit->depth;
 
-    switch (node.type)
+    if (visit->parent >= 0 && parser->ast_nodes[visit->parent].type == N_BINARY_EXPRESSION)
     {
-    case N_VARIABLE_DECLARATION:
-    {
-        wprintf(L"Variable Declaration: ");
-        wprintf(L"Var: %s\n", node.data.variable_declaration.name);
-        print_ast_node(parser, node.data.variable_declaration.expression, indent_level + 1);
+        buffer_append_repeat(buffer, '\t', indent - 1);
+        buffer_append_str(buffer, visit->child_position == 0 ? "Left operand:\n" : "Right operand:\n");
     }
-    break;
-    case N_ASSIGNMENT:
+
+    buffer_append_repeat(buffer, '\t', indent);
+
+    switch (node->type)
     {
-        wprintf(L"Assignment: ");
-        wprintf(L"Var: %s\n", node.data.assignment.name);
-        print_ast_node(parser, node.data.assignment.expression, indent_level + 1);
-    }
-    break;
+    case N_VARIABLE_DECLARATION:
+        buffer_append_str(buffer, "Variable Declaration: Var: ");
+        buffer_append_str(buffer, node->data.variable_declaration.name);
+        buffer_append_char(buffer, '\n');
+        break;
+    case N_ASSIGNMENT:
+        buffer_append_str(buffer, "Assignment: Var: ");
+        buffer_append_str(buffer, node->data.assignment.name);
+        buffer_append_char(buffer, '\n');
+        break;
     case N_LITERAL:
-    {
-        wprintf(L"Literal: ");
-        if (node.data.literal.literal_type == LITERAL_FLOAT)
-            wprintf(L"Float: %s\n", node.data.literal.value);
-        else if (node.data.literal.literal_type == LITERAL_INT)
-            wprintf(L"Int: %s\n", node.data.literal.value);
+        if (node->data.literal.literal_type == LITERAL_FLOAT)
+            buffer_append_str(buffer, "Literal: Float: ");
+        else if (node->data.literal.literal_type == LITERAL_INT)
+            buffer_append_str(buffer, "Literal: Int: ");
         else
-            wprintf(L"Unknown Literal Type\n");
-    }
-    break;
-    case N_UNARY_EXPRESSION:
-    {
-        wprintf(L"Unary: ");
-        switch (node.data.unary.operator)
         {
-        case T_PLUS:
-            wprintf(L"+\n");
-            break;
-        case T_MINUS:
-            wprintf(L"-\n");
+            buffer_append_str(buffer, "Literal: Unknown Literal Type\n");
             break;
-        default:
-            wprintf(L"Unknown Unary Operator\n");
         }
-        print_ast_node(parser, node.data.unary.expression, indent_level + 1);
+        buffer_append_str(buffer, node->data.literal.value);
+        buffer_append_char(buffer, '\n');
+        break;
+    case N_UNARY_EXPRESSION:
+    {
+        const char *symbol = operator_to_string(node->data.unary.operator);
+        buffer_append_str(buffer, "Unary: ");
+        buffer_append_str(buffer, symbol ? symbol : "Unknown Unary Operator");
+        buffer_append_char(buffer, '\n');
     }
     break;
-
     case N_BINARY_EXPRESSION:
     {
-        wprintf(L"Binary: ");
-        switch (node.data.binary.operator)
-        {
-        case T_PLUS:
-            wprintf(L"+\n");
-            break;
-        case T_MINUS:
-            wprintf(L"-\n");
-            break;
-        case T_MULTIPLY:
-            wprintf(L"*\n");
-            break;
-        case T_DIVIDE:
-            wprintf(L"/\n");
-            break;
-        default:
-            wprintf(L"Unknown Binary Operator\n");
-        }
-        print_ast_indent(indent_level);
-        wprintf(L"Left operand:\n");
-        print_ast_node(parser, node.data.binary.left, indent_level + 1);
-
-        print_ast_indent(indent_level);
-        wprintf(L"Right operand:\n");
-        print_ast_node(parser, node.data.binary.right, indent_level + 1);
+        const char *symbol = operator_to_string(node->data.binary.operator);
+        buffer_append_str(buffer, "Binary: ");
+        buffer_append_str(buffer, symbol ? symbol : "Unknown Binary Operator");
+        buffer_append_char(buffer, '\n');
     }
     break;
+    case N_IDENTIFIER:
+        buffer_append_str(buffer, "Identifier: ");
+        buffer_append_str(buffer, node->data.identifier.name);
+        buffer_append_char(buffer, '\n');
+        break;
+    case N_CALL:
+        buffer_append_str(buffer, "Call: ");
+        buffer_append_str(buffer, node->data.call.name);
+        buffer_append_char(buffer, '\n');
+        break;
+    case N_CAST:
+        buffer_append_str(buffer, "Cast: ");
+        append_type_name(parser->types, node->type_id, buffer);
+        buffer_append_char(buffer, '\n');
+        break;
+    case N_RETURN:
+        buffer_append_str(buffer, "Return\n");
+        break;
+    case N_BLOCK:
+        buffer_append_str(buffer, "Block\n");
+        break;
+    case N_PROGRAM:
+        buffer_append_str(buffer, "Program\n");
+        break;
+    case N_PARAMETER:
+        buffer_append_str(buffer, "Parameter: ");
+        buffer_append_str(buffer, literal_type_to_string(node->data.parameter.literal.literal_type));
+        buffer_append_char(buffer, ' ');
+        buffer_append_str(buffer, node->data.parameter.name);
+        buffer_append_char(buffer, '\n');
+        break;
+    case N_FUNCTION_PROTOTYPE:
+        buffer_append_str(buffer, node->data.function_prototype.is_extern ? "Extern Function Prototype: " : "Function Prototype: ");
+        buffer_append_str(buffer, literal_type_to_string(node->data.function_prototype.return_literal.literal_type));
+        buffer_append_char(buffer, ' ');
+        buffer_append_str(buffer, node->data.function_prototype.name);
+        buffer_append_char(buffer, '\n');
+        break;
+    case N_FUNCTION_DECLARATION:
+        buffer_append_str(buffer, "Function Declaration\n");
+        break;
+    case N_UPDATE:
+        buffer_append_str(buffer, "Update: ");
+        if (node->data.update.prefix)
+            buffer_append_str(buffer, operator_to_string(node->data.update.operator));
+        buffer_append_str(buffer, node->data.update.name);
+        if (!node->data.update.prefix)
+            buffer_append_str(buffer, operator_to_string(node->data.update.operator));
+        buffer_append_char(buffer, '\n');
+        break;
+    case N_IF:
+        buffer_append_str(buffer, "If\n");
+        break;
+    case N_WHILE:
+        buffer_append_str(buffer, "While\n");
+        break;
+    case N_FOR:
+        buffer_append_str(buffer, "For\n");
+        break;
+    default:
+        buffer_append_str(buffer, "Unknown node type in dump_ast: ");
+        buffer_append_str(buffer, node_type_to_string(node->type));
+        buffer_append_char(buffer, '\n');
+    }
+
+    return VISIT_CONTINUE;
+}
+
+// One line per node in pre-order: "<index> <kind> [attributes] [child indices]"
+static VisitAction dump_compact_node(Parser *parser, const ASTVisit *visit, void *context)
+{
+    ASTDumpContext *dump = context;
+    OutputBuffer *buffer = dump->buffer;
+    ASTNode *node = &parser->ast_nodes[visit->node];
+    const char *symbol;
+
+    buffer_append_int(buffer, visit->node);
 
+    switch (node->type)
+    {
+    case N_VARIABLE_DECLARATION:
+        buffer_append_str(buffer, " decl ");
+        buffer_append_str(buffer, node->data.variable_declaration.name);
+        buffer_append_char(buffer, ' ');
+        buffer_append_str(buffer, literal_type_to_string(node->data.variable_declaration.literal.literal_type));
+        break;
+    case N_ASSIGNMENT:
+        buffer_append_str(buffer, " assign ");
+        buffer_append_str(buffer, node->data.assignment.name);
+        break;
+    case N_LITERAL:
+        buffer_append_str(buffer, " lit ");
+        buffer_append_str(buffer, literal_type_to_string(node->data.literal.literal_type));
+        buffer_append_char(buffer, ' ');
+        buffer_append_str(buffer, node->data.literal.value);
+        break;
+    case N_UNARY_EXPRESSION:
+        symbol = operator_to_string(node->data.unary.operator);
+        buffer_append_str(buffer, " unary ");
+        buffer_append_str(buffer, symbol ? symbol : "?");
+        break;
+    case N_BINARY_EXPRESSION:
+        symbol = operator_to_string(node->data.binary.operator);
+        buffer_append_str(buffer, " binary ");
+        buffer_append_str(buffer, symbol ? symbol : "?");
+        break;
+    case N_IDENTIFIER:
+        buffer_append_str(buffer, " ident ");
+        buffer_append_str(buffer, node->data.identifier.name);
+        break;
+    case N_CALL:
+        buffer_append_str(buffer, " call ");
+        buffer_append_str(buffer, node->data.call.name);
+        break;
+    case N_CAST:
+        buffer_append_str(buffer, " cast ");
+        append_type_name(parser->types, node->type_id, buffer);
+        break;
+    case N_RETURN:
+        buffer_append_str(buffer, " return");
+        break;
+    case N_BLOCK:
+        buffer_append_str(buffer, " block");
+        break;
+    case N_PROGRAM:
+        buffer_append_str(buffer, " program");
+        break;
+    case N_PARAMETER:
+        buffer_append_str(buffer, " param ");
+        buffer_append_str(buffer, node->data.parameter.name);
+        buffer_append_char(buffer, ' ');
+        buffer_append_str(buffer, literal_type_to_string(node->data.parameter.literal.literal_type));
+        break;
+    case N_FUNCTION_PROTOTYPE:
+        buffer_append_str(buffer, node->data.function_prototype.is_extern ? " extern prototype " : " prototype ");
+        buffer_append_str(buffer, node->data.function_prototype.name);
+        buffer_append_char(buffer, ' ');
+        buffer_append_str(buffer, literal_type_to_string(node->data.function_prototype.return_literal.literal_type));
+        break;
+    case N_FUNCTION_DECLARATION:
+        buffer_append_str(buffer, " function");
+        break;
+    case N_UPDATE:
+        buffer_append_str(buffer, node->data.update.prefix ? " update pre " : " update post ");
+        buffer_append_str(buffer, operator_to_string(node->data.update.operator));
+        buffer_append_char(buffer, ' ');
+        buffer_append_str(buffer, node->data.update.name);
+        break;
+    case N_IF:
+        buffer_append_str(buffer, " if");
+        break;
+    case N_WHILE:
+        buffer_append_str(buffer, " while");
+        break;
+    case N_FOR:
+        buffer_append_str(buffer, " for");
+        break;
     default:
-        wprintf(L"Unknown node type in print_ast_node: %s\n", node_type_to_string(node.type));
+        buffer_append_str(buffer, " unknown");
+    }
+
+    for (int i = 0, child; (child = ast_node_child(parser, visit->node, i)) >= 0; i++)
+    {
+        buffer_append_char(buffer, ' ');
+        buffer_append_int(buffer, child);
     }
+    buffer_append_char(buffer, '\n');
+
+    return VISIT_CONTINUE;
+}
+
+void dump_ast(Parser *parser, int node_index, int indent_level, ASTDumpFormat format, OutputBuffer *buffer)
+{
+    ASTDumpContext context = {buffer, indent_level};
+    ASTVisitor visitor = {NULL, NULL, &context};
+    visitor.pre = format == AST_DUMP_COMPACT ? dump_compact_node : dump_tree_node;
+    visit_ast(parser, node_index, &visitor);
+}
+
+static void write_ast(Parser *parser, int node_index, int indent_level, ASTDumpFormat format)
+{
+    OutputBuffer *buffer = init_buffer(OUTPUT_BUFFER_SIZE);
+    dump_ast(parser, node_index, indent_level, format, buffer);
+
+    // stdout may still hold text written through wprintf, keep the order
+    fflush(stdout);
+    flush_buffer(buffer, STDOUT_FILENO);
+    free_buffer(buffer);
+}
+
+void print_ast(Parser *parser, int node_index, ASTDumpFormat format)
+{
+    write_ast(parser, node_index, 0, format);
+}
+
+void print_ast_node(Parser *parser, int node_index, int indent_level)
+{
+    write_ast(parser, node_index, indent_level, AST_DUMP_TREE);
 }
 
 char *node_type_to_string(NodeType type)
@@ -114,7 +347,33 @@ char *node_type_to_string(NodeType type)
         return "Unary";
     case N_BINARY_EXPRESSION:
         return "Binary";
+    case N_IDENTIFIER:
+        return "Identifier";
+    case N_CALL:
+        return "Call";
+    case N_CAST:
+        return "Cast";
+    case N_RETURN:
+        return "Return";
+    case N_BLOCK:
+        return "Block";
+    case N_PARAMETER:
+        return "Parameter";
+    case N_FUNCTION_PROTOTYPE:
+        return "Function Prototype";
+    case N_FUNCTION_DECLARATION:
+        return "Function Declaration";
+    case N_PROGRAM:
+        return "Program";
+    case N_UPDATE:
+        return "Update";
+    case N_IF:
+        return "If";
+    case N_WHILE:
+        return "While";
+    case N_FOR:
+        return "For";
     default:
         return "Unknown Node Type in node_type_to_string";
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,255 @@
+#include "parser.h"
+#include "../src_lexer/lexer.h"
+#include "../defc/defc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wchar.h>
+
+bool is_type_token(TokenType type)
+{
+    return type == T_INT || type == T_FLOAT || type == T_LONG;
+}
+
+parser_literal parse_var_type(Parser *parser)
+{
+    // TODO: add more complex types like long, unsigned
+    Token token = get_parser_token(parser);
+    parser_literal type = {NULL, LITERAL_INT, LITERAL_SIGNED};
+
+    switch (token.type)
+    {
+    case T_INT:
+        type.literal_type = LITERAL_INT;
+        break;
+    case T_FLOAT:
+        type.literal_type = LITERAL_FLOAT;
+        break;
+    // int everywhere but in the return type of extern functions, see ffi/ffi.c
+    case T_LONG:
+        type.literal_type = LITERAL_LONG;
+        break;
+    default:
+        syntax_error(parser, L"Unknown token type in parse_var_type: %s", token_to_string(token.type));
+    }
+
+    advance_parser(parser);
+    return type;
+}
+
+int parse_declaration(Parser *parser)
+{
+    parser_literal var_type = parse_var_type(parser);
+    int decl_node;
+
+    while (true)
+    {
+        Token token = consume_parser_token(parser, T_IDENTIFIER);
+        var_type.value = token.value;
+
+        int value = -1;
+        if (peek_parser_token_type(parser, T_ASSIGN, 0))
+        {
+            consume_parser_token(parser, T_ASSIGN);
+            value = parse_assignment_expression(parser);
+        }
+
+        decl_node = add_ast_node(parser, cast_declaration_node(token.value, var_type, value));
+
+        // TODO: remake declarations parcing so it could handle chain of declarations "int x = 5, y = 10, z = 15;"
+        break;
+        // if(!peek_parser_token_type(parser, T_COMMA, 0)){
+        //     break;
+        // }
+        // advance_parser(parser);
+    }
+
+    consume_parser_token(parser, T_SEMICOLON);
+    return decl_node;
+}
+
+int parse_statement(Parser *parser)
+{
+    Token token = get_parser_token(parser);
+
+    if (is_type_token(token.type))
+        return parse_declaration(parser);
+
+    switch (token.type)
+    {
+    case T_LBRACE:
+        return parse_block(parser);
+    case T_IF:
+        return parse_if(parser);
+    case T_WHILE:
+        return parse_while(parser);
+    case T_FOR:
+        return parse_for(parser);
+    case T_RETURN:
+    {
+        advance_parser(parser);
+        int expression = -1;
+        if (!peek_parser_token_type(parser, T_SEMICOLON, 0))
+            expression = parse_assignment_expression(parser);
+        consume_parser_token(parser, T_SEMICOLON);
+        return add_ast_node(parser, cast_return_node(expression));
+    }
+    default:
+    {
+        int expression = parse_assignment_expression(parser);
+        consume_parser_token(parser, T_SEMICOLON);
+        return expression;
+    }
+    }
+}
+
+int parse_if(Parser *parser)
+{
+    consume_parser_token(parser, T_IF);
+    consume_parser_token(parser, T_LPAREN);
+    int condition = parse_assignment_expression(parser);
+    consume_parser_token(parser, T_RPAREN);
+
+    int then_branch = parse_statement(parser);
+    int else_branch = -1;
+    if (peek_parser_token_type(parser, T_ELSE, 0))
+    {
+        advance_parser(parser);
+        else_branch = parse_statement(parser);
+    }
+
+    return add_ast_node(parser, cast_if_node(condition, then_branch, else_branch));
+}
+
+int parse_while(Parser *parser)
+{
+    consume_parser_token(parser, T_WHILE);
+    consume_parser_token(parser, T_LPAREN);
+    int condition = parse_assignment_expression(parser);
+    consume_parser_token(parser, T_RPAREN);
+
+    int body = parse_statement(parser);
+    return add_ast_node(parser, cast_while_node(condition, body));
+}
+
+// A variable declared in the init part is scoped to the loop
+int parse_for(Parser *parser)
+{
+    consume_parser_token(parser, T_FOR);
+    consume_parser_token(parser, T_LPAREN);
+    int scope_start = parser->ast_count;
+
+    int init = -1;
+    if (is_type_token(get_parser_token(parser).type))
+        init = parse_declaration(parser);
+    else
+    {
+        if (!peek_parser_token_type(parser, T_SEMICOLON, 0))
+            init = parse_assignment_expression(parser);
+        consume_parser_token(parser, T_SEMICOLON);
+    }
+
+    int condition = -1;
+    if (!peek_parser_token_type(parser, T_SEMICOLON, 0))
+        condition = parse_assignment_expression(parser);
+    consume_parser_token(parser, T_SEMICOLON);
+
+    int update = -1;
+    if (!peek_parser_token_type(parser, T_RPAREN, 0))
+        update = parse_assignment_expression(parser);
+    consume_parser_token(parser, T_RPAREN);
+
+    int body = parse_statement(parser);
+    return add_ast_node(parser, cast_for_node(init, condition, update, body, scope_start));
+}
+
+// Statements are collected first and stored contiguously in parser->ast_lists,
+// every node added while parsing the block belongs to its scope
+int parse_block(Parser *parser)
+{
+    consume_parser_token(parser, T_LBRACE);
+    int scope_start = parser->ast_count;
+
+    NodeList statements;
+    open_node_list(parser, &statements);
+    while (!peek_parser_token_type(parser, T_RBRACE, 0))
+    {
+        if (peek_parser_token_type(parser, T_EOF, 0))
+            syntax_error(parser, L"Expected %s but got %s", token_to_string(T_RBRACE), token_to_string(T_EOF));
+        node_list_push(&statements, parse_statement(parser));
+    }
+    consume_parser_token(parser, T_RBRACE);
+
+    int first_statement = close_node_list(parser, &statements);
+    return add_ast_node(parser, cast_block_node(N_BLOCK, first_statement, statements.count, scope_start));
+}
+
+// The prototype node is added before the body so a single forward pass over
+// ast_nodes sees the function (and its parameters) before any use inside it
+int parse_function(Parser *parser)
+{
+    parser_literal return_literal = parse_var_type(parser);
+    Token name = consume_parser_token(parser, T_IDENTIFIER);
+    return_literal.value = name.value;
+    consume_parser_token(parser, T_LPAREN);
+
+    NodeList parameters;
+    open_node_list(parser, &parameters);
+    while (!peek_parser_token_type(parser, T_RPAREN, 0))
+    {
+        parser_literal literal = parse_var_type(parser);
+        Token parameter = consume_parser_token(parser, T_IDENTIFIER);
+        literal.value = parameter.value;
+        node_list_push(&parameters, add_ast_node(parser, cast_parameter_node(parameter.value, literal)));
+
+        if (!peek_parser_token_type(parser, T_COMMA, 0))
+            break;
+        advance_parser(parser);
+    }
+    consume_parser_token(parser, T_RPAREN);
+
+    bool has_body = peek_parser_token_type(parser, T_LBRACE, 0);
+    int first_parameter = close_node_list(parser, &parameters);
+    int prototype = add_ast_node(parser, cast_prototype_node(name.value, return_literal, first_parameter, parameters.count, has_body));
+
+    if (!has_body)
+    {
+        consume_parser_token(parser, T_SEMICOLON);
+        return prototype;
+    }
+
+    int body = parse_block(parser);
+    return add_ast_node(parser, cast_function_node(prototype, body));
+}
+
+// extern <type> <name>(<parameters>); declares a C function, the semantic
+// pass rejects one with a body
+int parse_extern(Parser *parser)
+{
+    consume_parser_token(parser, T_EXTERN);
+    int function = parse_function(parser);
+    ASTNode *node = &parser->ast_nodes[function];
+    int prototype = node->type == N_FUNCTION_DECLARATION ? node->data.function_declaration.prototype : function;
+    parser->ast_nodes[prototype].data.function_prototype.is_extern = true;
+    return function;
+}
+
+int parse_program(Parser *parser)
+{
+    NodeList statements;
+    open_node_list(parser, &statements);
+
+    while (!peek_parser_token_type(parser, T_EOF, 0))
+    {
+        if (peek_parser_token_type(parser, T_EXTERN, 0))
+            node_list_push(&statements, parse_extern(parser));
+        else if (is_type_token(get_parser_token(parser).type) && peek_parser_token_type(parser, T_IDENTIFIER, 1) && peek_parser_token_type(parser, T_LPAREN, 2))
+            node_list_push(&statements, parse_function(parser));
+        else
+            node_list_push(&statements, parse_statement(parser));
+    }
+
+    int first_statement = close_node_list(parser, &statements);
+    parser->program = add_ast_node(parser, cast_block_node(N_PROGRAM, first_statement, statements.count, 0));
+    return parser->program;
+}
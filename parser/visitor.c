@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include "visitor.h"
+#include "../defc/defc.h"
+
+// Children are numbered from 0 in evaluation order. Returns -1 once position
+// is past the last child, which is how visit_ast knows a node is finished.
+int ast_node_child(Parser *parser, int node_index, int position)
+{
+    ASTNode *node = &parser->ast_nodes[node_index];
+
+    switch (node->type)
+    {
+    case N_BINARY_EXPRESSION:
+        if (position == 0)
+            return node->data.binary.left;
+        if (position == 1)
+            return node->data.binary.right;
+        return -1;
+    case N_UNARY_EXPRESSION:
+        return position == 0 ? node->data.unary.expression : -1;
+    case N_ASSIGNMENT:
+        return position == 0 ? node->data.assignment.expression : -1;
+    case N_VARIABLE_DECLARATION:
+        return position == 0 ? node->data.variable_declaration.expression : -1;
+    case N_CAST:
+        return position == 0 ? node->data.cast.expression : -1;
+    case N_RETURN:
+        return position == 0 ? node->data.return_statement.expression : -1;
+    case N_CALL:
+        if (position < node->data.call.argument_count)
+            return parser->ast_lists[node->data.call.first_argument + position];
+        return -1;
+    case N_BLOCK:
+    case N_PROGRAM:
+        if (position < node->data.block.statement_count)
+            return parser->ast_lists[node->data.block.first_statement + position];
+        return -1;
+    case N_FUNCTION_PROTOTYPE:
+        if (position < node->data.function_prototype.parameter_count)
+            return parser->ast_lists[node->data.function_prototype.first_parameter + position];
+        return -1;
+    case N_FUNCTION_DECLARATION:
+        if (position == 0)
+            return node->data.function_declaration.prototype;
+        if (position == 1)
+            return node->data.function_declaration.body;
+        return -1;
+    case N_IF:
+        if (position == 0)
+            return node->data.if_statement.condition;
+        if (position == 1)
+            return node->data.if_statement.then_branch;
+        if (position == 2)
+            return node->data.if_statement.else_branch;
+        return -1;
+    case N_WHILE:
+        if (position == 0)
+            return node->data.while_statement.condition;
+        if (position == 1)
+            return node->data.while_statement.body;
+        return -1;
+    case N_FOR:
+    {
+        // evaluation order, absent parts are skipped
+        int parts[4] = {node->data.for_statement.init, node->data.for_statement.condition, node->data.for_statement.body, node->data.for_statement.update};
+        for (int i = 0; i < 4; i++)
+        {
+            if (parts[i] < 0)
+                continue;
+            if (position-- == 0)
+                return parts[i];
+        }
+        return -1;
+    }
+    case N_LITERAL:
+    case N_UPDATE:
+    case N_IDENTIFIER:
+    case N_PARAMETER:
+    default:
+        return -1;
+    }
+}
+
+int ast_node_child_count(Parser *parser, int node_index)
+{
+    int count = 0;
+    while (ast_node_child(parser, node_index, count) >= 0)
+        count++;
+    return count;
+}
+
+// Walks the subtree rooted at root without recursion. Nodes are never copied,
+// callbacks receive the index and read parser->ast_nodes directly. Returns 1
+// when a callback asked to stop, 0 otherwise.
+int visit_ast(Parser *parser, int root, ASTVisitor *visitor)
+{
+    if (root < 0 || root >= parser->ast_count)
+        return 0;
+
+    int stack_size = AST_VISIT_STACK_INCREMENT;
+    int stack_count = 0;
+    ASTVisitFrame *stack = malloc(stack_size * sizeof(ASTVisitFrame));
+    if (!stack)
+    {
+        wprintf(L"Memory allocation failed while visiting AST.\n");
+        exit(1);
+    }
+
+    int stopped = 0;
+    ASTVisitFrame frame = {root, -1, 0, 0, 0};
+    ASTVisit visit = {root, -1, 0, 0};
+    VisitAction action = visitor->pre ? visitor->pre(parser, &visit, visitor->context) : VISIT_CONTINUE;
+
+    if (action == VISIT_STOP)
+    {
+        free(stack);
+        return 1;
+    }
+    if (action == VISIT_SKIP)
+        frame.next_child = -1;
+    stack[stack_count++] = frame;
+
+    while (stack_count > 0)
+    {
+        ASTVisitFrame *top = &stack[stack_count - 1];
+        int child = top->next_child >= 0 ? ast_node_child(parser, top->node, top->next_child) : -1;
+
+        if (child < 0)
+        {
+            visit.node = top->node;
+            visit.parent = top->parent;
+            visit.child_position = top->child_position;
+            visit.depth = top->depth;
+            stack_count--;
+
+            if (visitor->post && visitor->post(parser, &visit, visitor->context) == VISIT_STOP)
+            {
+                stopped = 1;
+                break;
+            }
+            continue;
+        }
+
+        frame.node = child;
+        frame.parent = top->node;
+        frame.child_position = top->next_child;
+        frame.depth = top->depth + 1;
+        frame.next_child = 0;
+        top->next_child++;
+
+        visit.node = frame.node;
+        visit.parent = frame.parent;
+        visit.child_position = frame.child_position;
+        visit.depth = frame.depth;
+
+        action = visitor->pre ? visitor->pre(parser, &visit, visitor->context) : VISIT_CONTINUE;
+        if (action == VISIT_STOP)
+        {
+            stopped = 1;
+            break;
+        }
+        if (action == VISIT_SKIP)
+            frame.next_child = -1;
+
+        if (stack_count >= stack_size)
+        {
+            stack_size += AST_VISIT_STACK_INCREMENT;
+            stack = realloc(stack, stack_size * sizeof(ASTVisitFrame));
+            if (!stack)
+            {
+                wprintf(L"Memory allocation failed while visiting AST.\n");
+                exit(1);
+            }
+        }
+        stack[stack_count++] = frame;
+    }
+
+    free(stack);
+    return stopped;
+}
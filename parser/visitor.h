@@ -0,0 +1,43 @@
+#include "parser.h"
+
+#ifndef PARSER_VISITOR_H
+#define PARSER_VISITOR_H
+
+typedef enum
+{
+    VISIT_CONTINUE, // descend into the children of the node
+    VISIT_SKIP,     // do not visit children, post callback still runs
+    VISIT_STOP      // abort the whole traversal
+} VisitAction;
+
+typedef struct
+{
+    int node;
+    int parent;
+    int child_position;
+    int depth;
+} ASTVisit;
+
+typedef VisitAction (*ASTVisitCallback)(Parser *parser, const ASTVisit *visit, void *context);
+
+typedef struct
+{
+    ASTVisitCallback pre;
+    ASTVisitCallback post;
+    void *context;
+} ASTVisitor;
+
+typedef struct
+{
+    int node;
+    int parent;
+    int child_position;
+    int depth;
+    int next_child;
+} ASTVisitFrame;
+
+int ast_node_child(Parser *parser, int node_index, int position);
+int ast_node_child_count(Parser *parser, int node_index);
+int visit_ast(Parser *parser, int root, ASTVisitor *visitor);
+
+#endif
@@ -0,0 +1,662 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <wchar.h>
+#include "semantic.h"
+#include "types.h"
+#include "../parser/parser.h"
+#include "../defc/defc.h"
+
+// The parser appends children before their parents and every scope is a
+// contiguous range of nodes, so one forward pass over ast_nodes sees operands
+// before the expressions using them and declarations before their uses.
+// Identifier lookups go through parser->declarations once and the symbol
+// index is cached on the node, later passes never look names up again.
+
+static void semantic_error(SemanticContext *context, const wchar_t *format, ...)
+{
+    wchar_t message[PARSER_ERROR_SIZE];
+    va_list args;
+    va_start(args, format);
+    if (vswprintf(message, PARSER_ERROR_SIZE, format, args) < 0)
+        message[PARSER_ERROR_SIZE - 1] = L'\0';
+    va_end(args);
+    report_error(context->parser, L"%s: semantic error: %ls", context->parser->file_name, message);
+    context->error_count++;
+}
+
+parser_declaration *get_symbol(Parser *parser, int symbol)
+{
+    return parser->symbols[symbol];
+}
+
+int literal_to_type(LiteralType literal_type)
+{
+    switch (literal_type)
+    {
+    case LITERAL_INT:
+    case LITERAL_LONG:
+        return TYPE_INT;
+    case LITERAL_FLOAT:
+        return TYPE_FLOAT;
+    default:
+        return TYPE_ERROR;
+    }
+}
+
+static int add_symbol(Parser *parser, DeclarationType type, parser_literal literal, int node, int type_id)
+{
+    if (parser->symbol_count >= parser->symbol_size)
+    {
+        parser->symbol_size += PARSER_INCREMENT;
+        parser->symbols = realloc(parser->symbols, parser->symbol_size * sizeof(parser_declaration *));
+        if (!parser->symbols)
+        {
+            wprintf(L"Memory allocation failed while resizing symbols.\n");
+            exit(1);
+        }
+    }
+
+    parser_declaration *declaration = malloc(sizeof(parser_declaration));
+    declaration->type = type;
+    declaration->literal = literal;
+    declaration->index = parser->symbol_count;
+    declaration->node = node;
+    declaration->type_id = type_id;
+    declaration->function = -1;
+    declaration->slot = -1;
+    declaration->definition = -1;
+    declaration->local_count = 0;
+    declaration->is_extern = false;
+    declaration->address = NULL;
+
+    parser->symbols[parser->symbol_count] = declaration;
+    return parser->symbol_count++;
+}
+
+static void declare_variable(SemanticContext *context, parser_literal literal, int node)
+{
+    Parser *parser = context->parser;
+
+    int symbol = add_symbol(parser, VARIABLE_DECLARATION, literal, node, literal_to_type(literal.literal_type));
+    parser_declaration *declaration = parser->symbols[symbol];
+    parser_declaration *function = parser->symbols[context->current_function];
+    declaration->function = context->current_function;
+    declaration->slot = function->local_count++;
+
+    if (context->scope_count >= context->scope_size)
+    {
+        context->scope_size += PARSER_INCREMENT;
+        context->scope_symbols = realloc(context->scope_symbols, context->scope_size * sizeof(int));
+    }
+    context->scope_symbols[context->scope_count++] = symbol;
+    hashmap_insert(parser->declarations, literal.value, declaration);
+}
+
+// Drops every variable declared by a node at or after scope_start
+static void pop_scope(SemanticContext *context, int scope_start)
+{
+    Parser *parser = context->parser;
+    while (context->scope_count > 0)
+    {
+        parser_declaration *declaration = parser->symbols[context->scope_symbols[context->scope_count - 1]];
+        if (declaration->node < scope_start)
+            break;
+        hashmap_remove(parser->declarations, declaration->literal.value);
+        context->scope_count--;
+    }
+}
+
+// Converts the value of expression to target, returns the node to use in its place.
+// Literals are retyped in place, everything else gets an explicit N_CAST node.
+static int coerce(SemanticContext *context, int expression, int target)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[expression];
+    int source = node->type_id;
+
+    if (source == target || source == TYPE_ERROR || target == TYPE_ERROR)
+        return expression;
+
+    if (!is_numeric_type(source) || !is_numeric_type(target))
+    {
+        semantic_error(context, L"cannot convert %s to %s", builtin_type_name(source) ? builtin_type_name(source) : "function", builtin_type_name(target) ? builtin_type_name(target) : "function");
+        return expression;
+    }
+
+    if (node->type == N_LITERAL)
+    {
+        node->data.literal.literal_type = target == TYPE_FLOAT ? LITERAL_FLOAT : LITERAL_INT;
+        node->type_id = target;
+        return expression;
+    }
+
+    int cast = add_ast_node(parser, cast_conversion_node(expression));
+    parser->ast_nodes[cast].type_id = target;
+    return cast;
+}
+
+static int node_type(SemanticContext *context, int node)
+{
+    return context->parser->ast_nodes[node].type_id;
+}
+
+static bool is_comparison_operator(TokenType type)
+{
+    return type == T_EQUAL || type == T_NOT_EQUAL || type == T_LESS || type == T_LESS_EQUAL || type == T_GREATER || type == T_GREATER_EQUAL;
+}
+
+static void check_binary(SemanticContext *context, int index)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[index];
+    TokenType operator= node->data.binary.operator;
+    int left_type = node_type(context, node->data.binary.left);
+    int right_type = node_type(context, node->data.binary.right);
+
+    if (left_type == TYPE_ERROR || right_type == TYPE_ERROR)
+    {
+        node->type_id = TYPE_ERROR;
+        return;
+    }
+
+    bool integer_only = operator== T_BAND || operator== T_BOR;
+    if (!is_numeric_type(left_type) || !is_numeric_type(right_type) || (integer_only && (left_type != TYPE_INT || right_type != TYPE_INT)))
+    {
+        semantic_error(context, L"invalid operands to binary %s", operator_to_string(operator));
+        node->type_id = TYPE_ERROR;
+        return;
+    }
+
+    // && and || only test their operands against zero, no conversion needed
+    if (operator== T_AND || operator== T_OR)
+    {
+        node->type_id = TYPE_INT;
+        return;
+    }
+
+    int common = left_type == TYPE_FLOAT || right_type == TYPE_FLOAT ? TYPE_FLOAT : TYPE_INT;
+    int left = coerce(context, node->data.binary.left, common);
+    int right = coerce(context, node->data.binary.right, common);
+
+    node = &parser->ast_nodes[index];
+    node->data.binary.left = left;
+    node->data.binary.right = right;
+    node->type_id = is_comparison_operator(operator) ? TYPE_INT : common;
+}
+
+static void check_unary(SemanticContext *context, int index)
+{
+    ASTNode *node = &context->parser->ast_nodes[index];
+    TokenType operator= node->data.unary.operator;
+    int operand_type = node_type(context, node->data.unary.expression);
+
+    if (operand_type != TYPE_ERROR && (!is_numeric_type(operand_type) || (operator== T_BNOT && operand_type != TYPE_INT)))
+    {
+        semantic_error(context, L"invalid operand to unary %s", operator_to_string(operator));
+        operand_type = TYPE_ERROR;
+    }
+    node->type_id = operator== T_NOT && operand_type != TYPE_ERROR ? TYPE_INT : operand_type;
+}
+
+static void check_condition(SemanticContext *context, int condition)
+{
+    int type_id = node_type(context, condition);
+    if (type_id != TYPE_ERROR && !is_numeric_type(type_id))
+        semantic_error(context, L"condition must be a number");
+}
+
+static parser_declaration *lookup_variable(SemanticContext *context, char *name)
+{
+    parser_declaration *declaration = hashmap_get(context->parser->declarations, name);
+    if (declaration == NULL)
+    {
+        if (hashmap_get(context->parser->symbol_table, name) != NULL)
+            semantic_error(context, L"function '%s' used as a variable", name);
+        else
+            semantic_error(context, L"use of undeclared identifier '%s'", name);
+    }
+    else if (declaration->function != context->current_function)
+    {
+        // there are no globals, every variable lives in the frame of its function
+        semantic_error(context, L"variable '%s' belongs to an enclosing function", name);
+        declaration = NULL;
+    }
+    return declaration;
+}
+
+static void check_identifier(SemanticContext *context, int index)
+{
+    ASTNode *node = &context->parser->ast_nodes[index];
+    parser_declaration *declaration = lookup_variable(context, node->data.identifier.name);
+
+    node->data.identifier.declaration = declaration ? declaration->index : -1;
+    node->type_id = declaration ? declaration->type_id : TYPE_ERROR;
+}
+
+static void check_update(SemanticContext *context, int index)
+{
+    ASTNode *node = &context->parser->ast_nodes[index];
+    parser_declaration *declaration = lookup_variable(context, node->data.update.name);
+
+    node->data.update.declaration = declaration ? declaration->index : -1;
+    node->type_id = declaration ? declaration->type_id : TYPE_ERROR;
+}
+
+static void check_assignment(SemanticContext *context, int index)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[index];
+    parser_declaration *declaration = lookup_variable(context, node->data.assignment.name);
+
+    if (declaration == NULL)
+    {
+        node->type_id = TYPE_ERROR;
+        return;
+    }
+
+    int value = coerce(context, node->data.assignment.expression, declaration->type_id);
+    node = &parser->ast_nodes[index];
+    node->data.assignment.expression = value;
+    node->data.assignment.declaration = declaration->index;
+    node->type_id = declaration->type_id;
+}
+
+static void check_declaration(SemanticContext *context, int index)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[index];
+    parser_literal literal = node->data.variable_declaration.literal;
+    int type_id = literal_to_type(literal.literal_type);
+
+    // a declaration of the innermost scope, inner scopes may shadow it
+    parser_declaration *previous = hashmap_get(parser->declarations, literal.value);
+    int scope_start = context->open_scope_count > 0 ? context->open_scopes[context->open_scope_count - 1] : 0;
+    if (previous != NULL && previous->function == context->current_function && previous->node >= scope_start)
+        semantic_error(context, L"redeclaration of variable '%s'", literal.value);
+
+    if (node->data.variable_declaration.expression >= 0)
+    {
+        int value = coerce(context, node->data.variable_declaration.expression, type_id);
+        node = &parser->ast_nodes[index];
+        node->data.variable_declaration.expression = value;
+    }
+
+    declare_variable(context, literal, index);
+    node->data.variable_declaration.declaration = parser->symbol_count - 1;
+    node->type_id = TYPE_VOID;
+}
+
+// Name, argument count and argument type of every Intrinsic. TYPE_UNRESOLVED
+// converts the arguments to their common type like arithmetic does.
+static const struct
+{
+    const char *name;
+    int param_count;
+    int param_type;
+} intrinsics[INTRINSIC_COUNT] = {
+    [INTRINSIC_SQRT] = {"sqrt", 1, TYPE_FLOAT},
+    [INTRINSIC_FMA] = {"fma", 3, TYPE_FLOAT},
+    [INTRINSIC_MIN] = {"min", 2, TYPE_UNRESOLVED},
+    [INTRINSIC_MAX] = {"max", 2, TYPE_UNRESOLVED},
+    [INTRINSIC_ABS] = {"abs", 1, TYPE_UNRESOLVED},
+    [INTRINSIC_POPCOUNT] = {"popcount", 1, TYPE_INT},
+    [INTRINSIC_CLZ] = {"clz", 1, TYPE_INT},
+    [INTRINSIC_CTZ] = {"ctz", 1, TYPE_INT},
+};
+
+static int find_intrinsic(const char *name)
+{
+    for (int k = 0; k < INTRINSIC_COUNT; k++)
+    {
+        if (strcmp(intrinsics[k].name, name) == 0)
+            return k;
+    }
+    return -1;
+}
+
+static void check_intrinsic_call(SemanticContext *context, int index, int intrinsic)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[index];
+    int count = intrinsics[intrinsic].param_count;
+    if (node->data.call.argument_count != count)
+    {
+        semantic_error(context, L"function '%s' expects %d arguments but %d were given", node->data.call.name, count, node->data.call.argument_count);
+        node->type_id = TYPE_ERROR;
+        return;
+    }
+
+    int *arguments = &parser->ast_lists[node->data.call.first_argument];
+    int type_id = intrinsics[intrinsic].param_type;
+    for (int i = 0; i < count; i++)
+    {
+        int argument_type = node_type(context, arguments[i]);
+        if (argument_type == TYPE_ERROR)
+        {
+            node->type_id = TYPE_ERROR;
+            return;
+        }
+        // bit counts take no floats, like the bitwise operators
+        if (!is_numeric_type(argument_type) || (type_id == TYPE_INT && argument_type != TYPE_INT))
+        {
+            semantic_error(context, L"invalid argument to %s", node->data.call.name);
+            node->type_id = TYPE_ERROR;
+            return;
+        }
+    }
+
+    if (type_id == TYPE_UNRESOLVED)
+    {
+        type_id = TYPE_INT;
+        for (int i = 0; i < count; i++)
+        {
+            if (node_type(context, arguments[i]) == TYPE_FLOAT)
+                type_id = TYPE_FLOAT;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int value = coerce(context, parser->ast_lists[node->data.call.first_argument + i], type_id);
+        node = &parser->ast_nodes[index];
+        parser->ast_lists[node->data.call.first_argument + i] = value;
+    }
+
+    node = &parser->ast_nodes[index];
+    node->data.call.intrinsic = intrinsic;
+    node->type_id = intrinsic == INTRINSIC_POPCOUNT || intrinsic == INTRINSIC_CLZ || intrinsic == INTRINSIC_CTZ ? TYPE_INT : type_id;
+}
+
+static void check_call(SemanticContext *context, int index)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[index];
+    parser_declaration *function = hashmap_get(parser->symbol_table, node->data.call.name);
+
+    if (function == NULL && find_intrinsic(node->data.call.name) >= 0)
+    {
+        check_intrinsic_call(context, index, find_intrinsic(node->data.call.name));
+        return;
+    }
+    if (function == NULL)
+    {
+        if (hashmap_get(parser->declarations, node->data.call.name) != NULL)
+            semantic_error(context, L"'%s' is not a function", node->data.call.name);
+        else
+            semantic_error(context, L"call to undeclared function '%s'", node->data.call.name);
+        node->type_id = TYPE_ERROR;
+        return;
+    }
+
+    Type *type = get_type(context->types, function->type_id);
+    if (type->param_count != node->data.call.argument_count)
+    {
+        semantic_error(context, L"function '%s' expects %d arguments but %d were given", node->data.call.name, type->param_count, node->data.call.argument_count);
+        node->type_id = TYPE_ERROR;
+        return;
+    }
+
+    for (int i = 0; i < type->param_count; i++)
+    {
+        int list_index = parser->ast_nodes[index].data.call.first_argument + i;
+        parser->ast_lists[list_index] = coerce(context, parser->ast_lists[list_index], type_param(context->types, function->type_id, i));
+    }
+
+    node = &parser->ast_nodes[index];
+    node->data.call.declaration = function->index;
+    node->type_id = type->base;
+}
+
+static void check_return(SemanticContext *context, int index)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[index];
+    parser_declaration *function = parser->symbols[context->current_function];
+    int expression = node->data.return_statement.expression;
+
+    node->type_id = TYPE_VOID;
+    if (expression < 0)
+    {
+        // the top level code may end without a value, it then returns 0
+        if (context->current_function != parser->entry_function)
+            semantic_error(context, L"missing return value in function '%s'", function->literal.value);
+        return;
+    }
+
+    // the top level code returns whatever its first return statement yields
+    if (function->type_id == TYPE_UNRESOLVED)
+    {
+        function->type_id = function_type(context->types, node_type(context, expression), NULL, 0);
+        return;
+    }
+
+    int return_type = get_type(context->types, function->type_id)->base;
+    int value = coerce(context, expression, return_type);
+    parser->ast_nodes[index].data.return_statement.expression = value;
+}
+
+static void check_prototype(SemanticContext *context, int index)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[index];
+    int parameter_count = node->data.function_prototype.parameter_count;
+    int *parameters = &parser->ast_lists[node->data.function_prototype.first_parameter];
+    int parameter_types[parameter_count > 0 ? parameter_count : 1];
+
+    for (int i = 0; i < parameter_count; i++)
+    {
+        parameter_types[i] = literal_to_type(parser->ast_nodes[parameters[i]].data.parameter.literal.literal_type);
+        parser->ast_nodes[parameters[i]].type_id = parameter_types[i];
+    }
+
+    int return_type = literal_to_type(node->data.function_prototype.return_literal.literal_type);
+    int type_id = function_type(context->types, return_type, parameter_types, parameter_count);
+    char *name = node->data.function_prototype.name;
+    node->type_id = type_id;
+
+    bool is_extern = node->data.function_prototype.is_extern;
+    parser_declaration *function = hashmap_get(parser->symbol_table, name);
+    if (function != NULL)
+    {
+        if (function->type_id != type_id || function->literal.literal_type != node->data.function_prototype.return_literal.literal_type)
+            semantic_error(context, L"conflicting types for function '%s'", name);
+        if (function->is_extern != is_extern)
+            semantic_error(context, L"function '%s' is declared both extern and not", name);
+        else if (function->definition >= 0 && node->data.function_prototype.has_body)
+            semantic_error(context, L"redefinition of function '%s'", name);
+    }
+    else
+    {
+        int symbol = add_symbol(parser, FUNCTION_DECLARATION, node->data.function_prototype.return_literal, index, type_id);
+        function = parser->symbols[symbol];
+        function->is_extern = is_extern;
+        hashmap_insert(parser->symbol_table, name, function);
+    }
+    node->data.function_prototype.declaration = function->index;
+
+    if (is_extern && node->data.function_prototype.has_body)
+        semantic_error(context, L"extern function '%s' cannot have a body", name);
+    if (!node->data.function_prototype.has_body)
+        return;
+
+    // the definition owns the frame, parameters take the first slots
+    function->node = index;
+    function->local_count = 0;
+    context->current_function = function->index;
+    for (int i = 0; i < parameter_count; i++)
+    {
+        declare_variable(context, parser->ast_nodes[parameters[i]].data.parameter.literal, parameters[i]);
+    }
+}
+
+static bool is_nonzero_literal(Parser *parser, int node)
+{
+    return parser->ast_nodes[node].type == N_LITERAL && strtod(parser->ast_nodes[node].data.literal.value, NULL) != 0;
+}
+
+// Whether control cannot reach the end of statement. Loops only count when
+// their condition is a nonzero constant, there is no break to leave them.
+static bool always_returns(Parser *parser, int statement)
+{
+    while (statement >= 0)
+    {
+        ASTNode *node = &parser->ast_nodes[statement];
+        switch (node->type)
+        {
+        case N_RETURN:
+            return true;
+        case N_BLOCK:
+            for (int i = 0; i < node->data.block.statement_count; i++)
+            {
+                if (always_returns(parser, parser->ast_lists[node->data.block.first_statement + i]))
+                    return true;
+            }
+            return false;
+        case N_IF:
+            if (node->data.if_statement.else_branch < 0 || !always_returns(parser, node->data.if_statement.then_branch))
+                return false;
+            // else if chains continue here instead of nesting calls
+            statement = node->data.if_statement.else_branch;
+            break;
+        case N_WHILE:
+            return is_nonzero_literal(parser, node->data.while_statement.condition);
+        case N_FOR:
+            return node->data.for_statement.condition < 0 || is_nonzero_literal(parser, node->data.for_statement.condition);
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+static void check_function(SemanticContext *context, int index)
+{
+    Parser *parser = context->parser;
+    ASTNode *node = &parser->ast_nodes[index];
+    ASTNode *prototype = &parser->ast_nodes[node->data.function_declaration.prototype];
+    parser_declaration *function = parser->symbols[prototype->data.function_prototype.declaration];
+    int first = prototype->data.function_prototype.parameter_count > 0 ? parser->ast_lists[prototype->data.function_prototype.first_parameter] : node->data.function_declaration.prototype;
+
+    function->definition = index;
+    if (!always_returns(parser, node->data.function_declaration.body))
+        semantic_error(context, L"control reaches the end of function '%s' without a return", function->literal.value);
+    pop_scope(context, first);
+    context->current_function = parser->entry_function;
+    node->type_id = TYPE_VOID;
+}
+
+int analyze_program(Parser *parser)
+{
+    SemanticContext context;
+    context.parser = parser;
+    context.types = parser->types = init_type_table();
+    context.scope_size = PARSER_INCREMENT;
+    context.scope_count = 0;
+    context.scope_symbols = malloc(context.scope_size * sizeof(int));
+    context.error_count = 0;
+
+    // blocks and for loops scope the nodes from scope_start to themselves
+    int node_count = parser->ast_count;
+    context.open_scopes = malloc((node_count + 1) * sizeof(int));
+    context.open_scope_count = 0;
+    context.scope_opens = calloc(node_count + 1, sizeof(int));
+    for (int i = 0; i < node_count; i++)
+    {
+        ASTNode *node = &parser->ast_nodes[i];
+        if (node->type == N_BLOCK)
+            context.scope_opens[node->data.block.scope_start]++;
+        else if (node->type == N_FOR)
+            context.scope_opens[node->data.for_statement.scope_start]++;
+    }
+
+    // top level statements form an implicit function, its type is settled by the first return
+    parser_literal entry = {ENTRY_FUNCTION_NAME, LITERAL_INT, LITERAL_SIGNED};
+    parser->entry_function = add_symbol(parser, FUNCTION_DECLARATION, entry, parser->program, TYPE_UNRESOLVED);
+    parser->symbols[parser->entry_function]->definition = parser->program;
+    context.current_function = parser->entry_function;
+
+    for (int i = 0; i < node_count; i++)
+    {
+        ASTNode *node = &parser->ast_nodes[i];
+        for (int k = 0; k < context.scope_opens[i]; k++)
+        {
+            context.open_scopes[context.open_scope_count++] = i;
+        }
+        if (node->type == N_BLOCK || node->type == N_FOR)
+            context.open_scope_count--;
+
+        switch (node->type)
+        {
+        case N_LITERAL:
+            node->type_id = literal_to_type(node->data.literal.literal_type);
+            break;
+        case N_IDENTIFIER:
+            check_identifier(&context, i);
+            break;
+        case N_UNARY_EXPRESSION:
+            check_unary(&context, i);
+            break;
+        case N_BINARY_EXPRESSION:
+            check_binary(&context, i);
+            break;
+        case N_ASSIGNMENT:
+            check_assignment(&context, i);
+            break;
+        case N_VARIABLE_DECLARATION:
+            check_declaration(&context, i);
+            break;
+        case N_CALL:
+            check_call(&context, i);
+            break;
+        case N_RETURN:
+            check_return(&context, i);
+            break;
+        case N_BLOCK:
+            pop_scope(&context, node->data.block.scope_start);
+            node->type_id = TYPE_VOID;
+            break;
+        case N_PARAMETER:
+            break;
+        case N_FUNCTION_PROTOTYPE:
+            check_prototype(&context, i);
+            break;
+        case N_FUNCTION_DECLARATION:
+            check_function(&context, i);
+            break;
+        case N_PROGRAM:
+            node->type_id = TYPE_VOID;
+            break;
+        case N_CAST:
+            break;
+        case N_UPDATE:
+            check_update(&context, i);
+            break;
+        case N_IF:
+            check_condition(&context, node->data.if_statement.condition);
+            node->type_id = TYPE_VOID;
+            break;
+        case N_WHILE:
+            check_condition(&context, node->data.while_statement.condition);
+            node->type_id = TYPE_VOID;
+            break;
+        case N_FOR:
+            if (node->data.for_statement.condition >= 0)
+                check_condition(&context, node->data.for_statement.condition);
+            pop_scope(&context, node->data.for_statement.scope_start);
+            node->type_id = TYPE_VOID;
+            break;
+        default:
+            semantic_error(&context, L"unexpected node %s", node_type_to_string(node->type));
+        }
+    }
+
+    parser_declaration *entry_function = parser->symbols[parser->entry_function];
+    if (entry_function->type_id == TYPE_UNRESOLVED)
+        entry_function->type_id = function_type(context.types, TYPE_INT, NULL, 0);
+
+    free(context.scope_symbols);
+    free(context.open_scopes);
+    free(context.scope_opens);
+    return context.error_count;
+}
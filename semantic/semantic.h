@@ -0,0 +1,48 @@
+#include "../parser/parser.h"
+#include "types.h"
+
+#ifndef SEMANTIC_H
+#define SEMANTIC_H
+
+#define ENTRY_FUNCTION_NAME "__toplevel"
+
+// Builtin functions the compilers turn into single instructions. A function
+// declared with the same name hides the builtin from its declaration on.
+typedef enum
+{
+    INTRINSIC_SQRT,
+    INTRINSIC_FMA,
+    INTRINSIC_MIN,
+    INTRINSIC_MAX,
+    INTRINSIC_ABS,
+    INTRINSIC_POPCOUNT,
+    INTRINSIC_CLZ,
+    INTRINSIC_CTZ,
+    INTRINSIC_COUNT
+} Intrinsic;
+
+typedef struct
+{
+    Parser *parser;
+    TypeTable *types;
+
+    // variables visible at the current node, innermost last
+    int *scope_symbols;
+    int scope_size;
+    int scope_count;
+
+    // first node of every scope open at the current node, innermost last,
+    // and how many scopes start at each node
+    int *open_scopes;
+    int open_scope_count;
+    int *scope_opens;
+
+    int current_function;
+    int error_count;
+} SemanticContext;
+
+int analyze_program(Parser *parser);
+int literal_to_type(LiteralType literal_type);
+parser_declaration *get_symbol(Parser *parser, int symbol);
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "types.h"
+#include "../defc/defc.h"
+
+static unsigned int hash_type(TypeKind kind, int base, const int *params, int param_count)
+{
+    unsigned int hash = 2166136261u;
+    hash = (hash ^ (unsigned int)kind) * 16777619u;
+    hash = (hash ^ (unsigned int)base) * 16777619u;
+    hash = (hash ^ (unsigned int)param_count) * 16777619u;
+    for (int i = 0; i < param_count; i++)
+    {
+        hash = (hash ^ (unsigned int)params[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool type_matches(TypeTable *table, Type *type, TypeKind kind, int base, const int *params, int param_count)
+{
+    if (type->kind != kind || type->base != base || type->param_count != param_count)
+        return false;
+    return param_count == 0 || memcmp(&table->params[type->first_param], params, param_count * sizeof(int)) == 0;
+}
+
+static void rehash_types(TypeTable *table)
+{
+    free(table->slots);
+    table->slot_size *= 2;
+    table->slots = malloc(table->slot_size * sizeof(int));
+    memset(table->slots, -1, table->slot_size * sizeof(int));
+
+    for (int i = 0; i < table->type_count; i++)
+    {
+        unsigned int slot = table->types[i].hash & (table->slot_size - 1);
+        while (table->slots[slot] >= 0)
+            slot = (slot + 1) & (table->slot_size - 1);
+        table->slots[slot] = i;
+    }
+}
+
+TypeTable *init_type_table()
+{
+    TypeTable *table = malloc(sizeof(TypeTable));
+
+    table->type_size = TYPE_TABLE_INCREMENT;
+    table->type_count = 0;
+    table->types = malloc(table->type_size * sizeof(Type));
+
+    table->param_size = TYPE_TABLE_INCREMENT;
+    table->param_count = 0;
+    table->params = malloc(table->param_size * sizeof(int));
+
+    table->slot_size = TYPE_TABLE_INCREMENT * 2;
+    table->slots = malloc(table->slot_size * sizeof(int));
+    memset(table->slots, -1, table->slot_size * sizeof(int));
+
+    if (!table->types || !table->params || !table->slots)
+    {
+        wprintf(L"Memory allocation failed while initializing type table.\n");
+        exit(1);
+    }
+
+    // order must match the TYPE_* constants
+    intern_type(table, TYPE_KIND_VOID, -1, NULL, 0);
+    intern_type(table, TYPE_KIND_INT, -1, NULL, 0);
+    intern_type(table, TYPE_KIND_FLOAT, -1, NULL, 0);
+    intern_type(table, TYPE_KIND_ERROR, -1, NULL, 0);
+
+    return table;
+}
+
+void free_type_table(TypeTable *table)
+{
+    free(table->types);
+    free(table->params);
+    free(table->slots);
+    free(table);
+}
+
+int intern_type(TypeTable *table, TypeKind kind, int base, const int *params, int param_count)
+{
+    unsigned int hash = hash_type(kind, base, params, param_count);
+    unsigned int slot = hash & (table->slot_size - 1);
+
+    while (table->slots[slot] >= 0)
+    {
+        Type *type = &table->types[table->slots[slot]];
+        if (type->hash == hash && type_matches(table, type, kind, base, params, param_count))
+            return table->slots[slot];
+        slot = (slot + 1) & (table->slot_size - 1);
+    }
+
+    if (table->type_count >= table->type_size)
+    {
+        table->type_size += TYPE_TABLE_INCREMENT;
+        table->types = realloc(table->types, table->type_size * sizeof(Type));
+    }
+    if (table->param_count + param_count >= table->param_size)
+    {
+        while (table->param_count + param_count >= table->param_size)
+            table->param_size += TYPE_TABLE_INCREMENT;
+        table->params = realloc(table->params, table->param_size * sizeof(int));
+    }
+    if (!table->types || !table->params)
+    {
+        wprintf(L"Memory allocation failed while resizing type table.\n");
+        exit(1);
+    }
+
+    int id = table->type_count++;
+    Type *type = &table->types[id];
+    type->kind = kind;
+    type->base = base;
+    type->first_param = table->param_count;
+    type->param_count = param_count;
+    type->hash = hash;
+    for (int i = 0; i < param_count; i++)
+    {
+        table->params[table->param_count++] = params[i];
+    }
+
+    table->slots[slot] = id;
+    if (table->type_count * 2 > table->slot_size)
+        rehash_types(table);
+
+    return id;
+}
+
+int function_type(TypeTable *table, int return_type, const int *params, int param_count)
+{
+    return intern_type(table, TYPE_KIND_FUNCTION, return_type, params, param_count);
+}
+
+Type *get_type(TypeTable *table, int type_id)
+{
+    return &table->types[type_id];
+}
+
+int type_param(TypeTable *table, int type_id, int index)
+{
+    Type *type = &table->types[type_id];
+    return table->params[type->first_param + index];
+}
+
+bool is_numeric_type(int type_id)
+{
+    return type_id == TYPE_INT || type_id == TYPE_FLOAT;
+}
+
+const char *builtin_type_name(int type_id)
+{
+    switch (type_id)
+    {
+    case TYPE_VOID:
+        return "void";
+    case TYPE_INT:
+        return "int";
+    case TYPE_FLOAT:
+        return "float";
+    case TYPE_ERROR:
+        return "<error>";
+    default:
+        return NULL;
+    }
+}
+
+void append_type_name(TypeTable *table, int type_id, OutputBuffer *buffer)
+{
+    if (type_id < 0 || table == NULL || type_id >= table->type_count)
+    {
+        buffer_append_str(buffer, "<unresolved>");
+        return;
+    }
+
+    Type *type = &table->types[type_id];
+    switch (type->kind)
+    {
+    case TYPE_KIND_FUNCTION:
+        append_type_name(table, type->base, buffer);
+        buffer_append_char(buffer, '(');
+        for (int i = 0; i < type->param_count; i++)
+        {
+            if (i > 0)
+                buffer_append_str(buffer, ", ");
+            append_type_name(table, table->params[type->first_param + i], buffer);
+        }
+        buffer_append_char(buffer, ')');
+        break;
+    default:
+        buffer_append_str(buffer, builtin_type_name(type_id));
+    }
+}
@@ -0,0 +1,59 @@
+#include <stdbool.h>
+#include "../buffer/buffer.h"
+
+#ifndef SEMANTIC_TYPES_H
+#define SEMANTIC_TYPES_H
+
+typedef enum
+{
+    TYPE_KIND_VOID,
+    TYPE_KIND_INT,
+    TYPE_KIND_FLOAT,
+    TYPE_KIND_ERROR,
+    TYPE_KIND_FUNCTION,
+} TypeKind;
+
+// Builtin types are interned first by init_type_table so their ids are fixed.
+// Every type is interned, two types are equal exactly when their ids are.
+#define TYPE_UNRESOLVED -1
+#define TYPE_VOID 0
+#define TYPE_INT 1
+#define TYPE_FLOAT 2
+#define TYPE_ERROR 3
+
+typedef struct
+{
+    TypeKind kind;
+    int base; // function: return type
+    int first_param;
+    int param_count;
+    unsigned int hash;
+} Type;
+
+typedef struct TypeTable
+{
+    Type *types;
+    int type_size;
+    int type_count;
+
+    // parameter lists of function types, indexed by first_param/param_count
+    int *params;
+    int param_size;
+    int param_count;
+
+    // open addressing index from structural hash to type id, -1 marks empty
+    int *slots;
+    int slot_size;
+} TypeTable;
+
+TypeTable *init_type_table();
+void free_type_table(TypeTable *table);
+int intern_type(TypeTable *table, TypeKind kind, int base, const int *params, int param_count);
+int function_type(TypeTable *table, int return_type, const int *params, int param_count);
+Type *get_type(TypeTable *table, int type_id);
+int type_param(TypeTable *table, int type_id, int index);
+bool is_numeric_type(int type_id);
+void append_type_name(TypeTable *table, int type_id, OutputBuffer *buffer);
+const char *builtin_type_name(int type_id);
+
+#endif
@@ -78,8 +78,10 @@ Lexer *lex_source(char *source, char *file_name)
 
     while (lexer->is_eof == false)
     {
+        // push_token copies the token
         Token *token = get_next_token(lexer);
         push_token(lexer, token);
+        free(token);
     }
 
     char *eof = (char *)malloc(2);
@@ -87,6 +89,7 @@ Lexer *lex_source(char *source, char *file_name)
     eof[1] = '\0';
     Token *eof_token = init_token(T_EOF, eof, lexer->line, lexer->column, lexer->position, lexer->position);
     push_token(lexer, eof_token);
+    free(eof_token);
 
     return lexer;
 }
@@ -201,6 +204,8 @@ Token *get_next_token(Lexer *lexer)
     while (lexer->is_eof == false)
     {
         skip_whitespace(lexer);
+        if (lexer->is_eof)
+            break;
 
         if (isdigit(lexer->current_char))
         {
@@ -220,6 +225,17 @@ Token *get_next_token(Lexer *lexer)
         switch (lexer->current_char)
         {
         case '/':
+            if (peek_next_char(lexer) == '/')
+            {
+                // line comment, the newline is left for skip_whitespace
+                while (lexer->is_eof == false && lexer->current_char != '\n')
+                {
+                    advance_lexer(lexer);
+                }
+                free(token->value);
+                free(token);
+                continue;
+            }
             token->type = T_DIVIDE;
             break;
         case '(':
@@ -231,6 +247,15 @@ Token *get_next_token(Lexer *lexer)
         case ';':
             token->type = T_SEMICOLON;
             break;
+        case '{':
+            token->type = T_LBRACE;
+            break;
+        case '}':
+            token->type = T_RBRACE;
+            break;
+        case ',':
+            token->type = T_COMMA;
+            break;
         case '=':
             if (peek_next_char(lexer) == '=')
             {
@@ -243,6 +268,69 @@ Token *get_next_token(Lexer *lexer)
                 token->type = T_ASSIGN;
             }
             break;
+        case '<':
+            if (peek_next_char(lexer) == '=')
+            {
+                advance_lexer(lexer);
+                token->type = T_LESS_EQUAL;
+                append_token_value(token, "=");
+            }
+            else
+            {
+                token->type = T_LESS;
+            }
+            break;
+        case '>':
+            if (peek_next_char(lexer) == '=')
+            {
+                advance_lexer(lexer);
+                token->type = T_GREATER_EQUAL;
+                append_token_value(token, "=");
+            }
+            else
+            {
+                token->type = T_GREATER;
+            }
+            break;
+        case '!':
+            if (peek_next_char(lexer) == '=')
+            {
+                advance_lexer(lexer);
+                token->type = T_NOT_EQUAL;
+                append_token_value(token, "=");
+            }
+            else
+            {
+                token->type = T_NOT;
+            }
+            break;
+        case '&':
+            if (peek_next_char(lexer) == '&')
+            {
+                advance_lexer(lexer);
+                token->type = T_AND;
+                append_token_value(token, "&");
+            }
+            else
+            {
+                token->type = T_BAND;
+            }
+            break;
+        case '|':
+            if (peek_next_char(lexer) == '|')
+            {
+                advance_lexer(lexer);
+                token->type = T_OR;
+                append_token_value(token, "|");
+            }
+            else
+            {
+                token->type = T_BOR;
+            }
+            break;
+        case '~':
+            token->type = T_BNOT;
+            break;
         case '+':
             if (peek_next_char(lexer) == '+')
             {
@@ -299,7 +387,7 @@ Token *get_next_token(Lexer *lexer)
         return token;
     }
 
-    Token *token = init_token(T_EOF, "", lexer->line, lexer->column, lexer->position, strlen(lexer->source));
+    Token *token = init_token(T_EOF, strdup(""), lexer->line, lexer->column, lexer->position, strlen(lexer->source));
     return token;
 }
 
@@ -313,6 +401,14 @@ TokenType get_token_keyword(char *value)
     {
         return T_FLOAT;
     }
+    if (strcmp(value, "long") == 0)
+    {
+        return T_LONG;
+    }
+    else if (strcmp(value, "if") == 0)
+    {
+        return T_IF;
+    }
     else if (strcmp(value, "else") == 0)
     {
         return T_ELSE;
@@ -329,6 +425,10 @@ TokenType get_token_keyword(char *value)
     {
         return T_RETURN;
     }
+    else if (strcmp(value, "extern") == 0)
+    {
+        return T_EXTERN;
+    }
     return T_IDENTIFIER;
 }
 
@@ -444,6 +544,8 @@ const char *token_to_string(TokenType type)
         return "Integer Keyword";
     case T_FLOAT:
         return "Float Keyword";
+    case T_LONG:
+        return "Long Keyword";
     case T_BOOL:
         return "Boolean Keyword";
     case T_IF:
@@ -456,6 +558,8 @@ const char *token_to_string(TokenType type)
         return "While Keyword";
     case T_RETURN:
         return "Return Keyword";
+    case T_EXTERN:
+        return "Extern Keyword";
     case T_PLUS:
         return "Plus Operator";
     case T_MINUS:
@@ -486,8 +590,28 @@ const char *token_to_string(TokenType type)
         return "Greater or Equal Operator";
     case T_LESS:
         return "Less Operator";
+    case T_LESS_EQUAL:
+        return "Less or Equal Operator";
+    case T_AND:
+        return "And Operator";
+    case T_OR:
+        return "Or Operator";
+    case T_NOT:
+        return "Not Operator";
+    case T_BAND:
+        return "Bitwise And Operator";
+    case T_BOR:
+        return "Bitwise Or Operator";
+    case T_BNOT:
+        return "Bitwise Not Operator";
     case T_SEMICOLON:
         return "Semicolon";
+    case T_LBRACE:
+        return "Left Brace";
+    case T_RBRACE:
+        return "Right Brace";
+    case T_COMMA:
+        return "Comma";
     default:
         return "Unknown Token Type in token_to_string()";
     }
@@ -14,12 +14,14 @@ typedef enum
     // Keywords
     T_INT,
     T_FLOAT,
+    T_LONG,
     T_BOOL,
     T_IF,
     T_ELSE,
     T_FOR,
     T_WHILE,
     T_RETURN,
+    T_EXTERN,
 
     // Operators
     T_PLUS,
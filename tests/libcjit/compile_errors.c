@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <string.h>
+#include "../../libcjit/libcjit.h"
+
+// Sources that do not compile return NULL with their first error in
+// cjit_last_error instead of ending the process, and the context compiles
+// the next program as if nothing happened. Prints one line per source and
+// exits with 1 when one of them went wrong.
+
+static bool check(CJITContext *context, const char *source, const char *error)
+{
+    CJITProgram *program = cjit_compile(context, "compile_errors.cj", source);
+    const char *message = cjit_last_error(context);
+    fprintf(stderr, "%s -> %s\n", source, program ? "compiled" : message);
+    if (program)
+    {
+        cjit_unload(program);
+        return false;
+    }
+    return strstr(message, error) != NULL;
+}
+
+int main(void)
+{
+    CJITContext *context = cjit_create_context();
+
+    bool passed = check(context, "int f(int a) { return a + ; }", "Error parsing expression");
+    passed = check(context, "int f(int a) { return a; ", "Expected") && passed;
+    passed = check(context, "int f(int a) { return (a; }", "Expected") && passed;
+    passed = check(context, "int f(x) { return x; }", "parse_var_type") && passed;
+    passed = check(context, "int f(int a) { return b; }", "semantic error") && passed;
+    passed = check(context, "extern int cjit_no_such_function(int x);\nreturn cjit_no_such_function(1);", "unresolved extern function") && passed;
+
+    CJITProgram *program = cjit_compile(context, "compile_errors.cj", "int f(int a) { return a + 1; }\nreturn f(41);");
+    CJITValue result = {.i = 0};
+    const char *error = NULL;
+    if (program == NULL || cjit_last_error(context)[0] != '\0' || !cjit_call(cjit_entry(program), NULL, &result, &error) || result.i != 42)
+        passed = false;
+    fprintf(stderr, "valid source after errors -> %lld\n", (long long)result.i);
+    if (program)
+        cjit_unload(program);
+
+    cjit_destroy_context(context);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+#include "../../libcjit/libcjit.h"
+
+// cjit_lookup finds declared functions only, cjit_function_pointer hands out
+// native entries only for the signature of the function. Exits with 1 when
+// one of the checks failed.
+
+static bool passed = true;
+
+static void expect(bool condition, const char *description)
+{
+    fprintf(stderr, "%s %s\n", condition ? "ok  " : "FAIL", description);
+    passed = passed && condition;
+}
+
+int main(void)
+{
+    CJITContext *context = cjit_create_context();
+    CJITProgram *program = cjit_compile(context, "lookup.cj",
+                                        "int add(int a, int b) { return a + b; }\n"
+                                        "float scale(float x, int n) { return x * n; }\n"
+                                        "return add(1, 2);\n");
+    if (program == NULL)
+        return 1;
+
+    const CJITFunction *add = cjit_lookup(program, "add");
+    const CJITFunction *scale = cjit_lookup(program, "scale");
+    expect(add != NULL && scale != NULL, "declared functions are found");
+    expect(cjit_lookup(program, "missing") == NULL, "a missing name is NULL");
+    expect(cjit_lookup(program, "ad") == NULL && cjit_lookup(program, "addx") == NULL, "prefixes and extensions of a name are not found");
+    expect(add && strcmp(cjit_signature(add), "i(ii)") == 0, "signature of add is i(ii)");
+    expect(scale && strcmp(cjit_signature(scale), "f(fi)") == 0, "signature of scale is f(fi)");
+    expect(strcmp(cjit_signature(cjit_entry(program)), "i()") == 0, "signature of the entry is i()");
+
+    expect(cjit_function_pointer(add, "f(ii)") == NULL, "another return type is refused");
+    expect(cjit_function_pointer(add, "i(i)") == NULL, "fewer parameters are refused");
+    expect(cjit_function_pointer(add, "i(if)") == NULL, "another parameter type is refused");
+    expect(cjit_function_pointer(NULL, "i(ii)") == NULL, "a missing function is refused");
+
+    int64_t (*add_pointer)(int64_t, int64_t) = (int64_t (*)(int64_t, int64_t))cjit_function_pointer(add, "i(ii)");
+    double (*scale_pointer)(double, int64_t) = (double (*)(double, int64_t))cjit_function_pointer(scale, "f(fi)");
+    expect(add_pointer && add_pointer(40, 2) == 42, "add through its pointer");
+    expect(scale_pointer && scale_pointer(1.5, 4) == 6.0, "scale through its pointer");
+
+    CJITValue arguments[2] = {{.f = 2.5}, {.i = 2}};
+    CJITValue result = {.i = 0};
+    const char *error = NULL;
+    expect(cjit_call(scale, arguments, &result, &error) && result.f == 5.0, "scale through cjit_call");
+
+    cjit_unload(program);
+    cjit_destroy_context(context);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <string.h>
+#include "../../libcjit/libcjit.h"
+
+// Compiles, calls and unloads programs in a loop, alternating between two
+// sources and with a failing compile in between, the way a long running
+// host replaces its scripts. Every round must see the code of its own
+// source. Exits with 1 when one of them went wrong.
+
+#define ROUNDS 300
+
+int main(void)
+{
+    CJITContext *context = cjit_create_context();
+    const char *sources[2] = {
+        "int step(int x) { return x * 3 + 1; }\nreturn step(4);\n",
+        "int step(int x) { int total = 0; for (int i = 0; i < x; i++) total = total + i; return total; }\nreturn step(5);\n",
+    };
+    int64_t expected[2][2] = {{13, 31}, {10, 45}}; // entry, step(10)
+
+    int failures = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        int which = round % 2;
+        if (round % 10 == 5 && cjit_compile(context, "reload.cj", "int step(int x) { return x +; }") != NULL)
+            failures++;
+
+        CJITProgram *program = cjit_compile(context, "reload.cj", sources[which]);
+        if (program == NULL)
+        {
+            failures++;
+            continue;
+        }
+        CJITValue argument = {.i = 10};
+        CJITValue result = {.i = 0};
+        const char *error = NULL;
+        if (!cjit_call(cjit_entry(program), NULL, &result, &error) || result.i != expected[which][0])
+            failures++;
+        if (!cjit_call(cjit_lookup(program, "step"), &argument, &result, &error) || result.i != expected[which][1])
+            failures++;
+        cjit_unload(program);
+    }
+    fprintf(stderr, "%d rounds: %d failures\n", ROUNDS, failures);
+
+    cjit_destroy_context(context);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "../../libcjit/libcjit.h"
+
+// Deep recursion through cjit_call from the main thread and from threads
+// with small stacks is reported as a stack overflow, shallow recursion
+// still returns. Prints one line per call and exits with 1 when one of
+// them went wrong.
+
+typedef struct
+{
+    const CJITFunction *function;
+    int64_t depth;
+    bool ok;
+    const char *error;
+    int64_t result;
+} Call;
+
+static void *run_call(void *data)
+{
+    Call *call = data;
+    CJITValue argument = {.i = call->depth};
+    CJITValue result = {.i = 0};
+    call->ok = cjit_call(call->function, &argument, &result, &call->error);
+    call->result = result.i;
+    return NULL;
+}
+
+// stack_size 0 calls on the main thread
+static bool check(const CJITFunction *function, size_t stack_size, int64_t depth, bool overflows)
+{
+    Call call = {function, depth, false, NULL, 0};
+    if (stack_size == 0)
+        run_call(&call);
+    else
+    {
+        pthread_attr_t attributes;
+        pthread_t thread;
+        pthread_attr_init(&attributes);
+        pthread_attr_setstacksize(&attributes, stack_size);
+        if (pthread_create(&thread, &attributes, run_call, &call) != 0)
+            return false;
+        pthread_join(thread, NULL);
+        pthread_attr_destroy(&attributes);
+    }
+    bool passed = overflows ? !call.ok && strcmp(call.error, "stack overflow") == 0 : call.ok && call.result == depth;
+    printf("stack %zu KiB, depth %lld: %s\n", stack_size / 1024, (long long)depth, call.ok ? "returned" : call.error);
+    return passed;
+}
+
+int main(void)
+{
+    CJITContext *context = cjit_create_context();
+    CJITProgram *program = cjit_compile(context, "stack_overflow.cj", "int depth(int n) { if (n <= 0) return 0; return depth(n - 1) + 1; }\n");
+    if (program == NULL)
+        return 1;
+    const CJITFunction *depth = cjit_lookup(program, "depth");
+
+    bool passed = check(depth, 0, 100000000, true);
+    passed = check(depth, 0, 1000, false) && passed;
+    passed = check(depth, 1 << 20, 100000000, true) && passed;
+    passed = check(depth, 1 << 20, 1000, false) && passed;
+    passed = check(depth, 256 << 10, 100000000, true) && passed;
+    passed = check(depth, 256 << 10, 1000, false) && passed;
+
+    cjit_unload(program);
+    cjit_destroy_context(context);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "../../libcjit/libcjit.h"
+
+// Host functions registered with cjit_register_symbol and declared with
+// their C prototypes: a C int result is sign extended, a long result kept
+// whole, int parameters read the low half of the value passed. Exits with
+// 1 when one of the results is wrong.
+
+static int negate(int x)
+{
+    return -x;
+}
+
+static int64_t widen(int64_t x, double scale)
+{
+    return (int64_t)(x * scale) << 20;
+}
+
+static double mix(int a, double b, int64_t c)
+{
+    return a + b + (double)c;
+}
+
+int main(void)
+{
+    CJITContext *context = cjit_create_context();
+    cjit_register_symbol(context, "negate", (void *)negate);
+    cjit_register_symbol(context, "widen", (void *)widen);
+    cjit_register_symbol(context, "mix", (void *)mix);
+    CJITProgram *program = cjit_compile(context, "symbols.cj",
+                                        "extern int negate(int x);\n"
+                                        "extern long widen(long x, float scale);\n"
+                                        "extern float mix(int a, float b, long c);\n"
+                                        "int negated(int x) { return negate(x); }\n"
+                                        "int widened(int x) { return widen(x, 2.0); }\n"
+                                        "float mixed(int a, int c) { return mix(a, 0.5, c); }\n");
+    if (program == NULL)
+        return 1;
+
+    struct
+    {
+        const char *function;
+        CJITValue arguments[2];
+        CJITValue expected;
+        bool is_float;
+    } cases[] = {
+        {"negated", {{.i = 5}}, {.i = -5}, false},
+        {"negated", {{.i = -7}}, {.i = 7}, false},
+        {"negated", {{.i = 4294967296 + 9}}, {.i = -9}, false},
+        {"widened", {{.i = 3000000}}, {.i = (int64_t)6000000 << 20}, false},
+        {"widened", {{.i = -3}}, {.i = -((int64_t)6 << 20)}, false},
+        {"mixed", {{.i = -2}, {.i = 10000000000}}, {.f = 9999999998.5}, true},
+    };
+
+    int failures = 0;
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++)
+    {
+        CJITValue result = {.i = 0};
+        const char *error = NULL;
+        bool ok = cjit_call(cjit_lookup(program, cases[k].function), cases[k].arguments, &result, &error);
+        bool right = ok && (cases[k].is_float ? result.f == cases[k].expected.f : result.i == cases[k].expected.i);
+        fprintf(stderr, "%s %s(%lld): %lld\n", right ? "ok  " : "FAIL", cases[k].function, (long long)cases[k].arguments[0].i, (long long)result.i);
+        failures += !right;
+    }
+
+    cjit_unload(program);
+    cjit_destroy_context(context);
+    return failures == 0 ? 0 : 1;
+}
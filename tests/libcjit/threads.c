@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "../../libcjit/libcjit.h"
+
+// Several threads call the functions of one program through cjit_call at
+// once, some of the calls divide by zero, while another thread compiles
+// and unloads programs in the same context and so writes to its code heap.
+// Every call must return its own result or error. Exits with 1 when one of
+// them went wrong.
+
+#define THREADS 8
+#define CALLS 20000
+#define COMPILES 200
+
+typedef struct
+{
+    const CJITFunction *function;
+    int id;
+    int failures;
+} Worker;
+
+static void *run_worker(void *data)
+{
+    Worker *worker = data;
+    for (int i = 0; i < CALLS; i++)
+    {
+        // every eighth call of a worker divides by zero
+        int64_t divisor = (i + worker->id) % 8;
+        CJITValue arguments[2] = {{.i = worker->id * 1000 + i}, {.i = divisor}};
+        CJITValue result = {.i = 0};
+        const char *error = NULL;
+        bool ok = cjit_call(worker->function, arguments, &result, &error);
+        if (divisor == 0 ? ok : !ok || result.i != (worker->id * 1000 + i) / divisor + worker->id * 1000 + i)
+            worker->failures++;
+    }
+    return NULL;
+}
+
+static void *run_compiler(void *data)
+{
+    CJITContext *context = data;
+    int failures = 0;
+    for (int i = 0; i < COMPILES; i++)
+    {
+        CJITProgram *program = cjit_compile(context, "compiled.cj", "int twice(int x) { return x * 2; }\nreturn twice(21);\n");
+        CJITValue result = {.i = 0};
+        const char *error = NULL;
+        if (program == NULL || !cjit_call(cjit_entry(program), NULL, &result, &error) || result.i != 42)
+            failures++;
+        if (program)
+            cjit_unload(program);
+    }
+    return (void *)(intptr_t)failures;
+}
+
+int main(void)
+{
+    CJITContext *context = cjit_create_context();
+    CJITProgram *program = cjit_compile(context, "threads.cj", "int quotient(int a, int b) { return a / b + a; }\n");
+    if (program == NULL)
+        return 1;
+
+    pthread_t threads[THREADS];
+    Worker workers[THREADS];
+    for (int t = 0; t < THREADS; t++)
+    {
+        workers[t] = (Worker){cjit_lookup(program, "quotient"), t, 0};
+        pthread_create(&threads[t], NULL, run_worker, &workers[t]);
+    }
+    pthread_t compiler;
+    pthread_create(&compiler, NULL, run_compiler, context);
+    void *compile_failures;
+    pthread_join(compiler, &compile_failures);
+    fprintf(stderr, "compiler: %d failures\n", (int)(intptr_t)compile_failures);
+    int failures = (int)(intptr_t)compile_failures;
+    for (int t = 0; t < THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+        fprintf(stderr, "thread %d: %d failures\n", t, workers[t].failures);
+        failures += workers[t].failures;
+    }
+
+    cjit_unload(program);
+    cjit_destroy_context(context);
+    return failures == 0 ? 0 : 1;
+}
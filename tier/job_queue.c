@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include "job_queue.h"
+
+JobQueue *init_job_queue(size_t capacity)
+{
+    JobQueue *queue = aligned_alloc(64, (sizeof(JobQueue) + 63) & ~(size_t)63);
+    if (!queue || (capacity & (capacity - 1)) != 0)
+    {
+        wprintf(L"Cannot create a job queue of %zu slots.\n", capacity);
+        exit(1);
+    }
+    queue->slots = malloc(capacity * sizeof(JobSlot));
+    if (!queue->slots)
+    {
+        wprintf(L"Memory allocation failed for a job queue.\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < capacity; i++)
+    {
+        queue->slots[i].sequence = i;
+    }
+    queue->mask = capacity - 1;
+    queue->enqueue_position = 0;
+    queue->dequeue_position = 0;
+    return queue;
+}
+
+void free_job_queue(JobQueue *queue)
+{
+    free(queue->slots);
+    free(queue);
+}
+
+// fails when the queue is full
+bool job_queue_push(JobQueue *queue, int value)
+{
+    size_t position = __atomic_load_n(&queue->enqueue_position, __ATOMIC_RELAXED);
+    while (true)
+    {
+        JobSlot *slot = &queue->slots[position & queue->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0)
+        {
+            // a failed exchange loads the current position and retries
+            if (__atomic_compare_exchange_n(&queue->enqueue_position, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                slot->value = value;
+                __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+        else if (difference < 0)
+            return false; // the slot still holds the value of the previous lap
+        else
+            position = __atomic_load_n(&queue->enqueue_position, __ATOMIC_RELAXED);
+    }
+}
+
+// fails when the queue is empty
+bool job_queue_pop(JobQueue *queue, int *value)
+{
+    size_t position = __atomic_load_n(&queue->dequeue_position, __ATOMIC_RELAXED);
+    while (true)
+    {
+        JobSlot *slot = &queue->slots[position & queue->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&queue->dequeue_position, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *value = slot->value;
+                // free for the producer one lap ahead
+                __atomic_store_n(&slot->sequence, position + queue->mask + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+        else if (difference < 0)
+            return false;
+        else
+            position = __atomic_load_n(&queue->dequeue_position, __ATOMIC_RELAXED);
+    }
+}
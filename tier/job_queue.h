@@ -0,0 +1,33 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+// Bounded multi producer multi consumer queue of ints without locks. Every
+// slot carries a sequence number telling whose turn it is: a producer may
+// fill slot i of lap n when its sequence is the position itself, a consumer
+// may empty it when the sequence is position + 1. Positions are claimed with
+// a compare and swap, so a full or empty queue is detected without waiting.
+typedef struct
+{
+    size_t sequence;
+    int value;
+} JobSlot;
+
+typedef struct
+{
+    JobSlot *slots;
+    size_t mask; // capacity - 1, the capacity is a power of two
+    // producers and consumers claim positions on separate cache lines
+    _Alignas(64) size_t enqueue_position;
+    _Alignas(64) size_t dequeue_position;
+} JobQueue;
+
+JobQueue *init_job_queue(size_t capacity);
+void free_job_queue(JobQueue *queue);
+bool job_queue_push(JobQueue *queue, int value);
+bool job_queue_pop(JobQueue *queue, int *value);
+
+#endif
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <time.h>
+#include <x86intrin.h>
+#include "tier.h"
+
+// The interpreter never waits for the compiler. A hot function is pushed to
+// a lock-free queue and the interpreter carries on; compiler threads take
+// jobs from the hottest non-empty queue, compile and publish the code
+// through VMFunction.native with a release store. The interpreter reads it
+// with an acquire load, so a function is either still interpreted or sees
+// fully written code.
+//
+// Hotness decides the queue: a function is submitted when its calls and
+// back edges reach the threshold and again each time they double, up to
+// TIER_PRIORITY_LEVELS times, so a function that keeps getting hotter while
+// it waits moves ahead of the others. A job whose queue is full is dropped,
+// the function comes back at the next doubling. Functions are claimed with a
+// compare and swap on their state, duplicate jobs find them claimed.
+//
+// A hot back edge asks for on-stack replacement code for its loop, a variant
+// of the function lowered to enter the loop body from an interpreter frame.
+// Loop jobs go to the hottest queue, an interpreted activation is stuck
+// until they are done; meanwhile its back edges look again every
+// TIER_OSR_POLL iterations. The entry function is never promoted, it only
+// runs once, but its loops are.
+//
+// Each hot function gets a module of its own holding its callees too, so
+// native code only ever calls native code. A callee shared by two hot
+// functions is compiled twice, which costs memory but keeps the interpreter
+// out of native frames and lets every module trap on its own.
+//
+// Native time is measured with the time stamp counter around each call from
+// the interpreter, clock_gettime would cost more than small functions run.
+
+typedef enum
+{
+    TIER_IDLE,
+    TIER_COMPILING,
+    TIER_DONE
+} TierState;
+
+static double now_seconds()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void publish(Tier *tier, JITModule *native)
+{
+    for (int f = 0; f < tier->program->function_count; f++)
+    {
+        VMFunction *function = tier->program->functions[f];
+        void *expected = NULL;
+        if (native->functions[f].entry == NULL || !jit_call_supported(function->param_count, function->param_types))
+            continue;
+        // a callee can be published by another module first, that one stays
+        if (__atomic_compare_exchange_n(&function->native, &expected, native, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            __atomic_fetch_add(&tier->stats.compiled, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void compile(Tier *tier, int function)
+{
+    uint8_t expected = TIER_IDLE;
+    if (!__atomic_compare_exchange_n(&tier->states[function], &expected, TIER_COMPILING, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return;
+    if (__atomic_load_n(&tier->program->functions[function]->native, __ATOMIC_ACQUIRE) == NULL)
+    {
+        uint64_t start = __rdtsc();
+        JITModule *native = jit_compile_function(tier->heap, tier->module, function, &tier->options.jit);
+        tier->modules[__atomic_fetch_add(&tier->module_count, 1, __ATOMIC_RELAXED)] = native;
+        publish(tier, native);
+        __atomic_fetch_add(&tier->stats.compile_ticks, __rdtsc() - start, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&tier->states[function], TIER_DONE, __ATOMIC_RELEASE);
+}
+
+static void compile_loop(Tier *tier, int loop)
+{
+    int job = tier->program->function_count + loop;
+    uint8_t expected = TIER_IDLE;
+    if (!__atomic_compare_exchange_n(&tier->states[job], &expected, TIER_COMPILING, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return;
+    int function = tier->loop_owner[loop];
+    VMLoop *target = &tier->program->functions[function]->loops[loop - tier->loop_first[function]];
+    uint64_t start = __rdtsc();
+    IRFunction *osr = lower_osr_function(tier->parser, tier->module, function, target->node);
+    if (osr)
+    {
+        optimize_function(osr, tier->module, &tier->options.opt, NULL);
+        JITModule *native = jit_compile_osr(tier->heap, tier->module, osr, &tier->options.jit);
+        free_ir_function(osr);
+        tier->modules[__atomic_fetch_add(&tier->module_count, 1, __ATOMIC_RELAXED)] = native;
+        publish(tier, native);
+        __atomic_store_n(&target->native, native, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&tier->stats.loops_compiled, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&tier->stats.compile_ticks, __rdtsc() - start, __ATOMIC_RELAXED);
+    __atomic_store_n(&tier->states[job], TIER_DONE, __ATOMIC_RELEASE);
+}
+
+static void run_job(Tier *tier, int job)
+{
+    if (job < tier->program->function_count)
+        compile(tier, job);
+    else
+        compile_loop(tier, job - tier->program->function_count);
+}
+
+static bool take_job(Tier *tier, int *job)
+{
+    for (int level = TIER_PRIORITY_LEVELS - 1; level >= 0; level--)
+    {
+        if (job_queue_pop(tier->queues[level], job))
+            return true;
+    }
+    return false;
+}
+
+static void *compiler_thread(void *data)
+{
+    Tier *tier = data;
+    while (true)
+    {
+        while (sem_wait(&tier->jobs) != 0)
+            ;
+        if (__atomic_load_n(&tier->stopping, __ATOMIC_ACQUIRE))
+            return NULL;
+        int job;
+        if (take_job(tier, &job))
+            run_job(tier, job);
+    }
+}
+
+// false when the queue of the level is full
+static bool submit(Tier *tier, int level, int job)
+{
+    if (tier->options.threads == 0)
+    {
+        tier->stats.submitted++;
+        run_job(tier, job);
+        return true;
+    }
+    if (!job_queue_push(tier->queues[level], job))
+    {
+        tier->stats.dropped++;
+        return false;
+    }
+    tier->stats.submitted++;
+    sem_post(&tier->jobs);
+    return true;
+}
+
+static void promote(Tier *tier, VMFunction *function, uint64_t heat)
+{
+    uint32_t *promote_at = &tier->promote_at[function->index];
+    if (__atomic_load_n(&function->native, __ATOMIC_ACQUIRE) != NULL)
+    {
+        *promote_at = UINT32_MAX;
+        return;
+    }
+    if (!jit_call_supported(function->param_count, function->param_types))
+    {
+        tier->stats.rejected++;
+        *promote_at = UINT32_MAX;
+        return;
+    }
+
+    int level = 0;
+    while (level + 1 < TIER_PRIORITY_LEVELS && heat >= (uint64_t)tier->options.threshold << (level + 1))
+        level++;
+    uint64_t next = (uint64_t)tier->options.threshold << (level + 1);
+    *promote_at = level + 1 == TIER_PRIORITY_LEVELS || next >= UINT32_MAX ? UINT32_MAX : (uint32_t)next;
+    submit(tier, level, function->index);
+}
+
+static uint32_t next_poll(uint64_t heat)
+{
+    return heat + TIER_OSR_POLL >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)(heat + TIER_OSR_POLL);
+}
+
+static void update_hot_at(Tier *tier, VMFunction *function)
+{
+    uint32_t promote_at = tier->promote_at[function->index];
+    uint32_t poll_at = tier->poll_at[function->index];
+    function->hot_at = promote_at < poll_at ? promote_at : poll_at;
+}
+
+static void tier_promote(void *data, VMFunction *function)
+{
+    Tier *tier = data;
+    uint64_t heat = (uint64_t)function->call_count + function->back_edge_count;
+    if (heat >= tier->promote_at[function->index])
+        promote(tier, function, heat);
+    // an activation may still wait for its loop code
+    if (heat >= tier->poll_at[function->index])
+        tier->poll_at[function->index] = next_poll(heat);
+    update_hot_at(tier, function);
+}
+
+static bool tier_enter_loop(void *data, VMFunction *function, VMLoop *loop, VMValue *frame, VMStatus *status, const char **error)
+{
+    Tier *tier = data;
+    uint64_t heat = (uint64_t)function->call_count + function->back_edge_count;
+    if (heat >= tier->promote_at[function->index])
+        promote(tier, function, heat);
+
+    int index = tier->loop_first[function->index] + (int)(loop - function->loops);
+    JITModule *native = __atomic_load_n(&loop->native, __ATOMIC_ACQUIRE);
+    if (native == NULL && !tier->loop_requested[index])
+    {
+        tier->loop_requested[index] = submit(tier, TIER_PRIORITY_LEVELS - 1, tier->program->function_count + index);
+        native = __atomic_load_n(&loop->native, __ATOMIC_ACQUIRE);
+    }
+    if (native == NULL)
+    {
+        tier->poll_at[function->index] = next_poll(heat);
+        update_hot_at(tier, function);
+        return false;
+    }
+    tier->poll_at[function->index] = UINT32_MAX;
+    update_hot_at(tier, function);
+
+    JITValue result;
+    uint64_t start = __rdtsc();
+    JITStatus jit_status = jit_call_osr(native, (const JITValue *)frame, &result, error);
+    tier->stats.native_ticks += __rdtsc() - start;
+    tier->stats.loops_entered++;
+    frame[0].i = result.i;
+    *status = jit_status == JIT_OK ? VM_OK : VM_ERROR;
+    return true;
+}
+
+static VMStatus tier_call_native(void *data, VMFunction *function, VMValue *frame, const char **error)
+{
+    Tier *tier = data;
+    JITModule *native = __atomic_load_n(&function->native, __ATOMIC_ACQUIRE);
+    JITValue arguments[JIT_CALL_ARGUMENTS];
+    for (int i = 0; i < function->param_count; i++)
+    {
+        arguments[i].i = frame[i].i;
+    }
+
+    JITValue result;
+    uint64_t start = __rdtsc();
+    JITStatus status = jit_call(native, function->index, arguments, &result, error);
+    tier->stats.native_ticks += __rdtsc() - start;
+    tier->stats.native_calls++;
+    frame[0].i = result.i;
+    return status == JIT_OK ? VM_OK : VM_ERROR;
+}
+
+Tier *init_tier(Parser *parser, VMProgram *program, IRModule *module, CodeHeap *heap, const TierOptions *options)
+{
+    Tier *tier = calloc(1, sizeof(Tier));
+    if (!tier)
+    {
+        wprintf(L"Memory allocation failed for the tier.\n");
+        exit(1);
+    }
+    tier->hooks.data = tier;
+    tier->hooks.promote = tier_promote;
+    tier->hooks.call_native = tier_call_native;
+    tier->hooks.enter_loop = tier_enter_loop;
+    tier->parser = parser;
+    tier->program = program;
+    tier->module = module;
+    tier->heap = heap;
+    tier->options = *options;
+
+    tier->loop_first = malloc((program->function_count + 1) * sizeof(int));
+    for (int f = 0; f < program->function_count; f++)
+    {
+        tier->loop_first[f] = tier->loop_count;
+        tier->loop_count += program->functions[f]->loop_count;
+    }
+    tier->loop_owner = malloc((tier->loop_count + 1) * sizeof(int));
+    for (int f = 0; f < program->function_count; f++)
+    {
+        for (int k = 0; k < program->functions[f]->loop_count; k++)
+        {
+            tier->loop_owner[tier->loop_first[f] + k] = f;
+        }
+    }
+    int job_count = program->function_count + tier->loop_count;
+    tier->states = calloc(job_count + 1, sizeof(uint8_t));
+    tier->modules = malloc((job_count + 1) * sizeof(JITModule *));
+    tier->loop_requested = calloc(tier->loop_count + 1, sizeof(bool));
+    tier->promote_at = malloc((program->function_count + 1) * sizeof(uint32_t));
+    tier->poll_at = malloc((program->function_count + 1) * sizeof(uint32_t));
+
+    // the entry runs once, nothing would ever call its native code
+    for (int f = 0; f < program->function_count; f++)
+    {
+        tier->promote_at[f] = f == program->entry ? UINT32_MAX : options->threshold;
+        tier->poll_at[f] = UINT32_MAX;
+        program->functions[f]->hot_at = options->threshold;
+    }
+
+    for (int level = 0; level < TIER_PRIORITY_LEVELS; level++)
+    {
+        tier->queues[level] = init_job_queue(TIER_QUEUE_DEPTH);
+    }
+    sem_init(&tier->jobs, 0, 0);
+    tier->threads = malloc((options->threads + 1) * sizeof(pthread_t));
+    for (int t = 0; t < options->threads; t++)
+    {
+        if (pthread_create(&tier->threads[t], NULL, compiler_thread, tier) != 0)
+        {
+            wprintf(L"Cannot start a compiler thread.\n");
+            exit(1);
+        }
+    }
+
+    tier->start_seconds = now_seconds();
+    tier->start_ticks = __rdtsc();
+    return tier;
+}
+
+// compiler threads finish the function they are compiling, queued jobs are dropped
+void free_tier(Tier *tier)
+{
+    __atomic_store_n(&tier->stopping, true, __ATOMIC_RELEASE);
+    for (int t = 0; t < tier->options.threads; t++)
+    {
+        sem_post(&tier->jobs);
+    }
+    for (int t = 0; t < tier->options.threads; t++)
+    {
+        pthread_join(tier->threads[t], NULL);
+    }
+
+    for (int m = 0; m < tier->module_count; m++)
+    {
+        free_jit_module(tier->modules[m]);
+    }
+    for (int f = 0; f < tier->program->function_count; f++)
+    {
+        VMFunction *function = tier->program->functions[f];
+        function->native = NULL;
+        for (int k = 0; k < function->loop_count; k++)
+        {
+            function->loops[k].native = NULL;
+        }
+    }
+    for (int level = 0; level < TIER_PRIORITY_LEVELS; level++)
+    {
+        free_job_queue(tier->queues[level]);
+    }
+    sem_destroy(&tier->jobs);
+    free(tier->threads);
+    free(tier->modules);
+    free(tier->states);
+    free(tier->loop_first);
+    free(tier->loop_owner);
+    free(tier->loop_requested);
+    free(tier->promote_at);
+    free(tier->poll_at);
+    free(tier);
+}
+
+// the counter is calibrated against the clock over the whole run, compile
+// time only counts against the interpreter when there are no compiler threads
+void dump_tier_stats(Tier *tier, OutputBuffer *buffer)
+{
+    TierStats *stats = &tier->stats;
+    double seconds = now_seconds() - tier->start_seconds;
+    uint64_t ticks = __rdtsc() - tier->start_ticks;
+    double seconds_per_tick = ticks ? seconds / ticks : 0.0;
+    double native = stats->native_ticks * seconds_per_tick;
+    double compile = __atomic_load_n(&stats->compile_ticks, __ATOMIC_RELAXED) * seconds_per_tick;
+    double interpreter = seconds - native - (tier->options.threads == 0 ? compile : 0.0);
+
+    buffer_printf(buffer, "tier: threshold %u, %d compiler threads, %d jobs submitted, %d dropped, %d rejected\n", tier->options.threshold, tier->options.threads, stats->submitted, stats->dropped, stats->rejected);
+    buffer_printf(buffer, "  %d functions and %d loops compiled in %d modules, %d activations finished by on-stack replacement\n", __atomic_load_n(&stats->compiled, __ATOMIC_RELAXED), __atomic_load_n(&stats->loops_compiled, __ATOMIC_RELAXED), __atomic_load_n(&tier->module_count, __ATOMIC_RELAXED), stats->loops_entered);
+    buffer_printf(buffer, "  interpreter %.3f ms, native %.3f ms in %llu calls, compile %.3f ms%s\n", interpreter * 1e3, native * 1e3, (unsigned long long)stats->native_calls, compile * 1e3, tier->options.threads > 0 ? " in the background" : "");
+    for (int f = 0; f < tier->program->function_count; f++)
+    {
+        VMFunction *function = tier->program->functions[f];
+        buffer_printf(buffer, "  %-20s %10u calls %10u back edges  %s\n", function->name, function->call_count, function->back_edge_count, __atomic_load_n(&function->native, __ATOMIC_ACQUIRE) ? "native" : "interpreter");
+    }
+}
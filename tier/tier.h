@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "job_queue.h"
+#include "../ir/ir.h"
+#include "../opt/opt.h"
+#include "../vm/bytecode.h"
+#include "../jit/jit.h"
+#include "../jit/code_heap.h"
+#include "../buffer/buffer.h"
+#include "../defc/defc.h"
+
+#ifndef TIER_H
+#define TIER_H
+
+typedef struct
+{
+    uint32_t threshold; // calls plus loop back edges before a function is compiled
+    int threads; // background compiler threads, 0 compiles on the interpreter thread
+    JITOptions jit;
+    OptOptions opt; // also run over on-stack replacement variants
+} TierOptions;
+
+// where the time of a tiered run went, in time stamp counter ticks. Fields
+// written by compiler threads are updated atomically.
+typedef struct
+{
+    uint64_t native_ticks;
+    uint64_t compile_ticks;
+    uint64_t native_calls; // calls from the interpreter into native code
+    int submitted; // jobs handed to the queues, a function is submitted again at every priority level
+    int dropped; // jobs that found their queue full
+    int compiled; // functions with native code, including the callees compiled along
+    int rejected; // hot functions the interpreter cannot enter natively
+    int loops_compiled; // on-stack replacement variants
+    int loops_entered; // activations the interpreter finished in one
+} TierStats;
+
+// Tiered execution: the program starts in the bytecode interpreter and every
+// function that gets hot is compiled with the functions it calls into its
+// own JITModule. The interpreter switches to native code on the next call,
+// or at the next back edge through on-stack replacement code for the loop.
+typedef struct
+{
+    VMTier hooks;
+    Parser *parser;
+    VMProgram *program;
+    IRModule *module;
+    CodeHeap *heap;
+    TierOptions options;
+
+    // one queue per priority level, the hottest jobs are taken first
+    JobQueue *queues[TIER_PRIORITY_LEVELS];
+    sem_t jobs; // counts queued jobs, idle compiler threads sleep on it
+    pthread_t *threads;
+    bool stopping;
+
+    // jobs are function indices, loop k of function f is the job
+    // function_count + loop_first[f] + k
+    int *loop_first;
+    int *loop_owner;
+    int loop_count;
+
+    uint8_t *states; // TierState of every job
+    JITModule **modules; // at most one per job
+    int module_count;
+
+    // interpreter thread only: the next promotion of every function, the
+    // next look for loop code while an activation waits for it, and the
+    // loops already submitted
+    uint32_t *promote_at;
+    uint32_t *poll_at;
+    bool *loop_requested;
+
+    TierStats stats;
+    uint64_t start_ticks;
+    double start_seconds;
+} Tier;
+
+Tier *init_tier(Parser *parser, VMProgram *program, IRModule *module, CodeHeap *heap, const TierOptions *options);
+void free_tier(Tier *tier);
+void dump_tier_stats(Tier *tier, OutputBuffer *buffer);
+
+#endif
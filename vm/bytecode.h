@@ -0,0 +1,267 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "../parser/parser.h"
+#include "../buffer/buffer.h"
+#include "../ir/ir.h"
+
+#ifndef VM_BYTECODE_H
+#define VM_BYTECODE_H
+
+// Three address code over a frame of registers: variables take the first
+// registers (parameters lowest), temporaries follow. Every opcode is typed,
+// _I works on int registers, _F on float registers, comparisons write int.
+// Operands: a is the destination, b and c are sources, imm is an immediate,
+// a constant index, a function or an extern function, target is a jump offset from the next
+// instruction. AND_JUMP and OR_JUMP test like JUMP_IF_ZERO and
+// JUMP_IF_NOT_ZERO but a stays live as the result of && and ||. Conditional
+// jumps and calls keep their profile site in c, which they do not use
+// otherwise: 0 for none, else 1 + 2 * site, plus one when a taken jump
+// means the condition held. FMA_F computes b * (b + 1) + (b + 2), its
+// operands are placed like call arguments.
+// operand layout of an opcode, used by the dumper and the fusion pass
+typedef enum
+{
+    VM_FORMAT_A,    // a
+    VM_FORMAT_AB,   // a, b
+    VM_FORMAT_ABC,  // a, b, c
+    VM_FORMAT_AI,   // a, imm
+    VM_FORMAT_AK,   // a, constants[imm]
+    VM_FORMAT_ABI,  // a, b, imm
+    VM_FORMAT_ABK,  // a, b, constants[imm]
+    VM_FORMAT_T,    // target
+    VM_FORMAT_AT,   // a, target
+    VM_FORMAT_ABT,  // a, b, target
+    VM_FORMAT_AIT,  // a, imm, target
+    VM_FORMAT_CALL, // a, functions[imm]
+    VM_FORMAT_EXTERN, // a, externs[imm]
+} VMFormat;
+
+#define VM_OPCODES(X)  \
+    X(MOVE, AB)            \
+    X(LOADK, AI)           \
+    X(LOADK_CONST, AK)     \
+    X(ADD_I, ABC)           \
+    X(SUB_I, ABC)           \
+    X(MUL_I, ABC)           \
+    X(DIV_I, ABC)           \
+    X(POW_I, ABC)           \
+    X(NEG_I, AB)           \
+    X(AND_I, ABC)           \
+    X(OR_I, ABC)            \
+    X(NOT_I, AB)           \
+    X(ADD_F, ABC)           \
+    X(SUB_F, ABC)           \
+    X(MUL_F, ABC)           \
+    X(DIV_F, ABC)           \
+    X(POW_F, ABC)           \
+    X(NEG_F, AB)           \
+    X(EQ_I, ABC)            \
+    X(NE_I, ABC)            \
+    X(LT_I, ABC)            \
+    X(LE_I, ABC)            \
+    X(GT_I, ABC)            \
+    X(GE_I, ABC)            \
+    X(EQ_F, ABC)            \
+    X(NE_F, ABC)            \
+    X(LT_F, ABC)            \
+    X(LE_F, ABC)            \
+    X(GT_F, ABC)            \
+    X(GE_F, ABC)            \
+    X(TRUTH_I, AB)         \
+    X(TRUTH_F, AB)         \
+    X(LNOT_I, AB)          \
+    X(LNOT_F, AB)          \
+    X(ITOF, AB)            \
+    X(FTOI, AB)            \
+    X(SQRT_F, AB)          \
+    X(FMA_F, AB)           \
+    X(MIN_I, ABC)          \
+    X(MAX_I, ABC)          \
+    X(MIN_F, ABC)          \
+    X(MAX_F, ABC)          \
+    X(ABS_I, AB)           \
+    X(ABS_F, AB)           \
+    X(POPCOUNT_I, AB)      \
+    X(CLZ_I, AB)           \
+    X(CTZ_I, AB)           \
+    X(JUMP, T)            \
+    X(JUMP_IF_ZERO, AT)    \
+    X(JUMP_IF_NOT_ZERO, AT) \
+    X(AND_JUMP, AT)        \
+    X(OR_JUMP, AT)         \
+    X(CALL, CALL)            \
+    X(CALL_EXTERN, EXTERN)   \
+    X(RETURN, A)          \
+    VM_SUPERINSTRUCTIONS(X)
+
+// Fused sequences, only produced by fuse_superinstructions. _IMM and _K
+// forms take their right operand from imm or constants[imm], J<cc> compare a
+// with b (or imm) and jump, INC_JLT adds one to a first.
+#define VM_SUPERINSTRUCTIONS(X) \
+    X(ADD_I_IMM, ABI)           \
+    X(MUL_I_IMM, ABI)           \
+    X(DIV_I_IMM, ABI)           \
+    X(AND_I_IMM, ABI)           \
+    X(ADD_F_K, ABK)             \
+    X(SUB_F_K, ABK)             \
+    X(MUL_F_K, ABK)             \
+    X(EQ_I_IMM, ABI)            \
+    X(NE_I_IMM, ABI)            \
+    X(LT_I_IMM, ABI)            \
+    X(LE_I_IMM, ABI)            \
+    X(GT_I_IMM, ABI)            \
+    X(GE_I_IMM, ABI)            \
+    X(JEQ_I, ABT)               \
+    X(JNE_I, ABT)               \
+    X(JLT_I, ABT)               \
+    X(JLE_I, ABT)               \
+    X(JGT_I, ABT)               \
+    X(JGE_I, ABT)               \
+    X(JEQ_I_IMM, AIT)           \
+    X(JNE_I_IMM, AIT)           \
+    X(JLT_I_IMM, AIT)           \
+    X(JLE_I_IMM, AIT)           \
+    X(JGT_I_IMM, AIT)           \
+    X(JGE_I_IMM, AIT)           \
+    X(INC_JLT_I, ABT)           \
+    X(INC_JLT_I_IMM, AIT)
+
+#define VM_OPCODE_ENUM(name, format) OP_##name,
+typedef enum
+{
+    VM_OPCODES(VM_OPCODE_ENUM)
+        VM_OPCODE_COUNT
+} VMOpcode;
+#undef VM_OPCODE_ENUM
+
+typedef union
+{
+    int64_t i;
+    double f;
+} VMValue;
+
+typedef struct
+{
+    int32_t handler; // offset of the handler label, set when the function is threaded
+    uint16_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+    int32_t imm;
+    int32_t target;
+} VMInstruction;
+
+// a while or for statement, its back edge jumps to start
+typedef struct
+{
+    int32_t start; // first instruction of the body
+    int32_t node; // AST node of the statement
+    void *native; // on-stack replacement code entering at start, owned by the tier
+} VMLoop;
+
+typedef struct
+{
+    char *name;
+    int symbol;
+    int index; // in VMProgram.functions, the same as the IR function index
+    int param_count;
+    int local_count;
+    int register_count;
+    uint8_t return_type; // IRType of the result
+    uint8_t *param_types;
+
+    VMInstruction *code;
+    int code_size;
+    int code_count;
+    const int32_t *threaded; // handler table the code was threaded with, NULL before the first run
+
+    VMLoop *loops;
+    int loop_size;
+    int loop_count;
+
+    // counted by vm_call_tiered, a function is handed to VMTier.promote, or
+    // enter_loop at a back edge, when its calls and loop back edges reach
+    // hot_at, which the tier then moves
+    uint32_t call_count;
+    uint32_t back_edge_count;
+    uint32_t hot_at; // UINT32_MAX stops back edge counting
+    void *native; // compiled code owned by the tier, read and written atomically
+} VMFunction;
+
+typedef struct
+{
+    VMFunction **functions;
+    int function_size;
+    int function_count;
+    int entry;
+
+    // the C functions CALL_EXTERN calls, see ffi/ffi.c
+    IRExtern *externs;
+    int extern_count;
+
+    // 64 bit constants that do not fit an immediate
+    VMValue *constants;
+    int constant_size;
+    int constant_count;
+
+    // branch and call sites, counted by vm_call_profiled and vm_call_tiered
+    IRProfile *profile;
+} VMProgram;
+
+typedef enum
+{
+    VM_OK,
+    VM_ERROR
+} VMStatus;
+
+// dynamic instruction counts, collected by vm_call_profiled
+typedef struct
+{
+    uint64_t instruction_count;
+    uint64_t counts[VM_OPCODE_COUNT];
+    uint64_t pairs[VM_OPCODE_COUNT][VM_OPCODE_COUNT];
+} VMProfile;
+
+typedef struct VMFrame VMFrame;
+
+// Hooks of the tiered interpreter. promote queues a hot function for
+// compilation and may publish its code in VMFunction.native right away,
+// call_native runs a published function on the arguments at the start of
+// frame and leaves the result in frame[0], like an interpreted call.
+// enter_loop is called instead of promote at the back edges of a hot
+// function: it returns false while loop has no native code, otherwise the
+// rest of the activation ran natively from the variables in frame, with the
+// result left in frame[0] and *status telling whether it trapped.
+typedef struct
+{
+    void *data;
+    void (*promote)(void *data, VMFunction *function);
+    VMStatus (*call_native)(void *data, VMFunction *function, VMValue *frame, const char **error);
+    bool (*enter_loop)(void *data, VMFunction *function, VMLoop *loop, VMValue *frame, VMStatus *status, const char **error);
+} VMTier;
+
+typedef struct
+{
+    VMProgram *program;
+    VMValue *stack;
+    int stack_size;
+    VMFrame *frames;
+    const char *error;
+    VMTier *tier; // used by vm_call_tiered only
+} VM;
+
+VMProgram *compile_program(Parser *parser);
+void free_vm_program(VMProgram *program);
+void fuse_superinstructions(VMProgram *program);
+void dump_bytecode(VMProgram *program, OutputBuffer *buffer);
+const char *vm_opcode_name(VMOpcode op);
+VMFormat vm_opcode_format(VMOpcode op);
+
+VM *init_vm(VMProgram *program);
+void free_vm(VM *vm);
+VMStatus vm_call(VM *vm, int function, const VMValue *arguments, VMValue *result);
+VMStatus vm_call_profiled(VM *vm, int function, const VMValue *arguments, VMValue *result, VMProfile *profile);
+VMStatus vm_call_tiered(VM *vm, int function, const VMValue *arguments, VMValue *result);
+void dump_vm_profile(VMProfile *profile, int top, OutputBuffer *buffer);
+
+#endif
@@ -0,0 +1,1003 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <math.h>
+#include "bytecode.h"
+#include "../parser/parser.h"
+#include "../parser/visitor.h"
+#include "../semantic/semantic.h"
+#include "../semantic/types.h"
+#include "../ir/ir.h"
+#include "../defc/defc.h"
+#include "../ffi/ffi.h"
+
+// The bytecode compiler works straight from the checked AST so a program can
+// start running without building SSA first. It walks the tree with visit_ast
+// like the IR lowering: every expression leaves the register holding its
+// value on the value stack in the post callback, control flow is patched
+// from the pre callback of the children. Loops are emitted with the
+// condition at the bottom so an iteration costs a single conditional jump.
+//
+// Variables are read in place, temporaries are allocated like a stack right
+// above them, so the result of an expression is always the first free
+// register at its start. The code is deliberately naive, one instruction per
+// AST operation; fuse_superinstructions improves the common sequences.
+
+typedef struct
+{
+    int node;
+    int patches[2]; // jump instructions waiting for their target
+    int target;     // first instruction of a loop body
+    int base;       // calls: first argument register, && ||: result register
+} CompileControl;
+
+typedef struct
+{
+    Parser *parser;
+    VMProgram *program;
+    VMFunction *function;
+    int *function_of_symbol;
+    int *extern_of_symbol;
+    ASTVisitor visitor;
+
+    int *values;
+    int value_size;
+    int value_count;
+    int next_register;
+
+    // index of the last instruction that is a jump target, nothing may be
+    // retargeted across it
+    int label;
+
+    // nodes whose subtree assigns a variable
+    bool *writes;
+
+    CompileControl *controls;
+    int control_size;
+    int control_count;
+
+    int error_count;
+} CompileContext;
+
+#define VM_OPCODE_NAME(name, format) #name,
+static const char *vm_opcode_names[] = {VM_OPCODES(VM_OPCODE_NAME)};
+#undef VM_OPCODE_NAME
+
+#define VM_OPCODE_FORMAT(name, format) VM_FORMAT_##format,
+static const VMFormat vm_opcode_formats[] = {VM_OPCODES(VM_OPCODE_FORMAT)};
+#undef VM_OPCODE_FORMAT
+
+const char *vm_opcode_name(VMOpcode op)
+{
+    if (op < 0 || op >= VM_OPCODE_COUNT)
+        return "?";
+    return vm_opcode_names[op];
+}
+
+VMFormat vm_opcode_format(VMOpcode op)
+{
+    return vm_opcode_formats[op];
+}
+
+static void *grow_array(void *array, int *size, int needed, size_t element_size, int increment)
+{
+    if (needed <= *size)
+        return array;
+    while (*size < needed)
+        *size += increment;
+    array = realloc(array, *size * element_size);
+    if (!array)
+    {
+        wprintf(L"Memory allocation failed while resizing bytecode.\n");
+        exit(1);
+    }
+    return array;
+}
+
+static int emit(CompileContext *context, VMOpcode op, int a, int b, int c)
+{
+    VMFunction *function = context->function;
+    function->code = grow_array(function->code, &function->code_size, function->code_count + 1, sizeof(VMInstruction), VM_CODE_INCREMENT);
+    VMInstruction *instruction = &function->code[function->code_count];
+    instruction->handler = 0;
+    instruction->op = op;
+    instruction->a = a;
+    instruction->b = b;
+    instruction->c = c;
+    instruction->imm = 0;
+    instruction->target = 0;
+    return function->code_count++;
+}
+
+static int emit_immediate(CompileContext *context, VMOpcode op, int a, int32_t imm)
+{
+    int index = emit(context, op, a, 0, 0);
+    context->function->code[index].imm = imm;
+    return index;
+}
+
+// jump offsets are relative to the instruction after the jump
+static void patch_jump(CompileContext *context, int jump, int target)
+{
+    context->function->code[jump].target = target - (jump + 1);
+    if (target == context->function->code_count)
+        context->label = target;
+}
+
+static int emit_jump(CompileContext *context, VMOpcode op, int a, int target)
+{
+    int jump = emit(context, op, a, 0, 0);
+    patch_jump(context, jump, target);
+    return jump;
+}
+
+// gives the jump or call at index the profile site of node, holds when
+// taking the jump means the condition held
+static void add_site(CompileContext *context, int index, int node, IRSiteKind kind, bool holds)
+{
+    IRProfile *profile = context->program->profile;
+    if (profile->site_count >= VM_SITE_LIMIT && profile->site_of_node[node] < 0)
+        return;
+    int site = ir_profile_add_site(profile, node, kind);
+    context->function->code[index].c = 1 + 2 * site + holds;
+}
+
+static int add_constant(VMProgram *program, VMValue value)
+{
+    program->constants = grow_array(program->constants, &program->constant_size, program->constant_count + 1, sizeof(VMValue), VM_CONSTANT_INCREMENT);
+    program->constants[program->constant_count] = value;
+    return program->constant_count++;
+}
+
+static int allocate_register(CompileContext *context)
+{
+    int reg = context->next_register++;
+    if (context->next_register > context->function->register_count)
+        context->function->register_count = context->next_register;
+    if (reg > UINT16_MAX)
+    {
+        wprintf(L"%s: compile error: function '%s' needs too many registers\n", context->parser->file_name, context->function->name);
+        exit(1);
+    }
+    return reg;
+}
+
+static bool is_temporary(CompileContext *context, int reg)
+{
+    return reg >= context->function->local_count;
+}
+
+static void push_value(CompileContext *context, int reg)
+{
+    context->values = grow_array(context->values, &context->value_size, context->value_count + 1, sizeof(int), 64);
+    context->values[context->value_count++] = reg;
+}
+
+// temporaries are released in the reverse order they were allocated
+static int pop_value(CompileContext *context)
+{
+    int reg = context->values[--context->value_count];
+    if (is_temporary(context, reg))
+        context->next_register = reg;
+    return reg;
+}
+
+static void emit_int(CompileContext *context, int reg, int64_t value)
+{
+    if (value >= INT32_MIN && value <= INT32_MAX)
+    {
+        emit_immediate(context, OP_LOADK, reg, (int32_t)value);
+        return;
+    }
+    VMValue constant = {.i = value};
+    emit_immediate(context, OP_LOADK_CONST, reg, add_constant(context->program, constant));
+}
+
+static void emit_float(CompileContext *context, int reg, double value)
+{
+    // +0.0 has the same bits as integer zero
+    if (value == 0.0 && !signbit(value))
+    {
+        emit_immediate(context, OP_LOADK, reg, 0);
+        return;
+    }
+    VMValue constant = {.f = value};
+    emit_immediate(context, OP_LOADK_CONST, reg, add_constant(context->program, constant));
+}
+
+static bool writes_register_a(VMOpcode op)
+{
+    switch (op)
+    {
+    case OP_JUMP:
+    case OP_JUMP_IF_ZERO:
+    case OP_JUMP_IF_NOT_ZERO:
+    case OP_AND_JUMP:
+    case OP_OR_JUMP:
+    case OP_RETURN:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Places the value of source in destination. A temporary computed by the
+// last instruction is written to destination directly instead of copied.
+static void move_value(CompileContext *context, int destination, int source)
+{
+    VMFunction *function = context->function;
+    if (destination == source)
+        return;
+
+    int last = function->code_count - 1;
+    if (is_temporary(context, source) && last >= 0 && context->label != function->code_count && function->code[last].a == source && writes_register_a(function->code[last].op) && function->code[last].op != OP_CALL && function->code[last].op != OP_CALL_EXTERN)
+    {
+        function->code[last].a = destination;
+        return;
+    }
+    emit(context, OP_MOVE, destination, source, 0);
+}
+
+static CompileControl *push_control(CompileContext *context, int node)
+{
+    context->controls = grow_array(context->controls, &context->control_size, context->control_count + 1, sizeof(CompileControl), 16);
+    CompileControl *control = &context->controls[context->control_count++];
+    control->node = node;
+    control->patches[0] = control->patches[1] = -1;
+    control->target = -1;
+    control->base = -1;
+    return control;
+}
+
+static CompileControl *top_control(CompileContext *context, int node)
+{
+    if (context->control_count > 0 && context->controls[context->control_count - 1].node == node)
+        return &context->controls[context->control_count - 1];
+    return NULL;
+}
+
+static void compile_error(CompileContext *context, const wchar_t *message, const char *name)
+{
+    wprintf(L"%s: compile error: %ls '%s'\n", context->parser->file_name, message, name);
+    context->error_count++;
+}
+
+static bool is_float(Parser *parser, int node)
+{
+    return parser->ast_nodes[node].type_id == TYPE_FLOAT;
+}
+
+static bool is_short_circuit(ASTNode *node)
+{
+    return node->type == N_BINARY_EXPRESSION && (node->data.binary.operator== T_AND || node->data.binary.operator== T_OR);
+}
+
+// nodes whose int value is already 0 or 1
+static bool is_boolean(Parser *parser, int node)
+{
+    ASTNode *ast_node = &parser->ast_nodes[node];
+    if (ast_node->type == N_UNARY_EXPRESSION)
+        return ast_node->data.unary.operator== T_NOT;
+    if (ast_node->type != N_BINARY_EXPRESSION)
+        return false;
+
+    switch (ast_node->data.binary.operator)
+    {
+    case T_AND:
+    case T_OR:
+    case T_EQUAL:
+    case T_NOT_EQUAL:
+    case T_LESS:
+    case T_LESS_EQUAL:
+    case T_GREATER:
+    case T_GREATER_EQUAL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// writes the 0/1 value of the register holding node into destination
+static void emit_truth(CompileContext *context, int destination, int source, int node)
+{
+    if (is_float(context->parser, node))
+        emit(context, OP_TRUTH_F, destination, source, 0);
+    else if (!is_boolean(context->parser, node))
+        emit(context, OP_TRUTH_I, destination, source, 0);
+    else
+        move_value(context, destination, source);
+}
+
+// pops a condition and jumps on it, conditional jumps test the int bits so
+// only floats need converting
+static int emit_condition_jump(CompileContext *context, VMOpcode op, int node, int target)
+{
+    int reg = pop_value(context);
+    if (is_float(context->parser, node))
+    {
+        int truth = allocate_register(context);
+        emit(context, OP_TRUTH_F, truth, reg, 0);
+        context->next_register = truth;
+        reg = truth;
+    }
+    return emit_jump(context, op, reg, target);
+}
+
+static VMOpcode binary_opcode(TokenType type, bool is_float_operation)
+{
+    switch (type)
+    {
+    case T_PLUS:
+        return is_float_operation ? OP_ADD_F : OP_ADD_I;
+    case T_MINUS:
+        return is_float_operation ? OP_SUB_F : OP_SUB_I;
+    case T_MULTIPLY:
+        return is_float_operation ? OP_MUL_F : OP_MUL_I;
+    case T_DIVIDE:
+        return is_float_operation ? OP_DIV_F : OP_DIV_I;
+    case T_POWER:
+        return is_float_operation ? OP_POW_F : OP_POW_I;
+    case T_BAND:
+        return OP_AND_I;
+    case T_BOR:
+        return OP_OR_I;
+    case T_EQUAL:
+        return is_float_operation ? OP_EQ_F : OP_EQ_I;
+    case T_NOT_EQUAL:
+        return is_float_operation ? OP_NE_F : OP_NE_I;
+    case T_LESS:
+        return is_float_operation ? OP_LT_F : OP_LT_I;
+    case T_LESS_EQUAL:
+        return is_float_operation ? OP_LE_F : OP_LE_I;
+    case T_GREATER:
+        return is_float_operation ? OP_GT_F : OP_GT_I;
+    case T_GREATER_EQUAL:
+        return is_float_operation ? OP_GE_F : OP_GE_I;
+    default:
+        return VM_OPCODE_COUNT;
+    }
+}
+
+static int variable_register(CompileContext *context, int symbol)
+{
+    return context->parser->symbols[symbol]->slot;
+}
+
+// statements produce no value, an expression used as a statement has its
+// register released right away
+static bool value_is_discarded(Parser *parser, const ASTVisit *visit)
+{
+    if (visit->parent < 0)
+        return false;
+
+    ASTNode *parent = &parser->ast_nodes[visit->parent];
+    switch (parent->type)
+    {
+    case N_BLOCK:
+    case N_PROGRAM:
+        return true;
+    case N_IF:
+    case N_WHILE:
+        return visit->child_position > 0;
+    case N_FOR:
+        return visit->node != parent->data.for_statement.condition;
+    default:
+        return false;
+    }
+}
+
+// Arguments are evaluated into consecutive registers starting at the call
+// base, the callee frame starts there.
+static void place_argument(CompileContext *context, CompileControl *control, int position)
+{
+    int destination = control->base + position;
+    int reg = pop_value(context);
+    if (reg != destination)
+        emit(context, OP_MOVE, destination, reg, 0);
+    context->next_register = destination;
+    allocate_register(context);
+}
+
+// Calls and fma place their arguments in consecutive registers, the other
+// intrinsics take their operands like the operators do
+static bool places_arguments(ASTNode *node)
+{
+    return node->type == N_CALL && (node->data.call.intrinsic < 0 || node->data.call.intrinsic == INTRINSIC_FMA);
+}
+
+static void enter_child(CompileContext *context, Parser *parser, const ASTVisit *visit)
+{
+    ASTNode *parent = &parser->ast_nodes[visit->parent];
+    CompileControl *control = top_control(context, visit->parent);
+
+    // a variable read earlier in the expression must keep its old value
+    // when a later operand assigns it
+    if ((parent->type == N_BINARY_EXPRESSION || parent->type == N_CALL) && control == NULL && visit->child_position == 1 && context->writes[visit->node])
+    {
+        int reg = context->values[context->value_count - 1];
+        if (!is_temporary(context, reg))
+        {
+            pop_value(context);
+            int copy = allocate_register(context);
+            emit(context, OP_MOVE, copy, reg, 0);
+            push_value(context, copy);
+        }
+    }
+
+    if (control == NULL)
+        return;
+
+    switch (parent->type)
+    {
+    case N_IF:
+        if (visit->child_position == 1)
+        {
+            control->patches[0] = emit_condition_jump(context, OP_JUMP_IF_ZERO, parent->data.if_statement.condition, 0);
+            add_site(context, control->patches[0], visit->parent, IR_SITE_BRANCH, false);
+        }
+        else if (visit->child_position == 2)
+        {
+            control->patches[1] = emit_jump(context, OP_JUMP, 0, 0);
+            patch_jump(context, control->patches[0], context->function->code_count);
+            control->patches[0] = -1;
+        }
+        break;
+    case N_WHILE:
+        if (visit->child_position == 1)
+        {
+            control->patches[0] = emit_condition_jump(context, OP_JUMP_IF_ZERO, parent->data.while_statement.condition, 0);
+            add_site(context, control->patches[0], visit->parent, IR_SITE_BRANCH, false);
+            control->target = context->label = context->function->code_count;
+        }
+        break;
+    case N_FOR:
+        if (visit->node == parent->data.for_statement.body)
+        {
+            if (parent->data.for_statement.condition >= 0)
+            {
+                control->patches[0] = emit_condition_jump(context, OP_JUMP_IF_ZERO, parent->data.for_statement.condition, 0);
+                add_site(context, control->patches[0], visit->parent, IR_SITE_BRANCH, false);
+            }
+            control->target = context->label = context->function->code_count;
+        }
+        break;
+    case N_BINARY_EXPRESSION:
+        if (visit->child_position == 1)
+        {
+            // && keeps a false left operand as its result, || a true one
+            int left = pop_value(context);
+            control->base = allocate_register(context);
+            emit_truth(context, control->base, left, parent->data.binary.left);
+            bool is_and = parent->data.binary.operator== T_AND;
+            control->patches[0] = emit_jump(context, is_and ? OP_AND_JUMP : OP_OR_JUMP, control->base, 0);
+            add_site(context, control->patches[0], visit->parent, IR_SITE_BRANCH, !is_and);
+        }
+        break;
+    case N_CALL:
+        if (visit->child_position > 0)
+            place_argument(context, control, visit->child_position - 1);
+        break;
+    default:
+        break;
+    }
+}
+
+static VisitAction compile_pre(Parser *parser, const ASTVisit *visit, void *data)
+{
+    CompileContext *context = data;
+    ASTNode *node = &parser->ast_nodes[visit->node];
+
+    // nested function definitions are compiled as functions of their own
+    if (node->type == N_FUNCTION_DECLARATION || node->type == N_FUNCTION_PROTOTYPE)
+        return VISIT_SKIP;
+
+    if (visit->parent >= 0)
+        enter_child(context, parser, visit);
+
+    if (node->type == N_IF || node->type == N_WHILE || node->type == N_FOR || is_short_circuit(node))
+        push_control(context, visit->node);
+    else if (places_arguments(node))
+        push_control(context, visit->node)->base = context->next_register;
+
+    return VISIT_CONTINUE;
+}
+
+// the bottom test of a loop, the condition is compiled a second time there.
+// The loop is recorded for on-stack replacement, which enters at its body.
+static void close_loop(CompileContext *context, CompileControl *control, int node, int condition)
+{
+    VMFunction *function = context->function;
+    function->loops = grow_array(function->loops, &function->loop_size, function->loop_count + 1, sizeof(VMLoop), VM_LOOP_INCREMENT);
+    function->loops[function->loop_count++] = (VMLoop){control->target, node, NULL};
+
+    if (condition >= 0)
+    {
+        visit_ast(context->parser, condition, &context->visitor);
+        int jump = emit_condition_jump(context, OP_JUMP_IF_NOT_ZERO, condition, control->target);
+        add_site(context, jump, node, IR_SITE_BRANCH, true);
+    }
+    else
+        emit_jump(context, OP_JUMP, 0, control->target);
+
+    if (control->patches[0] >= 0)
+        patch_jump(context, control->patches[0], context->function->code_count);
+}
+
+static void compile_update(CompileContext *context, ASTNode *node, bool discarded)
+{
+    int variable = variable_register(context, node->data.update.declaration);
+    bool is_float_update = node->type_id == TYPE_FLOAT;
+    bool increment = node->data.update.operator== T_INCREMENT;
+    int result = variable;
+
+    if (!node->data.update.prefix && !discarded)
+    {
+        result = allocate_register(context);
+        emit(context, OP_MOVE, result, variable, 0);
+    }
+
+    int one = allocate_register(context);
+    if (is_float_update)
+        emit_float(context, one, 1.0);
+    else
+        emit_immediate(context, OP_LOADK, one, 1);
+    emit(context, is_float_update ? (increment ? OP_ADD_F : OP_SUB_F) : (increment ? OP_ADD_I : OP_SUB_I), variable, variable, one);
+    context->next_register = one;
+
+    push_value(context, result);
+}
+
+static void compile_intrinsic(CompileContext *context, Parser *parser, int index)
+{
+    ASTNode *node = &parser->ast_nodes[index];
+    bool float_operands = is_float(parser, parser->ast_lists[node->data.call.first_argument]);
+    VMOpcode op;
+    switch (node->data.call.intrinsic)
+    {
+    case INTRINSIC_SQRT:
+        op = OP_SQRT_F;
+        break;
+    case INTRINSIC_MIN:
+        op = float_operands ? OP_MIN_F : OP_MIN_I;
+        break;
+    case INTRINSIC_MAX:
+        op = float_operands ? OP_MAX_F : OP_MAX_I;
+        break;
+    case INTRINSIC_ABS:
+        op = float_operands ? OP_ABS_F : OP_ABS_I;
+        break;
+    case INTRINSIC_POPCOUNT:
+        op = OP_POPCOUNT_I;
+        break;
+    case INTRINSIC_CLZ:
+        op = OP_CLZ_I;
+        break;
+    case INTRINSIC_CTZ:
+        op = OP_CTZ_I;
+        break;
+    default:
+    {
+        CompileControl *control = top_control(context, index);
+        place_argument(context, control, node->data.call.argument_count - 1);
+        context->next_register = control->base;
+        int reg = allocate_register(context);
+        emit(context, OP_FMA_F, reg, control->base, 0);
+        push_value(context, reg);
+        context->control_count--;
+        return;
+    }
+    }
+
+    int right = node->data.call.argument_count > 1 ? pop_value(context) : 0;
+    int left = pop_value(context);
+    int reg = allocate_register(context);
+    emit(context, op, reg, left, right);
+    push_value(context, reg);
+}
+
+static VisitAction compile_post(Parser *parser, const ASTVisit *visit, void *data)
+{
+    CompileContext *context = data;
+    ASTNode *node = &parser->ast_nodes[visit->node];
+
+    switch (node->type)
+    {
+    case N_LITERAL:
+    {
+        int reg = allocate_register(context);
+        if (node->data.literal.literal_type == LITERAL_FLOAT)
+            emit_float(context, reg, strtod(node->data.literal.value, NULL));
+        else
+            emit_int(context, reg, strtoll(node->data.literal.value, NULL, 10));
+        push_value(context, reg);
+        break;
+    }
+    case N_IDENTIFIER:
+        push_value(context, variable_register(context, node->data.identifier.declaration));
+        break;
+    case N_ASSIGNMENT:
+    {
+        int variable = variable_register(context, node->data.assignment.declaration);
+        move_value(context, variable, pop_value(context));
+        push_value(context, variable);
+        break;
+    }
+    case N_VARIABLE_DECLARATION:
+    {
+        int variable = variable_register(context, node->data.variable_declaration.declaration);
+        // zero bits are 0 for both types
+        if (node->data.variable_declaration.expression < 0)
+            emit_immediate(context, OP_LOADK, variable, 0);
+        else
+            move_value(context, variable, pop_value(context));
+        break;
+    }
+    case N_UPDATE:
+        compile_update(context, node, value_is_discarded(parser, visit));
+        break;
+    case N_CAST:
+    {
+        bool from_float = is_float(parser, node->data.cast.expression);
+        bool to_float = node->type_id == TYPE_FLOAT;
+        if (from_float != to_float)
+        {
+            int operand = pop_value(context);
+            int reg = allocate_register(context);
+            emit(context, to_float ? OP_ITOF : OP_FTOI, reg, operand, 0);
+            push_value(context, reg);
+        }
+        break;
+    }
+    case N_UNARY_EXPRESSION:
+    {
+        bool operand_float = is_float(parser, node->data.unary.expression);
+        VMOpcode op;
+        switch (node->data.unary.operator)
+        {
+        case T_MINUS:
+            op = operand_float ? OP_NEG_F : OP_NEG_I;
+            break;
+        case T_NOT:
+            op = operand_float ? OP_LNOT_F : OP_LNOT_I;
+            break;
+        case T_BNOT:
+            op = OP_NOT_I;
+            break;
+        default:
+            op = VM_OPCODE_COUNT;
+        }
+        if (op != VM_OPCODE_COUNT)
+        {
+            int operand = pop_value(context);
+            int reg = allocate_register(context);
+            emit(context, op, reg, operand, 0);
+            push_value(context, reg);
+        }
+        break;
+    }
+    case N_BINARY_EXPRESSION:
+    {
+        if (is_short_circuit(node))
+        {
+            CompileControl *control = top_control(context, visit->node);
+            int right = pop_value(context);
+            emit_truth(context, control->base, right, node->data.binary.right);
+            context->next_register = control->base + 1;
+            patch_jump(context, control->patches[0], context->function->code_count);
+            push_value(context, control->base);
+            context->control_count--;
+            break;
+        }
+
+        VMOpcode op = binary_opcode(node->data.binary.operator, is_float(parser, node->data.binary.left));
+        int right = pop_value(context);
+        int left = pop_value(context);
+        int reg = allocate_register(context);
+        if (op == VM_OPCODE_COUNT)
+            compile_error(context, L"cannot compile operator", operator_to_string(node->data.binary.operator));
+        else
+            emit(context, op, reg, left, right);
+        push_value(context, reg);
+        break;
+    }
+    case N_CALL:
+    {
+        if (node->data.call.intrinsic >= 0)
+        {
+            compile_intrinsic(context, parser, visit->node);
+            break;
+        }
+        CompileControl *control = top_control(context, visit->node);
+        int count = node->data.call.argument_count;
+        if (count > 0)
+            place_argument(context, control, count - 1);
+
+        parser_declaration *callee = parser->symbols[node->data.call.declaration];
+        if (callee->is_extern)
+        {
+            context->next_register = control->base;
+            int reg = allocate_register(context);
+            emit_immediate(context, OP_CALL_EXTERN, reg, context->extern_of_symbol[callee->index]);
+            push_value(context, reg);
+            context->control_count--;
+            break;
+        }
+        int callee_index = context->function_of_symbol[callee->index];
+        if (callee_index < 0)
+            compile_error(context, L"call to function without definition", callee->literal.value);
+
+        // the result replaces the first argument
+        context->next_register = control->base;
+        int reg = allocate_register(context);
+        int call = emit_immediate(context, OP_CALL, reg, callee_index);
+        add_site(context, call, visit->node, IR_SITE_CALL, true);
+        push_value(context, reg);
+        context->control_count--;
+        break;
+    }
+    case N_RETURN:
+    {
+        int reg;
+        if (node->data.return_statement.expression >= 0)
+            reg = pop_value(context);
+        else
+        {
+            reg = allocate_register(context);
+            emit_immediate(context, OP_LOADK, reg, 0);
+            context->next_register = reg;
+        }
+        emit(context, OP_RETURN, reg, 0, 0);
+        break;
+    }
+    case N_IF:
+    {
+        CompileControl *control = top_control(context, visit->node);
+        int end = context->function->code_count;
+        if (control->patches[0] >= 0)
+            patch_jump(context, control->patches[0], end);
+        if (control->patches[1] >= 0)
+            patch_jump(context, control->patches[1], end);
+        context->control_count--;
+        break;
+    }
+    case N_WHILE:
+    {
+        CompileControl control = *top_control(context, visit->node);
+        context->control_count--;
+        close_loop(context, &control, visit->node, node->data.while_statement.condition);
+        break;
+    }
+    case N_FOR:
+    {
+        CompileControl control = *top_control(context, visit->node);
+        context->control_count--;
+        close_loop(context, &control, visit->node, node->data.for_statement.condition);
+        break;
+    }
+    case N_BLOCK:
+    case N_PROGRAM:
+    case N_FUNCTION_DECLARATION:
+    case N_FUNCTION_PROTOTYPE:
+    case N_PARAMETER:
+        break;
+    default:
+        compile_error(context, L"cannot compile node", node_type_to_string(node->type));
+    }
+
+    bool has_value = node->type_id == TYPE_INT || node->type_id == TYPE_FLOAT;
+    if (has_value && value_is_discarded(parser, visit))
+        pop_value(context);
+
+    return VISIT_CONTINUE;
+}
+
+static VisitAction find_writes(Parser *parser, const ASTVisit *visit, void *data)
+{
+    CompileContext *context = data;
+    ASTNode *node = &parser->ast_nodes[visit->node];
+    bool writes = node->type == N_ASSIGNMENT || node->type == N_UPDATE;
+
+    if (node->type != N_FUNCTION_DECLARATION && node->type != N_FUNCTION_PROTOTYPE)
+    {
+        for (int position = 0, child; (child = ast_node_child(parser, visit->node, position)) >= 0; position++)
+        {
+            writes = writes || context->writes[child];
+        }
+    }
+    context->writes[visit->node] = writes;
+    return VISIT_CONTINUE;
+}
+
+static VisitAction skip_functions(Parser *parser, const ASTVisit *visit, void *data)
+{
+    (void)data;
+    ASTNode *node = &parser->ast_nodes[visit->node];
+    return node->type == N_FUNCTION_DECLARATION || node->type == N_FUNCTION_PROTOTYPE ? VISIT_SKIP : VISIT_CONTINUE;
+}
+
+static void compile_function(CompileContext *context, VMFunction *function, parser_declaration *symbol)
+{
+    Parser *parser = context->parser;
+    context->function = function;
+    context->value_count = 0;
+    context->control_count = 0;
+    context->next_register = function->local_count;
+    context->label = -1;
+    function->register_count = function->local_count;
+
+    int root = symbol->definition;
+    if (parser->ast_nodes[root].type == N_FUNCTION_DECLARATION)
+        root = parser->ast_nodes[root].data.function_declaration.body;
+
+    ASTVisitor write_visitor = {skip_functions, find_writes, context};
+    visit_ast(parser, root, &write_visitor);
+    visit_ast(parser, root, &context->visitor);
+
+    // falling off the end returns zero
+    int reg = allocate_register(context);
+    emit_immediate(context, OP_LOADK, reg, 0);
+    emit(context, OP_RETURN, reg, 0, 0);
+}
+
+VMProgram *compile_program(Parser *parser)
+{
+    VMProgram *program = calloc(1, sizeof(VMProgram));
+    program->entry = -1;
+    program->profile = init_ir_profile(parser->ast_count);
+
+    CompileContext context;
+    memset(&context, 0, sizeof(CompileContext));
+    context.parser = parser;
+    context.program = program;
+    context.visitor = (ASTVisitor){compile_pre, compile_post, &context};
+    context.function_of_symbol = malloc((parser->symbol_count + 1) * sizeof(int));
+    context.writes = calloc(parser->ast_count + 1, sizeof(bool));
+    context.extern_of_symbol = malloc((parser->symbol_count + 1) * sizeof(int));
+    program->extern_count = collect_extern_functions(parser, &program->externs, context.extern_of_symbol);
+
+    // functions are numbered in symbol order, the same numbering lower_program uses
+    for (int i = 0; i < parser->symbol_count; i++)
+    {
+        parser_declaration *symbol = parser->symbols[i];
+        context.function_of_symbol[i] = -1;
+        if (symbol->type != FUNCTION_DECLARATION || symbol->definition < 0)
+            continue;
+
+        Type *type = get_type(parser->types, symbol->type_id);
+        VMFunction *function = calloc(1, sizeof(VMFunction));
+        function->name = strdup(symbol->literal.value);
+        function->symbol = i;
+        function->index = program->function_count;
+        function->return_type = ir_type_of(type->base);
+        function->param_count = type->param_count;
+        function->local_count = symbol->local_count;
+        function->param_types = malloc(type->param_count + 1);
+        for (int k = 0; k < type->param_count; k++)
+        {
+            function->param_types[k] = ir_type_of(type_param(parser->types, symbol->type_id, k));
+        }
+
+        program->functions = grow_array(program->functions, &program->function_size, program->function_count + 1, sizeof(VMFunction *), IR_FUNCTION_INCREMENT);
+        context.function_of_symbol[i] = program->function_count;
+        if (i == parser->entry_function)
+            program->entry = program->function_count;
+        program->functions[program->function_count++] = function;
+    }
+
+    for (int i = 0; i < program->function_count; i++)
+    {
+        VMFunction *function = program->functions[i];
+        compile_function(&context, function, parser->symbols[function->symbol]);
+    }
+
+    free(context.function_of_symbol);
+    free(context.extern_of_symbol);
+    free(context.writes);
+    free(context.values);
+    free(context.controls);
+
+    if (context.error_count > 0)
+    {
+        free_vm_program(program);
+        return NULL;
+    }
+    return program;
+}
+
+void free_vm_program(VMProgram *program)
+{
+    for (int i = 0; i < program->function_count; i++)
+    {
+        VMFunction *function = program->functions[i];
+        free(function->name);
+        free(function->param_types);
+        free(function->code);
+        free(function->loops);
+        free(function);
+    }
+    free(program->functions);
+    free_extern_functions(program->externs, program->extern_count);
+    free(program->constants);
+    free_ir_profile(program->profile);
+    free(program);
+}
+
+static const char *value_type_name(uint8_t type)
+{
+    return type == IR_FLOAT ? "float" : "int";
+}
+
+static void dump_instruction(VMProgram *program, VMInstruction *instruction, int index, OutputBuffer *buffer)
+{
+    int target = index + 1 + instruction->target;
+    VMValue constant = {0};
+    buffer_printf(buffer, "  %4d  %-18s", index, vm_opcode_name(instruction->op));
+
+    switch (vm_opcode_format(instruction->op))
+    {
+    case VM_FORMAT_A:
+        buffer_printf(buffer, "r%d", instruction->a);
+        break;
+    case VM_FORMAT_AB:
+        buffer_printf(buffer, "r%d, r%d", instruction->a, instruction->b);
+        break;
+    case VM_FORMAT_ABC:
+        buffer_printf(buffer, "r%d, r%d, r%d", instruction->a, instruction->b, instruction->c);
+        break;
+    case VM_FORMAT_AI:
+        buffer_printf(buffer, "r%d, %d", instruction->a, instruction->imm);
+        break;
+    case VM_FORMAT_AK:
+        constant = program->constants[instruction->imm];
+        buffer_printf(buffer, "r%d, #%d ; %lld / %g", instruction->a, instruction->imm, (long long)constant.i, constant.f);
+        break;
+    case VM_FORMAT_ABI:
+        buffer_printf(buffer, "r%d, r%d, %d", instruction->a, instruction->b, instruction->imm);
+        break;
+    case VM_FORMAT_ABK:
+        constant = program->constants[instruction->imm];
+        buffer_printf(buffer, "r%d, r%d, #%d ; %g", instruction->a, instruction->b, instruction->imm, constant.f);
+        break;
+    case VM_FORMAT_T:
+        buffer_printf(buffer, "-> %d", target);
+        break;
+    case VM_FORMAT_AT:
+        buffer_printf(buffer, "r%d -> %d", instruction->a, target);
+        break;
+    case VM_FORMAT_ABT:
+        buffer_printf(buffer, "r%d, r%d -> %d", instruction->a, instruction->b, target);
+        break;
+    case VM_FORMAT_AIT:
+        buffer_printf(buffer, "r%d, %d -> %d", instruction->a, instruction->imm, target);
+        break;
+    case VM_FORMAT_CALL:
+        buffer_printf(buffer, "r%d, @%s", instruction->a, program->functions[instruction->imm]->name);
+        break;
+    case VM_FORMAT_EXTERN:
+        buffer_printf(buffer, "r%d, @%s", instruction->a, program->externs[instruction->imm].name);
+        break;
+    }
+    buffer_append_char(buffer, '\n');
+}
+
+void dump_bytecode(VMProgram *program, OutputBuffer *buffer)
+{
+    for (int f = 0; f < program->function_count; f++)
+    {
+        VMFunction *function = program->functions[f];
+        buffer_printf(buffer, "function @%s(", function->name);
+        for (int k = 0; k < function->param_count; k++)
+        {
+            buffer_printf(buffer, "%s%s", k ? ", " : "", value_type_name(function->param_types[k]));
+        }
+        buffer_printf(buffer, ") -> %s ; locals %d, registers %d\n", value_type_name(function->return_type), function->local_count, function->register_count);
+
+        for (int i = 0; i < function->code_count; i++)
+        {
+            dump_instruction(program, &function->code[i], i, buffer);
+        }
+        if (f + 1 < program->function_count)
+            buffer_append_char(buffer, '\n');
+    }
+}
@@ -0,0 +1,434 @@
+// Body of the interpreter loop, included three times by vm.c: with nothing
+// defined it gives the direct threaded vm_call, VM_PROFILING gives
+// vm_call_profiled which dispatches through a label table and counts every
+// instruction and every pair of consecutive instructions, VM_TIERING gives
+// vm_call_tiered which counts calls and loop back edges per function and
+// calls functions that have native code through the tier. Both also count
+// the branch and call sites of the program profile.
+
+#ifdef VM_PROFILING
+VMStatus vm_call_profiled(VM *vm, int function_index, const VMValue *arguments, VMValue *result, VMProfile *profile)
+#elif defined(VM_TIERING)
+VMStatus vm_call_tiered(VM *vm, int function_index, const VMValue *arguments, VMValue *result)
+#else
+VMStatus vm_call(VM *vm, int function_index, const VMValue *arguments, VMValue *result)
+#endif
+{
+#ifdef VM_PROFILING
+#define VM_OPCODE_LABEL(name, format) &&op_##name,
+    static const void *const labels[] = {VM_OPCODES(VM_OPCODE_LABEL)};
+#undef VM_OPCODE_LABEL
+    int previous = VM_OPCODE_COUNT;
+#define DISPATCH()                                   \
+    do                                               \
+    {                                                \
+        int op = pc->op;                             \
+        profile->instruction_count++;                \
+        profile->counts[op]++;                       \
+        if (previous != VM_OPCODE_COUNT)             \
+            profile->pairs[previous][op]++;          \
+        previous = op;                               \
+        goto *labels[op];                            \
+    } while (0)
+#else
+#define VM_OPCODE_OFFSET(name, format) &&op_##name - &&op_MOVE,
+    static const int32_t handler_offsets[] = {VM_OPCODES(VM_OPCODE_OFFSET)};
+#undef VM_OPCODE_OFFSET
+#define DISPATCH() goto *(&&op_MOVE + pc->handler)
+
+    thread_program(vm->program, handler_offsets);
+#endif
+
+    VMProgram *program = vm->program;
+    VMFrame *frames = vm->frames;
+    VMFrame *frame = frames;
+    VMFunction *function = program->functions[function_index];
+    const VMValue *constants = program->constants;
+    VMValue *stack_end = vm->stack + vm->stack_size;
+    VMValue *fp = vm->stack;
+    const VMInstruction *pc = function->code;
+
+    if (function->register_count > vm->stack_size)
+        goto stack_overflow;
+    if (function->param_count > 0)
+        memcpy(fp, arguments, function->param_count * sizeof(VMValue));
+    memset(fp + function->param_count, 0, (function->local_count - function->param_count) * sizeof(VMValue));
+    frame->return_pc = NULL;
+    frame->fp = fp;
+    frame->function = function;
+
+#ifdef VM_TIERING
+    // a back edge jumps to itself or an earlier instruction, counting stops
+    // once the tier has nothing left to do so hot loops only pay a test. A
+    // hot back edge may hand the rest of the activation to native code.
+    VMStatus osr_status = VM_OK;
+#define COUNT_BACK_EDGE()                    \
+    do                                       \
+    {                                        \
+        if (pc->target < 0 && frame->function->hot_at != UINT32_MAX) \
+        {                                    \
+            frame->function->back_edge_count++; \
+            if (check_hot_loop(vm, frame->function, pc + pc->target + 1, fp, &osr_status)) \
+                goto osr_return;             \
+        }                                    \
+    } while (0)
+#else
+#define COUNT_BACK_EDGE()
+#endif
+
+#if defined(VM_PROFILING) || defined(VM_TIERING)
+    // only this thread writes the counts, compiler threads read them
+    IRSite *sites = program->profile->sites;
+#define COUNT_SITE(taken)                    \
+    do                                       \
+    {                                        \
+        if (pc->c)                           \
+        {                                    \
+            uint64_t *count = &sites[(pc->c - 1) >> 1].counts[((pc->c - 1) & 1) ^ !(taken)]; \
+            __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED); \
+        }                                    \
+    } while (0)
+#else
+#define COUNT_SITE(taken)
+#endif
+
+#define NEXT()      \
+    do              \
+    {               \
+        pc++;       \
+        DISPATCH(); \
+    } while (0)
+#define JUMP_IF(condition)           \
+    do                               \
+    {                                \
+        bool taken = (condition);    \
+        COUNT_SITE(taken);           \
+        if (taken)                   \
+        {                            \
+            COUNT_BACK_EDGE();       \
+            pc += pc->target;        \
+        }                            \
+        NEXT();                      \
+    } while (0)
+#define BINARY_INT(expression)       \
+    do                               \
+    {                                \
+        int64_t x = fp[pc->b].i;     \
+        int64_t y = fp[pc->c].i;     \
+        fp[pc->a].i = (expression);  \
+        NEXT();                      \
+    } while (0)
+#define BINARY_FLOAT(expression)     \
+    do                               \
+    {                                \
+        double x = fp[pc->b].f;      \
+        double y = fp[pc->c].f;      \
+        fp[pc->a].f = (expression);  \
+        NEXT();                      \
+    } while (0)
+#define IMMEDIATE_INT(expression)    \
+    do                               \
+    {                                \
+        int64_t x = fp[pc->b].i;     \
+        int64_t y = pc->imm;         \
+        fp[pc->a].i = (expression);  \
+        NEXT();                      \
+    } while (0)
+#define CONSTANT_FLOAT(expression)   \
+    do                               \
+    {                                \
+        double x = fp[pc->b].f;      \
+        double y = constants[pc->imm].f; \
+        fp[pc->a].f = (expression);  \
+        NEXT();                      \
+    } while (0)
+#define COMPARE_FLOAT(expression)    \
+    do                               \
+    {                                \
+        double x = fp[pc->b].f;      \
+        double y = fp[pc->c].f;      \
+        fp[pc->a].i = (expression);  \
+        NEXT();                      \
+    } while (0)
+
+    DISPATCH();
+
+op_MOVE:
+    fp[pc->a] = fp[pc->b];
+    NEXT();
+op_LOADK:
+    fp[pc->a].i = pc->imm;
+    NEXT();
+op_LOADK_CONST:
+    fp[pc->a] = constants[pc->imm];
+    NEXT();
+
+    // integer arithmetic wraps around
+op_ADD_I:
+    BINARY_INT(wrap_add(x, y));
+op_SUB_I:
+    BINARY_INT(wrap_sub(x, y));
+op_MUL_I:
+    BINARY_INT(wrap_mul(x, y));
+op_DIV_I:
+    if (fp[pc->c].i == 0)
+        goto division_by_zero;
+    BINARY_INT(y == -1 ? wrap_sub(0, x) : x / y);
+op_POW_I:
+    BINARY_INT(power_int(x, y));
+op_NEG_I:
+    fp[pc->a].i = wrap_sub(0, fp[pc->b].i);
+    NEXT();
+op_AND_I:
+    BINARY_INT(x & y);
+op_OR_I:
+    BINARY_INT(x | y);
+op_NOT_I:
+    fp[pc->a].i = ~fp[pc->b].i;
+    NEXT();
+
+op_ADD_F:
+    BINARY_FLOAT(x + y);
+op_SUB_F:
+    BINARY_FLOAT(x - y);
+op_MUL_F:
+    BINARY_FLOAT(x * y);
+op_DIV_F:
+    BINARY_FLOAT(x / y);
+op_POW_F:
+    BINARY_FLOAT(pow(x, y));
+op_NEG_F:
+    fp[pc->a].f = -fp[pc->b].f;
+    NEXT();
+
+op_EQ_I:
+    BINARY_INT(x == y);
+op_NE_I:
+    BINARY_INT(x != y);
+op_LT_I:
+    BINARY_INT(x < y);
+op_LE_I:
+    BINARY_INT(x <= y);
+op_GT_I:
+    BINARY_INT(x > y);
+op_GE_I:
+    BINARY_INT(x >= y);
+op_EQ_F:
+    COMPARE_FLOAT(x == y);
+op_NE_F:
+    COMPARE_FLOAT(x != y);
+op_LT_F:
+    COMPARE_FLOAT(x < y);
+op_LE_F:
+    COMPARE_FLOAT(x <= y);
+op_GT_F:
+    COMPARE_FLOAT(x > y);
+op_GE_F:
+    COMPARE_FLOAT(x >= y);
+
+op_TRUTH_I:
+    fp[pc->a].i = fp[pc->b].i != 0;
+    NEXT();
+op_TRUTH_F:
+    fp[pc->a].i = fp[pc->b].f != 0.0;
+    NEXT();
+op_LNOT_I:
+    fp[pc->a].i = fp[pc->b].i == 0;
+    NEXT();
+op_LNOT_F:
+    fp[pc->a].i = fp[pc->b].f == 0.0;
+    NEXT();
+op_ITOF:
+    fp[pc->a].f = (double)fp[pc->b].i;
+    NEXT();
+op_FTOI:
+    fp[pc->a].i = float_to_int(fp[pc->b].f);
+    NEXT();
+
+    // intrinsics, min and max keep the right operand for NaN like minsd
+op_SQRT_F:
+    fp[pc->a].f = sqrt(fp[pc->b].f);
+    NEXT();
+op_FMA_F:
+    fp[pc->a].f = fma(fp[pc->b].f, fp[pc->b + 1].f, fp[pc->b + 2].f);
+    NEXT();
+op_MIN_I:
+    BINARY_INT(x < y ? x : y);
+op_MAX_I:
+    BINARY_INT(x > y ? x : y);
+op_MIN_F:
+    BINARY_FLOAT(x < y ? x : y);
+op_MAX_F:
+    BINARY_FLOAT(x > y ? x : y);
+op_ABS_I:
+    fp[pc->a].i = fp[pc->b].i < 0 ? wrap_sub(0, fp[pc->b].i) : fp[pc->b].i;
+    NEXT();
+op_ABS_F:
+    fp[pc->a].f = fabs(fp[pc->b].f);
+    NEXT();
+op_POPCOUNT_I:
+    fp[pc->a].i = __builtin_popcountll(fp[pc->b].i);
+    NEXT();
+op_CLZ_I:
+    fp[pc->a].i = fp[pc->b].i == 0 ? 64 : __builtin_clzll(fp[pc->b].i);
+    NEXT();
+op_CTZ_I:
+    fp[pc->a].i = fp[pc->b].i == 0 ? 64 : __builtin_ctzll(fp[pc->b].i);
+    NEXT();
+
+op_JUMP:
+    COUNT_BACK_EDGE();
+    pc += pc->target + 1;
+    DISPATCH();
+op_JUMP_IF_ZERO:
+op_AND_JUMP:
+    JUMP_IF(fp[pc->a].i == 0);
+op_JUMP_IF_NOT_ZERO:
+op_OR_JUMP:
+    JUMP_IF(fp[pc->a].i != 0);
+
+op_CALL:
+{
+    VMFunction *callee = program->functions[pc->imm];
+    VMValue *callee_fp = fp + pc->a;
+    COUNT_SITE(true);
+#ifdef VM_TIERING
+    callee->call_count++;
+    check_hot(vm->tier, callee);
+    if (__atomic_load_n(&callee->native, __ATOMIC_ACQUIRE))
+    {
+        if (vm->tier->call_native(vm->tier->data, callee, callee_fp, &vm->error) != VM_OK)
+            return VM_ERROR;
+        NEXT();
+    }
+#endif
+    if (frame + 1 == frames + VM_FRAME_LIMIT || callee_fp + callee->register_count > stack_end)
+        goto stack_overflow;
+
+    for (int i = callee->param_count; i < callee->local_count; i++)
+    {
+        callee_fp[i].i = 0;
+    }
+    frame++;
+    frame->return_pc = pc + 1;
+    frame->fp = callee_fp;
+    frame->function = callee;
+    fp = callee_fp;
+    pc = callee->code;
+    DISPATCH();
+}
+op_CALL_EXTERN:
+{
+    // VMValue and FFIValue are the same union
+    FFIValue value = ffi_call(&program->externs[pc->imm], (const FFIValue *)(fp + pc->a));
+    fp[pc->a].i = value.i;
+    NEXT();
+}
+op_RETURN:
+{
+    VMValue value = fp[pc->a];
+    if (frame == frames)
+    {
+        *result = value;
+        return VM_OK;
+    }
+
+    // the result replaces the first argument in the caller's frame
+    fp[0] = value;
+    pc = frame->return_pc;
+    frame--;
+    fp = frame->fp;
+    DISPATCH();
+}
+#ifdef VM_TIERING
+    // on-stack replacement code ran the function to its end, the result is in fp[0]
+osr_return:
+    if (osr_status != VM_OK)
+        return VM_ERROR;
+    if (frame == frames)
+    {
+        *result = fp[0];
+        return VM_OK;
+    }
+    pc = frame->return_pc;
+    frame--;
+    fp = frame->fp;
+    DISPATCH();
+#endif
+
+    // superinstructions
+op_ADD_I_IMM:
+    IMMEDIATE_INT(wrap_add(x, y));
+op_MUL_I_IMM:
+    IMMEDIATE_INT(wrap_mul(x, y));
+op_DIV_I_IMM:
+    IMMEDIATE_INT(x / y);
+op_AND_I_IMM:
+    IMMEDIATE_INT(x & y);
+op_ADD_F_K:
+    CONSTANT_FLOAT(x + y);
+op_SUB_F_K:
+    CONSTANT_FLOAT(x - y);
+op_MUL_F_K:
+    CONSTANT_FLOAT(x * y);
+op_EQ_I_IMM:
+    IMMEDIATE_INT(x == y);
+op_NE_I_IMM:
+    IMMEDIATE_INT(x != y);
+op_LT_I_IMM:
+    IMMEDIATE_INT(x < y);
+op_LE_I_IMM:
+    IMMEDIATE_INT(x <= y);
+op_GT_I_IMM:
+    IMMEDIATE_INT(x > y);
+op_GE_I_IMM:
+    IMMEDIATE_INT(x >= y);
+op_JEQ_I:
+    JUMP_IF(fp[pc->a].i == fp[pc->b].i);
+op_JNE_I:
+    JUMP_IF(fp[pc->a].i != fp[pc->b].i);
+op_JLT_I:
+    JUMP_IF(fp[pc->a].i < fp[pc->b].i);
+op_JLE_I:
+    JUMP_IF(fp[pc->a].i <= fp[pc->b].i);
+op_JGT_I:
+    JUMP_IF(fp[pc->a].i > fp[pc->b].i);
+op_JGE_I:
+    JUMP_IF(fp[pc->a].i >= fp[pc->b].i);
+op_JEQ_I_IMM:
+    JUMP_IF(fp[pc->a].i == pc->imm);
+op_JNE_I_IMM:
+    JUMP_IF(fp[pc->a].i != pc->imm);
+op_JLT_I_IMM:
+    JUMP_IF(fp[pc->a].i < pc->imm);
+op_JLE_I_IMM:
+    JUMP_IF(fp[pc->a].i <= pc->imm);
+op_JGT_I_IMM:
+    JUMP_IF(fp[pc->a].i > pc->imm);
+op_JGE_I_IMM:
+    JUMP_IF(fp[pc->a].i >= pc->imm);
+op_INC_JLT_I:
+    fp[pc->a].i = wrap_add(fp[pc->a].i, 1);
+    JUMP_IF(fp[pc->a].i < fp[pc->b].i);
+op_INC_JLT_I_IMM:
+    fp[pc->a].i = wrap_add(fp[pc->a].i, 1);
+    JUMP_IF(fp[pc->a].i < pc->imm);
+
+division_by_zero:
+    vm->error = "division by zero";
+    return VM_ERROR;
+stack_overflow:
+    vm->error = "stack overflow";
+    return VM_ERROR;
+
+#undef DISPATCH
+#undef NEXT
+#undef COUNT_BACK_EDGE
+#undef COUNT_SITE
+#undef JUMP_IF
+#undef BINARY_INT
+#undef BINARY_FLOAT
+#undef IMMEDIATE_INT
+#undef CONSTANT_FLOAT
+#undef COMPARE_FLOAT
+}
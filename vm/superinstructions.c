@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "bytecode.h"
+
+// Fuses pairs of adjacent instructions into superinstructions. The sequences
+// come from --vm-profile runs over bench/: constants feeding arithmetic and
+// comparisons, a comparison feeding a conditional jump, and the increment at
+// the bottom of a counted loop. Each round fuses pairs, so the three
+// instruction loop test (increment, compare, jump) takes two rounds.
+//
+// A pair is only fused when the second instruction is not a jump target and
+// the register passed between them is a temporary, which the compiler never
+// reads twice.
+
+typedef bool (*FuseRule)(VMFunction *function, VMInstruction *first, VMInstruction *second, VMInstruction *fused);
+
+// comparison codes in the order EQ NE LT LE GT GE
+static const VMOpcode compare_ops[] = {OP_EQ_I, OP_NE_I, OP_LT_I, OP_LE_I, OP_GT_I, OP_GE_I};
+static const VMOpcode compare_immediate_ops[] = {OP_EQ_I_IMM, OP_NE_I_IMM, OP_LT_I_IMM, OP_LE_I_IMM, OP_GT_I_IMM, OP_GE_I_IMM};
+static const VMOpcode jump_ops[] = {OP_JEQ_I, OP_JNE_I, OP_JLT_I, OP_JLE_I, OP_JGT_I, OP_JGE_I};
+static const VMOpcode jump_immediate_ops[] = {OP_JEQ_I_IMM, OP_JNE_I_IMM, OP_JLT_I_IMM, OP_JLE_I_IMM, OP_JGT_I_IMM, OP_JGE_I_IMM};
+static const int negated_compare[] = {1, 0, 5, 4, 3, 2};
+static const int swapped_compare[] = {0, 1, 4, 5, 2, 3};
+
+static int compare_code(const VMOpcode *ops, VMOpcode op)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (ops[i] == op)
+            return i;
+    }
+    return -1;
+}
+
+static bool is_jump_format(VMFormat format)
+{
+    return format == VM_FORMAT_T || format == VM_FORMAT_AT || format == VM_FORMAT_ABT || format == VM_FORMAT_AIT;
+}
+
+static bool is_temporary(VMFunction *function, int reg)
+{
+    return reg >= function->local_count;
+}
+
+// LOADK t, k; op d, b, t  ->  op_IMM d, b, k
+static bool fuse_integer_constant(VMFunction *function, VMInstruction *first, VMInstruction *second, VMInstruction *fused)
+{
+    if (first->op != OP_LOADK || !is_temporary(function, first->a))
+        return false;
+    if (vm_opcode_format(second->op) != VM_FORMAT_ABC || second->b == second->c)
+        return false;
+
+    int32_t k = first->imm;
+    int other;
+    bool constant_left = second->b == first->a;
+    if (constant_left)
+        other = second->c;
+    else if (second->c == first->a)
+        other = second->b;
+    else
+        return false;
+
+    VMOpcode op;
+    int code = compare_code(compare_ops, second->op);
+    switch (second->op)
+    {
+    case OP_ADD_I:
+        op = OP_ADD_I_IMM;
+        break;
+    case OP_SUB_I:
+        // x - k is x + -k, k - x has no fused form
+        if (constant_left || k == INT32_MIN)
+            return false;
+        op = OP_ADD_I_IMM;
+        k = -k;
+        break;
+    case OP_MUL_I:
+        op = OP_MUL_I_IMM;
+        break;
+    case OP_DIV_I:
+        // a known divisor needs neither the zero check nor the -1 case
+        if (constant_left || k == 0 || k == -1)
+            return false;
+        op = OP_DIV_I_IMM;
+        break;
+    case OP_AND_I:
+        op = OP_AND_I_IMM;
+        break;
+    default:
+        if (code < 0)
+            return false;
+        op = compare_immediate_ops[constant_left ? swapped_compare[code] : code];
+    }
+
+    *fused = *second;
+    fused->op = op;
+    fused->b = other;
+    fused->c = 0;
+    fused->imm = k;
+    return true;
+}
+
+// LOADK_CONST t, #k; op d, b, t  ->  op_K d, b, #k
+static bool fuse_float_constant(VMFunction *function, VMInstruction *first, VMInstruction *second, VMInstruction *fused)
+{
+    if (first->op != OP_LOADK_CONST || !is_temporary(function, first->a))
+        return false;
+    if (vm_opcode_format(second->op) != VM_FORMAT_ABC || second->b == second->c)
+        return false;
+
+    bool constant_left = second->b == first->a;
+    if (!constant_left && second->c != first->a)
+        return false;
+
+    VMOpcode op;
+    switch (second->op)
+    {
+    case OP_ADD_F:
+        op = OP_ADD_F_K;
+        break;
+    case OP_MUL_F:
+        op = OP_MUL_F_K;
+        break;
+    case OP_SUB_F:
+        if (constant_left)
+            return false;
+        op = OP_SUB_F_K;
+        break;
+    default:
+        return false;
+    }
+
+    *fused = *second;
+    fused->op = op;
+    fused->b = constant_left ? second->c : second->b;
+    fused->c = 0;
+    fused->imm = first->imm;
+    return true;
+}
+
+// cmp t, a, b; JUMP_IF_(NOT_)ZERO t  ->  J<cc> a, b
+static bool fuse_compare_jump(VMFunction *function, VMInstruction *first, VMInstruction *second, VMInstruction *fused)
+{
+    if (second->op != OP_JUMP_IF_ZERO && second->op != OP_JUMP_IF_NOT_ZERO)
+        return false;
+    if (second->a != first->a || !is_temporary(function, first->a))
+        return false;
+
+    int code = compare_code(compare_ops, first->op);
+    bool immediate = code < 0;
+    if (immediate)
+        code = compare_code(compare_immediate_ops, first->op);
+    if (code < 0)
+        return false;
+
+    // negating an integer comparison is exact
+    if (second->op == OP_JUMP_IF_ZERO)
+        code = negated_compare[code];
+
+    *fused = *second;
+    fused->op = immediate ? jump_immediate_ops[code] : jump_ops[code];
+    fused->a = first->b;
+    fused->b = immediate ? 0 : first->c;
+    fused->imm = first->imm;
+    return true;
+}
+
+// ADD_I_IMM i, i, 1; JLT i, n  ->  INC_JLT i, n
+static bool fuse_loop_increment(VMFunction *function, VMInstruction *first, VMInstruction *second, VMInstruction *fused)
+{
+    (void)function;
+    if (first->op != OP_ADD_I_IMM || first->imm != 1 || first->a != first->b)
+        return false;
+    if ((second->op != OP_JLT_I && second->op != OP_JLT_I_IMM) || second->a != first->a)
+        return false;
+
+    *fused = *second;
+    fused->op = second->op == OP_JLT_I ? OP_INC_JLT_I : OP_INC_JLT_I_IMM;
+    return true;
+}
+
+static void fuse_round(VMFunction *function, FuseRule rule)
+{
+    int count = function->code_count;
+    VMInstruction *code = function->code;
+    bool *is_target = calloc(count + 1, sizeof(bool));
+    int *new_index = malloc((count + 1) * sizeof(int));
+
+    // work on absolute targets while instructions move
+    for (int i = 0; i < count; i++)
+    {
+        if (is_jump_format(vm_opcode_format(code[i].op)))
+        {
+            code[i].target += i + 1;
+            is_target[code[i].target] = true;
+        }
+    }
+
+    int out = 0;
+    for (int i = 0; i < count; i++)
+    {
+        VMInstruction fused;
+        new_index[i] = out;
+        if (i + 1 < count && !is_target[i + 1] && rule(function, &code[i], &code[i + 1], &fused))
+        {
+            new_index[i + 1] = out;
+            code[out++] = fused;
+            i++;
+            continue;
+        }
+        code[out++] = code[i];
+    }
+    new_index[count] = out;
+
+    for (int i = 0; i < out; i++)
+    {
+        if (is_jump_format(vm_opcode_format(code[i].op)))
+            code[i].target = new_index[code[i].target] - (i + 1);
+    }
+    for (int k = 0; k < function->loop_count; k++)
+    {
+        function->loops[k].start = new_index[function->loops[k].start];
+    }
+    function->code_count = out;
+
+    free(is_target);
+    free(new_index);
+}
+
+void fuse_superinstructions(VMProgram *program)
+{
+    static const FuseRule rounds[] = {fuse_integer_constant, fuse_float_constant, fuse_compare_jump, fuse_loop_increment};
+
+    for (int f = 0; f < program->function_count; f++)
+    {
+        VMFunction *function = program->functions[f];
+        if (function->threaded)
+            continue;
+        for (int r = 0; r < (int)(sizeof(rounds) / sizeof(rounds[0])); r++)
+        {
+            fuse_round(function, rounds[r]);
+        }
+    }
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <math.h>
+#include "bytecode.h"
+#include "../defc/defc.h"
+#include "../ffi/ffi.h"
+
+// The interpreter is direct threaded with GCC computed goto: before a
+// function first runs, each instruction gets the offset of its handler label
+// from the first handler, and every handler ends with its own indirect jump
+// to the next one. vm_call and vm_call_tiered have labels of their own, the
+// code is threaded again when a program moves from one to the other.
+//
+// A frame is a window of the register stack. A call passes the register of
+// its first argument as the callee frame, arguments are already where the
+// callee expects its parameters and the result comes back in the same
+// register, so calls copy nothing.
+
+struct VMFrame
+{
+    const VMInstruction *return_pc;
+    VMValue *fp;
+    VMFunction *function; // kept by vm_call_tiered for the back edge counters
+};
+
+VM *init_vm(VMProgram *program)
+{
+    VM *vm = malloc(sizeof(VM));
+    vm->program = program;
+    vm->stack_size = VM_STACK_SIZE;
+    vm->stack = malloc(vm->stack_size * sizeof(VMValue));
+    vm->frames = malloc(VM_FRAME_LIMIT * sizeof(VMFrame));
+    vm->error = NULL;
+    vm->tier = NULL;
+    if (!vm->stack || !vm->frames)
+    {
+        wprintf(L"Memory allocation failed for the interpreter stack.\n");
+        exit(1);
+    }
+    return vm;
+}
+
+void free_vm(VM *vm)
+{
+    free(vm->stack);
+    free(vm->frames);
+    free(vm);
+}
+
+static int64_t power_int(int64_t base, int64_t exponent)
+{
+    if (exponent < 0)
+    {
+        // only 1 and -1 have integer reciprocals
+        if (base == 1)
+            return 1;
+        if (base == -1)
+            return exponent & 1 ? -1 : 1;
+        return 0;
+    }
+
+    uint64_t result = 1;
+    uint64_t factor = (uint64_t)base;
+    while (exponent > 0)
+    {
+        if (exponent & 1)
+            result *= factor;
+        factor *= factor;
+        exponent >>= 1;
+    }
+    return (int64_t)result;
+}
+
+// out of range and NaN give INT64_MIN, the same as cvttsd2si
+static int64_t float_to_int(double value)
+{
+    if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0))
+        return INT64_MIN;
+    return (int64_t)value;
+}
+
+static inline int64_t wrap_add(int64_t x, int64_t y)
+{
+    return (int64_t)((uint64_t)x + (uint64_t)y);
+}
+
+static inline int64_t wrap_sub(int64_t x, int64_t y)
+{
+    return (int64_t)((uint64_t)x - (uint64_t)y);
+}
+
+static inline int64_t wrap_mul(int64_t x, int64_t y)
+{
+    return (int64_t)((uint64_t)x * (uint64_t)y);
+}
+
+static void thread_program(VMProgram *program, const int32_t *handler_offsets)
+{
+    for (int f = 0; f < program->function_count; f++)
+    {
+        VMFunction *function = program->functions[f];
+        if (function->threaded == handler_offsets)
+            continue;
+        for (int i = 0; i < function->code_count; i++)
+        {
+            function->code[i].handler = handler_offsets[function->code[i].op];
+        }
+        function->threaded = handler_offsets;
+    }
+}
+
+static inline void check_hot(VMTier *tier, VMFunction *function)
+{
+    if ((uint64_t)function->call_count + function->back_edge_count >= function->hot_at)
+        tier->promote(tier->data, function);
+}
+
+// Back edge of a hot function to start: true when the activation in fp was
+// finished by on-stack replacement code, its result is in fp[0]
+static bool check_hot_loop(VM *vm, VMFunction *function, const VMInstruction *start, VMValue *fp, VMStatus *status)
+{
+    if ((uint64_t)function->call_count + function->back_edge_count < function->hot_at)
+        return false;
+    for (int k = 0; k < function->loop_count; k++)
+    {
+        if (function->code + function->loops[k].start == start)
+            return vm->tier->enter_loop(vm->tier->data, function, &function->loops[k], fp, status, &vm->error);
+    }
+    vm->tier->promote(vm->tier->data, function);
+    return false;
+}
+
+#include "interpreter.h"
+#define VM_PROFILING
+#include "interpreter.h"
+#undef VM_PROFILING
+#define VM_TIERING
+#include "interpreter.h"
+#undef VM_TIERING
+
+static int compare_counts(const void *left, const void *right)
+{
+    uint64_t a = ((const uint64_t *)left)[0];
+    uint64_t b = ((const uint64_t *)right)[0];
+    return a < b ? 1 : a > b ? -1 : 0;
+}
+
+// prints the most executed opcodes and opcode pairs, the pairs are what
+// fuse_superinstructions is tuned for
+void dump_vm_profile(VMProfile *profile, int top, OutputBuffer *buffer)
+{
+    int pair_count = VM_OPCODE_COUNT * VM_OPCODE_COUNT;
+    uint64_t(*entries)[2] = malloc(pair_count * sizeof(*entries));
+    double total = profile->instruction_count ? (double)profile->instruction_count : 1.0;
+
+    buffer_printf(buffer, "executed %llu instructions\n", (unsigned long long)profile->instruction_count);
+    for (int op = 0; op < VM_OPCODE_COUNT; op++)
+    {
+        entries[op][0] = profile->counts[op];
+        entries[op][1] = op;
+    }
+    qsort(entries, VM_OPCODE_COUNT, sizeof(*entries), compare_counts);
+    for (int i = 0; i < top && i < VM_OPCODE_COUNT && entries[i][0] > 0; i++)
+    {
+        buffer_printf(buffer, "  %12llu %5.1f%%  %s\n", (unsigned long long)entries[i][0], entries[i][0] * 100.0 / total, vm_opcode_name(entries[i][1]));
+    }
+
+    buffer_printf(buffer, "pairs\n");
+    for (int pair = 0; pair < pair_count; pair++)
+    {
+        entries[pair][0] = profile->pairs[pair / VM_OPCODE_COUNT][pair % VM_OPCODE_COUNT];
+        entries[pair][1] = pair;
+    }
+    qsort(entries, pair_count, sizeof(*entries), compare_counts);
+    for (int i = 0; i < top && entries[i][0] > 0; i++)
+    {
+        buffer_printf(buffer, "  %12llu %5.1f%%  %s %s\n", (unsigned long long)entries[i][0], entries[i][0] * 100.0 / total, vm_opcode_name(entries[i][1] / VM_OPCODE_COUNT), vm_opcode_name(entries[i][1] % VM_OPCODE_COUNT));
+    }
+    free(entries);
+}